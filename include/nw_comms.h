@@ -52,6 +52,33 @@ int open_client_socket(char *host, unsigned short int port);
 ******************************************************************************/
 int open_server_socket(char *host, unsigned short int port);
 
+/******************************************************************************
+* Function to open a UDP/IP multicast sender socket                           *
+*                                                                             *
+* Pre-condition:  The multicast group's IP address & port, the host name (or  *
+*                 IP address) of the interface to send on & the datagrams'    *
+*                 TTL are passed to the function                              *
+* Post-condition: Socket is connected to the group, so that datagrams can be  *
+*                 sent to it with send(), socket file descriptor is returned  *
+*                 or -1 on error                                              *
+******************************************************************************/
+int open_mcast_sender_socket(char *group, unsigned short int port,
+                             char *host, int ttl);
+
+/******************************************************************************
+* Function to open a UDP/IP multicast receiver socket                         *
+*                                                                             *
+* Pre-condition:  The multicast group's IP address & port & the host name (or *
+*                 IP address) of the interface to receive on are passed to    *
+*                 the function.  If the host is NULL, the routing table       *
+*                 chooses the interface                                       *
+* Post-condition: Socket is bound to the group's port & joined to the group   *
+*                 on the interface, socket file descriptor is returned or -1  *
+*                 on error                                                    *
+******************************************************************************/
+int open_mcast_receiver_socket(char *group, unsigned short int port,
+                               char *host);
+
 /******************************************************************************
 * Function to connect client to network server socket                         *
 *                                                                             *
@@ -14,6 +14,11 @@
 #include <pds_utils.h>
 #include <pds_protocols.h>
 
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
 /******************************************************************************
 * Defines                                                                     *
 ******************************************************************************/
@@ -38,7 +43,7 @@
 * Pre-condition:  A valid server connection, the tagname (base), the number   *
 *                 of tagvalues to read, a string for storage of the tags'     *
 *                 value and a data format specifier are passed to the         *
-*                 function.  The semaphore should be held before calling      *
+*                 function.  _hold_shm() should be called before calling      *
 * Post-condition: The tagnames are accessed in the shared memory segment and  *
 *                 their value's as a string are returned formatted as the     *
 *                 specified type.  On error a -1 is returned                  *
@@ -56,6 +61,130 @@
 ******************************************************************************/
 /* static int _semset(int id, int op, int snum); */
 
+/******************************************************************************
+* Internal function to find a tag by name                                     *
+*                                                                             *
+* Pre-condition:  A valid server connection & the tagname to search for are   *
+*                 passed to the function                                      *
+* Post-condition: The tagname is looked up in the server's tag name index in  *
+*                 the shared memory segment.  A pointer to the tag is         *
+*                 returned or a NULL if it's not found                        *
+******************************************************************************/
+/* static pdstag* _find_tag(pdsconn *conn, const char *tagname); */
+
+/******************************************************************************
+* Internal function to get the tag referenced by a resolved handle            *
+*                                                                             *
+* Pre-condition:  A valid server connection & a tag handle are passed to the  *
+*                 function                                                    *
+* Post-condition: The handle is validated against the segment's generation    *
+*                 no. & its no. of tags.  A pointer to the tag is returned or *
+*                 a NULL if the handle is invalid                             *
+******************************************************************************/
+/* static pdstag* _get_handle_tag(pdsconn *conn, pdshandle h); */
+
+/******************************************************************************
+* Internal function to setup a message to write tag value(s) to the PLC       *
+*                                                                             *
+* Pre-condition:  A valid server connection, a pointer to the (base) tag, the *
+*                 number of tagvalues, the tagvalues & storage for the        *
+*                 message are passed to the function                          *
+* Post-condition: The message is setup to request the write.  The             *
+*                 connection's PLC status is set from the tag's status.  If   *
+*                 the PLC is offline or an error occurs a -1 is returned      *
+******************************************************************************/
+/* static int _setup_write_msg(pdsconn *conn, pdstag *tag, short int ntags,
+                            const unsigned short int *tagvalues,
+                            pdsmsg *msg); */
+
+/******************************************************************************
+* Internal function to collect a server's reply to one of this client's       *
+* writes                                                                      *
+*                                                                             *
+* Pre-condition:  A valid server connection, the message queue flags for the  *
+*                 receive & storage for the write's PLC status are passed to  *
+*                 the function                                                *
+* Post-condition: A reply addressed to this client is received & the write's  *
+*                 PLC status is stored.  If the reply is for an async write,  *
+*                 it is recorded in the request table.  The reply's request   *
+*                 ID is returned or a -1 if no reply was received             *
+******************************************************************************/
+/* static int _collect_write_reply(pdsconn *conn, int msgflg,
+                               unsigned short int *status); */
+
+/******************************************************************************
+* Internal function to send a write message to the server                     *
+*                                                                             *
+* Pre-condition:  A valid server connection & the message are passed to the   *
+*                 function                                                    *
+* Post-condition: The message is sent to the server.  If the message queue is *
+*                 full, replies to this client's async writes are collected   *
+*                 until there is room.  On error a -1 is returned             *
+******************************************************************************/
+/* static int _send_write_msg(pdsconn *conn, pdsmsg *msg); */
+
+/******************************************************************************
+* Internal function to write tag value(s) to the PLC                          *
+*                                                                             *
+* Pre-condition:  A valid server connection, a pointer to the (base) tag, the *
+*                 number of tagvalues & the tagvalues are passed to the       *
+*                 function                                                    *
+* Post-condition: The tagvalues are sent to the server to write to the PLC.   *
+*                 The connection's PLC status is set from the server's        *
+*                 response.  On error a -1 is returned                        *
+******************************************************************************/
+/* static int _write_tag(pdsconn *conn, pdstag *tag, short int ntags,
+                      const unsigned short int *tagvalues); */
+
+/******************************************************************************
+* Internal function to write tag value(s) to the PLC asynchronously           *
+*                                                                             *
+* Pre-condition:  A valid server connection, a pointer to the (base) tag, the *
+*                 number of tagvalues & the tagvalues are passed to the       *
+*                 function                                                    *
+* Post-condition: The tagvalues are sent to the server to write to the PLC,   *
+*                 without waiting for the server's response.  If the request  *
+*                 table is full, the oldest write's response is waited for.   *
+*                 The write's request ID is returned or -1 on error           *
+******************************************************************************/
+/* static int _write_tag_async(pdsconn *conn, pdstag *tag, short int ntags,
+                            const unsigned short int *tagvalues); */
+
+/******************************************************************************
+* Internal function to copy a consistent set of tags' data                    *
+*                                                                             *
+* Pre-condition:  A valid server connection, a pointer to the 1st tag, the    *
+*                 no. of consecutive tags to copy and storage for their       *
+*                 values & statuses are passed to the function.  _hold_shm()  *
+*                 should be called before calling                             *
+* Post-condition: The tags' values & statuses are copied.  If the server      *
+*                 publishes under block sequence counters, the copy of each   *
+*                 block's tags is retried until it is consistent.  The no. of *
+*                 tags copied is returned                                     *
+******************************************************************************/
+/* static int _copy_tag_data(pdsconn *conn, pdstag *tag, int ntags,
+                          unsigned short int *values,
+                          unsigned short int *statuses); */
+
+/******************************************************************************
+* Internal function to hold the shared memory segment for reading             *
+*                                                                             *
+* Pre-condition:  A valid server connection is passed to the function         *
+* Post-condition: If the server publishes under block sequence counters, then *
+*                 nothing need be held.  Otherwise the semaphore is held.  If *
+*                 an error occurs a -1 is returned                            *
+******************************************************************************/
+/* static int _hold_shm(pdsconn *conn); */
+
+/******************************************************************************
+* Internal function to release the shared memory segment after reading        *
+*                                                                             *
+* Pre-condition:  A valid server connection is passed to the function         *
+* Post-condition: If the semaphore was held by _hold_shm() it is released.    *
+*                 If an error occurs a -1 is returned                         *
+******************************************************************************/
+/* static int _release_shm(pdsconn *conn); */
+
 /******************************************************************************
 * Function to connect a client to the server                                  *
 *                                                                             *
@@ -76,8 +205,9 @@ pdsconn* PDSconnect(key_t connkey);
 * Function to disconnect a client from the server                             *
 *                                                                             *
 * Pre-condition:  A valid server connection struct is passed to the function  *
-* Post-condition: The client program is disconnected from the server.  If an  *
-*                 error occurs a -1 is returned                               *
+* Post-condition: The server's replies to any in-flight async writes are      *
+*                 collected, then the client program is disconnected from the *
+*                 server.  If an error occurs a -1 is returned                *
 ******************************************************************************/
 int PDSdisconnect(pdsconn *conn);
 
@@ -291,5 +421,193 @@ int _default_print_footer(FILE *os, pdsconn *conn, void *aux);
 ******************************************************************************/
 pdstag* PDSget_tag_object(pdsconn *conn, const char *tagname);
 
+/******************************************************************************
+* Function to resolve a tagname to a handle                                   *
+*                                                                             *
+* Pre-condition:  A valid server connection & the tagname to resolve are      *
+*                 passed to the function                                      *
+* Post-condition: The tagname is looked up once & a handle to the tag is      *
+*                 returned, for use with the handle-based functions.  The     *
+*                 handle remains valid for the life of the connection.  On    *
+*                 error PDS_HANDLE_INVALID is returned                        *
+******************************************************************************/
+pdshandle PDSresolve_tag(pdsconn *conn, const char *tagname);
+
+/******************************************************************************
+* Function to get a tag's raw value & status via its handle                   *
+*                                                                             *
+* Pre-condition:  A valid server connection, the tag's handle & storage for   *
+*                 the tag's value & status are passed to the function         *
+* Post-condition: The tag is accessed directly in the shared memory segment   *
+*                 & its value & status are stored in hvalue & hstatus.  The   *
+*                 connection's PLC status is also set.  On error a -1 is      *
+*                 returned                                                    *
+******************************************************************************/
+int PDSget_tag_h(pdsconn *conn, pdshandle h, unsigned short int *hvalue,
+                 unsigned short int *hstatus);
+
+/******************************************************************************
+* Function to set tag value(s) via the (base) tag's handle                    *
+*                                                                             *
+* Pre-condition:  A valid server connection, the (base) tag's handle, the     *
+*                 number of tagvalues & the tagvalues are passed to the       *
+*                 function                                                    *
+* Post-condition: The tagvalues are written to the PLC.  The connection's PLC *
+*                 status is set from the server's response.  On error a -1 is *
+*                 returned                                                    *
+******************************************************************************/
+int PDSset_tag_h(pdsconn *conn, pdshandle h, short int ntags,
+                 const unsigned short int *tagvalues);
+
+/******************************************************************************
+* Function to set tag value(s) asynchronously                                 *
+*                                                                             *
+* Pre-condition:  A valid server connection, the base tagname, the no. of     *
+*                 tags to write and the tag value(s) are passed to the        *
+*                 function                                                    *
+* Post-condition: A message is sent to the server requesting that the tag     *
+*                 value(s) be written to the PLC, without waiting for the     *
+*                 write to complete.  The write's request ID is returned, for *
+*                 use with PDSpoll_write().  On error a -1 is returned        *
+******************************************************************************/
+int PDSset_tag_async(pdsconn *conn, const char *tagname, short int ntags,
+                     const unsigned short int *tagvalues);
+
+/******************************************************************************
+* Function to set tag value(s) asynchronously via the (base) tag's handle     *
+*                                                                             *
+* Pre-condition:  A valid server connection, the (base) tag's handle, the     *
+*                 number of tagvalues & the tagvalues are passed to the       *
+*                 function                                                    *
+* Post-condition: A message is sent to the server requesting that the tag     *
+*                 value(s) be written to the PLC, without waiting for the     *
+*                 write to complete.  The write's request ID is returned, for *
+*                 use with PDSpoll_write().  On error a -1 is returned        *
+******************************************************************************/
+int PDSset_tag_h_async(pdsconn *conn, pdshandle h, short int ntags,
+                       const unsigned short int *tagvalues);
+
+/******************************************************************************
+* Function to poll for the completion of an asynchronous write                *
+*                                                                             *
+* Pre-condition:  A valid server connection, the write's request ID & storage *
+*                 for the write's PLC status are passed to the function       *
+* Post-condition: Any replies that have arrived are collected without         *
+*                 waiting.  If the write has completed, its PLC status is     *
+*                 stored in wrstatus & a 1 is returned.  The write can then   *
+*                 no longer be polled.  If the write is still in flight a 0   *
+*                 is returned.  If the request ID is unknown a -1 is returned *
+******************************************************************************/
+int PDSpoll_write(pdsconn *conn, int reqid, unsigned short int *wrstatus);
+
+/******************************************************************************
+* Function to wait for all asynchronous writes to complete                    *
+*                                                                             *
+* Pre-condition:  A valid server connection is passed to the function         *
+* Post-condition: The server's replies to all this client's in-flight writes  *
+*                 are collected.  Their statuses can then be collected with   *
+*                 PDSpoll_write().  On error a -1 is returned                 *
+******************************************************************************/
+int PDSwait_writes(pdsconn *conn);
+
+/******************************************************************************
+* Function to wait for a change to any of the given tags                      *
+*                                                                             *
+* Pre-condition:  A valid server connection, an array of tag handles, the no. *
+*                 of handles & a timeout (in usecs, or PDS_WAIT_FOREVER) are  *
+*                 passed to the function                                      *
+* Post-condition: The caller sleeps until the server refreshes any of the     *
+*                 tags' blocks with a changed value or status, since the      *
+*                 last time that block was reported by this function (or      *
+*                 since connecting).  The no. of changed blocks is returned.  *
+*                 If the timeout expires or a signal is caught, a 0 is        *
+*                 returned.  On error a -1 is returned                        *
+******************************************************************************/
+int PDSwait_for_change(pdsconn *conn, const pdshandle *handles, int n,
+                       long timeout);
+
+/******************************************************************************
+* Function to get the sequence no. of the latest change                       *
+*                                                                             *
+* Pre-condition:  A valid server connection is passed to the function         *
+* Post-condition: The sequence no. of the last change appended to the change  *
+*                 journal is returned.  A client that mirrors the tags gets   *
+*                 this before copying them, & can then read only the changes  *
+*                 since.  If an error occurs a 0 is returned                  *
+******************************************************************************/
+unsigned long long PDSget_change_seq(pdsconn *conn);
+
+/******************************************************************************
+* Function to get the changes to the tags since a given sequence no.          *
+*                                                                             *
+* Pre-condition:  A valid server connection, the sequence no. of the last     *
+*                 change seen, a buffer & the max. no. of changes to store in *
+*                 it are passed to the function                               *
+* Post-condition: The oldest changes after the given sequence no. are copied  *
+*                 into the buffer, in order, & the no. of changes copied is   *
+*                 returned (0 if there are none).  If the journal has         *
+*                 overwritten changes that the client hasn't seen, then       *
+*                 PDS_JOURNAL_OVERRUN is returned & the client must copy the  *
+*                 tags afresh.  If an error occurs a -1 is returned           *
+******************************************************************************/
+int PDSget_changes_since(pdsconn *conn, unsigned long long seq,
+                         pdschange *buf, int n);
+
+/******************************************************************************
+* Function to get a tag's sample history                                      *
+*                                                                             *
+* Pre-condition:  A valid server connection, the tag's handle, a buffer & the *
+*                 max. no. of samples to store in it are passed to the        *
+*                 function                                                    *
+* Post-condition: The tag's latest samples (up to the max.) are copied into   *
+*                 the buffer, oldest first, & the no. of samples copied is    *
+*                 returned.  If the tag's block has no history, a 0 is        *
+*                 returned.  If an error occurs a -1 is returned              *
+******************************************************************************/
+int PDSget_tag_history(pdsconn *conn, pdshandle h, pdssample *buf, int n);
+
+/******************************************************************************
+* Function to get a tag's sample history ring, for reading in place           *
+*                                                                             *
+* Pre-condition:  A valid server connection, the tag's handle & storage for   *
+*                 the ring's depth are passed to the function                 *
+* Post-condition: A pointer to the tag's ring of samples in shared memory is  *
+*                 returned & its depth stored.  The ring is indexed by        *
+*                 PDS_HIST_SLOT(n, depth), where n is a sample's no.  The     *
+*                 oldest sample in the ring may be being overwritten.  If the *
+*                 tag's block has no history or an error occurs, a null is    *
+*                 returned                                                    *
+******************************************************************************/
+const pdssample* PDSget_tag_history_ring(pdsconn *conn, pdshandle h,
+                                        int *depth);
+
+/******************************************************************************
+* Function to get the no. of samples taken of a tag                           *
+*                                                                             *
+* Pre-condition:  A valid server connection & the tag's handle are passed to  *
+*                 the function                                                *
+* Post-condition: The no. of samples taken of the tag's block is returned, so *
+*                 the latest sample is no. count - 1 (modulo 2^32).  If the   *
+*                 tag's block has no history or an error occurs, a 0 is       *
+*                 returned                                                    *
+******************************************************************************/
+unsigned int PDSget_tag_history_count(pdsconn *conn, pdshandle h);
+
+/******************************************************************************
+* Function to get a consistent snapshot of all the tags                       *
+*                                                                             *
+* Pre-condition:  A valid server connection & storage for the image, of at    *
+*                 least PDS_IMAGE_LEN(ttags) bytes, are passed to the         *
+*                 function                                                    *
+* Post-condition: The latest snapshot published by the server is copied into  *
+*                 the image, without taking any locks.  All of the tags'      *
+*                 values & statuses in the image were taken at the same       *
+*                 time, so are consistent across blocks.  The image's values  *
+*                 & statuses are indexed by tag ID.  The no. of tags in the   *
+*                 image is returned.  If no snapshot has been published yet,  *
+*                 a 0 is returned.  If an error occurs a -1 is returned       *
+******************************************************************************/
+int PDSsnapshot(pdsconn *conn, pdsimage *image);
+
 #endif
 
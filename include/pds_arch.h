@@ -0,0 +1,101 @@
+/******************************************************************************
+* PROJECT:  PLC data server library                                           *
+* MODULE:   pds_arch.h                                                        *
+* PURPOSE:  Header file for the PLC data server historian archive format      *
+* AUTHOR:   Paul M. Breen                                                     *
+* DATE:     2026-10-17                                                        *
+******************************************************************************/
+
+#ifndef __PDS_ARCH_H
+#define __PDS_ARCH_H
+
+#include <pds_defs.h>
+
+/******************************************************************************
+* Defines                                                                     *
+******************************************************************************/
+
+#define PDS_ARCH_MAGIC			0x48534450  /* "PDSH" */
+#define PDS_ARCH_VERSION		1
+
+/* Archive files are named by the (UTC) time they were started, & a count to
+   keep the names unique, so that listing a directory's archive files in name
+   order lists them in time order */
+#define PDS_ARCH_FILE_PREFIX		"pds-"
+#define PDS_ARCH_FILE_SUFFIX		".hist"
+#define PDS_ARCH_FILE_TMSTAMP_FMT	"%Y%m%dT%H%M%S"
+#define PDS_ARCH_FILE_TMSTAMP_LEN	16
+#define PDS_ARCH_FILE_FMT		"%s/" PDS_ARCH_FILE_PREFIX "%s-%06u" PDS_ARCH_FILE_SUFFIX
+#define PDS_ARCH_FILE_MODE		0644
+
+/* An archive file is a header, followed by a tag index & then a column for
+   each field of the file's records (the changes to the tags).  The columns
+   are preallocated for the file's capacity, so that the file can be mapped
+   once & appended to in place.  Each region starts on a page */
+#define PDS_ARCH_HDR_LEN		4096
+#define PDS_ARCH_ALIGN(n, a)		((((n) + (a) - 1) / (a)) * (a))
+
+/* The value column holds each record's change from the tag's previous value,
+   zigzag-encoded & stored as a varint (7 bits per byte, low bits first), so
+   that small changes take 1 byte.  The tag index holds each tag's value
+   before the file's 1st record, so each file can be decoded on its own */
+#define PDS_ARCH_DELTA_MAXLEN		3      /* Max. bytes of a value delta */
+#define PDS_ARCH_VARINT_MORE		0x80
+#define PDS_ARCH_VARINT_MASK		0x7f
+#define PDS_ARCH_VARINT_BITS		7
+
+#define PDS_ARCH_ZIGZAG(d)\
+((unsigned short int) ((((int) (d)) << 1) ^ (((int) (d)) >> 15)))
+#define PDS_ARCH_UNZIGZAG(z)\
+((short int) (((z) >> 1) ^ -((int) ((z) & 0x01))))
+
+/* Locate a file's tag index & columns from its header */
+#define PDS_ARCH_TAGS(h)\
+((pdsarch_tag *) ((char *) (h) + (h)->tags))
+#define PDS_ARCH_TIMES(h)\
+((unsigned long long *) ((char *) (h) + (h)->times))
+#define PDS_ARCH_IDS(h)\
+((unsigned int *) ((char *) (h) + (h)->ids))
+#define PDS_ARCH_STATUSES(h)\
+((unsigned short int *) ((char *) (h) + (h)->statuses))
+#define PDS_ARCH_VALUES(h)\
+((unsigned char *) ((char *) (h) + (h)->values))
+
+/******************************************************************************
+* Structure definitions                                                       *
+******************************************************************************/
+
+/******************************************************************************
+* Archive file header structure                                               *
+******************************************************************************/
+typedef struct pdsarch_hdr_rec
+{
+  unsigned int magic;                  /* PDS_ARCH_MAGIC */
+  unsigned int version;                /* PDS_ARCH_VERSION */
+  unsigned int ntags;                  /* No. of tags in the tag index */
+  unsigned int capacity;               /* Max. no. of records in the file */
+  volatile unsigned int nrecs;         /* No. of records committed */
+  volatile unsigned int nvalue_bytes;  /* No. of value column bytes used */
+  unsigned long long first_ns;         /* Time of 1st record (nsecs) */
+  volatile unsigned long long last_ns; /* Time of last record (nsecs) */
+  unsigned int tags;                   /* Offset of the tag index */
+  unsigned int times;                  /* Offset of the time column */
+  unsigned int ids;                    /* Offset of the tag ID column */
+  unsigned int statuses;               /* Offset of the status column */
+  unsigned int values;                 /* Offset of the value column */
+  unsigned int size;                   /* Total size of the file */
+} pdsarch_hdr;
+
+/******************************************************************************
+* Archive file tag index entry structure                                      *
+******************************************************************************/
+typedef struct pdsarch_tag_rec
+{
+  char name[PDS_TAGNAME_LEN];          /* The tag's name */
+  unsigned short int value;            /* Value before the file's 1st record */
+  unsigned short int status;           /* Status before the file's 1st rec. */
+  unsigned int nrecs;                  /* No. of the tag's records in file */
+} pdsarch_tag;
+
+#endif
+
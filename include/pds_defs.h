@@ -21,7 +21,7 @@
 * Defines                                                                     *
 ******************************************************************************/
 
-#define PDS_FEBE_PROTO_VER	6
+#define PDS_FEBE_PROTO_VER	18
 
 #define PDS_TAGNAME_LEN		64
 #define PDS_TAGVALUE_LEN	16
@@ -57,11 +57,123 @@
 #define PDS_PLC_COMMSERR	0x02   /* PLC comms error */
 #define PDS_PLC_RESPERR		0x04   /* PLC response error */
 #define PDS_PLC_OFFLINE		0x08   /* PLC is offline */
+#define PDS_PLC_BREAKER		0x10   /* PLC's circuit breaker is open */
 
 #define PDS_PLC_CONNERR_RST	~0x01  /* PLC connection error reset */
 #define PDS_PLC_COMMSERR_RST	~0x02  /* PLC comms error reset */
 #define PDS_PLC_RESPERR_RST	~0x04  /* PLC response error reset */
 #define PDS_PLC_OFFLINE_RST	~0x08  /* PLC is offline reset */
+#define PDS_PLC_BREAKER_RST	~0x10  /* PLC's circuit breaker is open reset */
+
+/* The segment starts with a header describing its layout.  The tags'
+   metadata follow the header and are read-only once the server has mapped
+   them.  Each tag's value, status & mtime (its hot data) are held in dense
+   arrays, indexed by the tag's id, after the metadata.  The mtime is held
+   both in seconds & in nanoseconds.  Each block's acquisition times (when
+   its last query was sent & its response received) follow the hot data */
+#define PDS_SEG_HDR_LEN			64
+#define PDS_SEG_CACHE_LINE		64
+#define PDS_SEG_ALIGN(n, a)		((((n) + (a) - 1) / (a)) * (a))
+
+/* Locate a segment's header & hot data arrays from one of its tags */
+#define PDS_TAG_SEG(t)\
+((pdsseg *) ((char *) ((t) - (t)->id) - PDS_SEG_HDR_LEN))
+#define PDS_SEG_VALUES(s)\
+((unsigned short int *) ((char *) (s) + (s)->values))
+#define PDS_SEG_STATUSES(s)\
+((unsigned short int *) ((char *) (s) + (s)->statuses))
+#define PDS_SEG_MTIMES(s)\
+((time_t *) ((char *) (s) + (s)->mtimes))
+#define PDS_SEG_MTIMES_NS(s)\
+((unsigned long long *) ((char *) (s) + (s)->mtimes_ns))
+#define PDS_SEG_ACQ(s)\
+((pdsacq *) ((char *) (s) + (s)->acq))
+
+/* A tag's hot data, via its connection (an lvalue) */
+#define PDS_TAG_VALUE(c, t)		((c)->values[(t)->id])
+#define PDS_TAG_STATUS(c, t)		((c)->statuses[(t)->id])
+#define PDS_TAG_MTIME(c, t)		((c)->mtimes[(t)->id])
+#define PDS_TAG_MTIME_NS(c, t)		((c)->mtimes_ns[(t)->id])
+
+/* A block's acquisition times, via its connection (an lvalue) */
+#define PDS_BLOCK_ACQ(c, b)		((c)->acq[(b)])
+
+/* No. of block sequence counters in the segment (data blocks + PLCs) */
+#define PDS_GET_NSEQ(c)			((c)->nblocks + (c)->nstatus_tags)
+
+/* Change notification.  The server bumps a block's change counter whenever
+   a refresh changes any of its tags' values or statuses, & then bumps the
+   segment-wide change counter, which clients wait on as a futex.  The
+   block change counters (one per block sequence counter) start on the
+   cache line after the segment-wide counter & its count of waiters */
+#define PDS_CHG_FUTEX			0      /* Segment-wide change counter */
+#define PDS_CHG_WAITERS			1      /* No. of clients waiting */
+#define PDS_CHG_BLOCKS			(PDS_SEG_CACHE_LINE / sizeof(unsigned int))
+#define PDS_GET_NCHG(c)			(PDS_CHG_BLOCKS + PDS_GET_NSEQ(c))
+#define PDS_BLOCK_CHG(c, b)		((c)->chg[PDS_CHG_BLOCKS + (b)])
+#define PDS_WAIT_FOREVER		-1
+
+/* Change journal.  A ring of the most recent changes to the tags' values or
+   statuses, each stamped with a sequence no.  The journal starts with the
+   sequence no. of the last change appended, on a cache line of its own,
+   followed by the ring's records.  A record's slot is its sequence no.
+   modulo the no. of records, so the no. of records must be a power of 2 */
+#define PDS_JOURNAL_RECS_TAG		4      /* Min. journal records per tag */
+#define PDS_JOURNAL_MIN_RECS		1024
+#define PDS_JOURNAL_SLOT(s, n)		((s) & ((n) - 1))
+#define PDS_JOURNAL_OVERRUN		-2     /* Reader fell behind the ring */
+
+/* Sample history.  A block configured with a history depth has a ring of
+   that many samples for each of its tags, taken each time the block is
+   refreshed.  Each block's history descriptor holds the no. of samples
+   taken, so the latest sample is in slot PDS_HIST_SLOT(count - 1, depth).
+   N.B.: The depth is a power of 2 */
+#define PDS_HIST_SLOT(n, d)		((n) & ((d) - 1))
+#define PDS_HIST_TAG_SAMPLES(c, h, t)\
+(&(c)->samples[(h)->samples + (((t)->id - (h)->first) * (h)->depth)])
+
+/* Snapshots.  The server periodically publishes a consistent image of all
+   the tags' values & statuses into one of two buffers & then bumps the
+   snapshot epoch, on a cache line of its own, so that the latest image is
+   in buffer (epoch & 1).  The publisher only ever writes the other buffer,
+   so a client copying the latest image only has to retry if the epoch
+   moved whilst it was copying.  An epoch of 0 means none is published yet.
+   An image is its header, followed by the values & then the statuses */
+#define PDS_IMAGE_LEN(n)\
+(sizeof(pdsimage) + ((n) * 2 * sizeof(unsigned short int)))
+#define PDS_IMAGE_VALUES(i)\
+((unsigned short int *) ((char *) (i) + sizeof(pdsimage)))
+#define PDS_IMAGE_STATUSES(i)		(PDS_IMAGE_VALUES(i) + (i)->ntags)
+
+#define PDS_SNAP_IMAGE_LEN(n)\
+PDS_SEG_ALIGN(PDS_IMAGE_LEN(n), PDS_SEG_CACHE_LINE)
+#define PDS_SNAP_LEN(n)			(PDS_SEG_CACHE_LINE + (2 * PDS_SNAP_IMAGE_LEN(n)))
+#define PDS_SNAP_IMAGE(c, e)\
+((pdsimage *) ((char *) (c)->snap + PDS_SEG_CACHE_LINE + (((e) & 1) * PDS_SNAP_IMAGE_LEN((c)->ttags))))
+
+/* Resolved tag handles.  A handle is the tag's index into the segment's
+   tags, stamped with the segment's generation no. so that a handle can't
+   be used against a different server instance's segment */
+#define PDS_HANDLE_INVALID		-1
+#define PDS_HANDLE_INDEX_BITS		20
+#define PDS_HANDLE_INDEX_MASK		((1 << PDS_HANDLE_INDEX_BITS) - 1)
+#define PDS_HANDLE_GEN_MASK		0x7ff
+#define PDS_MAKE_HANDLE(g, i)\
+((int) ((((g) & PDS_HANDLE_GEN_MASK) << PDS_HANDLE_INDEX_BITS) | ((i) & PDS_HANDLE_INDEX_MASK)))
+#define PDS_GET_HANDLE_GEN(h)		(((h) >> PDS_HANDLE_INDEX_BITS) & PDS_HANDLE_GEN_MASK)
+#define PDS_GET_HANDLE_INDEX(h)		((h) & PDS_HANDLE_INDEX_MASK)
+
+/* Asynchronous write requests.  Each in-flight write is tracked in a slot of
+   the client's request table, so no more than PDS_WRREQ_MAX can be in
+   flight at once.  N.B.: PDS_WRREQ_MAX must be a power of 2 */
+#define PDS_WRREQ_SYNC			0      /* Request ID of a sync. write */
+#define PDS_WRREQ_ID_MAX		0x7fffffff
+#define PDS_WRREQ_MAX			1024
+#define PDS_WRREQ_SLOT(id)		((id) & (PDS_WRREQ_MAX - 1))
+
+#define PDS_WRREQ_FREE			0      /* Async write request states */
+#define PDS_WRREQ_PENDING		1
+#define PDS_WRREQ_DONE			2
 
 #define PDS_CHECK_PROTO_VER(c)		((c)->febe_proto_ver)
 #define PDScheck_proto_ver(c)		PDS_CHECK_PROTO_VER(c)
@@ -89,6 +201,7 @@
  ((s) & PDS_PLC_COMMSERR) ? "PLC Comms Error" :\
  ((s) & PDS_PLC_RESPERR) ? "PLC Response Error" :\
  ((s) & PDS_PLC_OFFLINE) ? "PLC is Offline" :\
+ ((s) & PDS_PLC_BREAKER) ? "PLC Circuit Breaker is Open" :\
  "PLC Status Unknown!")
 #define PDSprint_plc_status(c)		PDS_PRINT_PLC_STATUS((c)->plc_status)
 
@@ -102,6 +215,7 @@
 #define PDSconn_get_path(c)		((c) ? (c)->path : NULL)
 #define PDSconn_get_fd(c)		((c) ? (c)->fd : -1)
 #define PDSconn_get_plc_status(c)	((c) ? (c)->plc_status : -1)
+#define PDSconn_get_seg(c)		((c) ? (c)->seg : NULL)
 #define PDSconn_get_data(c)		((c) ? (c)->data : NULL)
 #define PDSconn_get_status(c)		((c) ? (c)->status : NULL)
 #define PDSconn_get_nblocks(c)		((c) ? (c)->nblocks : -1)
@@ -109,6 +223,23 @@
 #define PDSconn_get_ndata_tags(c)	((c) ? (c)->ndata_tags : -1)
 #define PDSconn_get_nstatus_tags(c)	((c) ? (c)->nstatus_tags : -1)
 #define PDSconn_get_ttags(c)		((c) ? (c)->ttags : -1)
+#define PDSconn_get_seq(c)		((c) ? (c)->seq : NULL)
+#define PDSconn_get_chg(c)		((c) ? (c)->chg : NULL)
+#define PDSconn_get_journal(c)		((c) ? (c)->journal : NULL)
+#define PDSconn_get_njournal(c)		((c) ? (c)->njournal : -1)
+#define PDSconn_get_hist(c)		((c) ? (c)->hist : NULL)
+#define PDSconn_get_samples(c)		((c) ? (c)->samples : NULL)
+#define PDSconn_get_nsamples(c)		((c) ? (c)->nsamples : -1)
+#define PDSconn_get_snap(c)		((c) ? (c)->snap : NULL)
+#define PDSconn_get_hash(c)		((c) ? (c)->hash : NULL)
+#define PDSconn_get_nhash(c)		((c) ? (c)->nhash : -1)
+#define PDSconn_get_seqlock(c)		((c) ? (c)->seqlock : -1)
+#define PDSconn_get_gen(c)		((c) ? (c)->gen : -1)
+#define PDSconn_get_values(c)		((c) ? (c)->values : NULL)
+#define PDSconn_get_statuses(c)		((c) ? (c)->statuses : NULL)
+#define PDSconn_get_mtimes(c)		((c) ? (c)->mtimes : NULL)
+#define PDSconn_get_mtimes_ns(c)	((c) ? (c)->mtimes_ns : NULL)
+#define PDSconn_get_acq(c)		((c) ? (c)->acq : NULL)
 
 /* Accessor macros for the pdstag structure */
 #define PDStag_get_id(t)		((t) ? (t)->id : -1)
@@ -124,10 +255,26 @@
 #define PDStag_get_ref(t)		((t) ? (t)->ref : -1)
 #define PDStag_get_ascii_ref(t)		((t) ? (t)->ascii_ref : NULL)
 #define PDStag_get_name(t)		((t) ? (t)->name : NULL)
-#define PDStag_get_value(t)		((t) ? (t)->value : -1)
 #define PDStag_get_type(t)		((t) ? (t)->type : -1)
-#define PDStag_get_status(t)		((t) ? (t)->status : -1)
-#define PDStag_get_mtime(t)		((t) ? (t)->mtime : -1)
+
+/* Accessor macros for a tag's hot data.  N.B.: These only work on a tag in
+   the segment, as the hot data are found via the segment's header */
+#define PDStag_get_value(t)\
+((t) ? PDS_SEG_VALUES(PDS_TAG_SEG(t))[(t)->id] : -1)
+#define PDStag_get_status(t)\
+((t) ? PDS_SEG_STATUSES(PDS_TAG_SEG(t))[(t)->id] : -1)
+#define PDStag_get_mtime(t)\
+((t) ? PDS_SEG_MTIMES(PDS_TAG_SEG(t))[(t)->id] : -1)
+#define PDStag_get_mtime_ns(t)\
+((t) ? PDS_SEG_MTIMES_NS(PDS_TAG_SEG(t))[(t)->id] : 0)
+
+/* Accessor macros for the acquisition times of a tag's block */
+#define PDStag_get_sent_ns(t)\
+((t) ? PDS_SEG_ACQ(PDS_TAG_SEG(t))[(t)->block_id].sent_ns : 0)
+#define PDStag_get_rcvd_ns(t)\
+((t) ? PDS_SEG_ACQ(PDS_TAG_SEG(t))[(t)->block_id].rcvd_ns : 0)
+#define PDStag_get_latency_ns(t)\
+((t) ? PDS_SEG_ACQ(PDS_TAG_SEG(t))[(t)->block_id].latency_ns : 0)
 
 /* Construct a PLC's fully-qualified ID (dependent on comms protocol) */
 #define PDS_GET_PLC_FQID(s, p)\
@@ -145,6 +292,74 @@
 * Structure definitions                                                       *
 ******************************************************************************/
 
+/******************************************************************************
+* Resolved tag handle type definition                                         *
+******************************************************************************/
+typedef int pdshandle;
+
+/******************************************************************************
+* Asynchronous write request structure                                        *
+******************************************************************************/
+typedef struct pdswrreq_rec
+{
+  int reqid;                           /* The write's request ID */
+  unsigned short int state;            /* The request's state */
+  unsigned short int status;           /* PLC status returned by the server */
+} pdswrreq;
+
+/******************************************************************************
+* Change journal record structure                                             *
+******************************************************************************/
+typedef struct pdschange_rec
+{
+  unsigned long long seq;              /* The change's sequence no. */
+  unsigned int id;                     /* The changed tag's ID */
+  unsigned short int value;            /* The tag's new value */
+  unsigned short int status;           /* The tag's new status */
+  time_t mtime;                        /* The tag's mtime */
+} pdschange;
+
+/******************************************************************************
+* Tag sample (history) structure                                              *
+******************************************************************************/
+typedef struct pdssample_rec
+{
+  unsigned long long mtime_ns;         /* Sample time (nsecs since epoch) */
+  unsigned short int value;            /* The tag's value */
+  unsigned short int status;           /* The tag's status */
+} pdssample;
+
+/******************************************************************************
+* Block acquisition times structure                                           *
+******************************************************************************/
+typedef struct pdsacq_rec
+{
+  unsigned long long sent_ns;          /* Query sent (nsecs since epoch) */
+  unsigned long long rcvd_ns;          /* Response rcvd. (nsecs since epoch) */
+  unsigned long long latency_ns;       /* Response latency (monotonic nsecs) */
+} pdsacq;
+
+/******************************************************************************
+* Snapshot image header structure                                             *
+******************************************************************************/
+typedef struct pdsimage_rec
+{
+  unsigned long long mtime_ns;         /* Image time (nsecs since epoch) */
+  unsigned int epoch;                  /* The image's snapshot epoch */
+  unsigned int ntags;                  /* No. of tags in the image */
+} pdsimage;
+
+/******************************************************************************
+* Block sample history descriptor structure                                   *
+******************************************************************************/
+typedef struct pdshist_rec
+{
+  volatile unsigned int count;         /* No. of samples taken of the block */
+  unsigned int depth;                  /* No. of samples kept (0 = none) */
+  unsigned int first;                  /* ID of the block's 1st tag */
+  unsigned int samples;                /* Index of the 1st tag's samples */
+} pdshist;
+
 /******************************************************************************
 * The PLC data server tag structure                                           *
 ******************************************************************************/
@@ -163,12 +378,32 @@ typedef struct pdstag_rec
   unsigned int ref;                    /* The tag reference */
   char ascii_ref[PDS_PLC_REF_LEN];     /* The tag logical reference */
   char name[PDS_TAGNAME_LEN];          /* The tag name */
-  unsigned short int value;            /* The tag value */
   unsigned short int type;             /* The tag's data type */
-  unsigned short int status;           /* The tag's PLC status */
-  time_t mtime;                        /* The tag's last modification time */
 } pdstag;
 
+/******************************************************************************
+* The PLC data server shared memory segment header structure                  *
+******************************************************************************/
+typedef struct pdsseg_rec
+{
+  unsigned int ttags;                  /* Total no. of tags in the segment */
+  unsigned int values;                 /* Offset of the tags' values */
+  unsigned int statuses;               /* Offset of the tags' statuses */
+  unsigned int mtimes;                 /* Offset of the tags' mtimes */
+  unsigned int mtimes_ns;              /* Offset of the tags' mtimes (nsecs) */
+  unsigned int acq;                    /* Offset of the blocks' acq. times */
+  unsigned int seq;                    /* Offset of the block seq. nos. */
+  unsigned int chg;                    /* Offset of the change counters */
+  unsigned int journal;                /* Offset of the change journal */
+  unsigned int njournal;               /* No. of records in the journal */
+  unsigned int hist;                   /* Offset of the history descriptors */
+  unsigned int samples;                /* Offset of the history samples */
+  unsigned int nsamples;               /* No. of history samples */
+  unsigned int snap;                   /* Offset of the snapshots */
+  unsigned int hash;                   /* Offset of the tag name index */
+  unsigned int size;                   /* Total size of the segment */
+} pdsseg;
+
 /******************************************************************************
 * The PLC data server connection structure                                    *
 ******************************************************************************/
@@ -202,8 +437,22 @@ typedef struct pdsconn_rec
 
   unsigned short int plc_status;  /* PLC status */
 
+  pdsseg *seg;                    /* Pointer to the segment's header */
   pdstag *data;                   /* Pointer to start of data tags */
   pdstag *status;                 /* Pointer to start of status tags */
+  unsigned short int *values;     /* Pointer to start of tags' values */
+  unsigned short int *statuses;   /* Pointer to start of tags' statuses */
+  time_t *mtimes;                 /* Pointer to start of tags' mtimes */
+  unsigned long long *mtimes_ns;  /* Pointer to start of tags' ns mtimes */
+  pdsacq *acq;                    /* Pointer to start of blocks' acq. times */
+  volatile unsigned int *seq;     /* Pointer to start of block seq. nos. */
+  volatile unsigned int *chg;     /* Pointer to start of change counters */
+  volatile unsigned long long *jseq; /* Pointer to journal's last seq. no. */
+  volatile pdschange *journal;    /* Pointer to start of journal records */
+  pdshist *hist;                  /* Pointer to start of blocks' histories */
+  volatile pdssample *samples;    /* Pointer to start of history samples */
+  volatile unsigned int *snap;    /* Pointer to the snapshot epoch */
+  unsigned int *hash;             /* Pointer to start of tag name index */
 
   int nblocks;                    /* No. of blocks in sh mem */ 
   int nplcs;                      /* No. of PLCs in sh mem */ 
@@ -211,6 +460,20 @@ typedef struct pdsconn_rec
   int nstatus_tags;               /* No. of status tags in sh mem */ 
   int ttags;                      /* Total no. of tags in sh mem */ 
 
+  int nhash;                      /* No. of slots in the tag name index */
+  int njournal;                   /* No. of records in the change journal */
+  int nsamples;                   /* No. of history samples in sh mem */
+  int seqlock;                    /* Reads use the block seq. nos. (bool) */
+  int gen;                        /* Segment generation no. (for handles) */
+
+  pdswrreq *wrreqs;               /* Async write request table (client) */
+  int wr_nextid;                  /* Last async write request ID issued */
+  int wr_npending;                /* No. of async writes awaiting a reply */
+
+  unsigned int *chg_seen;         /* Block change counters seen (client) */
+
+  struct pdsnpstate_rec *npstate; /* PDSNP state (network client) */
+
   int febe_proto_ver;             /* Front-end/Back-end protocol version */
    
 } pdsconn;
@@ -18,6 +18,10 @@
 #include <sys/sem.h> 
 #include <sys/shm.h>
 #include <sys/msg.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <unistd.h>
 
 #include "pds_defs.h"
 
@@ -40,13 +44,53 @@
 #define PDS_SEMHLD		-1     /* Hold the semaphore */
 #define PDS_SEMREL		1      /* Release the semaphore */
 
+/* N.B.: The server receives all messages with a type up to PDS_INITMSG, so
+         response types must be greater than PDS_INITMSG */
 #define PDS_WRMSG		100    /* Message priority (1 = high) */
-#define PDS_WRMSG_RESP		110
+#define PDS_WRMSG_RESP		220
 #define PDS_INITMSG		200
 #define PDS_INITMSG_RESP	210
 #define PDS_RDMSG		300
 #define PDS_RDMSG_RESP		310
 
+/* Write responses are addressed to the requesting client's process, so each
+   client gets the status of its own write */
+#define PDS_WRMSG_RESP_TYPE(p)		(PDS_WRMSG_RESP + (long int) (p))
+
+/* Block sequence counter (seqlock) operations.  A counter is odd whilst the
+   server is publishing the block, and even once the block is consistent */
+#define PDS_SEQ_BARRIER()		__sync_synchronize()
+#define PDS_SEQ_WRITE_BEGIN(s)		{ (s)++; PDS_SEQ_BARRIER(); }
+#define PDS_SEQ_WRITE_END(s)		{ PDS_SEQ_BARRIER(); (s)++; }
+#define PDS_SEQ_IS_WRITING(s)		((s) & 0x01)
+
+/* Change notification futex operations.  N.B.: The segment is shared between
+   processes, so these can't be private futexes */
+#define PDS_CHG_WAIT(a, v, t)\
+syscall(SYS_futex, (a), FUTEX_WAIT, (v), (t), NULL, 0)
+#define PDS_CHG_WAKE(a)\
+syscall(SYS_futex, (a), FUTEX_WAKE, INT_MAX, NULL, NULL, 0)
+
+/* Tag name hash index (open addressing, linear probing).  The index follows
+   the change journal in the segment.  Each slot holds a tag's
+   index + 1, or PDS_HASH_EMPTY */
+#define PDS_HASH_SLOTS_TAG		2      /* Min. index slots per tag */
+#define PDS_HASH_EMPTY			0
+#define PDS_HASH_FNV_OFFSET		2166136261U
+#define PDS_HASH_FNV_PRIME		16777619U
+
+/* FNV-1a hash of a tag name, stored in h */
+#define PDS_HASH_TAGNAME(h, s)\
+{\
+  const unsigned char *_p = (const unsigned char *) (s);\
+  for((h) = PDS_HASH_FNV_OFFSET; *_p; _p++)\
+    (h) = ((h) ^ *_p) * PDS_HASH_FNV_PRIME;\
+}
+
+/* Index slot for a hash & the next slot to probe (n is a power of 2) */
+#define PDS_HASH_SLOT(h, n)		((h) & ((n) - 1))
+#define PDS_HASH_NEXT_SLOT(i, n)	(((i) + 1) & ((n) - 1))
+
 /******************************************************************************
 * Structure definitions                                                       *
 ******************************************************************************/
@@ -61,17 +105,24 @@ typedef struct pdsmsg_rec
   /*********************** For writing data to the PLC ***********************/
 
   pdstag tag;                     /* The PLC data server tag structure */
+  unsigned short int status;      /* The tag's PLC status (response) */
                                   /* Array of tag values */
   unsigned short int tagvalues[PDS_NTAGVALUES];
   short int ntags;                /* No. of tags in the query */
+  pid_t pid;                      /* The requesting client's process ID */
+  int reqid;                      /* The client's write request ID */
 
   /*********************** For connecting to the server **********************/
   
   int semid;                      /* The semaphore ID */
   int shmid;                      /* The shared memory segment ID */
 
+  int nblocks;                    /* No. of blocks in sh mem segment */
   int ndata_tags;                 /* No. of data tags in sh mem segment */
   int nstatus_tags;               /* No. of status tags in sh mem segment */
+  int nhash;                      /* No. of slots in the tag name index */
+  int seqlock;                    /* Reads use the block seq. nos. (bool) */
+  int gen;                        /* Segment generation no. (for handles) */
 
   int febe_proto_ver;             /* Front-end/Back-end protocol version */
 
@@ -75,6 +75,75 @@ extern int pds_tcl_get_strtag(ClientData cData, Tcl_Interp *interp, int argc,
 extern int pds_tcl_set_tag(ClientData cData, Tcl_Interp *interp, int argc,
                            char *argv[]);
 
+/******************************************************************************
+* Function to resolve a tagname to a handle                                   *
+*                                                                             *
+* Pre-condition:  The standard Tcl function parameters are passed to the      *
+*                 function                                                    *
+* Post-condition: The tag's handle is returned.  If an error occurs a stack   *
+*                 trace is produced and a TCL_ERROR is returned               *
+******************************************************************************/
+extern int pds_tcl_resolve_tag(ClientData cData, Tcl_Interp *interp, int argc,
+                               char *argv[]);
+
+/******************************************************************************
+* Function to get a tag's value & status via its handle                       *
+*                                                                             *
+* Pre-condition:  The standard Tcl function parameters are passed to the      *
+*                 function                                                    *
+* Post-condition: The tag's value & status are returned as a list.  If an     *
+*                 error occurs a stack trace is produced and a TCL_ERROR is   *
+*                 returned                                                    *
+******************************************************************************/
+extern int pds_tcl_get_tag_h(ClientData cData, Tcl_Interp *interp, int argc,
+                             char *argv[]);
+
+/******************************************************************************
+* Function to set tag value(s) via the (base) tag's handle                    *
+*                                                                             *
+* Pre-condition:  The standard Tcl function parameters are passed to the      *
+*                 function                                                    *
+* Post-condition: The tag value(s) is set in the PLC.  If an error occurs a   *
+*                 stack trace is produced and a TCL_ERROR is returned         *
+******************************************************************************/
+extern int pds_tcl_set_tag_h(ClientData cData, Tcl_Interp *interp, int argc,
+                             char *argv[]);
+
+/******************************************************************************
+* Function to set tag value(s) asynchronously                                 *
+*                                                                             *
+* Pre-condition:  The standard Tcl function parameters are passed to the      *
+*                 function                                                    *
+* Post-condition: The write is sent to the server & its request ID is         *
+*                 returned.  If an error occurs a stack trace is produced and *
+*                 a TCL_ERROR is returned                                     *
+******************************************************************************/
+extern int pds_tcl_set_tag_async(ClientData cData, Tcl_Interp *interp,
+                                 int argc, char *argv[]);
+
+/******************************************************************************
+* Function to poll for the completion of an asynchronous write                *
+*                                                                             *
+* Pre-condition:  The standard Tcl function parameters are passed to the      *
+*                 function                                                    *
+* Post-condition: Whether the write has completed & its PLC status are        *
+*                 returned as a list.  If an error occurs a stack trace is    *
+*                 produced and a TCL_ERROR is returned                        *
+******************************************************************************/
+extern int pds_tcl_poll_write(ClientData cData, Tcl_Interp *interp, int argc,
+                              char *argv[]);
+
+/******************************************************************************
+* Function to wait for all asynchronous writes to complete                    *
+*                                                                             *
+* Pre-condition:  The standard Tcl function parameters are passed to the      *
+*                 function                                                    *
+* Post-condition: All in-flight writes have completed.  If an error occurs a  *
+*                 stack trace is produced and a TCL_ERROR is returned         *
+******************************************************************************/
+extern int pds_tcl_wait_writes(ClientData cData, Tcl_Interp *interp, int argc,
+                               char *argv[]);
+
 /******************************************************************************
 * Internal function to validate a tag's data format specifier                 *
 *                                                                             *
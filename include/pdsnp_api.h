@@ -11,6 +11,7 @@
 
 #include <pds.h>
 #include <pdsnp_defs.h>
+#include <pdsnp_comms.h>
 
 /******************************************************************************
 * Function prototypes                                                         *
@@ -23,7 +24,8 @@
 *                 host is NULL a local connection is made, else a network     *
 *                 connection is made                                          *
 * Post-condition: The client program is connected to the server which is      *
-*                 identified by the host & port.  The server connection       *
+*                 identified by the host & port, & the protocol version is    *
+*                 negotiated with the server.  The server connection          *
 *                 structure is returned which is used in all subsequent       *
 *                 calls to the server.  On return the connection structure    *
 *                 should be interrogated to determine if the connection was   *
@@ -65,5 +67,208 @@ int PDSNPget_tag(pdsconn *conn, const char *tagname, char *tagvalue);
 int PDSNPset_tag(pdsconn *conn, const char *tagname, short int ntags,
                  const short int *tagvalues);
 
+/******************************************************************************
+* Function to get a batch of tags' values                                     *
+*                                                                             *
+* Pre-condition:  A valid server connection, the no. of tags, the tagnames &  *
+*                 storage for the tags' values & statuses are passed to the   *
+*                 function.  The statuses are optional                        *
+* Post-condition: The tags' raw values & statuses are read from the server,   *
+*                 in as few round trips as the protocol allows.  An unknown   *
+*                 tag's status has PDSNP_COMMS_APP_ERR set.  On error a -1 is *
+*                 returned                                                    *
+******************************************************************************/
+int PDSNPget_tags(pdsconn *conn, int ntags, const char **tagnames,
+                  unsigned short int *tagvalues,
+                  unsigned short int *tagstatuses);
+
+/******************************************************************************
+* Function to set a batch of tags' values                                     *
+*                                                                             *
+* Pre-condition:  A valid server connection, the no. of tags, the tagnames,   *
+*                 the tags' values & storage for the writes' statuses are     *
+*                 passed to the function.  The statuses are optional          *
+* Post-condition: The tags' values are written to the PLC, & each write's     *
+*                 status is returned once all the writes have completed.  On  *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+int PDSNPset_tags(pdsconn *conn, int ntags, const char **tagnames,
+                  const unsigned short int *tagvalues,
+                  unsigned short int *tagstatuses);
+
+/******************************************************************************
+* Function to resolve a batch of tagnames to handles                          *
+*                                                                             *
+* Pre-condition:  A valid server connection, the no. of tags, the tagnames &  *
+*                 storage for the handles are passed to the function          *
+* Post-condition: Each tagname is looked up once by the server & a handle to  *
+*                 the tag is stored, for use with the handle-based batch      *
+*                 functions.  An unknown tag's handle is PDS_HANDLE_INVALID.  *
+*                 On error a -1 is returned                                   *
+******************************************************************************/
+int PDSNPresolve_tags(pdsconn *conn, int ntags, const char **tagnames,
+                      pdshandle *handles);
+
+/******************************************************************************
+* Function to get a batch of tags' values via their handles                   *
+*                                                                             *
+* Pre-condition:  A valid server connection, the no. of tags, the tags'       *
+*                 handles & storage for the tags' values & statuses are       *
+*                 passed to the function.  The statuses are optional          *
+* Post-condition: The tags' raw values & statuses are read from the server,   *
+*                 in as few round trips as the protocol allows.  An invalid   *
+*                 handle's status has PDSNP_COMMS_APP_ERR set.  On error a -1 *
+*                 is returned                                                 *
+******************************************************************************/
+int PDSNPget_tags_h(pdsconn *conn, int ntags, const pdshandle *handles,
+                    unsigned short int *tagvalues,
+                    unsigned short int *tagstatuses);
+
+/******************************************************************************
+* Function to set a batch of tags' values via their handles                   *
+*                                                                             *
+* Pre-condition:  A valid server connection, the no. of tags, the tags'       *
+*                 handles, the tags' values & storage for the writes'         *
+*                 statuses are passed to the function.  The statuses are      *
+*                 optional                                                    *
+* Post-condition: The tags' values are written to the PLC, & each write's     *
+*                 status is returned once all the writes have completed.  On  *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+int PDSNPset_tags_h(pdsconn *conn, int ntags, const pdshandle *handles,
+                    const unsigned short int *tagvalues,
+                    unsigned short int *tagstatuses);
+
+/******************************************************************************
+* Function to subscribe to changes to a set of tags                           *
+*                                                                             *
+* Pre-condition:  A valid server connection, the no. of tags, the tagnames,   *
+*                 each tag's deadband, the min. interval between updates (in  *
+*                 msecs) & storage for the tags' values & statuses are passed *
+*                 to the function.  The deadbands & statuses are optional     *
+* Post-condition: The tags replace any that the client was subscribed to, &   *
+*                 their current values & statuses are stored.  The server     *
+*                 then pushes each tag's changes that exceed its deadband, or *
+*                 change its status, which are read by PDSNPget_updates().    *
+*                 Subscribing to no tags ends the subscription.  On error a   *
+*                 -1 is returned                                              *
+******************************************************************************/
+int PDSNPsubscribe(pdsconn *conn, int ntags, const char **tagnames,
+                   const unsigned short int *deadbands, unsigned int interval,
+                   unsigned short int *tagvalues,
+                   unsigned short int *tagstatuses);
+
+/******************************************************************************
+* Function to get the updates pushed to a subscribed client                   *
+*                                                                             *
+* Pre-condition:  A valid server connection, storage for the updates, the     *
+*                 max. no. of updates to store & a timeout (in usecs, or      *
+*                 PDS_WAIT_FOREVER) are passed to the function                *
+* Post-condition: Any updates already held are stored, oldest first, else the *
+*                 function waits for the server to push some.  Each update's  *
+*                 ID is the tag's index in the subscribed tagnames.  The      *
+*                 connection's PLC status has PDSNP_COMMS_DROPPED set if      *
+*                 updates were dropped, because the client didn't keep up.    *
+*                 The no. of updates stored is returned.  If the timeout      *
+*                 expires or a signal is caught, a 0 is returned.  On error a *
+*                 -1 is returned                                              *
+******************************************************************************/
+int PDSNPget_updates(pdsconn *conn, pdsnpupdate *updates, int n, long timeout);
+
+/******************************************************************************
+* Function to submit a pipelined request                                      *
+*                                                                             *
+* Pre-condition:  A valid server connection, the v2 function ID (a get or set *
+*                 by name or by handle), the no. of tags, the tags' names or  *
+*                 handles, any tag values to set & storage for the tags'      *
+*                 values & statuses are passed to the function.  Unused       *
+*                 arguments are NULL.  The storage must remain valid until    *
+*                 the request is collected                                    *
+* Post-condition: The request is buffered, & sent without waiting for its     *
+*                 response, once enough requests are buffered or when a       *
+*                 response is collected.  The request's ID is returned, which *
+*                 PDSNPcollect() returns when the tags' results have been     *
+*                 stored.  On error a -1 is returned                          *
+******************************************************************************/
+int PDSNPsubmit(pdsconn *conn, int func_id, int ntags, const char **tagnames,
+                const pdshandle *handles, const unsigned short int *tagvalues,
+                unsigned short int *values, unsigned short int *statuses);
+
+/******************************************************************************
+* Function to collect the response to a pipelined request                     *
+*                                                                             *
+* Pre-condition:  A valid server connection & a timeout (in usecs, or         *
+*                 PDS_WAIT_FOREVER) are passed to the function                *
+* Post-condition: Any buffered requests are sent, & the oldest request is     *
+*                 collected once its response has arrived.  Its tags' results *
+*                 have been stored, & the connection's PLC status is the      *
+*                 response's exception code.  The request's ID is returned.   *
+*                 If the timeout expires or a signal is caught, a 0 is        *
+*                 returned.  If no requests are outstanding, or on error, a   *
+*                 -1 is returned                                              *
+******************************************************************************/
+int PDSNPcollect(pdsconn *conn, long timeout);
+
+/******************************************************************************
+* Function to join the multicast group that the server publishes the tags to  *
+*                                                                             *
+* Pre-condition:  A valid server connection & the multicast group's IP        *
+*                 address & port are passed to the function                   *
+* Post-condition: The client joins the group, on the interface that it        *
+*                 reaches the server through, leaving any group it had        *
+*                 joined.  The client's image of the published tags is        *
+*                 filled by PDSNPread_mcast().  On error a -1 is returned     *
+******************************************************************************/
+int PDSNPjoin_mcast(pdsconn *conn, const char *group, unsigned short int port);
+
+/******************************************************************************
+* Function to read the frames published to the multicast group                *
+*                                                                             *
+* Pre-condition:  A valid server connection, that has joined the group, & a   *
+*                 timeout (in usecs, or PDS_WAIT_FOREVER) are passed to the   *
+*                 function                                                    *
+* Post-condition: The function waits for a frame to arrive, & then all the    *
+*                 frames that have arrived are applied to the client's image  *
+*                 of the published tags.  If frames were lost, the            *
+*                 connection's PLC status has PDSNP_COMMS_DROPPED set, & the  *
+*                 image is brought up to date by the next keyframe, or by     *
+*                 PDSNPsnapshot_mcast().  The no. of frames applied is        *
+*                 returned.  If the timeout expires or a signal is caught, a  *
+*                 0 is returned.  On error a -1 is returned                   *
+******************************************************************************/
+int PDSNPread_mcast(pdsconn *conn, long timeout);
+
+/******************************************************************************
+* Function to get a snapshot of the published tags from the server            *
+*                                                                             *
+* Pre-condition:  A valid server connection, that has joined the multicast    *
+*                 group, is passed to the function                            *
+* Post-condition: All the published tags are got from the server, over the    *
+*                 connection, as the server last published them, & applied    *
+*                 to the client's image, filling any gaps.  The no. of tags   *
+*                 in the image is returned.  On error a -1 is returned        *
+******************************************************************************/
+int PDSNPsnapshot_mcast(pdsconn *conn);
+
+/******************************************************************************
+* Function to get tags' values from the client's image of the published tags  *
+*                                                                             *
+* Pre-condition:  A valid server connection, that has joined the multicast    *
+*                 group, the no. of tags, the tags' handles & storage for the *
+*                 tags' values, statuses & acquisition times (nsecs since the *
+*                 epoch) are passed to the function.  The statuses & times    *
+*                 are optional                                                *
+* Post-condition: Each tag's latest value, status & time, as received from    *
+*                 the group, are stored.  A tag that hasn't been received has *
+*                 a read error status, & an invalid handle has an application *
+*                 error status.  The connection's PLC status is the           *
+*                 combination of all the tags' statuses.  On error a -1 is    *
+*                 returned                                                    *
+******************************************************************************/
+int PDSNPget_mcast_tags_h(pdsconn *conn, int ntags, const pdshandle *handles,
+                          unsigned short int *tagvalues,
+                          unsigned short int *tagstatuses,
+                          unsigned long long *tagmtimes_ns);
+
 #endif
 
@@ -20,7 +20,10 @@
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
 
+#include <nw_comms.h>
 #include <pdsnp_defs.h>
 
 /******************************************************************************
@@ -48,5 +51,56 @@ int comms_read(int fd, pdscomms *comms);
 ******************************************************************************/
 int comms_write(int fd, pdscomms *comms);
 
+/******************************************************************************
+* Function to make room at the end of a buffered stream                       *
+*                                                                             *
+* Pre-condition:  The stream & the no. of bytes to make room for are passed   *
+*                 to the function                                             *
+* Post-condition: Any consumed data is discarded & the buffer is grown if     *
+*                 need be, so that the bytes can be appended at the end of    *
+*                 the stream's data.  On error a -1 is returned               *
+******************************************************************************/
+int comms_reserve(pdsnpio *io, int len);
+
+/******************************************************************************
+* Function to fill a buffered stream from a particular socket fd              *
+*                                                                             *
+* Pre-condition:  Socket fd, the stream & a timeout (NULL waits forever) are  *
+*                 passed to the function                                      *
+* Post-condition: Once the socket is ready for reading, as much data as has   *
+*                 arrived & will fit in the stream is received, with a single *
+*                 recv().  The number of bytes read is returned, or 0 if the  *
+*                 timeout expired or a signal was caught.  If the peer has    *
+*                 closed the socket, or on error, a -1 is returned            *
+******************************************************************************/
+int comms_fill(int fd, pdsnpio *in, struct timeval *tv);
+
+/******************************************************************************
+* Function to get the next frame from a buffered stream                       *
+*                                                                             *
+* Pre-condition:  The stream & a pointer for the frame are passed to the      *
+*                 function                                                    *
+* Post-condition: If a whole frame (of either version) is at the start of the *
+*                 stream's data, it is consumed, its address is stored, & its *
+*                 length is returned.  The frame is valid until the stream is *
+*                 next filled.  If the frame hasn't all arrived, room is made *
+*                 for it & a 0 is returned.  If the frame is invalid a -1 is  *
+*                 returned                                                    *
+******************************************************************************/
+int comms_next_frame(pdsnpio *in, pdsnp_buf **frame);
+
+/******************************************************************************
+* Function to flush a buffered stream on a particular socket fd               *
+*                                                                             *
+* Pre-condition:  Socket fd, the stream to send & the stream to receive on    *
+*                 are passed to the function                                  *
+* Post-condition: The stream's data is written on the socket.  Whilst waiting *
+*                 for the socket to be ready for writing, any data that       *
+*                 arrives is received into the receive stream, so that a peer *
+*                 that is blocked sending responses is never waited on.  The  *
+*                 number of bytes written is returned or -1 on error          *
+******************************************************************************/
+int comms_flush(int fd, pdsnpio *out, pdsnpio *in);
+
 #endif
 
@@ -15,7 +15,9 @@
 * Defines                                                                     *
 ******************************************************************************/
 
-#define PDSNP_VER		1
+#define PDSNP1_VER		1
+#define PDSNP2_VER		2
+#define PDSNP_VER		PDSNP2_VER
 #define PDSNP_HOST		"localhost"
 #define PDSNP_PORT		9574
 
@@ -23,23 +25,57 @@
 #define PDSNP_DEF_HOST		PDSNP_HOST
 #define PDSNP_DEF_PORT		PDSNP_PORT
 
-#define PDSNP_SOCKQ		5
+#define PDSNP_SOCKQ		1024
 #define PDSNP_MAXFD		32 
 #define PDSNP_TMO_SECS		15
 #define PDSNP_TMO_USECS		0
 #define PDSNP_SEC		1000000
-#define PDSNP_CLNTRDPAUSE	(PDSNP_SEC / 2)
-#define PDSNP_CLNTRDTRIES	8
 
 #define PDSNP_GET_TAG_FUNC_ID	1
 #define PDSNP_SET_TAG_FUNC_ID	2
 
+/* A client negotiates the protocol version by sending a v1 frame, with this
+   function ID & the latest version it speaks.  The server replies with the
+   version to use.  N.B.: A v1 server replies with a function error */
+#define PDSNP_VERSION_FUNC_ID	3
+
+/* The v2 functions are batched.  Each frame carries the no. of tags in the
+   batch, followed by an item for each tag.  A request may also carry an ID,
+   which its response echoes, so that a client can send many requests before
+   reading their responses.  The responses are sent in the requests' order */
+#define PDSNP2_GET_TAGS_FUNC_ID		0x10   /* name -> value, status */
+#define PDSNP2_SET_TAGS_FUNC_ID		0x11   /* name, value -> status */
+#define PDSNP2_RESOLVE_TAGS_FUNC_ID	0x12   /* name -> handle */
+#define PDSNP2_GET_HANDLES_FUNC_ID	0x13   /* handle -> value, status */
+#define PDSNP2_SET_HANDLES_FUNC_ID	0x14   /* handle, value -> status */
+
+/* A client subscribes to a set of tags with a min. interval between updates,
+   followed by each tag's name & deadband, & gets each tag's value & status.
+   Each tag's ID in the updates is its position in the subscription.  The
+   server then pushes updates to the tags, unrequested, as they change */
+#define PDSNP2_SUBSCRIBE_FUNC_ID	0x15   /* name, deadband -> value, status */
+#define PDSNP2_UPDATE_FUNC_ID		0x16   /* (pushed) id, value, status */
+
+/* The server can also publish all the tags' changes to a UDP multicast group,
+   so that any no. of clients can follow them for the cost of one.  Each
+   datagram is a v2 frame, whose request ID is its sequence no., so that a
+   client can tell when datagrams have been lost.  A frame holds one block's
+   changes, or in a keyframe its tags' latest values, stamped with the time
+   they were acquired & the change journal's seq. no. that they are as of.
+   Keyframes are published periodically, so that a client that has just
+   joined, or has lost datagrams, catches up.  A client can also get a
+   snapshot of all the tags, from a given tag ID, as published, over TCP */
+#define PDSNP2_CHANGES_FUNC_ID		0x17   /* (published) id, value, status */
+#define PDSNP2_KEYFRAME_FUNC_ID		0x18   /* (published) id, value, status */
+#define PDSNP2_SNAPSHOT_FUNC_ID		0x19   /* 1st id -> id, value, status */
+
 /* N.B.: The network protocol extends the PDS exceptions */
 #define PDSNP_COMMS_OK		0x00
 #define PDSNP_COMMS_RD_ERR	0x10
 #define PDSNP_COMMS_WR_ERR	0x20
 #define PDSNP_COMMS_APP_ERR	0x40
 #define PDSNP_COMMS_FUNC_ERR	0x80
+#define PDSNP_COMMS_DROPPED	0x100  /* Updates were dropped (v2 only) */
 
 #define PDS_PRINT_NP_STATUS(s)\
 (((s) == PDSNP_COMMS_OK) ? "PDSNP Status OK" :\
@@ -47,6 +83,7 @@
  ((s) & PDSNP_COMMS_WR_ERR) ? "PDSNP Comms Write Error" :\
  ((s) & PDSNP_COMMS_APP_ERR) ? "PDSNP Application Error" :\
  ((s) & PDSNP_COMMS_FUNC_ERR) ? "PDSNP Function Error" :\
+ ((s) & PDSNP_COMMS_DROPPED) ? "PDSNP Updates Dropped" :\
  "PDSNP Status Unknown!")
 
 /* Override to include the network protocol extended exceptions */
@@ -77,11 +114,107 @@
 #define PDSNP_GET_TAGVALUE(s,b)	(strncpy((s), (char*) &(b)[68], PDSNP_TAGVALUE_LEN))
 #define PDSNP_SET_TAGVALUE(b,v)	(strncpy((char*) &(b)[68], (v), PDSNP_TAGVALUE_LEN))
 
+/* A v2 frame is a header, followed by the batch's items.  The frame's length
+   is a 32-bit prefix, & all fields are binary, in network byte order.  A tag
+   name is prefixed by its length.  N.B.: A v1 frame starts with its length
+   (PDSNP_LEN), whereas a v2 frame's length is less than PDSNP2_MAX_LEN, so
+   its 1st byte is 0, which tells the two apart */
+#define PDSNP2_BUF_LEN		4
+#define PDSNP2_VER_LEN		1
+#define PDSNP2_FUNC_ID_LEN	1
+#define PDSNP2_EX_CODE_LEN	2
+#define PDSNP2_NTAGS_LEN	4
+#define PDSNP2_REQ_ID_LEN	4
+#define PDSNP2_NAMELEN_LEN	1
+#define PDSNP2_HANDLE_LEN	4
+#define PDSNP2_VALUE_LEN	2
+#define PDSNP2_STATUS_LEN	2
+#define PDSNP2_INTERVAL_LEN	4
+#define PDSNP2_DEADBAND_LEN	2
+#define PDSNP2_ID_LEN		4
+#define PDSNP2_JSEQ_LEN		8
+#define PDSNP2_TIME_LEN		8
+#define PDSNP2_GEN_LEN		2
+#define PDSNP2_BLOCK_LEN	2
+#define PDSNP2_TTAGS_LEN	4
+
+#define PDSNP2_HDR_LEN		(PDSNP2_BUF_LEN + PDSNP2_VER_LEN + PDSNP2_FUNC_ID_LEN + PDSNP2_EX_CODE_LEN + PDSNP2_NTAGS_LEN + PDSNP2_REQ_ID_LEN)
+#define PDSNP2_MAX_ITEM_LEN	(PDSNP2_NAMELEN_LEN + PDSNP_TAGNAME_LEN + PDSNP2_VALUE_LEN)
+#define PDSNP2_MAX_TAGS		4096   /* Max. tags in a frame */
+#define PDSNP2_MAX_WRITES	512    /* Max. tags in a set frame */
+#define PDSNP2_MAX_LEN		(PDSNP2_HDR_LEN + PDSNP2_INTERVAL_LEN + PDSNP2_MAX_TAGS * PDSNP2_MAX_ITEM_LEN)
+#define PDSNP2_UPDATE_ITEM_LEN	(PDSNP2_ID_LEN + PDSNP2_VALUE_LEN + PDSNP2_STATUS_LEN)
+#define PDSNP2_MAX_UPDATE_LEN	(PDSNP2_HDR_LEN + PDSNP2_MAX_TAGS * PDSNP2_UPDATE_ITEM_LEN)
+
+/* A published frame (or snapshot) has a 2nd header, after the v2 header,
+   holding the journal seq. no. & time of its values, the segment's
+   generation no., the block's ID & the total no. of tags.  A published
+   frame fits in one Ethernet datagram */
+#define PDSNP2_PUB_HDR_LEN	(PDSNP2_JSEQ_LEN + PDSNP2_TIME_LEN + PDSNP2_GEN_LEN + PDSNP2_BLOCK_LEN + PDSNP2_TTAGS_LEN)
+#define PDSNP2_MAX_PUB_LEN	1472
+#define PDSNP2_MAX_PUB_TAGS	((PDSNP2_MAX_PUB_LEN - PDSNP2_HDR_LEN - PDSNP2_PUB_HDR_LEN) / PDSNP2_UPDATE_ITEM_LEN)
+#define PDSNP2_NO_BLOCK		0xffff /* A snapshot isn't of one block */
+
+/* Updates that arrive whilst a client waits for a response are held for it,
+   up to this many, dropping the oldest */
+#define PDSNP_MAX_UPDATES	(PDSNP2_MAX_TAGS * 4)
+
+/* Initial size of a client's buffered streams.  Pipelined requests are sent
+   once this much is buffered, or when their responses are collected */
+#define PDSNP_IO_LEN		65536
+#define PDSNP_REQS_LEN		64     /* Initial size of the request table */
+#define PDSNP_MAX_REQ_ID	0x7fffffff
+
+#define PDSNP_GET_FRAME_VER(b)	((b)[0] == 0 ? PDSNP2_VER : PDSNP1_VER)
+
+#define PDSNP2_GET_U16(p)\
+((unsigned short int) (((p)[0] << 8) | (p)[1]))
+#define PDSNP2_SET_U16(p,v)\
+((p)[0] = ((v) >> 8) & 0xff, (p)[1] = (v) & 0xff)
+#define PDSNP2_GET_U64(p)\
+(((unsigned long long) PDSNP2_GET_U32(p) << 32) | PDSNP2_GET_U32((p) + 4))
+#define PDSNP2_SET_U64(p,v)\
+(PDSNP2_SET_U32((p), (unsigned int) ((v) >> 32)),\
+ PDSNP2_SET_U32((p) + 4, (unsigned int) (v)))
+#define PDSNP2_GET_U32(p)\
+(((unsigned int) (p)[0] << 24) | ((unsigned int) (p)[1] << 16) |\
+ ((unsigned int) (p)[2] << 8) | (unsigned int) (p)[3])
+#define PDSNP2_SET_U32(p,v)\
+((p)[0] = ((v) >> 24) & 0xff, (p)[1] = ((v) >> 16) & 0xff,\
+ (p)[2] = ((v) >> 8) & 0xff, (p)[3] = (v) & 0xff)
+
+#define PDSNP2_GET_BUF_LEN(b)	((int) PDSNP2_GET_U32(&(b)[0]))
+#define PDSNP2_SET_BUF_LEN(b,v)	PDSNP2_SET_U32(&(b)[0], (unsigned int) (v))
+#define PDSNP2_GET_VER(b)	((int) (b)[4])
+#define PDSNP2_SET_VER(b,v)	((b)[4] = (v))
+#define PDSNP2_GET_FUNC_ID(b)	((int) (b)[5])
+#define PDSNP2_SET_FUNC_ID(b,v)	((b)[5] = (v))
+#define PDSNP2_GET_EX_CODE(b)	PDSNP2_GET_U16(&(b)[6])
+#define PDSNP2_SET_EX_CODE(b,v)	PDSNP2_SET_U16(&(b)[6], (v))
+#define PDSNP2_GET_NTAGS(b)	((int) PDSNP2_GET_U32(&(b)[8]))
+#define PDSNP2_SET_NTAGS(b,v)	PDSNP2_SET_U32(&(b)[8], (unsigned int) (v))
+#define PDSNP2_GET_REQ_ID(b)	PDSNP2_GET_U32(&(b)[12])
+#define PDSNP2_SET_REQ_ID(b,v)	PDSNP2_SET_U32(&(b)[12], (unsigned int) (v))
+#define PDSNP2_ITEMS(b)		(&(b)[PDSNP2_HDR_LEN])
+
+#define PDSNP2_GET_JSEQ(b)	PDSNP2_GET_U64(&(b)[16])
+#define PDSNP2_SET_JSEQ(b,v)	PDSNP2_SET_U64(&(b)[16], (v))
+#define PDSNP2_GET_TIME(b)	PDSNP2_GET_U64(&(b)[24])
+#define PDSNP2_SET_TIME(b,v)	PDSNP2_SET_U64(&(b)[24], (v))
+#define PDSNP2_GET_GEN(b)	((int) PDSNP2_GET_U16(&(b)[32]))
+#define PDSNP2_SET_GEN(b,v)	PDSNP2_SET_U16(&(b)[32], (v))
+#define PDSNP2_GET_BLOCK(b)	((int) PDSNP2_GET_U16(&(b)[34]))
+#define PDSNP2_SET_BLOCK(b,v)	PDSNP2_SET_U16(&(b)[34], (v))
+#define PDSNP2_GET_TTAGS(b)	((int) PDSNP2_GET_U32(&(b)[36]))
+#define PDSNP2_SET_TTAGS(b,v)	PDSNP2_SET_U32(&(b)[36], (unsigned int) (v))
+#define PDSNP2_PUB_ITEMS(b)	(&(b)[PDSNP2_HDR_LEN + PDSNP2_PUB_HDR_LEN])
+
 /******************************************************************************
 * Buffer to handle PDS network stub client/server socket communications       *
 ******************************************************************************/
 typedef unsigned char pdsnp1_buf;           /* PDS n/w protocol v. 1 */
-typedef pdsnp1_buf pdsnp_buf;               /* Latest protocol version */
+typedef unsigned char pdsnp2_buf;           /* PDS n/w protocol v. 2 */
+typedef pdsnp2_buf pdsnp_buf;               /* Latest protocol version */
  
 /******************************************************************************
 * Structure to handle PDS network stub client/server socket communications    *
@@ -92,5 +225,77 @@ typedef struct pdscomms_rec
   pdsnp_buf buf[PDSNP_LEN];            /* PDS n/w protocol buffer */
 } pdscomms;
 
+/******************************************************************************
+* Structure of an update to a subscribed tag                                  *
+******************************************************************************/
+typedef struct pdsnpupdate_rec
+{
+  unsigned int id;                     /* The tag's ID in the subscription */
+  unsigned short int value;            /* The tag's new value */
+  unsigned short int status;           /* The tag's new status */
+} pdsnpupdate;
+
+/******************************************************************************
+* Structure of a buffered stream on a socket                                  *
+******************************************************************************/
+typedef struct pdsnpio_rec
+{
+  pdsnp_buf *buf;                      /* The stream's buffer */
+  int size;                            /* Size of the buffer */
+  int off;                             /* Offset of the unconsumed data */
+  int len;                             /* Offset of the end of the data */
+} pdsnpio;
+
+/******************************************************************************
+* Structure of a pipelined request                                            *
+******************************************************************************/
+typedef struct pdsnpreq_rec
+{
+  unsigned int reqid;                  /* The request's ID */
+  int func_id;                         /* The request's function ID */
+  int ntags;                           /* No. of tags in the request */
+  unsigned short int ex_code;          /* The response's exception code */
+  unsigned short int *values;          /* Storage for the tags' values */
+  unsigned short int *statuses;        /* Storage for the tags' statuses */
+  pdshandle *handles;                  /* Storage for the tags' handles */
+} pdsnpreq;
+
+/******************************************************************************
+* Structure of a client's image of the tags published to a multicast group    *
+******************************************************************************/
+typedef struct pdsnpmcast_rec
+{
+  int fd;                              /* The multicast socket fd */
+  pdsnp_buf buf[PDSNP2_MAX_PUB_LEN];   /* The datagram received */
+  unsigned int pubseq;                 /* Seq. no. of the last frame */
+  int synced;                          /* A frame has been received (bool) */
+  int gen;                             /* The segment's generation no. */
+  int ttags;                           /* No. of tags in the image */
+  unsigned short int *values;          /* The tags' values */
+  unsigned short int *statuses;        /* The tags' statuses */
+  unsigned long long *mtimes_ns;       /* The tags' acq. times (nsecs) */
+  unsigned long long *jseqs;           /* Journal seq. nos. of the values */
+} pdsnpmcast;
+
+/******************************************************************************
+* Structure of a PDS network client's state                                   *
+******************************************************************************/
+typedef struct pdsnpstate_rec
+{
+  pdsnpio in;                          /* Frames received */
+  pdsnpio out;                         /* Frames to send */
+  pdsnpreq *reqs;                      /* Pipelined requests, in order */
+  int reqoff;                          /* Index of the oldest request */
+  int nreqs;                           /* No. of pipelined requests */
+  int ndone;                           /* No. of the requests completed */
+  int reqsize;                         /* Size of the request table */
+  unsigned int reqid;                  /* ID of the last pipelined request */
+  pdsnpupdate *updates;                /* Updates held for the client */
+  int nupdates;                        /* No. of updates held */
+  int updsize;                         /* Max. no. of updates held */
+  unsigned short int upd_status;       /* Status of the updates held */
+  pdsnpmcast *mcast;                   /* The multicast group's image */
+} pdsnpstate;
+
 #endif
 
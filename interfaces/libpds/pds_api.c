@@ -8,13 +8,112 @@
 
 #include "pds_api.h" 
 
+/******************************************************************************
+* Internal function to find a tag by name                                     *
+*                                                                             *
+* Pre-condition:  A valid server connection & the tagname to search for are   *
+*                 passed to the function                                      *
+* Post-condition: The tagname is looked up in the server's tag name index in  *
+*                 the shared memory segment.  A pointer to the tag is         *
+*                 returned or a NULL if it's not found                        *
+******************************************************************************/
+static pdstag* _find_tag(pdsconn *conn, const char *tagname)
+{
+  pdstag *tag = NULL;
+  unsigned int h = 0;
+  int i = 0, n = 0;
+
+  if(!conn->data || !conn->hash || conn->nhash < 1)
+    return NULL;
+
+  PDS_HASH_TAGNAME(h, tagname);
+
+  /* Probe from the tagname's slot until we find it or hit an empty slot */
+  for(i = PDS_HASH_SLOT(h, conn->nhash), n = 0; n < conn->nhash; i = PDS_HASH_NEXT_SLOT(i, conn->nhash), n++)
+  {
+    if(conn->hash[i] == PDS_HASH_EMPTY)
+      break;
+
+    tag = &conn->data[conn->hash[i] - 1];
+
+    if(strcmp(tag->name, tagname) == 0)
+      return tag;
+  }
+
+  return NULL;
+}
+
+
+
+/******************************************************************************
+* Internal function to copy a consistent set of tags' data                    *
+*                                                                             *
+* Pre-condition:  A valid server connection, a pointer to the 1st tag, the    *
+*                 no. of consecutive tags to copy and storage for their       *
+*                 values & statuses are passed to the function.  _hold_shm()  *
+*                 should be called before calling                             *
+* Post-condition: The tags' values & statuses are copied.  If the server      *
+*                 publishes under block sequence counters, the copy of each   *
+*                 block's tags is retried until it is consistent.  The no. of *
+*                 tags copied is returned                                     *
+******************************************************************************/
+static int _copy_tag_data(pdsconn *conn, pdstag *tag, int ntags,
+                          unsigned short int *values,
+                          unsigned short int *statuses)
+{
+  volatile unsigned int *seq = NULL;
+  unsigned int s = 0;
+  int i = 0, j = 0;
+
+  if(!conn->seqlock)
+  {
+    memcpy(values, &PDS_TAG_VALUE(conn, tag), (ntags * sizeof(unsigned short int)));
+    memcpy(statuses, &PDS_TAG_STATUS(conn, tag), (ntags * sizeof(unsigned short int)));
+
+    return ntags;
+  }
+
+  /* Copy each run of tags from the same block under that block's counter.
+     If the server published the block whilst we were copying, try again */
+  for(i = 0; i < ntags; i = j)
+  {
+    seq = &conn->seq[tag[i].block_id];
+
+    for(;;)
+    {
+      if(PDS_SEQ_IS_WRITING((s = *seq)))
+      {
+        sched_yield();
+        continue;
+      }
+
+      PDS_SEQ_BARRIER();
+
+      for(j = i; j < ntags && tag[j].block_id == tag[i].block_id; j++)
+      {
+        values[j] = PDS_TAG_VALUE(conn, &tag[j]);
+        statuses[j] = PDS_TAG_STATUS(conn, &tag[j]);
+      }
+
+      PDS_SEQ_BARRIER();
+
+      if(*seq == s)
+        break;
+    }
+  }
+
+  return ntags;
+}
+
+
+
 /******************************************************************************
 * Internal function to get a string of tags' value (formatted)                *
 *                                                                             *
 * Pre-condition:  A valid server connection, the tagname (base), the number   *
 *                 of tagvalues to read, a string for storage of the tags'     *
 *                 value and a data format specifier are passed to the         *
-*                 function.  The semaphore should be held before calling      *
+*                 function.  _hold_shm() should be called before calling      *
 * Post-condition: The tagnames are accessed in the shared memory segment and  *
 *                 their value's as a string are returned formatted as the     *
 *                 specified type.  On error a -1 is returned                  *
@@ -23,54 +122,57 @@ static int _get_strtagf(pdsconn *conn, const char *tagname, int ntags,
                         char *tagvalue, const char fmt)
 {
   pdstag *tag = NULL;
-  int len = strlen(tagname), retval = -1, i = 0, j = 0;
+  int retval = -1, i = 0, j = 0;
+  unsigned short int values[PDS_NTAGVALUES], statuses[PDS_NTAGVALUES];
 
   if(tagvalue) tagvalue[0] = '\0';
 
-  /* Search for tagname ensuring string is not just a substring of tag */
-  for(tag = conn->data, i = 0; tag && i < conn->ttags; tag++, i++)
+  /* Lookup the tagname in the index */
+  if((tag = _find_tag(conn, tagname)))
   {
-    if(memcmp(tag->name, tagname, len) == 0)
+    i = (tag - conn->data);
+
+    /* Take a consistent copy of the tags' data */
+    if(ntags > (conn->ttags - i))
+      ntags = (conn->ttags - i);
+    if(ntags > PDS_NTAGVALUES)
+      ntags = PDS_NTAGVALUES;
+
+    _copy_tag_data(conn, tag, ntags, values, statuses);
+
+    /* Build the string of tags and set the query status */
+    switch(fmt)
     {
-      if(len == strlen(tag->name)) 
-      {
-        /* Build the string of tags and set the query status */
-        switch(fmt)
+      case 'd' :
+      case 'i' :
+      default  :                   /* Default - format as an integer */
+        for(j = 0; j < ntags; j++)
         {
-          case 'd' :
-          case 'i' :
-          default  :                   /* Default - format as an integer */
-            for(j = 0; j < ntags && tag && i < conn->ttags; tag++, i++, j++)
-            {
-              sprintf(tagvalue, "%s%u", tagvalue, tag->value);
-              conn->plc_status |= tag->status;
-            }
-          break;
-
-          case 'f' :                   /* Format as a float */
-            for(j = 0; j < ntags && tag && i < conn->ttags; tag++, i++, j++)
-            {
-              sprintf(tagvalue, "%s%f", tagvalue, (float) tag->value);
-              conn->plc_status |= tag->status;
-            }
-          break;
+          sprintf(tagvalue, "%s%u", tagvalue, values[j]);
+          conn->plc_status |= statuses[j];
+        }
+      break;
 
-          case 'c' :                   /* Format as a char */
-          case 's' :
-            for(j = 0; j < ntags && tag && i < conn->ttags; tag++, i++, j++)
-            {
-              sprintf(tagvalue, "%s%c%c", tagvalue,
-              isprint((tag->value >> 8)) ? (char) (tag->value >> 8) : ' ',
-              isprint((tag->value & 0xff)) ? (char) (tag->value & 0xff) : ' ');
-              conn->plc_status |= tag->status;
-            }
-          break;
+      case 'f' :                   /* Format as a float */
+        for(j = 0; j < ntags; j++)
+        {
+          sprintf(tagvalue, "%s%f", tagvalue, (float) values[j]);
+          conn->plc_status |= statuses[j];
         }
-        retval = 0;
-        break;
+      break;
 
-      }
+      case 'c' :                   /* Format as a char */
+      case 's' :
+        for(j = 0; j < ntags; j++)
+        {
+          sprintf(tagvalue, "%s%c%c", tagvalue,
+          isprint((values[j] >> 8)) ? (char) (values[j] >> 8) : ' ',
+          isprint((values[j] & 0xff)) ? (char) (values[j] & 0xff) : ' ');
+          conn->plc_status |= statuses[j];
+        }
+      break;
     }
+    retval = 0;
   }
 
   return retval;
@@ -99,6 +201,283 @@ static int _semset(int id, int op, int snum)
 
 
 
+/******************************************************************************
+* Internal function to hold the shared memory segment for reading             *
+*                                                                             *
+* Pre-condition:  A valid server connection is passed to the function         *
+* Post-condition: If the server publishes under block sequence counters, then *
+*                 nothing need be held.  Otherwise the semaphore is held.  If *
+*                 an error occurs a -1 is returned                            *
+******************************************************************************/
+static int _hold_shm(pdsconn *conn)
+{
+  return (conn->seqlock ? 0 : _semset(conn->semid, PDS_SEMHLD, 0));
+}
+
+
+
+/******************************************************************************
+* Internal function to release the shared memory segment after reading        *
+*                                                                             *
+* Pre-condition:  A valid server connection is passed to the function         *
+* Post-condition: If the semaphore was held by _hold_shm() it is released.    *
+*                 If an error occurs a -1 is returned                         *
+******************************************************************************/
+static int _release_shm(pdsconn *conn)
+{
+  return (conn->seqlock ? 0 : _semset(conn->semid, PDS_SEMREL, 0));
+}
+
+
+
+/******************************************************************************
+* Internal function to get the tag referenced by a resolved handle            *
+*                                                                             *
+* Pre-condition:  A valid server connection & a tag handle are passed to the  *
+*                 function                                                    *
+* Post-condition: The handle is validated against the segment's generation    *
+*                 no. & its no. of tags.  A pointer to the tag is returned or *
+*                 a NULL if the handle is invalid                             *
+******************************************************************************/
+static pdstag* _get_handle_tag(pdsconn *conn, pdshandle h)
+{
+  if(!conn->data || h < 0)
+    return NULL;
+
+  if(PDS_GET_HANDLE_GEN(h) != (conn->gen & PDS_HANDLE_GEN_MASK))
+    return NULL;
+
+  if(PDS_GET_HANDLE_INDEX(h) >= conn->ttags)
+    return NULL;
+
+  return &conn->data[PDS_GET_HANDLE_INDEX(h)];
+}
+
+
+
+/******************************************************************************
+* Internal function to setup a message to write tag value(s) to the PLC       *
+*                                                                             *
+* Pre-condition:  A valid server connection, a pointer to the (base) tag, the *
+*                 number of tagvalues, the tagvalues & storage for the        *
+*                 message are passed to the function                          *
+* Post-condition: The message is setup to request the write.  The             *
+*                 connection's PLC status is set from the tag's status.  If   *
+*                 the PLC is offline or an error occurs a -1 is returned      *
+******************************************************************************/
+static int _setup_write_msg(pdsconn *conn, pdstag *tag, short int ntags,
+                            const unsigned short int *tagvalues,
+                            pdsmsg *msg)
+{
+  memset(msg, 0, sizeof(pdsmsg));
+  conn->plc_status = 0;
+
+  if(ntags > PDS_NTAGVALUES)
+    ntags = PDS_NTAGVALUES;
+
+  /* Set up the message queue struct */
+  msg->msgtype = PDS_WRMSG;
+  strncpy(msg->tag.name, tag->name, PDS_TAGNAME_LEN - 1);
+  msg->ntags = ntags;
+  msg->pid = getpid();
+  memcpy(msg->tagvalues, tagvalues, (ntags * sizeof(unsigned short int)));
+
+  /* Get the tag's current PLC status */
+  if(_hold_shm(conn) == -1)
+    return -1;
+
+  conn->plc_status |= PDS_TAG_STATUS(conn, tag);
+
+  _release_shm(conn);
+
+  /* Only write data to PLC if PLC is ONLINE */
+  if((PDS_CHECK_PLC_STATUS(conn) & PDS_PLC_OFFLINE) == PDS_PLC_OFFLINE)
+    return -1;
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Internal function to collect a server's reply to one of this client's       *
+* writes                                                                      *
+*                                                                             *
+* Pre-condition:  A valid server connection, the message queue flags for the  *
+*                 receive & storage for the write's PLC status are passed to  *
+*                 the function                                                *
+* Post-condition: A reply addressed to this client is received & the write's  *
+*                 PLC status is stored.  If the reply is for an async write,  *
+*                 it is recorded in the request table.  The reply's request   *
+*                 ID is returned or a -1 if no reply was received             *
+******************************************************************************/
+static int _collect_write_reply(pdsconn *conn, int msgflg,
+                               unsigned short int *status)
+{
+  int msgsize = (sizeof(pdsmsg) - sizeof(long int));
+  pdsmsg msg;
+  pdswrreq *req = NULL;
+
+  memset(&msg, 0, sizeof(pdsmsg));
+
+  if(msgrcv(conn->msgid, (void *) &msg, msgsize, PDS_WRMSG_RESP_TYPE(getpid()), msgflg) < msgsize)
+    return -1;
+
+  *status = msg.status;
+
+  /* Record the completion of an async write */
+  if(msg.reqid != PDS_WRREQ_SYNC && conn->wrreqs)
+  {
+    req = &conn->wrreqs[PDS_WRREQ_SLOT(msg.reqid)];
+
+    if(req->reqid == msg.reqid && req->state == PDS_WRREQ_PENDING)
+    {
+      req->state = PDS_WRREQ_DONE;
+      req->status = msg.status;
+      conn->wr_npending--;
+    }
+  }
+
+  return msg.reqid;
+}
+
+
+
+/******************************************************************************
+* Internal function to send a write message to the server                     *
+*                                                                             *
+* Pre-condition:  A valid server connection & the message are passed to the   *
+*                 function                                                    *
+* Post-condition: The message is sent to the server.  If the message queue is *
+*                 full, replies to this client's async writes are collected   *
+*                 until there is room.  On error a -1 is returned             *
+******************************************************************************/
+static int _send_write_msg(pdsconn *conn, pdsmsg *msg)
+{
+  int msgsize = (sizeof(pdsmsg) - sizeof(long int));
+  unsigned short int status = 0;
+
+  /* N.B.: If the queue is full, it may well be full of replies to this
+           client's async writes, so collect one before trying again */
+  while(msgsnd(conn->msgid, (void *) msg, msgsize, IPC_NOWAIT) == -1)
+  {
+    if(errno != EAGAIN)
+      return -1;
+
+    if(conn->wr_npending < 1)
+      return msgsnd(conn->msgid, (void *) msg, msgsize, 0);
+
+    if(_collect_write_reply(conn, 0, &status) == -1)
+      return -1;
+  }
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Internal function to write tag value(s) to the PLC                          *
+*                                                                             *
+* Pre-condition:  A valid server connection, a pointer to the (base) tag, the *
+*                 number of tagvalues & the tagvalues are passed to the       *
+*                 function                                                    *
+* Post-condition: The tagvalues are sent to the server to write to the PLC.   *
+*                 The connection's PLC status is set from the server's        *
+*                 response.  On error a -1 is returned                        *
+******************************************************************************/
+static int _write_tag(pdsconn *conn, pdstag *tag, short int ntags,
+                      const unsigned short int *tagvalues)
+{
+  pdsmsg msg;
+  unsigned short int status = 0;
+  int reqid = 0, retval = -1;
+
+  if(_setup_write_msg(conn, tag, ntags, tagvalues, &msg) == -1)
+    return retval;
+
+  msg.reqid = PDS_WRREQ_SYNC;
+
+  /* Send the message */
+  if(_send_write_msg(conn, &msg) != -1)
+  {
+    /* Receive the server's response (status word is set).  Any replies to
+       this client's async writes that arrive first are recorded */
+    while((reqid = _collect_write_reply(conn, 0, &status)) != -1)
+    {
+      if(reqid == PDS_WRREQ_SYNC)
+      {
+        retval = 0;
+
+        /* Return to the client the status of the PLC as returned by the 
+           server */
+        conn->plc_status = status;
+        break;
+      }
+    }
+  }
+
+  return retval;
+}
+
+
+
+/******************************************************************************
+* Internal function to write tag value(s) to the PLC asynchronously           *
+*                                                                             *
+* Pre-condition:  A valid server connection, a pointer to the (base) tag, the *
+*                 number of tagvalues & the tagvalues are passed to the       *
+*                 function                                                    *
+* Post-condition: The tagvalues are sent to the server to write to the PLC,   *
+*                 without waiting for the server's response.  If the request  *
+*                 table is full, the oldest write's response is waited for.   *
+*                 The write's request ID is returned or -1 on error           *
+******************************************************************************/
+static int _write_tag_async(pdsconn *conn, pdstag *tag, short int ntags,
+                            const unsigned short int *tagvalues)
+{
+  pdsmsg msg;
+  pdswrreq *req = NULL;
+  unsigned short int status = 0;
+  int reqid = 0;
+
+  /* Allocate the request table on the client's first async write */
+  if(!conn->wrreqs)
+  {
+    if(!(conn->wrreqs = (pdswrreq *) calloc(PDS_WRREQ_MAX, sizeof(pdswrreq))))
+      return -1;
+  }
+
+  if(_setup_write_msg(conn, tag, ntags, tagvalues, &msg) == -1)
+    return -1;
+
+  /* Request IDs are positive, wrapping back round to 1 */
+  reqid = (conn->wr_nextid >= PDS_WRREQ_ID_MAX) ? 1 : conn->wr_nextid + 1;
+  conn->wr_nextid = reqid;
+  req = &conn->wrreqs[PDS_WRREQ_SLOT(reqid)];
+
+  /* If this request's slot is still in flight, then the table is full */
+  while(req->state == PDS_WRREQ_PENDING)
+  {
+    if(_collect_write_reply(conn, 0, &status) == -1)
+      return -1;
+  }
+
+  msg.reqid = reqid;
+
+  if(_send_write_msg(conn, &msg) == -1)
+    return -1;
+
+  req->reqid = reqid;
+  req->state = PDS_WRREQ_PENDING;
+  req->status = 0;
+  conn->wr_npending++;
+
+  return reqid;
+}
+
+
+
 /******************************************************************************
 * Function to connect a client to the server                                  *
 *                                                                             *
@@ -212,9 +591,13 @@ pdsconn* PDSconnect(key_t connkey)
   /* Set the IPC parameters as returned by the server */
   conn->semid = msg.semid;
   conn->shmid = msg.shmid;
+  conn->nblocks = msg.nblocks;
   conn->ndata_tags = msg.ndata_tags;
   conn->nstatus_tags = msg.nstatus_tags;
   conn->ttags = (conn->ndata_tags + conn->nstatus_tags);
+  conn->nhash = msg.nhash;
+  conn->seqlock = msg.seqlock;
+  conn->gen = msg.gen;
   conn->plc_status = PDS_PLC_OK;
 
   /* Attempt to attach to the server's shared memory segment */
@@ -234,9 +617,44 @@ pdsconn* PDSconnect(key_t connkey)
       break;
   }
 
+  /* The segment's header describes where each region is */
+  conn->seg = (pdsseg *) conn->shm;
+
   /* Assign tag pointers to the start of the data & status tags */
-  conn->data = (pdstag *) conn->shm;
-  conn->status = (pdstag *) (conn->shm + (conn->ndata_tags * sizeof(pdstag)));
+  conn->data = (pdstag *) (conn->shm + PDS_SEG_HDR_LEN);
+  conn->status = conn->data + conn->ndata_tags;
+
+  /* Assign pointers to the start of the hot data, acquisition times, seq.
+     nos., change counters, change journal, sample histories, snapshots &
+     index */
+  conn->values = (unsigned short int *) (conn->shm + conn->seg->values);
+  conn->statuses = (unsigned short int *) (conn->shm + conn->seg->statuses);
+  conn->mtimes = (time_t *) (conn->shm + conn->seg->mtimes);
+  conn->mtimes_ns = (unsigned long long *) (conn->shm + conn->seg->mtimes_ns);
+  conn->acq = (pdsacq *) (conn->shm + conn->seg->acq);
+  conn->seq = (unsigned int *) (conn->shm + conn->seg->seq);
+  conn->chg = (unsigned int *) (conn->shm + conn->seg->chg);
+  conn->jseq = (unsigned long long *) (conn->shm + conn->seg->journal);
+  conn->journal = (pdschange *) (conn->shm + conn->seg->journal + PDS_SEG_CACHE_LINE);
+  conn->njournal = conn->seg->njournal;
+  conn->hist = (pdshist *) (conn->shm + conn->seg->hist);
+  conn->samples = (pdssample *) (conn->shm + conn->seg->samples);
+  conn->nsamples = conn->seg->nsamples;
+  conn->snap = (unsigned int *) (conn->shm + conn->seg->snap);
+  conn->hash = (unsigned int *) (conn->shm + conn->seg->hash);
+
+  /* Changes are waited for relative to the blocks' state on connecting */
+  if(!(conn->chg_seen = (unsigned int *) calloc(PDS_GET_NSEQ(conn), sizeof(unsigned int))))
+  {
+    conn->conn_status |= PDS_CONN_SHMCONN_ERR;
+    return conn;
+  }
+
+  memcpy(conn->chg_seen, (void *) &PDS_BLOCK_CHG(conn, 0), (PDS_GET_NSEQ(conn) * sizeof(unsigned int)));
+
+  /* The segment's header & the tags' metadata are read-only.  N.B.: Failing
+     to protect them isn't fatal */
+  mprotect(conn->shm, conn->seg->values, PROT_READ);
 
   /* Finally set the connection status to OK */
   conn->conn_status = PDS_CONN_OK;
@@ -250,13 +668,26 @@ pdsconn* PDSconnect(key_t connkey)
 * Function to disconnect a client from the server                             *
 *                                                                             *
 * Pre-condition:  A valid server connection struct is passed to the function  *
-* Post-condition: The client program is disconnected from the server.  If an  *
-*                 error occurs a -1 is returned                               *
+* Post-condition: The server's replies to any in-flight async writes are      *
+*                 collected, then the client program is disconnected from the *
+*                 server.  If an error occurs a -1 is returned                *
 ******************************************************************************/
 int PDSdisconnect(pdsconn *conn)
 {
   if(conn)
   {
+    /* Collect the replies to any in-flight async writes, otherwise they
+       would stay in the message queue, as no one else can read them */
+    if(conn->wrreqs)
+    {
+      PDSwait_writes(conn);
+      free(conn->wrreqs);
+    }
+
+    /* Free the block change counters seen */
+    if(conn->chg_seen)
+      free(conn->chg_seen);
+
     /* Detach from the server's shared memory segment */
     if(shmdt(conn->shm) == -1)
     {
@@ -285,34 +716,30 @@ int PDSdisconnect(pdsconn *conn)
 int PDSget_tag(pdsconn *conn, const char *tagname, char *tagvalue)
 {
   pdstag *tag = NULL;
-  int len = strlen(tagname), retval = -1, i = 0;
+  int retval = -1;
+  unsigned short int value = 0, status = 0;
 
   if(conn)
   {
     conn->plc_status = 0;
     if(tagvalue) tagvalue[0] = '\0';
 
-    /* Attempt to hold the semaphore */ 
-    if(_semset(conn->semid, PDS_SEMHLD, 0) != -1)
+    /* Attempt to hold the shared memory */ 
+    if(_hold_shm(conn) != -1)
     { 
-      /* Search for tagname ensuring string is not just a substring of tag */
-      for(tag = conn->data, i = 0; tag && i < conn->ttags; tag++, i++)
+      /* Lookup the tagname in the index */
+      if((tag = _find_tag(conn, tagname)))
       {
-        if(memcmp(tag->name, tagname, len) == 0)
-        {
-          if(len == strlen(tag->name)) 
-          {
-            /* Copy value into string and set the query's status */
-            sprintf(tagvalue, "%u", tag->value);
-            conn->plc_status |= tag->status;
-
-            retval = 0;
-            break;
-          }
-        }
+        _copy_tag_data(conn, tag, 1, &value, &status);
+
+        /* Copy value into string and set the query's status */
+        sprintf(tagvalue, "%u", value);
+        conn->plc_status |= status;
+
+        retval = 0;
       }
-      /* Release the semaphore */
-      _semset(conn->semid, PDS_SEMREL, 0);
+      /* Release the shared memory */
+      _release_shm(conn);
     }
   }
 
@@ -341,14 +768,14 @@ int PDSget_tagf(pdsconn *conn, const char *tagname, char *tagvalue,
   {
     conn->plc_status = 0;
 
-    /* Attempt to hold the semaphore */ 
-    if(_semset(conn->semid, PDS_SEMHLD, 0) != -1)
+    /* Attempt to hold the shared memory */ 
+    if(_hold_shm(conn) != -1)
     { 
       /* Get this tag's data (formatted) */
       retval = _get_strtagf(conn, tagname, 1, tagvalue, fmt);
 
-      /* Release the semaphore */
-      _semset(conn->semid, PDS_SEMREL, 0);
+      /* Release the shared memory */
+      _release_shm(conn);
     }
   }
 
@@ -381,14 +808,14 @@ int PDSget_strtag(pdsconn *conn, const char *tagname, int ntags,
   {
     conn->plc_status = 0;
 
-    /* Attempt to hold the semaphore */ 
-    if(_semset(conn->semid, PDS_SEMHLD, 0) != -1)
+    /* Attempt to hold the shared memory */ 
+    if(_hold_shm(conn) != -1)
     { 
       /* Get this tag's data (formatted) */
       retval = _get_strtagf(conn, tagname, ntags, tagvalue, fmt);
 
-      /* Release the semaphore */
-      _semset(conn->semid, PDS_SEMREL, 0);
+      /* Release the shared memory */
+      _release_shm(conn);
     }
   }
 
@@ -409,47 +836,16 @@ int PDSget_strtag(pdsconn *conn, const char *tagname, int ntags,
 int PDSset_tag(pdsconn *conn, const char *tagname, short int ntags,
                const unsigned short int *tagvalues)
 {
-  int msgsize = (sizeof(pdsmsg) - sizeof(long int));
-  long int msgtype = 0;
-  pdsmsg msg;
-  int nbytes = 0, retval = -1;
+  pdstag *tag = NULL;
+  int retval = -1;
 
   if(conn)
   {
-    memset(&msg, 0, sizeof(pdsmsg));
     conn->plc_status = 0;
 
-    /* Set up the message queue struct */
-    msg.msgtype = PDS_WRMSG;
-    strncpy(msg.tag.name, tagname, PDS_TAGNAME_LEN - 1);
-    msg.ntags = ntags;
-    memcpy(msg.tagvalues, tagvalues, (ntags * sizeof(unsigned short int)));
-
-    if(PDSget_tag_status(conn, tagname, &conn->plc_status) != -1)
-    {
-      /* Only write data to PLC if PLC is ONLINE */
-      if((PDS_CHECK_PLC_STATUS(conn) & PDS_PLC_OFFLINE) != PDS_PLC_OFFLINE)
-      {
-        /* Send the message */
-        if((nbytes = msgsnd(conn->msgid, (void *) &msg, msgsize, 0)) != -1)
-        {
-          memset(&msg, 0, sizeof(pdsmsg));
-          msgtype = PDS_WRMSG_RESP;
-
-          /* Receive the server's response (status word is set) */
-          nbytes = msgrcv(conn->msgid, (void *) &msg, msgsize, msgtype, 0);
-
-          if(nbytes == msgsize)
-          {
-            retval = 0;
-
-            /* Return to the client the status of the PLC as returned by the 
-               server */
-            conn->plc_status = msg.tag.status;
-          }
-        }
-      }
-    }
+    /* Lookup the tagname in the index */
+    if((tag = _find_tag(conn, tagname)))
+      retval = _write_tag(conn, tag, ntags, tagvalues);
   }
 
   return retval;
@@ -541,8 +937,8 @@ int PDSget_taglist(pdsconn *conn, plctaglist *taglist)
   {
     conn->plc_status = 0;
 
-    /* Attempt to hold the semaphore */ 
-    if(_semset(conn->semid, PDS_SEMHLD, 0) != -1)
+    /* Attempt to hold the shared memory */ 
+    if(_hold_shm(conn) != -1)
     { 
       /* Cycle through the taglist and get each tag's value (formatted) */
       for(i = 0, x = 0, tag = taglist->tags; i < taglist->ntags; i++, tag++) 
@@ -557,8 +953,8 @@ int PDSget_taglist(pdsconn *conn, plctaglist *taglist)
           break;
         }
       }
-      /* Release the semaphore */
-      _semset(conn->semid, PDS_SEMREL, 0);
+      /* Release the shared memory */
+      _release_shm(conn);
     }
   }
 
@@ -661,28 +1057,21 @@ int PDSget_tag_status(pdsconn *conn, const char *tagname,
                       unsigned short int *status)
 {
   pdstag *tag = NULL;
-  int len = strlen(tagname), retval = -1, i = 0;
+  int retval = -1;
 
   if(conn)
   {
-    /* Attempt to hold the semaphore */ 
-    if(_semset(conn->semid, PDS_SEMHLD, 0) != -1)
+    /* Attempt to hold the shared memory */ 
+    if(_hold_shm(conn) != -1)
     { 
-      /* Search for tagname ensuring string is not just a substring of tag */
-      for(tag = conn->data, i = 0; tag && i < conn->ttags; tag++, i++)
+      /* Lookup the tagname in the index */
+      if((tag = _find_tag(conn, tagname)))
       {
-        if(memcmp(tag->name, tagname, len) == 0)
-        {
-          if(len == strlen(tag->name)) 
-          {
-            *status |= tag->status;
-            retval = 0;
-            break;
-          }
-        }
+        *status |= PDS_TAG_STATUS(conn, tag);
+        retval = 0;
       }
-      /* Release the semaphore */
-      _semset(conn->semid, PDS_SEMREL, 0);
+      /* Release the shared memory */
+      _release_shm(conn);
     }
   }
 
@@ -912,28 +1301,623 @@ int _default_print_footer(FILE *os, pdsconn *conn, void *aux)
 pdstag* PDSget_tag_object(pdsconn *conn, const char *tagname)
 {
   pdstag *tag = NULL;
-  int len = strlen(tagname), found = 0, i = 0;
 
   if(conn)
   {
-    /* Get a pointer to the start of the data tags */
-    if((tag = PDSconn_get_data(conn)))
-    {
-      /* Search for tagname ensuring string is not just a substring of tag */
-      for(i = 0; i < PDSconn_get_ttags(conn) && tag; i++, tag++)
-      {
-        if(memcmp(tag->name, tagname, len) == 0)
-        {
-          if(len == strlen(tag->name)) 
-          {
-            found = 1;
-            break;
-          }
-        }
-      }
-    }
+    /* Lookup the tagname in the index */
+    tag = _find_tag(conn, tagname);
   }
 
-  return (pdstag *) found ? tag : NULL;
+  return tag;
 }
 
+
+
+/******************************************************************************
+* Function to resolve a tagname to a handle                                   *
+*                                                                             *
+* Pre-condition:  A valid server connection & the tagname to resolve are      *
+*                 passed to the function                                      *
+* Post-condition: The tagname is looked up once & a handle to the tag is      *
+*                 returned, for use with the handle-based functions.  The     *
+*                 handle remains valid for the life of the connection.  On    *
+*                 error PDS_HANDLE_INVALID is returned                        *
+******************************************************************************/
+pdshandle PDSresolve_tag(pdsconn *conn, const char *tagname)
+{
+  pdstag *tag = NULL;
+  int i = 0;
+
+  if(conn)
+  {
+    if((tag = _find_tag(conn, tagname)))
+    {
+      /* The handle can only address so many tags */
+      if((i = (tag - conn->data)) <= PDS_HANDLE_INDEX_MASK)
+        return PDS_MAKE_HANDLE(conn->gen, i);
+    }
+  }
+
+  return PDS_HANDLE_INVALID;
+}
+
+
+
+/******************************************************************************
+* Function to get a tag's raw value & status via its handle                   *
+*                                                                             *
+* Pre-condition:  A valid server connection, the tag's handle & storage for   *
+*                 the tag's value & status are passed to the function         *
+* Post-condition: The tag is accessed directly in the shared memory segment   *
+*                 & its value & status are stored in hvalue & hstatus.  The   *
+*                 connection's PLC status is also set.  On error a -1 is      *
+*                 returned                                                    *
+******************************************************************************/
+int PDSget_tag_h(pdsconn *conn, pdshandle h, unsigned short int *hvalue,
+                 unsigned short int *hstatus)
+{
+  pdstag *tag = NULL;
+  unsigned short int value = 0, status = 0;
+  int retval = -1;
+
+  if(conn)
+  {
+    conn->plc_status = 0;
+
+    if((tag = _get_handle_tag(conn, h)))
+    {
+      /* Attempt to hold the shared memory */ 
+      if(_hold_shm(conn) != -1)
+      { 
+        _copy_tag_data(conn, tag, 1, &value, &status);
+
+        /* Release the shared memory */
+        _release_shm(conn);
+
+        if(hvalue) *hvalue = value;
+        if(hstatus) *hstatus = status;
+        conn->plc_status |= status;
+
+        retval = 0;
+      }
+    }
+  }
+
+  return retval;
+}
+
+
+
+/******************************************************************************
+* Function to set tag value(s) via the (base) tag's handle                    *
+*                                                                             *
+* Pre-condition:  A valid server connection, the (base) tag's handle, the     *
+*                 number of tagvalues & the tagvalues are passed to the       *
+*                 function                                                    *
+* Post-condition: The tagvalues are written to the PLC.  The connection's PLC *
+*                 status is set from the server's response.  On error a -1 is *
+*                 returned                                                    *
+******************************************************************************/
+int PDSset_tag_h(pdsconn *conn, pdshandle h, short int ntags,
+                 const unsigned short int *tagvalues)
+{
+  pdstag *tag = NULL;
+  int retval = -1;
+
+  if(conn)
+  {
+    conn->plc_status = 0;
+
+    if((tag = _get_handle_tag(conn, h)))
+      retval = _write_tag(conn, tag, ntags, tagvalues);
+  }
+
+  return retval;
+}
+
+
+
+/******************************************************************************
+* Function to set tag value(s) asynchronously                                 *
+*                                                                             *
+* Pre-condition:  A valid server connection, the base tagname, the no. of     *
+*                 tags to write and the tag value(s) are passed to the        *
+*                 function                                                    *
+* Post-condition: A message is sent to the server requesting that the tag     *
+*                 value(s) be written to the PLC, without waiting for the     *
+*                 write to complete.  The write's request ID is returned, for *
+*                 use with PDSpoll_write().  On error a -1 is returned        *
+******************************************************************************/
+int PDSset_tag_async(pdsconn *conn, const char *tagname, short int ntags,
+                     const unsigned short int *tagvalues)
+{
+  pdstag *tag = NULL;
+  int retval = -1;
+
+  if(conn)
+  {
+    conn->plc_status = 0;
+
+    /* Lookup the tagname in the index */
+    if((tag = _find_tag(conn, tagname)))
+      retval = _write_tag_async(conn, tag, ntags, tagvalues);
+  }
+
+  return retval;
+}
+
+
+
+/******************************************************************************
+* Function to set tag value(s) asynchronously via the (base) tag's handle     *
+*                                                                             *
+* Pre-condition:  A valid server connection, the (base) tag's handle, the     *
+*                 number of tagvalues & the tagvalues are passed to the       *
+*                 function                                                    *
+* Post-condition: A message is sent to the server requesting that the tag     *
+*                 value(s) be written to the PLC, without waiting for the     *
+*                 write to complete.  The write's request ID is returned, for *
+*                 use with PDSpoll_write().  On error a -1 is returned        *
+******************************************************************************/
+int PDSset_tag_h_async(pdsconn *conn, pdshandle h, short int ntags,
+                       const unsigned short int *tagvalues)
+{
+  pdstag *tag = NULL;
+  int retval = -1;
+
+  if(conn)
+  {
+    conn->plc_status = 0;
+
+    if((tag = _get_handle_tag(conn, h)))
+      retval = _write_tag_async(conn, tag, ntags, tagvalues);
+  }
+
+  return retval;
+}
+
+
+
+/******************************************************************************
+* Function to poll for the completion of an asynchronous write                *
+*                                                                             *
+* Pre-condition:  A valid server connection, the write's request ID & storage *
+*                 for the write's PLC status are passed to the function       *
+* Post-condition: Any replies that have arrived are collected without         *
+*                 waiting.  If the write has completed, its PLC status is     *
+*                 stored in wrstatus & a 1 is returned.  The write can then   *
+*                 no longer be polled.  If the write is still in flight a 0   *
+*                 is returned.  If the request ID is unknown a -1 is returned *
+******************************************************************************/
+int PDSpoll_write(pdsconn *conn, int reqid, unsigned short int *wrstatus)
+{
+  pdswrreq *req = NULL;
+  unsigned short int status = 0;
+  int retval = -1;
+
+  if(conn && conn->wrreqs && reqid > 0)
+  {
+    /* Collect any replies that have already arrived */
+    while(conn->wr_npending > 0)
+    {
+      if(_collect_write_reply(conn, IPC_NOWAIT, &status) == -1)
+        break;
+    }
+
+    req = &conn->wrreqs[PDS_WRREQ_SLOT(reqid)];
+
+    if(req->reqid == reqid)
+    {
+      if(req->state == PDS_WRREQ_DONE)
+      {
+        *wrstatus = req->status;
+        conn->plc_status = req->status;
+        req->state = PDS_WRREQ_FREE;
+        retval = 1;
+      }
+      else if(req->state == PDS_WRREQ_PENDING)
+        retval = 0;
+    }
+  }
+
+  return retval;
+}
+
+
+
+/******************************************************************************
+* Function to wait for all asynchronous writes to complete                    *
+*                                                                             *
+* Pre-condition:  A valid server connection is passed to the function         *
+* Post-condition: The server's replies to all this client's in-flight writes  *
+*                 are collected.  Their statuses can then be collected with   *
+*                 PDSpoll_write().  On error a -1 is returned                 *
+******************************************************************************/
+int PDSwait_writes(pdsconn *conn)
+{
+  unsigned short int status = 0;
+  int retval = -1;
+
+  if(conn)
+  {
+    retval = 0;
+
+    while(conn->wr_npending > 0)
+    {
+      if(_collect_write_reply(conn, 0, &status) == -1)
+      {
+        retval = -1;
+        break;
+      }
+    }
+  }
+
+  return retval;
+}
+
+
+
+/******************************************************************************
+* Function to wait for a change to any of the given tags                      *
+*                                                                             *
+* Pre-condition:  A valid server connection, an array of tag handles, the no. *
+*                 of handles & a timeout (in usecs, or PDS_WAIT_FOREVER) are  *
+*                 passed to the function                                      *
+* Post-condition: The caller sleeps until the server refreshes any of the     *
+*                 tags' blocks with a changed value or status, since the      *
+*                 last time that block was reported by this function (or      *
+*                 since connecting).  The no. of changed blocks is returned.  *
+*                 If the timeout expires or a signal is caught, a 0 is        *
+*                 returned.  On error a -1 is returned                        *
+******************************************************************************/
+int PDSwait_for_change(pdsconn *conn, const pdshandle *handles, int n,
+                       long timeout)
+{
+  pdstag *tag = NULL;
+  struct timespec deadline, now, remaining, *tmo = NULL;
+  unsigned int chg = 0, block_chg = 0;
+  register int i = 0;
+  int nchanged = 0;
+
+  if(!conn || !conn->chg_seen || !handles || n < 1)
+    return -1;
+
+  if(timeout >= 0)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (timeout / 1000000L);
+    deadline.tv_nsec += ((timeout % 1000000L) * 1000L);
+
+    if(deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+
+    tmo = &remaining;
+  }
+
+  /* N.B.: The server only makes the wake syscall whilst a client waits.  As
+           the atomic add is a full barrier, either the server sees this
+           client waiting, or this client sees the server's change */
+  __sync_fetch_and_add(&conn->chg[PDS_CHG_WAITERS], 1);
+
+  while(1)
+  {
+    /* Snapshot the segment-wide counter before checking the blocks, so that
+       a change after the check makes the wait return immediately */
+    chg = conn->chg[PDS_CHG_FUTEX];
+    PDS_SEQ_BARRIER();
+
+    for(i = 0; i < n; i++)
+    {
+      if(!(tag = _get_handle_tag(conn, handles[i])))
+      {
+        nchanged = -1;
+        break;
+      }
+
+      if((block_chg = PDS_BLOCK_CHG(conn, tag->block_id)) != conn->chg_seen[tag->block_id])
+      {
+        conn->chg_seen[tag->block_id] = block_chg;
+        nchanged++;
+      }
+    }
+
+    if(nchanged != 0)
+      break;
+
+    if(tmo)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+
+      remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+      remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+
+      if(remaining.tv_nsec < 0)
+      {
+        remaining.tv_sec--;
+        remaining.tv_nsec += 1000000000L;
+      }
+
+      /* The timeout has expired */
+      if(remaining.tv_sec < 0 || (remaining.tv_sec == 0 && remaining.tv_nsec == 0))
+        break;
+    }
+
+    /* Sleep until the segment-wide counter moves on from our snapshot.  A
+       change to a block that isn't being watched just loops round again */
+    if(PDS_CHG_WAIT(&conn->chg[PDS_CHG_FUTEX], chg, tmo) == -1 && errno == EINTR)
+      break;
+  }
+
+  __sync_fetch_and_sub(&conn->chg[PDS_CHG_WAITERS], 1);
+
+  return nchanged;
+}
+
+
+
+/******************************************************************************
+* Function to get the sequence no. of the latest change                       *
+*                                                                             *
+* Pre-condition:  A valid server connection is passed to the function         *
+* Post-condition: The sequence no. of the last change appended to the change  *
+*                 journal is returned.  A client that mirrors the tags gets   *
+*                 this before copying them, & can then read only the changes  *
+*                 since.  If an error occurs a 0 is returned                  *
+******************************************************************************/
+unsigned long long PDSget_change_seq(pdsconn *conn)
+{
+  if(!conn || !conn->jseq)
+    return 0;
+
+  return *conn->jseq;
+}
+
+
+
+/******************************************************************************
+* Function to get the changes to the tags since a given sequence no.          *
+*                                                                             *
+* Pre-condition:  A valid server connection, the sequence no. of the last     *
+*                 change seen, a buffer & the max. no. of changes to store in *
+*                 it are passed to the function                               *
+* Post-condition: The oldest changes after the given sequence no. are copied  *
+*                 into the buffer, in order, & the no. of changes copied is   *
+*                 returned (0 if there are none).  If the journal has         *
+*                 overwritten changes that the client hasn't seen, then       *
+*                 PDS_JOURNAL_OVERRUN is returned & the client must copy the  *
+*                 tags afresh.  If an error occurs a -1 is returned           *
+******************************************************************************/
+int PDSget_changes_since(pdsconn *conn, unsigned long long seq,
+                         pdschange *buf, int n)
+{
+  volatile pdschange *rec = NULL;
+  unsigned long long last = 0, next = 0;
+  register int i = 0;
+
+  if(!conn || !conn->journal || !buf || n < 1)
+    return -1;
+
+  last = *conn->jseq;
+  PDS_SEQ_BARRIER();
+
+  /* A sequence no. from the future can't have come from this journal */
+  if(seq > last)
+    return -1;
+
+  /* The oldest change not seen has already been overwritten */
+  if((last - seq) > conn->njournal)
+    return PDS_JOURNAL_OVERRUN;
+
+  for(i = 0, next = seq + 1; i < n && next <= last; i++, next++)
+  {
+    rec = &conn->journal[PDS_JOURNAL_SLOT(next, conn->njournal)];
+
+    /* The record is either still being written, in which case stop here &
+       pick it up next time, or has been reused for a later change */
+    if(rec->seq != next)
+    {
+      if((*conn->jseq - next) >= conn->njournal)
+        return PDS_JOURNAL_OVERRUN;
+
+      break;
+    }
+
+    PDS_SEQ_BARRIER();
+
+    buf[i].seq = next;
+    buf[i].id = rec->id;
+    buf[i].value = rec->value;
+    buf[i].status = rec->status;
+    buf[i].mtime = rec->mtime;
+
+    PDS_SEQ_BARRIER();
+
+    /* The record was reused whilst it was being copied */
+    if(rec->seq != next)
+      return PDS_JOURNAL_OVERRUN;
+  }
+
+  return i;
+}
+
+
+
+/******************************************************************************
+* Internal function to get a tag's history descriptor                         *
+*                                                                             *
+* Pre-condition:  A valid server connection & a pointer to the tag in shared  *
+*                 memory are passed to the function                           *
+* Post-condition: A pointer to the tag's block's history descriptor is        *
+*                 returned.  If the tag isn't a data tag, or its block has no *
+*                 history, a null is returned                                 *
+******************************************************************************/
+static pdshist* _get_tag_hist(pdsconn *conn, pdstag *tag)
+{
+  pdshist *hist = NULL;
+
+  /* Only data blocks have histories */
+  if(!conn->hist || tag->block_id >= conn->nblocks)
+    return NULL;
+
+  hist = &conn->hist[tag->block_id];
+
+  return (hist->depth > 0) ? hist : NULL;
+}
+
+
+
+/******************************************************************************
+* Function to get a tag's sample history                                      *
+*                                                                             *
+* Pre-condition:  A valid server connection, the tag's handle, a buffer & the *
+*                 max. no. of samples to store in it are passed to the        *
+*                 function                                                    *
+* Post-condition: The tag's latest samples (up to the max.) are copied into   *
+*                 the buffer, oldest first, & the no. of samples copied is    *
+*                 returned.  If the tag's block has no history, a 0 is        *
+*                 returned.  If an error occurs a -1 is returned              *
+******************************************************************************/
+int PDSget_tag_history(pdsconn *conn, pdshandle h, pdssample *buf, int n)
+{
+  pdstag *tag = NULL;
+  pdshist *hist = NULL;
+  volatile pdssample *ring = NULL;
+  unsigned int count = 0, last = 0, next = 0, stale = 0;
+  register int i = 0, m = 0;
+
+  if(!conn || !buf || n < 1 || !(tag = _get_handle_tag(conn, h)))
+    return -1;
+
+  if(!(hist = _get_tag_hist(conn, tag)))
+    return 0;
+
+  ring = PDS_HIST_TAG_SAMPLES(conn, hist, tag);
+
+  count = hist->count;
+  PDS_SEQ_BARRIER();
+
+  /* The oldest sample in the ring may be being overwritten by the next, so
+     at most depth - 1 samples can be copied */
+  m = (count < (hist->depth - 1)) ? count : (hist->depth - 1);
+  m = (m < n) ? m : n;
+
+  for(i = 0, next = (count - m); i < m; i++, next++)
+  {
+    buf[i].mtime_ns = ring[PDS_HIST_SLOT(next, hist->depth)].mtime_ns;
+    buf[i].value = ring[PDS_HIST_SLOT(next, hist->depth)].value;
+    buf[i].status = ring[PDS_HIST_SLOT(next, hist->depth)].status;
+  }
+
+  PDS_SEQ_BARRIER();
+  last = hist->count;
+
+  /* Drop any samples that were overwritten whilst being copied */
+  if((last - (count - m)) > (hist->depth - 1))
+  {
+    stale = (last - (count - m)) - (hist->depth - 1);
+
+    if(stale >= (unsigned int) m)
+      return 0;
+
+    memmove(buf, &buf[stale], ((m - stale) * sizeof(pdssample)));
+    m -= stale;
+  }
+
+  return m;
+}
+
+
+
+/******************************************************************************
+* Function to get a tag's sample history ring, for reading in place           *
+*                                                                             *
+* Pre-condition:  A valid server connection, the tag's handle & storage for   *
+*                 the ring's depth are passed to the function                 *
+* Post-condition: A pointer to the tag's ring of samples in shared memory is  *
+*                 returned & its depth stored.  The ring is indexed by        *
+*                 PDS_HIST_SLOT(n, depth), where n is a sample's no.  The     *
+*                 oldest sample in the ring may be being overwritten.  If the *
+*                 tag's block has no history or an error occurs, a null is    *
+*                 returned                                                    *
+******************************************************************************/
+const pdssample* PDSget_tag_history_ring(pdsconn *conn, pdshandle h,
+                                        int *depth)
+{
+  pdstag *tag = NULL;
+  pdshist *hist = NULL;
+
+  if(!conn || !(tag = _get_handle_tag(conn, h)) || !(hist = _get_tag_hist(conn, tag)))
+    return NULL;
+
+  if(depth)
+    *depth = hist->depth;
+
+  return (const pdssample *) PDS_HIST_TAG_SAMPLES(conn, hist, tag);
+}
+
+
+
+/******************************************************************************
+* Function to get the no. of samples taken of a tag                           *
+*                                                                             *
+* Pre-condition:  A valid server connection & the tag's handle are passed to  *
+*                 the function                                                *
+* Post-condition: The no. of samples taken of the tag's block is returned, so *
+*                 the latest sample is no. count - 1 (modulo 2^32).  If the   *
+*                 tag's block has no history or an error occurs, a 0 is       *
+*                 returned                                                    *
+******************************************************************************/
+unsigned int PDSget_tag_history_count(pdsconn *conn, pdshandle h)
+{
+  pdstag *tag = NULL;
+  pdshist *hist = NULL;
+
+  if(!conn || !(tag = _get_handle_tag(conn, h)) || !(hist = _get_tag_hist(conn, tag)))
+    return 0;
+
+  return hist->count;
+}
+
+
+
+/******************************************************************************
+* Function to get a consistent snapshot of all the tags                       *
+*                                                                             *
+* Pre-condition:  A valid server connection & storage for the image, of at    *
+*                 least PDS_IMAGE_LEN(ttags) bytes, are passed to the         *
+*                 function                                                    *
+* Post-condition: The latest snapshot published by the server is copied into  *
+*                 the image, without taking any locks.  All of the tags'      *
+*                 values & statuses in the image were taken at the same       *
+*                 time, so are consistent across blocks.  The image's values  *
+*                 & statuses are indexed by tag ID.  The no. of tags in the   *
+*                 image is returned.  If no snapshot has been published yet,  *
+*                 a 0 is returned.  If an error occurs a -1 is returned       *
+******************************************************************************/
+int PDSsnapshot(pdsconn *conn, pdsimage *image)
+{
+  unsigned int epoch = 0;
+
+  if(!conn || !conn->snap || !image)
+    return -1;
+
+  /* The server only overwrites a snapshot after publishing the next, so the
+     copy is only retried if a snapshot was published whilst copying */
+  do
+  {
+    if((epoch = *conn->snap) == 0)
+      return 0;
+
+    PDS_SEQ_BARRIER();
+
+    memcpy(image, PDS_SNAP_IMAGE(conn, epoch), PDS_IMAGE_LEN(conn->ttags));
+
+    PDS_SEQ_BARRIER();
+  }
+  while(*conn->snap != epoch);
+
+  return image->ntags;
+}
@@ -269,6 +269,348 @@ int pds_tcl_set_tag(ClientData cData, Tcl_Interp *interp, int argc,
 
 
 
+/******************************************************************************
+* Function to resolve a tagname to a handle                                   *
+*                                                                             *
+* Pre-condition:  The standard Tcl function parameters are passed to the      *
+*                 function                                                    *
+* Post-condition: The tag's handle is returned.  If an error occurs a stack   *
+*                 trace is produced and a TCL_ERROR is returned               *
+******************************************************************************/
+int pds_tcl_resolve_tag(ClientData cData, Tcl_Interp *interp, int argc,
+                        char *argv[])
+{
+  pdshandle h = PDS_HANDLE_INVALID;
+  char retstr[16] = "\0";
+  pdsconn *conn = NULL;
+  pdsconn_id *connid = NULL;
+
+  if(argc != 3)
+  {
+    Tcl_AppendResult(interp, "pdsresolve_tag: wrong # of arguments\n", "pdsresolve_tag conn tagname", (char *) NULL);
+    return TCL_ERROR;
+  }
+
+  if((conn = (pdsconn *) pdsGetConnectionId(interp, argv[1], &connid)))
+  {
+    /* Call the 'C' API function to resolve the tag's handle */
+    if((h = PDSresolve_tag(conn, argv[2])) == PDS_HANDLE_INVALID)
+    {
+      Tcl_AppendResult(interp, "pdsresolve_tag: error resolving handle for ", argv[2], (char *) NULL);
+      return TCL_ERROR;
+    }
+    else
+    {
+      sprintf(retstr, "%d", h);
+      Tcl_ResetResult(interp);
+      Tcl_AppendResult(interp, retstr, (char *) NULL);
+      return TCL_OK;
+    }
+  }
+  else
+  {
+    Tcl_AppendResult(interp, "pdsresolve_tag: error getting PDS connection", " from ID ", argv[1], (char *) NULL);
+    return TCL_ERROR;
+  }
+}
+
+
+
+/******************************************************************************
+* Function to get a tag's value & status via its handle                       *
+*                                                                             *
+* Pre-condition:  The standard Tcl function parameters are passed to the      *
+*                 function                                                    *
+* Post-condition: The tag's value & status are returned as a list.  If an     *
+*                 error occurs a stack trace is produced and a TCL_ERROR is   *
+*                 returned                                                    *
+******************************************************************************/
+int pds_tcl_get_tag_h(ClientData cData, Tcl_Interp *interp, int argc,
+                      char *argv[])
+{
+  int h = PDS_HANDLE_INVALID;
+  unsigned short int value = 0, status = 0;
+  char retstr[16] = "\0";
+  pdsconn *conn = NULL;
+  pdsconn_id *connid = NULL;
+
+  if(argc != 3)
+  {
+    Tcl_AppendResult(interp, "pdsget_tag_h: wrong # of arguments\n", "pdsget_tag_h conn handle", (char *) NULL);
+    return TCL_ERROR;
+  }
+
+  /* Get the handle arg */
+  if((Tcl_GetInt(interp, argv[2], &h) != TCL_OK)) 
+  {
+    Tcl_AppendResult(interp, "pdsget_tag_h: error getting handle as an int ", (char *) NULL);
+    return TCL_ERROR;
+  }
+
+  if((conn = (pdsconn *) pdsGetConnectionId(interp, argv[1], &connid)))
+  {
+    /* Call the 'C' API function to get a tag's value & status */
+    if(PDSget_tag_h(conn, h, &value, &status) == -1)
+    {
+      Tcl_AppendResult(interp, "pdsget_tag_h: error getting value for handle ", argv[2], (char *) NULL);
+      return TCL_ERROR;
+    }
+    else
+    {
+      Tcl_ResetResult(interp);
+      sprintf(retstr, "%u", value);
+      Tcl_AppendElement(interp, retstr);
+      sprintf(retstr, "%u", status);
+      Tcl_AppendElement(interp, retstr);
+      return TCL_OK;
+    }
+  }
+  else
+  {
+    Tcl_AppendResult(interp, "pdsget_tag_h: error getting PDS connection", " from ID ", argv[1], (char *) NULL);
+    return TCL_ERROR;
+  }
+}
+
+
+
+/******************************************************************************
+* Function to set tag value(s) via the (base) tag's handle                    *
+*                                                                             *
+* Pre-condition:  The standard Tcl function parameters are passed to the      *
+*                 function                                                    *
+* Post-condition: The tag value(s) is set in the PLC.  If an error occurs a   *
+*                 stack trace is produced and a TCL_ERROR is returned         *
+******************************************************************************/
+int pds_tcl_set_tag_h(ClientData cData, Tcl_Interp *interp, int argc,
+                      char *argv[])
+{
+  int h = PDS_HANDLE_INVALID, ntags = 0, retval = -1, tagvalue = 0;
+  register int i = 0;
+  unsigned short int tagvalues[PDS_NTAGVALUES];
+  char retstr[5] = "\0";
+  pdsconn *conn = NULL;
+  pdsconn_id *connid = NULL;
+
+  memset(tagvalues, 0, (PDS_NTAGVALUES * sizeof(unsigned short int)));
+
+  if(argc < 4)
+  {
+    Tcl_AppendResult(interp, "pdsset_tag_h: wrong # of arguments\n", "pdsset_tag_h conn handle tagvalue [tagvalue ...]", (char *) NULL);
+    return TCL_ERROR;
+  }
+
+  /* Get the handle arg */
+  if((Tcl_GetInt(interp, argv[2], &h) != TCL_OK)) 
+  {
+    Tcl_AppendResult(interp, "pdsset_tag_h: error getting handle as an int ", (char *) NULL);
+    return TCL_ERROR;
+  }
+
+  /* Get the variable number of tagvalues */
+  for(i = 3, ntags = 0; i < argc && (i - 3) < PDS_NTAGVALUES; i++)
+  {
+    if((Tcl_GetInt(interp, argv[i], &tagvalue) != TCL_OK)) 
+    {
+      Tcl_AppendResult(interp, "pdsset_tag_h: error getting tagvalue as an int ", (char *) NULL);
+      return TCL_ERROR;
+    }
+    tagvalues[ntags++] = (unsigned short int) tagvalue;
+  }
+
+  if((conn = (pdsconn *) pdsGetConnectionId(interp, argv[1], &connid)))
+  {
+    /* Call the 'C' API function to set tag value(s) */
+    if((retval = PDSset_tag_h(conn, h, ntags, tagvalues)) == -1)
+    {
+      Tcl_AppendResult(interp, "pdsset_tag_h: error setting value for handle ", argv[2], (char *) NULL);
+      return TCL_ERROR;
+    }
+    else
+    {
+      sprintf(retstr, "%d", retval);
+      Tcl_ResetResult(interp);
+      Tcl_AppendResult(interp, retstr, (char *) NULL);
+      return TCL_OK;
+    }
+  }
+  else
+  {
+    Tcl_AppendResult(interp, "pdsset_tag_h: error getting PDS connection", " from ID ", argv[1], (char *) NULL);
+    return TCL_ERROR;
+  }
+}
+
+
+
+/******************************************************************************
+* Function to set tag value(s) asynchronously                                 *
+*                                                                             *
+* Pre-condition:  The standard Tcl function parameters are passed to the      *
+*                 function                                                    *
+* Post-condition: The write is sent to the server & its request ID is         *
+*                 returned.  If an error occurs a stack trace is produced and *
+*                 a TCL_ERROR is returned                                     *
+******************************************************************************/
+int pds_tcl_set_tag_async(ClientData cData, Tcl_Interp *interp, int argc,
+                          char *argv[])
+{
+  int ntags = 0, reqid = -1, tagvalue = 0;
+  register int i = 0;
+  unsigned short int tagvalues[PDS_NTAGVALUES];
+  char retstr[16] = "\0";
+  pdsconn *conn = NULL;
+  pdsconn_id *connid = NULL;
+
+  memset(tagvalues, 0, (PDS_NTAGVALUES * sizeof(unsigned short int)));
+
+  if(argc < 4)
+  {
+    Tcl_AppendResult(interp, "pdsset_tag_async: wrong # of arguments\n", "pdsset_tag_async conn tagname tagvalue [tagvalue ...]", (char *) NULL);
+    return TCL_ERROR;
+  }
+
+  /* Get the variable number of tagvalues */
+  for(i = 3, ntags = 0; i < argc && (i - 3) < PDS_NTAGVALUES; i++)
+  {
+    if((Tcl_GetInt(interp, argv[i], &tagvalue) != TCL_OK)) 
+    {
+      Tcl_AppendResult(interp, "pdsset_tag_async: error getting tagvalue as an int ", (char *) NULL);
+      return TCL_ERROR;
+    }
+    tagvalues[ntags++] = (unsigned short int) tagvalue;
+  }
+
+  if((conn = (pdsconn *) pdsGetConnectionId(interp, argv[1], &connid)))
+  {
+    /* Call the 'C' API function to set tag value(s) asynchronously */
+    if((reqid = PDSset_tag_async(conn, argv[2], ntags, tagvalues)) == -1)
+    {
+      Tcl_AppendResult(interp, "pdsset_tag_async: error setting value for ", argv[2], (char *) NULL);
+      return TCL_ERROR;
+    }
+    else
+    {
+      sprintf(retstr, "%d", reqid);
+      Tcl_ResetResult(interp);
+      Tcl_AppendResult(interp, retstr, (char *) NULL);
+      return TCL_OK;
+    }
+  }
+  else
+  {
+    Tcl_AppendResult(interp, "pdsset_tag_async: error getting PDS connection", " from ID ", argv[1], (char *) NULL);
+    return TCL_ERROR;
+  }
+}
+
+
+
+/******************************************************************************
+* Function to poll for the completion of an asynchronous write                *
+*                                                                             *
+* Pre-condition:  The standard Tcl function parameters are passed to the      *
+*                 function                                                    *
+* Post-condition: Whether the write has completed & its PLC status are        *
+*                 returned as a list.  If an error occurs a stack trace is    *
+*                 produced and a TCL_ERROR is returned                        *
+******************************************************************************/
+int pds_tcl_poll_write(ClientData cData, Tcl_Interp *interp, int argc,
+                       char *argv[])
+{
+  int reqid = 0, retval = -1;
+  unsigned short int status = 0;
+  char retstr[16] = "\0";
+  pdsconn *conn = NULL;
+  pdsconn_id *connid = NULL;
+
+  if(argc != 3)
+  {
+    Tcl_AppendResult(interp, "pdspoll_write: wrong # of arguments\n", "pdspoll_write conn reqid", (char *) NULL);
+    return TCL_ERROR;
+  }
+
+  /* Get the request ID arg */
+  if((Tcl_GetInt(interp, argv[2], &reqid) != TCL_OK)) 
+  {
+    Tcl_AppendResult(interp, "pdspoll_write: error getting reqid as an int ", (char *) NULL);
+    return TCL_ERROR;
+  }
+
+  if((conn = (pdsconn *) pdsGetConnectionId(interp, argv[1], &connid)))
+  {
+    /* Call the 'C' API function to poll for the write's completion */
+    if((retval = PDSpoll_write(conn, reqid, &status)) == -1)
+    {
+      Tcl_AppendResult(interp, "pdspoll_write: unknown write request ", argv[2], (char *) NULL);
+      return TCL_ERROR;
+    }
+    else
+    {
+      Tcl_ResetResult(interp);
+      sprintf(retstr, "%d", retval);
+      Tcl_AppendElement(interp, retstr);
+      sprintf(retstr, "%u", status);
+      Tcl_AppendElement(interp, retstr);
+      return TCL_OK;
+    }
+  }
+  else
+  {
+    Tcl_AppendResult(interp, "pdspoll_write: error getting PDS connection", " from ID ", argv[1], (char *) NULL);
+    return TCL_ERROR;
+  }
+}
+
+
+
+/******************************************************************************
+* Function to wait for all asynchronous writes to complete                    *
+*                                                                             *
+* Pre-condition:  The standard Tcl function parameters are passed to the      *
+*                 function                                                    *
+* Post-condition: All in-flight writes have completed.  If an error occurs a  *
+*                 stack trace is produced and a TCL_ERROR is returned         *
+******************************************************************************/
+int pds_tcl_wait_writes(ClientData cData, Tcl_Interp *interp, int argc,
+                        char *argv[])
+{
+  int retval = -1;
+  char retstr[5] = "\0";
+  pdsconn *conn = NULL;
+  pdsconn_id *connid = NULL;
+
+  if(argc != 2)
+  {
+    Tcl_AppendResult(interp, "pdswait_writes: wrong # of arguments\n", "pdswait_writes conn", (char *) NULL);
+    return TCL_ERROR;
+  }
+
+  if((conn = (pdsconn *) pdsGetConnectionId(interp, argv[1], &connid)))
+  {
+    /* Call the 'C' API function to wait for all writes to complete */
+    if((retval = PDSwait_writes(conn)) == -1)
+    {
+      Tcl_AppendResult(interp, "pdswait_writes: error waiting for writes", (char *) NULL);
+      return TCL_ERROR;
+    }
+    else
+    {
+      sprintf(retstr, "%d", retval);
+      Tcl_ResetResult(interp);
+      Tcl_AppendResult(interp, retstr, (char *) NULL);
+      return TCL_OK;
+    }
+  }
+  else
+  {
+    Tcl_AppendResult(interp, "pdswait_writes: error getting PDS connection", " from ID ", argv[1], (char *) NULL);
+    return TCL_ERROR;
+  }
+}
+
+
+
 /******************************************************************************
 * Internal function to validate a tag's data format specifier                 *
 *                                                                             *
@@ -330,6 +672,18 @@ int Pds_tcl_Init(Tcl_Interp *interp)
 
   Tcl_CreateCommand(interp, "pdsset_tag", (Tcl_CmdProc *) pds_tcl_set_tag, (ClientData) 0, (Tcl_CmdDeleteProc *) NULL);
 
+  Tcl_CreateCommand(interp, "pdsresolve_tag", (Tcl_CmdProc *) pds_tcl_resolve_tag, (ClientData) 0, (Tcl_CmdDeleteProc *) NULL);
+
+  Tcl_CreateCommand(interp, "pdsget_tag_h", (Tcl_CmdProc *) pds_tcl_get_tag_h, (ClientData) 0, (Tcl_CmdDeleteProc *) NULL);
+
+  Tcl_CreateCommand(interp, "pdsset_tag_h", (Tcl_CmdProc *) pds_tcl_set_tag_h, (ClientData) 0, (Tcl_CmdDeleteProc *) NULL);
+
+  Tcl_CreateCommand(interp, "pdsset_tag_async", (Tcl_CmdProc *) pds_tcl_set_tag_async, (ClientData) 0, (Tcl_CmdDeleteProc *) NULL);
+
+  Tcl_CreateCommand(interp, "pdspoll_write", (Tcl_CmdProc *) pds_tcl_poll_write, (ClientData) 0, (Tcl_CmdDeleteProc *) NULL);
+
+  Tcl_CreateCommand(interp, "pdswait_writes", (Tcl_CmdProc *) pds_tcl_wait_writes, (ClientData) 0, (Tcl_CmdDeleteProc *) NULL);
+
   return TCL_OK;
 }
 
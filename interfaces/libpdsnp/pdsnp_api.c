@@ -8,192 +8,1546 @@
 
 #include "pdsnp_api.h"
 
+/******************************************************************************
+* Internal function to negotiate the protocol version with the server         *
+*                                                                             *
+* Pre-condition:  A valid server connection is passed to the function         *
+* Post-condition: The latest version this client speaks is offered to the     *
+*                 server, in a v1 frame, & the version to use is returned.  A *
+*                 v1 server doesn't know the function, so v1 is used.  On     *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+static int _negotiate_version(pdsconn *conn)
+{
+  pdscomms comms;
+  int ver = -1;
+
+  memset(&comms, 0, sizeof(pdscomms));
+
+  PDSNP_SET_BUF_LEN(comms.buf, PDSNP_LEN);
+  PDSNP_SET_VER(comms.buf, PDSNP_VER);
+  PDSNP_SET_FUNC_ID(comms.buf, PDSNP_VERSION_FUNC_ID);
+  PDSNP_SET_EX_CODE(comms.buf, PDSNP_COMMS_OK);
+
+  comms.conn = conn;
+
+  if(comms_write(conn->fd, &comms) == PDSNP_LEN &&
+     comms_read(conn->fd, &comms) == PDSNP_LEN)
+  {
+    if(PDSNP_GET_EX_CODE(comms.buf) == PDSNP_COMMS_OK)
+    {
+      ver = PDSNP_GET_VER(comms.buf);
+
+      if(ver < PDSNP1_VER || ver > PDSNP_VER)
+        ver = -1;
+    }
+    else
+      ver = PDSNP1_VER;
+  }
+
+  return ver;
+}
+
+
+
+/******************************************************************************
+* Internal function to start a frame at the end of the connection's output    *
+*                                                                             *
+* Pre-condition:  A valid server connection & the max. length of the frame    *
+*                 are passed to the function                                  *
+* Post-condition: Room is made for the frame, & the address to build it at is *
+*                 returned.  The frame is sent once it is ended & flushed.    *
+*                 On error a null pointer is returned                         *
+******************************************************************************/
+static pdsnp_buf* _start_frame(pdsconn *conn, int len)
+{
+  pdsnpio *out = &conn->npstate->out;
+
+  if(comms_reserve(out, len) == -1)
+    return (pdsnp_buf *) NULL;
+
+  return out->buf + out->len;
+}
+
+
+
+/******************************************************************************
+* Internal function to end a v2 frame at the end of the connection's output   *
+*                                                                             *
+* Pre-condition:  A valid server connection, the frame's length & request ID  *
+*                 are passed to the function.  The frame was started by       *
+*                 _start_frame()                                              *
+* Post-condition: The frame's header is completed, & the frame is appended    *
+*                 to the output, to be sent when it is next flushed           *
+******************************************************************************/
+static void _end_frame(pdsconn *conn, int len, unsigned int reqid)
+{
+  pdsnpio *out = &conn->npstate->out;
+  pdsnp_buf *frame = out->buf + out->len;
+
+  PDSNP2_SET_BUF_LEN(frame, len);
+  PDSNP2_SET_VER(frame, PDSNP2_VER);
+  PDSNP2_SET_EX_CODE(frame, PDSNP_COMMS_OK);
+  PDSNP2_SET_REQ_ID(frame, reqid);
+
+  out->len += len;
+}
+
+
+
+/******************************************************************************
+* Internal function to build a batch (v2) request                             *
+*                                                                             *
+* Pre-condition:  A valid server connection, the v2 function ID, the no. of   *
+*                 tags, the tags' names or handles, any tag values to set &   *
+*                 the request ID are passed to the function.  Unused          *
+*                 arguments are NULL                                          *
+* Post-condition: The request is appended to the connection's output.  On     *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+static int _build_request(pdsconn *conn, int func_id, int ntags,
+                          const char **tagnames, const pdshandle *handles,
+                          const unsigned short int *tagvalues,
+                          unsigned int reqid)
+{
+  pdsnp_buf *frame = NULL, *p = NULL;
+  int len = 0;
+  register int i = 0;
+
+  if(!(frame = _start_frame(conn, (PDSNP2_HDR_LEN + ntags * PDSNP2_MAX_ITEM_LEN))))
+    return -1;
+
+  for(i = 0, p = PDSNP2_ITEMS(frame); i < ntags; i++)
+  {
+    if(tagnames)
+    {
+      if((len = strlen(tagnames[i])) > PDSNP_TAGNAME_LEN)
+        len = PDSNP_TAGNAME_LEN;
+
+      *p = (pdsnp_buf) len;
+      memcpy(p + PDSNP2_NAMELEN_LEN, tagnames[i], len);
+      p += PDSNP2_NAMELEN_LEN + len;
+    }
+    else
+    {
+      PDSNP2_SET_U32(p, (unsigned int) handles[i]);
+      p += PDSNP2_HANDLE_LEN;
+    }
+
+    if(tagvalues)
+    {
+      PDSNP2_SET_U16(p, tagvalues[i]);
+      p += PDSNP2_VALUE_LEN;
+    }
+  }
+
+  PDSNP2_SET_FUNC_ID(frame, func_id);
+  PDSNP2_SET_NTAGS(frame, ntags);
+  _end_frame(conn, (p - frame), reqid);
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Internal function to get the length of each item in a v2 response           *
+*                                                                             *
+* Pre-condition:  The v2 function ID is passed to the function                *
+* Post-condition: The length of each tag's item in the function's response    *
+*                 is returned                                                 *
+******************************************************************************/
+static int _response_item_len(int func_id)
+{
+  switch(func_id)
+  {
+    case PDSNP2_RESOLVE_TAGS_FUNC_ID :
+      return PDSNP2_HANDLE_LEN;
+
+    case PDSNP2_SET_TAGS_FUNC_ID :
+    case PDSNP2_SET_HANDLES_FUNC_ID :
+      return PDSNP2_STATUS_LEN;
+
+    default :
+      return PDSNP2_VALUE_LEN + PDSNP2_STATUS_LEN;
+  }
+}
+
+
+
+/******************************************************************************
+* Internal function to store the results in a v2 response                     *
+*                                                                             *
+* Pre-condition:  The response frame & storage for the tags' values, statuses *
+*                 & handles are passed to the function.  Unused storage is    *
+*                 NULL                                                        *
+* Post-condition: Each tag's results are stored.  N.B.: The response has been *
+*                 checked against its request                                 *
+******************************************************************************/
+static void _store_results(const pdsnp_buf *frame, unsigned short int *values,
+                           unsigned short int *statuses, pdshandle *handles)
+{
+  const pdsnp_buf *p = PDSNP2_ITEMS(frame);
+  int func_id = PDSNP2_GET_FUNC_ID(frame), n = PDSNP2_GET_NTAGS(frame);
+  int getting = (_response_item_len(func_id) > PDSNP2_STATUS_LEN);
+  register int i = 0;
+
+  for(i = 0; i < n; i++)
+  {
+    if(func_id == PDSNP2_RESOLVE_TAGS_FUNC_ID)
+    {
+      if(handles)
+        handles[i] = (pdshandle) PDSNP2_GET_U32(p);
+      p += PDSNP2_HANDLE_LEN;
+      continue;
+    }
+
+    if(getting)
+    {
+      if(values)
+        values[i] = PDSNP2_GET_U16(p);
+      p += PDSNP2_VALUE_LEN;
+    }
+
+    if(statuses)
+      statuses[i] = PDSNP2_GET_U16(p);
+    p += PDSNP2_STATUS_LEN;
+  }
+}
+
+
+
+/******************************************************************************
+* Internal function to hold the updates pushed to a client                    *
+*                                                                             *
+* Pre-condition:  A valid server connection, the update frame & its length    *
+*                 are passed to the function                                  *
+* Post-condition: The frame's updates are appended to those held for the      *
+*                 client.  If more than PDSNP_MAX_UPDATES are held, the       *
+*                 oldest are dropped.  The no. of updates held is returned.   *
+*                 On error a -1 is returned                                   *
+******************************************************************************/
+static int _hold_updates(pdsconn *conn, const pdsnp_buf *buf, int len)
+{
+  pdsnpstate *np = conn->npstate;
+  pdsnpupdate *updates = NULL;
+  const pdsnp_buf *p = PDSNP2_ITEMS(buf);
+  int n = PDSNP2_GET_NTAGS(buf), size = 0, ndropped = 0;
+  register int i = 0;
+
+  if(n < 0 || n > PDSNP2_MAX_TAGS ||
+     len != (PDSNP2_HDR_LEN + n * PDSNP2_UPDATE_ITEM_LEN))
+    return -1;
+
+  if((np->nupdates + n) > np->updsize && np->updsize < PDSNP_MAX_UPDATES)
+  {
+    for(size = (np->updsize > 0) ? np->updsize : PDSNP2_MAX_TAGS;
+        size < (np->nupdates + n) && size < PDSNP_MAX_UPDATES; size *= 2);
+
+    if(size > PDSNP_MAX_UPDATES)
+      size = PDSNP_MAX_UPDATES;
+
+    if(!(updates = (pdsnpupdate *) realloc(np->updates, size * sizeof(pdsnpupdate))))
+      return -1;
+
+    np->updates = updates;
+    np->updsize = size;
+  }
+
+  /* Drop the oldest updates to make room */
+  if((ndropped = (np->nupdates + n) - np->updsize) > 0)
+  {
+    np->nupdates -= ndropped;
+    memmove(np->updates, np->updates + ndropped, (np->nupdates * sizeof(pdsnpupdate)));
+    np->upd_status |= PDSNP_COMMS_DROPPED;
+  }
+
+  for(i = 0; i < n; i++)
+  {
+    np->updates[np->nupdates].id = PDSNP2_GET_U32(p);
+    np->updates[np->nupdates].value = PDSNP2_GET_U16(p + PDSNP2_ID_LEN);
+    np->updates[np->nupdates].status = PDSNP2_GET_U16(p + PDSNP2_ID_LEN + PDSNP2_VALUE_LEN);
+    np->nupdates++;
+    p += PDSNP2_UPDATE_ITEM_LEN;
+  }
+
+  np->upd_status |= PDSNP2_GET_EX_CODE(buf);
+
+  return np->nupdates;
+}
+
+
+
+/******************************************************************************
+* Internal function to complete a pipelined request                           *
+*                                                                             *
+* Pre-condition:  A valid server connection, the response frame & its length  *
+*                 are passed to the function                                  *
+* Post-condition: The response is checked against its request, the tags'      *
+*                 results are stored & the request is completed, to be        *
+*                 collected.  If the response isn't to the oldest request     *
+*                 still outstanding, or doesn't match it, a -1 is returned    *
+******************************************************************************/
+static int _complete_request(pdsconn *conn, const pdsnp_buf *frame, int len)
+{
+  pdsnpstate *np = conn->npstate;
+  pdsnpreq *req = NULL;
+
+  /* N.B.: The responses arrive in the requests' order */
+  if(np->ndone < np->nreqs)
+    req = &np->reqs[np->reqoff + np->ndone];
+
+  if(!req || PDSNP2_GET_REQ_ID(frame) != req->reqid ||
+     PDSNP2_GET_FUNC_ID(frame) != req->func_id ||
+     PDSNP2_GET_NTAGS(frame) != req->ntags ||
+     len != (PDSNP2_HDR_LEN + req->ntags * _response_item_len(req->func_id)))
+    return -1;
+
+  _store_results(frame, req->values, req->statuses, req->handles);
+  req->ex_code = PDSNP2_GET_EX_CODE(frame);
+  np->ndone++;
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Internal function to read the next frame from the server                    *
+*                                                                             *
+* Pre-condition:  A valid server connection, a pointer for the frame & a      *
+*                 timeout for each wait (NULL waits forever) are passed to    *
+*                 the function                                                *
+* Post-condition: The next frame is read from the connection's buffered       *
+*                 input, receiving more from the server only when a whole     *
+*                 frame isn't already buffered.  The frame's address is       *
+*                 stored & its length is returned.  If the timeout expires or *
+*                 a signal is caught, a 0 is returned.  On error a -1 is      *
+*                 returned                                                    *
+******************************************************************************/
+static int _read_frame(pdsconn *conn, pdsnp_buf **frame, struct timeval *tv)
+{
+  pdsnpio *in = &conn->npstate->in;
+  int len = 0, nread = 0;
+
+  while((len = comms_next_frame(in, frame)) == 0)
+  {
+    if((nread = comms_fill(conn->fd, in, tv)) < 1)
+      return nread;
+  }
+
+  return len;
+}
+
+
+
+/******************************************************************************
+* Internal function to dispatch a frame that the client didn't wait for       *
+*                                                                             *
+* Pre-condition:  A valid server connection, the frame & its length are       *
+*                 passed to the function                                      *
+* Post-condition: If the frame is an update it's held for the client, & if    *
+*                 it's the response to a pipelined request the request is     *
+*                 completed, & a 1 is returned.  Otherwise the frame is the   *
+*                 response the client is waiting for, & a 0 is returned.  On  *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+static int _dispatch_frame(pdsconn *conn, const pdsnp_buf *frame, int len)
+{
+  if(PDSNP_GET_FRAME_VER(frame) != PDSNP2_VER)
+    return 0;
+
+  if(PDSNP2_GET_FUNC_ID(frame) == PDSNP2_UPDATE_FUNC_ID)
+    return (_hold_updates(conn, frame, len) == -1) ? -1 : 1;
+
+  if(PDSNP2_GET_REQ_ID(frame) != 0)
+    return (_complete_request(conn, frame, len) == -1) ? -1 : 1;
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Internal function to read the response to a client's request                *
+*                                                                             *
+* Pre-condition:  A valid server connection & a pointer for the response are  *
+*                 passed to the function                                      *
+* Post-condition: The next frame that the client is waiting for is read.  Any *
+*                 updates & responses to pipelined requests that arrive       *
+*                 before it are dispatched.  The response's address is stored *
+*                 & its length is returned.  On error a -1 is returned        *
+******************************************************************************/
+static int _read_response(pdsconn *conn, pdsnp_buf **frame)
+{
+  struct timeval tv;
+  int len = 0, retval = 0;
+
+  do
+  {
+    tv.tv_sec = PDSNP_TMO_SECS;
+    tv.tv_usec = PDSNP_TMO_USECS;
+
+    if((len = _read_frame(conn, frame, &tv)) < 1 ||
+       (retval = _dispatch_frame(conn, *frame, len)) == -1)
+      return -1;
+  }
+  while(retval);
+
+  return len;
+}
+
+
+
+/******************************************************************************
+* Internal function to send a v1 request                                      *
+*                                                                             *
+* Pre-condition:  A valid server connection & comms struct pointer are passed *
+*                 to the function                                             *
+* Post-condition: The request is appended to the connection's output, which   *
+*                 is then flushed.  The number of bytes written is returned   *
+*                 or -1 on error                                              *
+******************************************************************************/
+static int _send_comms(pdsconn *conn, pdscomms *comms)
+{
+  pdsnp_buf *frame = NULL;
+
+  if(!(frame = _start_frame(conn, PDSNP_LEN)))
+    return -1;
+
+  memcpy(frame, comms->buf, PDSNP_LEN);
+  conn->npstate->out.len += PDSNP_LEN;
+
+  return comms_flush(conn->fd, &conn->npstate->out, &conn->npstate->in);
+}
+
+
+
+/******************************************************************************
+* Internal function to read the response to a client's v1 request             *
+*                                                                             *
+* Pre-condition:  A valid server connection & comms struct pointer are passed *
+*                 to the function                                             *
+* Post-condition: The response is stored in the comms struct.  The number of  *
+*                 bytes read is returned or -1 on error                       *
+******************************************************************************/
+static int _read_comms(pdsconn *conn, pdscomms *comms)
+{
+  pdsnp_buf *frame = NULL;
+
+  if(_read_response(conn, &frame) != PDSNP_LEN ||
+     PDSNP_GET_FRAME_VER(frame) != PDSNP1_VER)
+    return -1;
+
+  memcpy(comms->buf, frame, PDSNP_LEN);
+
+  return PDSNP_LEN;
+}
+
+
+
+/******************************************************************************
+* Internal function to send a batch (v2) request & read its response          *
+*                                                                             *
+* Pre-condition:  A valid server connection, with the request at the end of   *
+*                 its output, the request's function ID & no. of tags, & a    *
+*                 pointer for the response are passed to the function         *
+* Post-condition: The output is flushed & the request's response is read, &   *
+*                 checked against the request.  The response's exception      *
+*                 code is added to the connection's PLC status.  On error a   *
+*                 -1 is returned                                              *
+******************************************************************************/
+static int _transact_frame(pdsconn *conn, int func_id, int ntags,
+                           pdsnp_buf **frame)
+{
+  int len = 0;
+
+  if(comms_flush(conn->fd, &conn->npstate->out, &conn->npstate->in) == -1)
+  {
+    conn->plc_status |= PDSNP_COMMS_WR_ERR;
+    return -1;
+  }
+
+  if((len = _read_response(conn, frame)) == -1)
+  {
+    conn->plc_status |= PDSNP_COMMS_RD_ERR;
+    return -1;
+  }
+
+  /* Propagate comms status to the client */
+  if(PDSNP_GET_FRAME_VER(*frame) == PDSNP2_VER)
+    conn->plc_status |= PDSNP2_GET_EX_CODE(*frame);
+
+  if(PDSNP_GET_FRAME_VER(*frame) != PDSNP2_VER ||
+     PDSNP2_GET_FUNC_ID(*frame) != func_id || PDSNP2_GET_NTAGS(*frame) != ntags ||
+     len != (PDSNP2_HDR_LEN + ntags * _response_item_len(func_id)))
+  {
+    conn->plc_status |= PDSNP_COMMS_RD_ERR;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Internal function to get, set or resolve a batch of tags                    *
+*                                                                             *
+* Pre-condition:  A valid server connection, the v2 function ID, the no. of   *
+*                 tags, the tags' names or handles, any tag values to set &   *
+*                 storage for the function's results are passed to the        *
+*                 function.  Unused arguments are NULL                        *
+* Post-condition: The tags are sent to the server in as few frames as the     *
+*                 protocol allows, & each tag's results are stored.  The      *
+*                 connection's PLC status is the combination of all the       *
+*                 tags' statuses.  On error a -1 is returned                  *
+******************************************************************************/
+static int _batch_tags(pdsconn *conn, int func_id, int ntags,
+                       const char **tagnames, const pdshandle *handles,
+                       const unsigned short int *tagvalues,
+                       unsigned short int *values,
+                       unsigned short int *statuses, pdshandle *outhandles)
+{
+  pdsnp_buf *frame = NULL;
+  int maxtags = 0, n = 0;
+  register int i = 0;
+
+  if(!conn || !conn->npstate)
+    return -1;
+
+  conn->plc_status = 0;
+
+  /* The batched functions were introduced in v2 */
+  if(conn->febe_proto_ver < PDSNP2_VER)
+  {
+    conn->plc_status = PDSNP_COMMS_FUNC_ERR;
+    return -1;
+  }
+
+  maxtags = (tagvalues) ? PDSNP2_MAX_WRITES : PDSNP2_MAX_TAGS;
+
+  for(i = 0; i < ntags; i += n)
+  {
+    n = ((ntags - i) < maxtags) ? (ntags - i) : maxtags;
+
+    if(_build_request(conn, func_id, n, (tagnames) ? tagnames + i : NULL,
+                      (handles) ? handles + i : NULL,
+                      (tagvalues) ? tagvalues + i : NULL, 0) == -1)
+      return -1;
+
+    /* Send the batch & receive the tags' results */
+    if(_transact_frame(conn, func_id, n, &frame) == -1)
+      return -1;
+
+    _store_results(frame, (values) ? values + i : NULL,
+                   (statuses) ? statuses + i : NULL,
+                   (outhandles) ? outhandles + i : NULL);
+  }
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Internal function to reset a client's image of the published tags           *
+*                                                                             *
+* Pre-condition:  The multicast group's image, the no. of tags published &    *
+*                 the segment's generation no. are passed to the function     *
+* Post-condition: The image is reallocated for the tags, none of which have   *
+*                 been received, so their statuses are a read error.  On      *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+static int _reset_mcast_image(pdsnpmcast *mc, int ttags, int gen)
+{
+  int n = (ttags > 0) ? ttags : 1;
+  register int i = 0;
+
+  if(mc->values) free(mc->values);
+  if(mc->statuses) free(mc->statuses);
+  if(mc->mtimes_ns) free(mc->mtimes_ns);
+  if(mc->jseqs) free(mc->jseqs);
+
+  mc->ttags = 0;
+  mc->synced = 0;
+
+  if(!(mc->values = (unsigned short int *) calloc(n, sizeof(unsigned short int))) ||
+     !(mc->statuses = (unsigned short int *) malloc(n * sizeof(unsigned short int))) ||
+     !(mc->mtimes_ns = (unsigned long long *) calloc(n, sizeof(unsigned long long))) ||
+     !(mc->jseqs = (unsigned long long *) calloc(n, sizeof(unsigned long long))))
+    return -1;
+
+  for(i = 0; i < n; i++)
+    mc->statuses[i] = PDSNP_COMMS_RD_ERR;
+
+  mc->ttags = ttags;
+  mc->gen = gen;
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Internal function to apply a published frame to the client's image          *
+*                                                                             *
+* Pre-condition:  A valid server connection, the multicast group's image, the *
+*                 frame (published, or a snapshot) & its length are passed to *
+*                 the function                                                *
+* Post-condition: The frame is checked, & each of its tags is stored in the   *
+*                 image, unless the image already holds the tag as of a later *
+*                 change.  If a published frame's sequence no. shows that     *
+*                 frames were lost, the connection's PLC status has           *
+*                 PDSNP_COMMS_DROPPED set.  The no. of tags in the frame is   *
+*                 returned.  If the frame is invalid a -1 is returned         *
+******************************************************************************/
+static int _apply_publication(pdsconn *conn, pdsnpmcast *mc,
+                              const pdsnp_buf *frame, int len)
+{
+  const pdsnp_buf *p = NULL;
+  unsigned long long jseq = 0, mtime_ns = 0;
+  unsigned int seq = 0, id = 0;
+  int func_id = 0, ntags = 0;
+  register int i = 0;
+
+  if(len < (PDSNP2_HDR_LEN + PDSNP2_PUB_HDR_LEN) ||
+     PDSNP_GET_FRAME_VER(frame) != PDSNP2_VER ||
+     PDSNP2_GET_VER(frame) != PDSNP2_VER || PDSNP2_GET_BUF_LEN(frame) != len)
+    return -1;
+
+  func_id = PDSNP2_GET_FUNC_ID(frame);
+  ntags = PDSNP2_GET_NTAGS(frame);
+
+  if((func_id != PDSNP2_CHANGES_FUNC_ID && func_id != PDSNP2_KEYFRAME_FUNC_ID &&
+      func_id != PDSNP2_SNAPSHOT_FUNC_ID) || ntags < 0 ||
+     len != (PDSNP2_HDR_LEN + PDSNP2_PUB_HDR_LEN + ntags * PDSNP2_UPDATE_ITEM_LEN))
+    return -1;
+
+  /* The image is stale if the server has restarted */
+  if(PDSNP2_GET_TTAGS(frame) != mc->ttags || PDSNP2_GET_GEN(frame) != mc->gen)
+  {
+    if(_reset_mcast_image(mc, PDSNP2_GET_TTAGS(frame), PDSNP2_GET_GEN(frame)) == -1)
+      return -1;
+  }
+
+  /* A snapshot is sent over TCP, so isn't in the group's sequence */
+  if(func_id != PDSNP2_SNAPSHOT_FUNC_ID)
+  {
+    seq = PDSNP2_GET_REQ_ID(frame);
+
+    if(mc->synced && seq != (mc->pubseq + 1))
+      conn->plc_status |= PDSNP_COMMS_DROPPED;
+
+    mc->pubseq = seq;
+    mc->synced = 1;
+  }
+
+  jseq = PDSNP2_GET_JSEQ(frame);
+  mtime_ns = PDSNP2_GET_TIME(frame);
+
+  for(i = 0, p = PDSNP2_PUB_ITEMS(frame); i < ntags; i++, p += PDSNP2_UPDATE_ITEM_LEN)
+  {
+    id = PDSNP2_GET_U32(p);
+
+    if(id >= (unsigned int) mc->ttags || jseq < mc->jseqs[id])
+      continue;
+
+    mc->values[id] = PDSNP2_GET_U16(p + PDSNP2_ID_LEN);
+    mc->statuses[id] = PDSNP2_GET_U16(p + PDSNP2_ID_LEN + PDSNP2_VALUE_LEN);
+    mc->mtimes_ns[id] = mtime_ns;
+    mc->jseqs[id] = jseq;
+  }
+
+  return ntags;
+}
+
+
+
+/******************************************************************************
+* Internal function to leave a multicast group                                *
+*                                                                             *
+* Pre-condition:  A valid server connection is passed to the function         *
+* Post-condition: The client leaves the group it joined, if any, & its image  *
+*                 of the published tags is freed                              *
+******************************************************************************/
+static void _leave_mcast(pdsconn *conn)
+{
+  pdsnpmcast *mc = conn->npstate->mcast;
+
+  if(!mc)
+    return;
+
+  if(mc->fd != -1) close(mc->fd);
+  if(mc->values) free(mc->values);
+  if(mc->statuses) free(mc->statuses);
+  if(mc->mtimes_ns) free(mc->mtimes_ns);
+  if(mc->jseqs) free(mc->jseqs);
+
+  free(mc);
+  conn->npstate->mcast = NULL;
+}
+
+
+
 /******************************************************************************
 * Function to connect a client to the server                                  *
 *                                                                             *
-* Pre-condition:  A server host & port are passed to the function.  If the    *
-*                 host is NULL a local connection is made, else a network     *
-*                 connection is made                                          *
-* Post-condition: The client program is connected to the server which is      *
-*                 identified by the host & port.  The server connection       *
-*                 structure is returned which is used in all subsequent       *
-*                 calls to the server.  On return the connection structure    *
-*                 should be interrogated to determine if the connection was   *
-*                 successful or if an error occurred.  If memory cannot be    *
-*                 allocated for the connection structure a null pointer is    *
-*                 returned                                                    *
+* Pre-condition:  A server host & port are passed to the function.  If the    *
+*                 host is NULL a local connection is made, else a network     *
+*                 connection is made                                          *
+* Post-condition: The client program is connected to the server which is      *
+*                 identified by the host & port, & the protocol version is    *
+*                 negotiated with the server.  The server connection          *
+*                 structure is returned which is used in all subsequent       *
+*                 calls to the server.  On return the connection structure    *
+*                 should be interrogated to determine if the connection was   *
+*                 successful or if an error occurred.  If memory cannot be    *
+*                 allocated for the connection structure a null pointer is    *
+*                 returned                                                    *
+******************************************************************************/
+pdsconn* PDSNPconnect(const char *host, unsigned short int port)
+{
+  pdsconn *conn = (pdsconn *) malloc(sizeof(pdsconn));
+  const char *phost = NULL;
+
+  if(!conn)
+  {
+    return (pdsconn *) NULL;
+  }
+
+  memset(conn, 0, sizeof(pdsconn));
+
+  if(!(conn->npstate = (pdsnpstate *) calloc(1, sizeof(pdsnpstate))))
+  {
+    free(conn);
+    return (pdsconn *) NULL;
+  }
+ 
+  /* Set the connection status initially to error */
+  conn->conn_status = PDS_CONN_CONNERR;
+
+  /* Do sanity checks on host - if no host, use default */
+  phost = ((host == NULL) || (strcmp(host, "") == 0)) ? PDSNP_DEF_HOST : host;
+
+  /* Connect to the PDS network stub */
+  if((conn->fd = open_client_socket((char *) phost, port)) == -1)
+  {
+    return conn;
+  }
+  else if((conn->febe_proto_ver = _negotiate_version(conn)) == -1)
+  {
+    close(conn->fd);
+    conn->fd = -1;
+    conn->conn_status = PDS_CONN_PROTO_ERR;
+    return conn;
+  }
+  else
+  {
+    /* Assign the network stub host and port to the connection struct */
+    strncpy(conn->ip_addr, phost, PDS_IP_ADDR_LEN - 1);
+    conn->port = port;
+
+    /* Finally set the connection status to OK */
+    conn->conn_status = PDS_CONN_OK;
+  }
+
+  return conn;
+}
+
+
+
+/******************************************************************************
+* Function to disconnect a client from the server                             *
+*                                                                             *
+* Pre-condition:  A valid server connection struct is passed to the function  *
+* Post-condition: The client program is disconnected from the server.  If an  *
+*                 error occurrs a -1 is returned                              *
+******************************************************************************/
+int PDSNPdisconnect(pdsconn *conn)
+{
+  if(conn)
+  {
+    /* Disconnect from the PDS network stub */
+    close(conn->fd);
+
+    if(conn->npstate)
+    {
+      if(conn->npstate->in.buf) free(conn->npstate->in.buf);
+      if(conn->npstate->out.buf) free(conn->npstate->out.buf);
+      if(conn->npstate->reqs) free(conn->npstate->reqs);
+      if(conn->npstate->updates) free(conn->npstate->updates);
+      _leave_mcast(conn);
+      free(conn->npstate);
+    }
+
+    free(conn);
+    return 0;
+  }
+  else
+    return -1;
+}
+
+
+
+/******************************************************************************
+* Function to get a tag's value                                               *
+*                                                                             *
+* Pre-condition:  A valid server connection, the tagname and a string for     *
+*                 storage of the tag's value are passed to the function       *
+* Post-condition: The tagname is accessed in the shared memory segment and    *
+*                 its corresponding value is returned.  On error a -1 is      *
+*                 returned                                                    *
+******************************************************************************/
+int PDSNPget_tag(pdsconn *conn, const char *tagname, char *tagvalue)
+{
+  pdscomms comms;
+  int retval = -1;
+
+  if(conn)
+  {
+    memset(&comms, 0, sizeof(pdscomms));
+
+    PDSNP_SET_BUF_LEN(comms.buf, PDSNP_LEN);
+    PDSNP_SET_VER(comms.buf, PDSNP1_VER);
+    PDSNP_SET_FUNC_ID(comms.buf, PDSNP_GET_TAG_FUNC_ID);
+    PDSNP_SET_EX_CODE(comms.buf, PDSNP_COMMS_OK);
+    PDSNP_SET_TAGNAME(comms.buf, tagname);
+    PDSNP_SET_TAGVALUE(comms.buf, "0");
+
+    comms.conn = conn;
+
+    /* Send the request to get the value for the given tag */
+    if(_send_comms(conn, &comms) < 0)
+    {
+      PDSNP_SET_EX_CODE(comms.buf, PDSNP_COMMS_WR_ERR);
+      conn->plc_status = PDSNP_GET_EX_CODE(comms.buf);
+    }
+    else
+    {
+      if(_read_comms(conn, &comms) < 0)
+      {
+        PDSNP_SET_EX_CODE(comms.buf, PDSNP_COMMS_RD_ERR);
+        conn->plc_status = PDSNP_GET_EX_CODE(comms.buf);
+      }
+      else
+      {
+        /* Propagate comms status to the client */
+        conn->plc_status = PDSNP_GET_EX_CODE(comms.buf);
+
+        /* Store the tagvalue in the string */
+        PDSNP_GET_TAGVALUE(tagvalue, comms.buf);
+
+        retval = 0;
+      }
+    }
+  }
+
+  return retval;
+}
+
+
+
+/******************************************************************************
+* Function to set tag value(s)                                                *
+*                                                                             *
+* Pre-condition:  A valid server connection, the base tagname, the no. of     *
+*                 tags to write and the tag value(s) as an integer pointer    *
+*                 are passed to the function                                  *
+* Post-condition: A message is sent to the server requesting that the tag     *
+*                 value(s) be written to the PLC.  On error a -1 is returned  *
+******************************************************************************/
+int PDSNPset_tag(pdsconn *conn, const char *tagname, short int ntags,
+                 const short int *tagvalues)
+{
+  pdscomms comms;
+  char tagvalue[PDSNP_TAGVALUE_LEN+1] = "\0";
+  int retval = -1;
+
+  if(conn)
+  {
+    memset(&comms, 0, sizeof(pdscomms));
+
+    PDSNP_SET_BUF_LEN(comms.buf, PDSNP_LEN);
+    PDSNP_SET_VER(comms.buf, PDSNP1_VER);
+    PDSNP_SET_FUNC_ID(comms.buf, PDSNP_SET_TAG_FUNC_ID);
+    PDSNP_SET_EX_CODE(comms.buf, PDSNP_COMMS_OK);
+    PDSNP_SET_TAGNAME(comms.buf, tagname);
+    sprintf(tagvalue, "%u", *tagvalues);
+    PDSNP_SET_TAGVALUE(comms.buf, tagvalue);
+
+    comms.conn = conn;
+
+    /* Send the request to set the value for the given tag(s) */
+    if(_send_comms(conn, &comms) < 0)
+    {
+      PDSNP_SET_EX_CODE(comms.buf, PDSNP_COMMS_WR_ERR);
+      conn->plc_status = PDSNP_GET_EX_CODE(comms.buf);
+    }
+    else
+    {
+      if(_read_comms(conn, &comms) < 0)
+      {
+        PDSNP_SET_EX_CODE(comms.buf, PDSNP_COMMS_RD_ERR);
+        conn->plc_status = PDSNP_GET_EX_CODE(comms.buf);
+      }
+      else
+      {
+        /* Propagate comms status to the client */
+        conn->plc_status = PDSNP_GET_EX_CODE(comms.buf);
+
+        retval = 0;
+      }
+    }
+  }
+
+  return retval;
+}
+
+
+
+/******************************************************************************
+* Function to get a batch of tags' values                                     *
+*                                                                             *
+* Pre-condition:  A valid server connection, the no. of tags, the tagnames &  *
+*                 storage for the tags' values & statuses are passed to the   *
+*                 function.  The statuses are optional                        *
+* Post-condition: The tags' raw values & statuses are read from the server,   *
+*                 in as few round trips as the protocol allows.  An unknown   *
+*                 tag's status has PDSNP_COMMS_APP_ERR set.  On error a -1 is *
+*                 returned                                                    *
+******************************************************************************/
+int PDSNPget_tags(pdsconn *conn, int ntags, const char **tagnames,
+                  unsigned short int *tagvalues,
+                  unsigned short int *tagstatuses)
+{
+  return _batch_tags(conn, PDSNP2_GET_TAGS_FUNC_ID, ntags, tagnames, NULL, NULL, tagvalues, tagstatuses, NULL);
+}
+
+
+
+/******************************************************************************
+* Function to set a batch of tags' values                                     *
+*                                                                             *
+* Pre-condition:  A valid server connection, the no. of tags, the tagnames,   *
+*                 the tags' values & storage for the writes' statuses are     *
+*                 passed to the function.  The statuses are optional          *
+* Post-condition: The tags' values are written to the PLC, & each write's     *
+*                 status is returned once all the writes have completed.  On  *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+int PDSNPset_tags(pdsconn *conn, int ntags, const char **tagnames,
+                  const unsigned short int *tagvalues,
+                  unsigned short int *tagstatuses)
+{
+  return _batch_tags(conn, PDSNP2_SET_TAGS_FUNC_ID, ntags, tagnames, NULL, tagvalues, NULL, tagstatuses, NULL);
+}
+
+
+
+/******************************************************************************
+* Function to resolve a batch of tagnames to handles                          *
+*                                                                             *
+* Pre-condition:  A valid server connection, the no. of tags, the tagnames &  *
+*                 storage for the handles are passed to the function          *
+* Post-condition: Each tagname is looked up once by the server & a handle to  *
+*                 the tag is stored, for use with the handle-based batch      *
+*                 functions.  An unknown tag's handle is PDS_HANDLE_INVALID.  *
+*                 On error a -1 is returned                                   *
+******************************************************************************/
+int PDSNPresolve_tags(pdsconn *conn, int ntags, const char **tagnames,
+                      pdshandle *handles)
+{
+  return _batch_tags(conn, PDSNP2_RESOLVE_TAGS_FUNC_ID, ntags, tagnames, NULL, NULL, NULL, NULL, handles);
+}
+
+
+
+/******************************************************************************
+* Function to get a batch of tags' values via their handles                   *
+*                                                                             *
+* Pre-condition:  A valid server connection, the no. of tags, the tags'       *
+*                 handles & storage for the tags' values & statuses are       *
+*                 passed to the function.  The statuses are optional          *
+* Post-condition: The tags' raw values & statuses are read from the server,   *
+*                 in as few round trips as the protocol allows.  An invalid   *
+*                 handle's status has PDSNP_COMMS_APP_ERR set.  On error a -1 *
+*                 is returned                                                 *
+******************************************************************************/
+int PDSNPget_tags_h(pdsconn *conn, int ntags, const pdshandle *handles,
+                    unsigned short int *tagvalues,
+                    unsigned short int *tagstatuses)
+{
+  return _batch_tags(conn, PDSNP2_GET_HANDLES_FUNC_ID, ntags, NULL, handles, NULL, tagvalues, tagstatuses, NULL);
+}
+
+
+
+/******************************************************************************
+* Function to set a batch of tags' values via their handles                   *
+*                                                                             *
+* Pre-condition:  A valid server connection, the no. of tags, the tags'       *
+*                 handles, the tags' values & storage for the writes'         *
+*                 statuses are passed to the function.  The statuses are      *
+*                 optional                                                    *
+* Post-condition: The tags' values are written to the PLC, & each write's     *
+*                 status is returned once all the writes have completed.  On  *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+int PDSNPset_tags_h(pdsconn *conn, int ntags, const pdshandle *handles,
+                    const unsigned short int *tagvalues,
+                    unsigned short int *tagstatuses)
+{
+  return _batch_tags(conn, PDSNP2_SET_HANDLES_FUNC_ID, ntags, NULL, handles, tagvalues, NULL, tagstatuses, NULL);
+}
+
+
+
+/******************************************************************************
+* Function to subscribe to changes to a set of tags                           *
+*                                                                             *
+* Pre-condition:  A valid server connection, the no. of tags, the tagnames,   *
+*                 each tag's deadband, the min. interval between updates (in  *
+*                 msecs) & storage for the tags' values & statuses are passed *
+*                 to the function.  The deadbands & statuses are optional     *
+* Post-condition: The tags replace any that the client was subscribed to, &   *
+*                 their current values & statuses are stored.  The server     *
+*                 then pushes each tag's changes that exceed its deadband, or *
+*                 change its status, which are read by PDSNPget_updates().    *
+*                 Subscribing to no tags ends the subscription.  On error a   *
+*                 -1 is returned                                              *
+******************************************************************************/
+int PDSNPsubscribe(pdsconn *conn, int ntags, const char **tagnames,
+                   const unsigned short int *deadbands, unsigned int interval,
+                   unsigned short int *tagvalues,
+                   unsigned short int *tagstatuses)
+{
+  pdsnp_buf *frame = NULL, *p = NULL;
+  int len = 0;
+  register int i = 0;
+
+  if(!conn || !conn->npstate || ntags < 0 || ntags > PDSNP2_MAX_TAGS)
+    return -1;
+
+  conn->plc_status = 0;
+
+  /* Subscriptions were introduced in v2 */
+  if(conn->febe_proto_ver < PDSNP2_VER)
+  {
+    conn->plc_status = PDSNP_COMMS_FUNC_ERR;
+    return -1;
+  }
+
+  if(!(frame = _start_frame(conn, (PDSNP2_HDR_LEN + PDSNP2_INTERVAL_LEN + ntags * PDSNP2_MAX_ITEM_LEN))))
+    return -1;
+
+  p = PDSNP2_ITEMS(frame);
+  PDSNP2_SET_U32(p, interval);
+  p += PDSNP2_INTERVAL_LEN;
+
+  for(i = 0; i < ntags; i++)
+  {
+    if((len = strlen(tagnames[i])) > PDSNP_TAGNAME_LEN)
+      len = PDSNP_TAGNAME_LEN;
+
+    *p = (pdsnp_buf) len;
+    memcpy(p + PDSNP2_NAMELEN_LEN, tagnames[i], len);
+    p += PDSNP2_NAMELEN_LEN + len;
+
+    PDSNP2_SET_U16(p, (deadbands) ? deadbands[i] : 0);
+    p += PDSNP2_DEADBAND_LEN;
+  }
+
+  PDSNP2_SET_FUNC_ID(frame, PDSNP2_SUBSCRIBE_FUNC_ID);
+  PDSNP2_SET_NTAGS(frame, ntags);
+  _end_frame(conn, (p - frame), 0);
+
+  if(_transact_frame(conn, PDSNP2_SUBSCRIBE_FUNC_ID, ntags, &frame) == -1)
+    return -1;
+
+  /* Updates held from a previous subscription are stale */
+  conn->npstate->nupdates = 0;
+  conn->npstate->upd_status = 0;
+
+  _store_results(frame, tagvalues, tagstatuses, NULL);
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to get the updates pushed to a subscribed client                   *
+*                                                                             *
+* Pre-condition:  A valid server connection, storage for the updates, the     *
+*                 max. no. of updates to store & a timeout (in usecs, or      *
+*                 PDS_WAIT_FOREVER) are passed to the function                *
+* Post-condition: Any updates already held are stored, oldest first, else the *
+*                 function waits for the server to push some.  Each update's  *
+*                 ID is the tag's index in the subscribed tagnames.  The      *
+*                 connection's PLC status has PDSNP_COMMS_DROPPED set if      *
+*                 updates were dropped, because the client didn't keep up.    *
+*                 The no. of updates stored is returned.  If the timeout      *
+*                 expires or a signal is caught, a 0 is returned.  On error a *
+*                 -1 is returned                                              *
 ******************************************************************************/
-pdsconn* PDSNPconnect(const char *host, unsigned short int port)
+int PDSNPget_updates(pdsconn *conn, pdsnpupdate *updates, int n, long timeout)
 {
-  pdsconn *conn = (pdsconn *) malloc(sizeof(pdsconn));
-  const char *phost = NULL;
+  pdsnpstate *np = NULL;
+  pdsnp_buf *frame = NULL;
+  struct timeval tv, *tmo = NULL;
+  int len = 0, nret = 0;
 
-  if(!conn)
+  if(!conn || !(np = conn->npstate) || !updates || n < 1)
+    return -1;
+
+  conn->plc_status = 0;
+
+  while(np->nupdates == 0)
   {
-    return (pdsconn *) NULL;
+    if(timeout >= 0)
+    {
+      tv.tv_sec = timeout / 1000000L;
+      tv.tv_usec = timeout % 1000000L;
+      tmo = &tv;
+    }
+
+    /* The timeout expired, or a signal was caught */
+    if((len = _read_frame(conn, &frame, tmo)) == 0)
+      return 0;
+
+    /* Only updates & pipelined responses arrive unrequested */
+    if(len == -1 || _dispatch_frame(conn, frame, len) != 1)
+    {
+      conn->plc_status = PDSNP_COMMS_RD_ERR;
+      return -1;
+    }
   }
 
-  memset(conn, 0, sizeof(pdsconn));
- 
-  /* Set the connection status initially to error */
-  conn->conn_status = PDS_CONN_CONNERR;
+  nret = (np->nupdates < n) ? np->nupdates : n;
+  memcpy(updates, np->updates, (nret * sizeof(pdsnpupdate)));
+  np->nupdates -= nret;
+  memmove(np->updates, np->updates + nret, (np->nupdates * sizeof(pdsnpupdate)));
 
-  /* Do sanity checks on host - if no host, use default */
-  phost = ((host == NULL) || (strcmp(host, "") == 0)) ? PDSNP_DEF_HOST : host;
+  /* Report the updates' status to the client */
+  conn->plc_status = np->upd_status;
+  np->upd_status = 0;
 
-  /* Connect to the PDS network stub */
-  if((conn->fd = open_client_socket(phost, port)) == -1)
+  return nret;
+}
+
+
+
+/******************************************************************************
+* Function to submit a pipelined request                                      *
+*                                                                             *
+* Pre-condition:  A valid server connection, the v2 function ID (a get or set *
+*                 by name or by handle), the no. of tags, the tags' names or  *
+*                 handles, any tag values to set & storage for the tags'      *
+*                 values & statuses are passed to the function.  Unused       *
+*                 arguments are NULL.  The storage must remain valid until    *
+*                 the request is collected                                    *
+* Post-condition: The request is buffered, & sent without waiting for its     *
+*                 response, once enough requests are buffered or when a       *
+*                 response is collected.  The request's ID is returned, which *
+*                 PDSNPcollect() returns when the tags' results have been     *
+*                 stored.  On error a -1 is returned                          *
+******************************************************************************/
+int PDSNPsubmit(pdsconn *conn, int func_id, int ntags, const char **tagnames,
+                const pdshandle *handles, const unsigned short int *tagvalues,
+                unsigned short int *values, unsigned short int *statuses)
+{
+  pdsnpstate *np = NULL;
+  pdsnpreq *reqs = NULL, *req = NULL;
+  int size = 0, writing = 0;
+
+  if(!conn || !(np = conn->npstate))
+    return -1;
+
+  conn->plc_status = 0;
+
+  /* Pipelining was introduced in v2 */
+  if(conn->febe_proto_ver < PDSNP2_VER)
   {
-    return conn;
+    conn->plc_status = PDSNP_COMMS_FUNC_ERR;
+    return -1;
   }
-  else
+
+  switch(func_id)
   {
-    /* Assign the network stub host and port to the connection struct */
-    strncpy(conn->ip_addr, phost, PDS_IP_ADDR_LEN - 1);
-    conn->port = port;
+    case PDSNP2_GET_TAGS_FUNC_ID :
+    case PDSNP2_GET_HANDLES_FUNC_ID :
+    break;
 
-    /* Finally set the connection status to OK */
-    conn->conn_status = PDS_CONN_OK;
+    case PDSNP2_SET_TAGS_FUNC_ID :
+    case PDSNP2_SET_HANDLES_FUNC_ID :
+      writing = 1;
+    break;
+
+    default :
+      conn->plc_status = PDSNP_COMMS_FUNC_ERR;
+      return -1;
   }
 
-  return conn;
+  /* A pipelined request is sent in a single frame */
+  if(ntags < 0 || ntags > ((writing) ? PDSNP2_MAX_WRITES : PDSNP2_MAX_TAGS) ||
+     (writing && !tagvalues) ||
+     ((func_id == PDSNP2_GET_TAGS_FUNC_ID || func_id == PDSNP2_SET_TAGS_FUNC_ID) ? !tagnames : !handles))
+    return -1;
+
+  /* Make room at the end of the request table, discarding those collected */
+  if((np->reqoff + np->nreqs) == np->reqsize && np->reqoff > 0)
+  {
+    memmove(np->reqs, np->reqs + np->reqoff, (np->nreqs * sizeof(pdsnpreq)));
+    np->reqoff = 0;
+  }
+  else if((np->reqoff + np->nreqs) == np->reqsize)
+  {
+    size = (np->reqsize > 0) ? np->reqsize * 2 : PDSNP_REQS_LEN;
+
+    if(!(reqs = (pdsnpreq *) realloc(np->reqs, size * sizeof(pdsnpreq))))
+      return -1;
+
+    np->reqs = reqs;
+    np->reqsize = size;
+  }
+
+  /* N.B.: A request ID of 0 isn't pipelined */
+  if(++np->reqid > PDSNP_MAX_REQ_ID)
+    np->reqid = 1;
+
+  if(_build_request(conn, func_id, ntags,
+                    (func_id == PDSNP2_GET_TAGS_FUNC_ID || func_id == PDSNP2_SET_TAGS_FUNC_ID) ? tagnames : NULL,
+                    (func_id == PDSNP2_GET_HANDLES_FUNC_ID || func_id == PDSNP2_SET_HANDLES_FUNC_ID) ? handles : NULL,
+                    (writing) ? tagvalues : NULL, np->reqid) == -1)
+    return -1;
+
+  req = &np->reqs[np->reqoff + np->nreqs];
+  memset(req, 0, sizeof(pdsnpreq));
+  req->reqid = np->reqid;
+  req->func_id = func_id;
+  req->ntags = ntags;
+  req->values = (writing) ? NULL : values;
+  req->statuses = statuses;
+  np->nreqs++;
+
+  /* Send the requests once enough are buffered */
+  if((np->out.len - np->out.off) >= PDSNP_IO_LEN &&
+     comms_flush(conn->fd, &np->out, &np->in) == -1)
+  {
+    conn->plc_status = PDSNP_COMMS_WR_ERR;
+    return -1;
+  }
+
+  return (int) np->reqid;
 }
 
 
 
 /******************************************************************************
-* Function to disconnect a client from the server                             *
+* Function to collect the response to a pipelined request                     *
 *                                                                             *
-* Pre-condition:  A valid server connection struct is passed to the function  *
-* Post-condition: The client program is disconnected from the server.  If an  *
-*                 error occurrs a -1 is returned                              *
+* Pre-condition:  A valid server connection & a timeout (in usecs, or         *
+*                 PDS_WAIT_FOREVER) are passed to the function                *
+* Post-condition: Any buffered requests are sent, & the oldest request is     *
+*                 collected once its response has arrived.  Its tags' results *
+*                 have been stored, & the connection's PLC status is the      *
+*                 response's exception code.  The request's ID is returned.   *
+*                 If the timeout expires or a signal is caught, a 0 is        *
+*                 returned.  If no requests are outstanding, or on error, a   *
+*                 -1 is returned                                              *
 ******************************************************************************/
-int PDSNPdisconnect(pdsconn *conn)
+int PDSNPcollect(pdsconn *conn, long timeout)
 {
-  if(conn)
+  pdsnpstate *np = NULL;
+  pdsnp_buf *frame = NULL;
+  struct timeval tv, *tmo = NULL;
+  int reqid = 0, len = 0;
+
+  if(!conn || !(np = conn->npstate) || np->nreqs < 1)
+    return -1;
+
+  conn->plc_status = 0;
+
+  if(comms_flush(conn->fd, &np->out, &np->in) == -1)
   {
-    /* Disconnect from the PDS network stub */
-    close(conn->fd);
-    free(conn);
-    return 0;
+    conn->plc_status = PDSNP_COMMS_WR_ERR;
+    return -1;
   }
-  else
+
+  while(np->ndone == 0)
+  {
+    if(timeout >= 0)
+    {
+      tv.tv_sec = timeout / 1000000L;
+      tv.tv_usec = timeout % 1000000L;
+      tmo = &tv;
+    }
+
+    /* The timeout expired, or a signal was caught */
+    if((len = _read_frame(conn, &frame, tmo)) == 0)
+      return 0;
+
+    /* Only updates & pipelined responses arrive unrequested */
+    if(len == -1 || _dispatch_frame(conn, frame, len) != 1)
+    {
+      conn->plc_status = PDSNP_COMMS_RD_ERR;
+      return -1;
+    }
+  }
+
+  /* N.B.: The oldest request is always the first completed */
+  reqid = (int) np->reqs[np->reqoff].reqid;
+  conn->plc_status = np->reqs[np->reqoff].ex_code;
+
+  np->reqoff++;
+  np->nreqs--;
+  np->ndone--;
+
+  return reqid;
+}
+
+
+
+/******************************************************************************
+* Function to join the multicast group that the server publishes the tags to  *
+*                                                                             *
+* Pre-condition:  A valid server connection & the multicast group's IP        *
+*                 address & port are passed to the function                   *
+* Post-condition: The client joins the group, on the interface that it        *
+*                 reaches the server through, leaving any group it had        *
+*                 joined.  The client's image of the published tags is        *
+*                 filled by PDSNPread_mcast().  On error a -1 is returned     *
+******************************************************************************/
+int PDSNPjoin_mcast(pdsconn *conn, const char *group, unsigned short int port)
+{
+  pdsnpmcast *mc = NULL;
+  struct sockaddr_in local;
+  socklen_t len = sizeof(local);
+  char *host = NULL;
+
+  if(!conn || !conn->npstate || !group)
+    return -1;
+
+  conn->plc_status = 0;
+  _leave_mcast(conn);
+
+  if(!(mc = (pdsnpmcast *) calloc(1, sizeof(pdsnpmcast))))
+    return -1;
+
+  mc->fd = -1;
+  conn->npstate->mcast = mc;
+
+  /* The server publishes on its own subnet, which the client reaches it on */
+  if(getsockname(conn->fd, (struct sockaddr *) &local, &len) == 0 &&
+     local.sin_family == AF_INET)
+    host = inet_ntoa(local.sin_addr);
+
+  if((mc->fd = open_mcast_receiver_socket((char *) group, port, host)) == -1)
+  {
+    _leave_mcast(conn);
     return -1;
+  }
+
+  fcntl(mc->fd, F_SETFL, fcntl(mc->fd, F_GETFL) | O_NONBLOCK);
+
+  return 0;
 }
 
 
 
 /******************************************************************************
-* Function to get a tag's value                                               *
+* Function to read the frames published to the multicast group                *
 *                                                                             *
-* Pre-condition:  A valid server connection, the tagname and a string for     *
-*                 storage of the tag's value are passed to the function       *
-* Post-condition: The tagname is accessed in the shared memory segment and    *
-*                 its corresponding value is returned.  On error a -1 is      *
-*                 returned                                                    *
+* Pre-condition:  A valid server connection, that has joined the group, & a   *
+*                 timeout (in usecs, or PDS_WAIT_FOREVER) are passed to the   *
+*                 function                                                    *
+* Post-condition: The function waits for a frame to arrive, & then all the    *
+*                 frames that have arrived are applied to the client's image  *
+*                 of the published tags.  If frames were lost, the            *
+*                 connection's PLC status has PDSNP_COMMS_DROPPED set, & the  *
+*                 image is brought up to date by the next keyframe, or by     *
+*                 PDSNPsnapshot_mcast().  The no. of frames applied is        *
+*                 returned.  If the timeout expires or a signal is caught, a  *
+*                 0 is returned.  On error a -1 is returned                   *
 ******************************************************************************/
-int PDSNPget_tag(pdsconn *conn, const char *tagname, char *tagvalue)
+int PDSNPread_mcast(pdsconn *conn, long timeout)
 {
-  pdscomms comms;
-  int retval = -1;
+  pdsnpmcast *mc = NULL;
+  fd_set fds;
+  struct timeval tv, *tmo = NULL;
+  int len = 0, nframes = 0;
 
-  if(conn)
+  if(!conn || !conn->npstate || !(mc = conn->npstate->mcast))
+    return -1;
+
+  conn->plc_status = 0;
+
+  if(timeout >= 0)
   {
-    memset(&comms, 0, sizeof(pdscomms));
+    tv.tv_sec = timeout / 1000000L;
+    tv.tv_usec = timeout % 1000000L;
+    tmo = &tv;
+  }
 
-    PDSNP_SET_BUF_LEN(comms.buf, PDSNP_LEN);
-    PDSNP_SET_VER(comms.buf, PDSNP_VER);
-    PDSNP_SET_FUNC_ID(comms.buf, PDSNP_GET_TAG_FUNC_ID);
-    PDSNP_SET_EX_CODE(comms.buf, PDSNP_COMMS_OK);
-    PDSNP_SET_TAGNAME(comms.buf, tagname);
-    PDSNP_SET_TAGVALUE(comms.buf, "0");
+  FD_ZERO(&fds);
+  FD_SET(mc->fd, &fds);
 
-    comms.conn = conn;
+  if((len = select((mc->fd + 1), &fds, NULL, NULL, tmo)) < 1)
+    return (len == 0 || errno == EINTR) ? 0 : -1;
 
-    /* Send the request to get the value for the given tag */
-    if(comms_write(conn->fd, &comms) < 0)
+  /* N.B.: Frames that aren't published tags are ignored */
+  while((len = recv(mc->fd, mc->buf, PDSNP2_MAX_PUB_LEN, 0)) > 0)
+  {
+    if(_apply_publication(conn, mc, mc->buf, len) != -1)
+      nframes++;
+  }
+
+  if(len == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    return -1;
+
+  return nframes;
+}
+
+
+
+/******************************************************************************
+* Function to get a snapshot of the published tags from the server            *
+*                                                                             *
+* Pre-condition:  A valid server connection, that has joined the multicast    *
+*                 group, is passed to the function                            *
+* Post-condition: All the published tags are got from the server, over the    *
+*                 connection, as the server last published them, & applied    *
+*                 to the client's image, filling any gaps.  The no. of tags   *
+*                 in the image is returned.  On error a -1 is returned        *
+******************************************************************************/
+int PDSNPsnapshot_mcast(pdsconn *conn)
+{
+  pdsnpmcast *mc = NULL;
+  pdsnp_buf *frame = NULL;
+  unsigned int first = 0;
+  int len = 0, ntags = 0;
+
+  if(!conn || !conn->npstate || !(mc = conn->npstate->mcast))
+    return -1;
+
+  conn->plc_status = 0;
+
+  /* Snapshots were introduced in v2 */
+  if(conn->febe_proto_ver < PDSNP2_VER)
+  {
+    conn->plc_status = PDSNP_COMMS_FUNC_ERR;
+    return -1;
+  }
+
+  /* The tags are got a frame at a time, from the 1st tag not yet got */
+  do
+  {
+    if(!(frame = _start_frame(conn, (PDSNP2_HDR_LEN + PDSNP2_ID_LEN))))
+      return -1;
+
+    PDSNP2_SET_U32(PDSNP2_ITEMS(frame), first);
+    PDSNP2_SET_FUNC_ID(frame, PDSNP2_SNAPSHOT_FUNC_ID);
+    PDSNP2_SET_NTAGS(frame, 0);
+    _end_frame(conn, (PDSNP2_HDR_LEN + PDSNP2_ID_LEN), 0);
+
+    if(comms_flush(conn->fd, &conn->npstate->out, &conn->npstate->in) == -1)
     {
-      PDSNP_SET_EX_CODE(comms.buf, PDSNP_COMMS_WR_ERR);
-      conn->plc_status = PDSNP_GET_EX_CODE(comms.buf);
+      conn->plc_status |= PDSNP_COMMS_WR_ERR;
+      return -1;
     }
-    else
+
+    if((len = _read_response(conn, &frame)) == -1 ||
+       PDSNP_GET_FRAME_VER(frame) != PDSNP2_VER ||
+       PDSNP2_GET_FUNC_ID(frame) != PDSNP2_SNAPSHOT_FUNC_ID)
     {
-      if(comms_read(conn->fd, &comms) < 0)
-      {
-        PDSNP_SET_EX_CODE(comms.buf, PDSNP_COMMS_RD_ERR);
-        conn->plc_status = PDSNP_GET_EX_CODE(comms.buf);
-      }
-      else
-      {
-        /* Propagate comms status to the client */
-        conn->plc_status = PDSNP_GET_EX_CODE(comms.buf);
+      conn->plc_status |= PDSNP_COMMS_RD_ERR;
+      return -1;
+    }
 
-        /* Store the tagvalue in the string */
-        PDSNP_GET_TAGVALUE(tagvalue, comms.buf);
+    /* The server doesn't publish the tags */
+    if((conn->plc_status |= PDSNP2_GET_EX_CODE(frame)) != PDSNP_COMMS_OK)
+      return -1;
 
-        retval = 0;
-      }
+    if((ntags = _apply_publication(conn, mc, frame, len)) == -1)
+    {
+      conn->plc_status |= PDSNP_COMMS_RD_ERR;
+      return -1;
     }
+
+    first += ntags;
   }
+  while(ntags > 0 && first < (unsigned int) mc->ttags);
 
-  return retval;
+  return mc->ttags;
 }
 
 
 
 /******************************************************************************
-* Function to set tag value(s)                                                *
+* Function to get tags' values from the client's image of the published tags  *
 *                                                                             *
-* Pre-condition:  A valid server connection, the base tagname, the no. of     *
-*                 tags to write and the tag value(s) as an integer pointer    *
-*                 are passed to the function                                  *
-* Post-condition: A message is sent to the server requesting that the tag     *
-*                 value(s) be written to the PLC.  On error a -1 is returned  *
+* Pre-condition:  A valid server connection, that has joined the multicast    *
+*                 group, the no. of tags, the tags' handles & storage for the *
+*                 tags' values, statuses & acquisition times (nsecs since the *
+*                 epoch) are passed to the function.  The statuses & times    *
+*                 are optional                                                *
+* Post-condition: Each tag's latest value, status & time, as received from    *
+*                 the group, are stored.  A tag that hasn't been received has *
+*                 a read error status, & an invalid handle has an application *
+*                 error status.  The connection's PLC status is the           *
+*                 combination of all the tags' statuses.  On error a -1 is    *
+*                 returned                                                    *
 ******************************************************************************/
-int PDSNPset_tag(pdsconn *conn, const char *tagname, short int ntags,
-                 const short int *tagvalues)
+int PDSNPget_mcast_tags_h(pdsconn *conn, int ntags, const pdshandle *handles,
+                          unsigned short int *tagvalues,
+                          unsigned short int *tagstatuses,
+                          unsigned long long *tagmtimes_ns)
 {
-  pdscomms comms;
-  char tagvalue[PDSNP_TAGVALUE_LEN+1] = "\0";
-  int retval = -1;
+  pdsnpmcast *mc = NULL;
+  unsigned short int value = 0, status = 0;
+  unsigned long long mtime_ns = 0;
+  int id = 0;
+  register int i = 0;
 
-  if(conn)
-  {
-    memset(&comms, 0, sizeof(pdscomms));
+  if(!conn || !conn->npstate || !(mc = conn->npstate->mcast) ||
+     ntags < 0 || !handles || !tagvalues)
+    return -1;
 
-    PDSNP_SET_BUF_LEN(comms.buf, PDSNP_LEN);
-    PDSNP_SET_VER(comms.buf, PDSNP_VER);
-    PDSNP_SET_FUNC_ID(comms.buf, PDSNP_SET_TAG_FUNC_ID);
-    PDSNP_SET_EX_CODE(comms.buf, PDSNP_COMMS_OK);
-    PDSNP_SET_TAGNAME(comms.buf, tagname);
-    sprintf(tagvalue, "%u", *tagvalues);
-    PDSNP_SET_TAGVALUE(comms.buf, tagvalue);
+  conn->plc_status = 0;
 
-    comms.conn = conn;
+  for(i = 0; i < ntags; i++)
+  {
+    id = PDS_GET_HANDLE_INDEX(handles[i]);
 
-    /* Send the request to set the value for the given tag(s) */
-    if(comms_write(conn->fd, &comms) < 0)
+    /* Until the tags are first received, their values are unknown */
+    if(!mc->values)
     {
-      PDSNP_SET_EX_CODE(comms.buf, PDSNP_COMMS_WR_ERR);
-      conn->plc_status = PDSNP_GET_EX_CODE(comms.buf);
+      value = 0;
+      status = PDSNP_COMMS_RD_ERR;
+      mtime_ns = 0;
+    }
+    /* The handle must be from the server instance that published the tags */
+    else if(handles[i] < 0 || PDS_GET_HANDLE_GEN(handles[i]) != mc->gen ||
+            id >= mc->ttags)
+    {
+      value = 0;
+      status = PDSNP_COMMS_APP_ERR;
+      mtime_ns = 0;
     }
     else
     {
-      if(comms_read(conn->fd, &comms) < 0)
-      {
-        PDSNP_SET_EX_CODE(comms.buf, PDSNP_COMMS_RD_ERR);
-        conn->plc_status = PDSNP_GET_EX_CODE(comms.buf);
-      }
-      else
-      {
-        /* Propagate comms status to the client */
-        conn->plc_status = PDSNP_GET_EX_CODE(comms.buf);
-
-        retval = 0;
-      }
+      value = mc->values[id];
+      status = mc->statuses[id];
+      mtime_ns = mc->mtimes_ns[id];
     }
+
+    tagvalues[i] = value;
+    if(tagstatuses) tagstatuses[i] = status;
+    if(tagmtimes_ns) tagmtimes_ns[i] = mtime_ns;
+
+    conn->plc_status |= status;
   }
 
-  return retval;
+  return 0;
 }
-
@@ -68,3 +68,179 @@ int comms_write(int fd, pdscomms *comms)
     return send(fd, comms->buf, PDSNP_GET_BUF_LEN(comms->buf), 0);
 }
 
+
+
+
+/******************************************************************************
+* Function to make room at the end of a buffered stream                       *
+*                                                                             *
+* Pre-condition:  The stream & the no. of bytes to make room for are passed   *
+*                 to the function                                             *
+* Post-condition: Any consumed data is discarded & the buffer is grown if     *
+*                 need be, so that the bytes can be appended at the end of    *
+*                 the stream's data.  On error a -1 is returned               *
+******************************************************************************/
+int comms_reserve(pdsnpio *io, int len)
+{
+  pdsnp_buf *buf = NULL;
+  int size = 0;
+
+  /* Move the unconsumed data to the start of the buffer */
+  if(io->off > 0)
+  {
+    io->len -= io->off;
+    memmove(io->buf, io->buf + io->off, io->len);
+    io->off = 0;
+  }
+
+  if((io->size - io->len) >= len)
+    return 0;
+
+  for(size = (io->size > 0) ? io->size : PDSNP_IO_LEN; (size - io->len) < len; size *= 2);
+
+  if(!(buf = (pdsnp_buf *) realloc(io->buf, size)))
+    return -1;
+
+  io->buf = buf;
+  io->size = size;
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to fill a buffered stream from a particular socket fd              *
+*                                                                             *
+* Pre-condition:  Socket fd, the stream & a timeout (NULL waits forever) are  *
+*                 passed to the function                                      *
+* Post-condition: Once the socket is ready for reading, as much data as has   *
+*                 arrived & will fit in the stream is received, with a single *
+*                 recv().  The number of bytes read is returned, or 0 if the  *
+*                 timeout expired or a signal was caught.  If the peer has    *
+*                 closed the socket, or on error, a -1 is returned            *
+******************************************************************************/
+int comms_fill(int fd, pdsnpio *in, struct timeval *tv)
+{
+  fd_set fds;
+  int nread = 0;
+
+  FD_ZERO(&fds);
+  FD_SET(fd, &fds);
+
+  if(comms_reserve(in, PDSNP_LEN) == -1)
+    return -1;
+
+  /* Check that the socket is ready for reading and receive the data */
+  if((nread = select((fd + 1), &fds, NULL, NULL, tv)) < 1)
+    return (nread == 0 || errno == EINTR) ? 0 : -1;
+
+  if((nread = recv(fd, in->buf + in->len, (in->size - in->len), 0)) < 1)
+    return -1;
+
+  in->len += nread;
+
+  return nread;
+}
+
+
+
+/******************************************************************************
+* Function to get the next frame from a buffered stream                       *
+*                                                                             *
+* Pre-condition:  The stream & a pointer for the frame are passed to the      *
+*                 function                                                    *
+* Post-condition: If a whole frame (of either version) is at the start of the *
+*                 stream's data, it is consumed, its address is stored, & its *
+*                 length is returned.  The frame is valid until the stream is *
+*                 next filled.  If the frame hasn't all arrived, room is made *
+*                 for it & a 0 is returned.  If the frame is invalid a -1 is  *
+*                 returned                                                    *
+******************************************************************************/
+int comms_next_frame(pdsnpio *in, pdsnp_buf **frame)
+{
+  pdsnp_buf *p = in->buf + in->off;
+  int avail = in->len - in->off, len = 0;
+
+  if(avail < 1)
+    return 0;
+
+  /* A v1 frame has a fixed length, & a v2 frame is prefixed by its length */
+  if(PDSNP_GET_FRAME_VER(p) == PDSNP1_VER)
+  {
+    if((len = PDSNP_GET_BUF_LEN(p)) != PDSNP_LEN)
+      return -1;
+  }
+  else
+  {
+    if(avail < PDSNP2_BUF_LEN)
+      return 0;
+
+    if((len = PDSNP2_GET_BUF_LEN(p)) < PDSNP2_HDR_LEN || len > PDSNP2_MAX_LEN)
+      return -1;
+  }
+
+  if(avail < len)
+    return (comms_reserve(in, (len - avail)) == -1) ? -1 : 0;
+
+  *frame = p;
+  in->off += len;
+
+  return len;
+}
+
+
+
+/******************************************************************************
+* Function to flush a buffered stream on a particular socket fd               *
+*                                                                             *
+* Pre-condition:  Socket fd, the stream to send & the stream to receive on    *
+*                 are passed to the function                                  *
+* Post-condition: The stream's data is written on the socket.  Whilst waiting *
+*                 for the socket to be ready for writing, any data that       *
+*                 arrives is received into the receive stream, so that a peer *
+*                 that is blocked sending responses is never waited on.  The  *
+*                 number of bytes written is returned or -1 on error          *
+******************************************************************************/
+int comms_flush(int fd, pdsnpio *out, pdsnpio *in)
+{
+  fd_set rfds, wfds;
+  struct timeval tv;
+  int nwritten = 0, writetotal = 0;
+
+  while(out->off < out->len)
+  {
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    FD_SET(fd, &rfds);
+    FD_SET(fd, &wfds);
+    tv.tv_sec = PDSNP_TMO_SECS;
+    tv.tv_usec = PDSNP_TMO_USECS;
+
+    if((select((fd + 1), &rfds, &wfds, NULL, &tv)) < 1)
+      return -1;
+
+    if(FD_ISSET(fd, &rfds))
+    {
+      if(comms_reserve(in, PDSNP_IO_LEN) == -1 ||
+         (nwritten = recv(fd, in->buf + in->len, (in->size - in->len), 0)) < 1)
+        return -1;
+
+      in->len += nwritten;
+    }
+
+    if(FD_ISSET(fd, &wfds))
+    {
+      if((nwritten = send(fd, out->buf + out->off, (out->len - out->off), 0)) < 1)
+        return -1;
+
+      out->off += nwritten;
+      writetotal += nwritten;
+    }
+  }
+
+  out->off = out->len = 0;
+
+  return writetotal;
+}
+
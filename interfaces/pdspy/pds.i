@@ -55,6 +55,27 @@ typedef long int time_t;
 extern int PDSset_wordbit_state(pdsconn *conn, char *tagname, unsigned short int *tagvalue, int bitno, int bitvalue);
 %}
 
+/* Return the raw value & status from the handle-based get as outputs */
+%apply unsigned short int *OUTPUT {unsigned short int *hvalue, unsigned short int *hstatus};
+%apply unsigned short int *OUTPUT {unsigned short int *wrstatus};
+
+/* Return a tag's sample history ring as a read-only buffer onto the shared
+   memory, so that trending clients can read the samples without copying
+   them (e.g., with numpy.frombuffer()).  The buffer is only valid whilst
+   connected.  If the tag has no history, None is returned */
+%inline %{
+PyObject* PDSget_tag_history_buffer(pdsconn *conn, pdshandle h)
+{
+  const pdssample *ring = NULL;
+  int depth = 0;
+
+  if(!(ring = PDSget_tag_history_ring(conn, h, &depth)))
+    Py_RETURN_NONE;
+
+  return PyMemoryView_FromMemory((char *) ring, (depth * sizeof(pdssample)), PyBUF_READ);
+}
+%}
+
 %include "pds_defs.h"
 %include "pds_api.h" 
 %include "pds_ipc.h"
@@ -56,6 +56,117 @@ int open_server_socket(char *host, unsigned short int port)
 
 
 
+/******************************************************************************
+* Function to open a UDP/IP multicast sender socket                           *
+*                                                                             *
+* Pre-condition:  The multicast group's IP address & port, the host name (or  *
+*                 IP address) of the interface to send on & the datagrams'    *
+*                 TTL are passed to the function                              *
+* Post-condition: Socket is connected to the group, so that datagrams can be  *
+*                 sent to it with send(), socket file descriptor is returned  *
+*                 or -1 on error                                              *
+******************************************************************************/
+int open_mcast_sender_socket(char *group, unsigned short int port,
+                             char *host, int ttl)
+{
+  struct sockaddr_in address;
+  struct hostent *hostinfo = NULL;
+  struct in_addr iface;
+  unsigned char sopt = 0;
+  int sockfd = -1;
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+
+  if(!inet_aton(group, &address.sin_addr) ||
+     !IN_MULTICAST(ntohl(address.sin_addr.s_addr)))
+    return -1;
+
+  if((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+    return -1;
+
+  /* Send on the host's interface, unless it's the wildcard address, in
+     which case the routing table chooses the interface */
+  if(host && (hostinfo = (struct hostent *) gethostbyname(host)))
+  {
+    iface = *(struct in_addr*)*hostinfo->h_addr_list;
+
+    if(iface.s_addr != htonl(INADDR_ANY))
+      setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface));
+  }
+
+  sopt = (unsigned char) ttl;
+  setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_TTL, &sopt, sizeof(sopt));
+
+  /* Loop the datagrams back, so that receivers on this host get them too */
+  sopt = 1;
+  setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_LOOP, &sopt, sizeof(sopt));
+
+  if(connect(sockfd, (struct sockaddr *)&address, sizeof(address)) == -1)
+  {
+    close(sockfd);
+    sockfd = -1;
+  }
+
+  return sockfd;
+}
+
+
+
+/******************************************************************************
+* Function to open a UDP/IP multicast receiver socket                         *
+*                                                                             *
+* Pre-condition:  The multicast group's IP address & port & the host name (or *
+*                 IP address) of the interface to receive on are passed to    *
+*                 the function.  If the host is NULL, the routing table       *
+*                 chooses the interface                                       *
+* Post-condition: Socket is bound to the group's port & joined to the group   *
+*                 on the interface, socket file descriptor is returned or -1  *
+*                 on error                                                    *
+******************************************************************************/
+int open_mcast_receiver_socket(char *group, unsigned short int port,
+                               char *host)
+{
+  struct sockaddr_in address;
+  struct hostent *hostinfo = NULL;
+  struct ip_mreq mreq;
+  int sockfd = -1, sopt = 0;
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+
+  if(!inet_aton(group, &address.sin_addr) ||
+     !IN_MULTICAST(ntohl(address.sin_addr.s_addr)))
+    return -1;
+
+  mreq.imr_multiaddr = address.sin_addr;
+  mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+
+  if(host && (hostinfo = (struct hostent *) gethostbyname(host)))
+    mreq.imr_interface = *(struct in_addr*)*hostinfo->h_addr_list;
+
+  if((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+    return -1;
+
+  /* Several receivers on a host can join the same group.  Binding to the
+     group's address means that only the group's datagrams are received */
+  sopt = 1;
+  setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &sopt, sizeof(int));
+
+  if(bind(sockfd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+     setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1)
+  {
+    close(sockfd);
+    sockfd = -1;
+  }
+
+  return sockfd;
+}
+
+
+
 /******************************************************************************
 * Function to connect client to network server socket                         *
 *                                                                             *
@@ -11,8 +11,13 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <netdb.h>
@@ -21,9 +26,11 @@
 #include <sys/ioctl.h>
 #include <signal.h>
 #include <errno.h>
+#include <time.h>
 
 #include <daemon.h>
 #include <debug.h>
+#include <nw_comms.h>
 #include <pdsnp_defs.h>
 
 /******************************************************************************
@@ -38,13 +45,40 @@
 #define PDS_NWSTUB_DEF_HOST	"localhost"
 #define PDS_NWSTUB_DEF_PORT	9574
 
-#define PDS_NWSTUB_SOCKQ	5
-#define PDS_NWSTUB_MAXFD	32 
-#define PDS_NWSTUB_TMO_SECS	15
-#define PDS_NWSTUB_TMO_USECS	0
-#define PDS_NWSTUB_SEC		1000000
-#define PDS_NWSTUB_CLNTRDPAUSE	(PDS_NWSTUB_SEC / 2)
-#define PDS_NWSTUB_CLNTRDTRIES	8
+#define PDS_NWSTUB_SOCKQ	PDSNP_SOCKQ
+#define PDS_NWSTUB_MAXEVENTS	256    /* Max. epoll events per wait */
+#define PDS_NWSTUB_WRPOLL	1      /* msec write completion poll */
+#define PDS_NWSTUB_BUFLEN	(PDSNP_LEN * 16) /* Initial client buffer length */
+
+/* The client buffers grow to hold a v2 frame, but once a client has this
+   much data queued to send, its requests wait until some has been sent */
+#define PDS_NWSTUB_WRHIWAT	PDS_NWSTUB_BUFLEN
+
+/* The writes in flight are tracked by the PDS connection's request table, so
+   they are limited to the table's size.  A client's write request waits for
+   room in the table */
+#define PDS_NWSTUB_MAXWRITES	PDS_WRREQ_MAX
+
+/* A subscriber's updates are coalesced per tag, & at most this many are
+   queued to be pushed to it.  When the queue is full, the oldest update is
+   dropped.  The change journal is polled whilst there are subscribers */
+#define PDS_NWSTUB_SUBQLEN	1024
+#define PDS_NWSTUB_SUBPOLL	10     /* msec change journal poll */
+#define PDS_NWSTUB_CHGBATCH	4096   /* Changes read from the journal at once */
+
+/* The multicast publisher (if enabled) publishes each batch of changes read
+   from the journal as it's read, & a keyframe of all the tags periodically.
+   The datagrams stay on the local subnet, & the socket's send buffer holds
+   a keyframe of many tags.  N.B.: A datagram that can't be sent is dropped,
+   & the clients see the gap in the sequence nos. */
+#define PDS_NWSTUB_DEF_MCAST_PORT	9575
+#define PDS_NWSTUB_DEF_KEYFRAME	1000   /* msec keyframe interval */
+#define PDS_NWSTUB_MCAST_TTL	1
+#define PDS_NWSTUB_MCAST_SNDBUF	1048576
+
+/* The listening socket is registered with epoll with a null pointer, & each
+   client's socket with a pointer to its client struct */
+#define PDS_NWSTUB_LISTENER	NULL
 
 /******************************************************************************
 * Structure definitions                                                       *
@@ -57,8 +91,91 @@ typedef struct nwstub_args_rec
 {
   char *host;                     /* The host {IP address|hostname} */
   unsigned short int port;        /* The nwstub's well-known port */
+  char *mcast_group;              /* The multicast group (NULL = none) */
+  unsigned short int mcast_port;  /* The multicast group's port */
+  unsigned int keyframe;          /* Keyframe interval (msecs, 0 = none) */
 } nwstub_args;
 
+/******************************************************************************
+* nwstub's tag subscription struct definition                                 *
+******************************************************************************/
+typedef struct nwstub_subtag_rec
+{
+  unsigned int id;                /* The tag's index in the subscription */
+  int tag;                        /* The tag's index in the PDS (-1 = none) */
+  unsigned short int deadband;    /* Min. change in value to push */
+  unsigned short int value;       /* The tag's latest value */
+  unsigned short int status;      /* The tag's latest status */
+  unsigned short int sent_value;  /* The tag's value last pushed */
+  unsigned short int sent_status; /* The tag's status last pushed */
+  int queued;                     /* An update is queued (bool) */
+  struct nwstub_client_rec *client; /* The subscribed client */
+  struct nwstub_subtag_rec *next; /* Next subscription to the same tag */
+} nwstub_subtag;
+
+/******************************************************************************
+* nwstub's client connection struct definition                                *
+******************************************************************************/
+typedef struct nwstub_client_rec
+{
+  int fd;                         /* The client's socket fd */
+  unsigned int events;            /* The epoll events registered */
+  pdsnp_buf *rbuf;                /* Requests received */
+  int rlen;                       /* No. of bytes in the receive buffer */
+  int rsize;                      /* Size of the receive buffer */
+  pdsnp_buf *wbuf;                /* Responses to send */
+  int wlen;                       /* No. of bytes in the send buffer */
+  int wsize;                      /* Size of the send buffer */
+  int wrwait;                     /* Waiting for writes (bool) */
+  int *wrreqs;                    /* IDs of the request's writes (0 = done) */
+  int wrreqsize;                  /* Size of the write IDs buffer */
+  int nwrreqs;                    /* No. of writes in the request */
+  int nwrpending;                 /* No. of the writes still in flight */
+  pdsnp_buf *wrframe;             /* The response to the writes */
+  int wrlen;                      /* Length of the response */
+  int wrsize;                     /* Size of the response buffer */
+  struct nwstub_client_rec *next_wr; /* Next client waiting for writes */
+  nwstub_subtag *subtags;         /* The tags subscribed to */
+  int nsubtags;                   /* No. of tags subscribed to */
+  unsigned long long interval_ns; /* Min. interval between updates */
+  unsigned long long next_push_ns; /* Time the next update may be pushed */
+  nwstub_subtag **subq;           /* Updates to push (ring buffer) */
+  int subqsize;                   /* Size of the update queue */
+  int subqhead;                   /* Index of the oldest update queued */
+  int subqlen;                    /* No. of updates queued */
+  int subdropped;                 /* Updates have been dropped (bool) */
+  struct nwstub_client_rec *next_sub; /* Next subscribed client */
+} nwstub_client;
+
+/******************************************************************************
+* nwstub's server struct definition                                           *
+******************************************************************************/
+typedef struct nwstub_rec
+{
+  int serverfd;                   /* The listening socket fd */
+  int epfd;                       /* The epoll fd */
+  int nclients;                   /* No. of connected clients */
+  pdscomms *comms;                /* The comms struct, with the PDS conn. */
+  nwstub_client *wrclients;       /* Clients waiting for writes */
+  int nwrites;                    /* No. of writes in flight */
+  nwstub_client *subclients;      /* Subscribed clients */
+  nwstub_subtag **tagsubs;        /* Each PDS tag's subscriptions */
+  int ntagsubs;                   /* No. of PDS tags (size of tagsubs) */
+  unsigned long long jseq;        /* Last change read from the journal */
+  pdschange *changes;             /* Changes read from the journal */
+  int mcastfd;                    /* The multicast socket fd (-1 = none) */
+  unsigned int pubseq;            /* Seq. no. of the last frame published */
+  int npubtags;                   /* No. of PDS tags published */
+  unsigned short int *pubvalues;  /* The tags' values as published */
+  unsigned short int *pubstatuses; /* The tags' statuses as published */
+  unsigned char *pubchanged;      /* Each tag has changed in the batch */
+  unsigned int *pubids;           /* IDs of the tags changed in the batch */
+  int npubids;                    /* No. of tags changed in the batch */
+  unsigned long long keyframe_ns; /* Interval between keyframes (0 = none) */
+  unsigned long long next_key_ns; /* Time the next keyframe is due */
+  unsigned int npubdropped;       /* No. of datagrams that couldn't be sent */
+} nwstub;
+
 /******************************************************************************
 * Function prototypes                                                         *
 ******************************************************************************/
@@ -87,15 +204,6 @@ void install_signal_handler(void);
 ******************************************************************************/
 void set_quit(int sig);
 
-/******************************************************************************
-* Function to handle child signal                                             *
-*                                                                             *
-* Pre-condition:  Signal has been received                                    *
-* Post-condition: Child process is prevented from becoming a zombie process,  *
-*                 signal handler is re-installed                              *
-******************************************************************************/
-void cleanup_child(int sig);
-
 /******************************************************************************
 * Function to parse the command line arguments                                *
 *                                                                             *
@@ -112,37 +220,370 @@ int parse_nwstub_cmdln(int argc, char *argv[], nwstub_args *args);
 * Pre-condition:  The command line args struct & the comms struct containing  *
 *                 a valid PDS connection are passed to the function           *
 * Post-condition: The nwstub listens on its well-known port & accepts         *
-*                 incoming client connections.  It acts as a network gateway  *
-*                 to the PDS.  On error a -1 is returned                      *
+*                 incoming client connections.  All clients are serviced by   *
+*                 this process, as their requests arrive, sharing its PDS     *
+*                 connection.  It acts as a network gateway to the PDS.  On   *
+*                 error a -1 is returned                                      *
 ******************************************************************************/
 int nwstub_main(nwstub_args *args, pdscomms *comms);
 
 /******************************************************************************
-* Function to encapsulate the new backend process's core functionality        *
+* Function to accept pending client connections                               *
 *                                                                             *
-* Pre-condition:  The connected client socket & the comms struct containing   *
-*                 a valid PDS connection are passed to the function           *
-* Post-condition: The new backend server process services this client until   *
-*                 the client disconnects.  On error a -1 is returned          *
+* Pre-condition:  The nwstub struct is passed to the function                 *
+* Post-condition: Each pending client connection is accepted, made            *
+*                 non-blocking & registered with epoll.  The no. of clients   *
+*                 connected is returned                                       *
 ******************************************************************************/
-int new_backend_main(int fd, pdscomms *comms);
+int accept_clients(nwstub *stub);
+
+/******************************************************************************
+* Function to close a client connection                                       *
+*                                                                             *
+* Pre-condition:  The nwstub struct & the client are passed to the function   *
+* Post-condition: The client is removed from epoll, from the clients waiting  *
+*                 for writes & from the tags it subscribed to, its socket is  *
+*                 closed & it is freed.  The no. of clients still connected   *
+*                 is returned                                                 *
+******************************************************************************/
+int close_client(nwstub *stub, nwstub_client *client);
+
+/******************************************************************************
+* Function to service a client's socket activity                              *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the client & its epoll events are passed *
+*                 to the function                                             *
+* Post-condition: Any data pending on the client's socket is received, each   *
+*                 complete request is processed & the responses are sent.  If *
+*                 the client has disconnected or an error occurs, the client  *
+*                 is closed & a -1 is returned                                *
+******************************************************************************/
+int service_client(nwstub *stub, nwstub_client *client, unsigned int events);
+
+/******************************************************************************
+* Function to process a client's complete requests                            *
+*                                                                             *
+* Pre-condition:  The nwstub struct & the client are passed to the function   *
+* Post-condition: Each complete request in the client's receive buffer is     *
+*                 processed in turn, & its response is queued in the          *
+*                 client's send buffer.  Processing stops at a write, until   *
+*                 it has completed, or when the send buffer is full.  The no. *
+*                 of requests processed is returned.  If the client sent an   *
+*                 invalid request a -1 is returned                            *
+******************************************************************************/
+int process_client_requests(nwstub *stub, nwstub_client *client);
+
+/******************************************************************************
+* Function to complete the clients' writes                                    *
+*                                                                             *
+* Pre-condition:  The nwstub struct is passed to the function                 *
+* Post-condition: The clients' writes in flight are polled for completion.    *
+*                 When all of a client's writes have completed, their         *
+*                 response is sent to the client, & any further requests from *
+*                 the client are processed.  The no. of writes completed is   *
+*                 returned                                                    *
+******************************************************************************/
+int complete_client_writes(nwstub *stub);
+
+/******************************************************************************
+* Function to update the epoll events a client is registered with             *
+*                                                                             *
+* Pre-condition:  The nwstub struct & the client are passed to the function   *
+* Post-condition: The client waits to receive requests unless it's waiting    *
+*                 for writes or its receive buffer is full, & waits to send   *
+*                 whilst it has responses queued.  On error a -1 is returned  *
+******************************************************************************/
+int update_client_events(nwstub *stub, nwstub_client *client);
 
 /******************************************************************************
 * Function to process the received comms data                                 *
 *                                                                             *
-* Pre-condition:  A comms struct is passed to the function                    *
+* Pre-condition:  A comms struct & the client that sent it are passed to the  *
+*                 function                                                    *
 * Post-condition: Data in the structure is processed, a flag is returned      *
-*                 indicating whether a write operation is necessary or not    *
+*                 indicating whether a write operation is necessary or not.   *
+*                 A write to the PLC is sent to the PDS without waiting for   *
+*                 it to complete, & its ID is stored in the client, so the    *
+*                 flag is unset                                               *
+******************************************************************************/
+int process_comms_data(pdscomms *comms, nwstub_client *client);
+
+/******************************************************************************
+* Function to process a client's batch (v2) request                           *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the client & its request frame are       *
+*                 passed to the function                                      *
+* Post-condition: Each of the batch's tags is got, set, resolved or           *
+*                 subscribed to, or the published tags are snapshotted.  For  *
+*                 a get, resolve, subscribe or snapshot, the response is      *
+*                 queued in the client's send buffer & a 1 is returned.  For  *
+*                 a set, the writes are sent to the PDS without waiting for   *
+*                 them to complete, their IDs are stored in the client, & a 0 *
+*                 is returned.  If the request is invalid a -1 is returned    *
+******************************************************************************/
+int process_batch_data(nwstub *stub, nwstub_client *client,
+                       const pdsnp_buf *req, int len);
+
+/******************************************************************************
+* Function to subscribe a client to a set of tags                             *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the client, the no. of tags & the min.   *
+*                 interval between updates (in msecs) are passed to the       *
+*                 function                                                    *
+* Post-condition: Any tags the client was subscribed to are unsubscribed, &   *
+*                 room is made for the new tags, which the caller then fills  *
+*                 in.  The change journal is brought up to date first, so     *
+*                 that only changes after the tags are read are pushed.  On   *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+int subscribe_client(nwstub *stub, nwstub_client *client, int ntags,
+                     unsigned int interval);
+
+/******************************************************************************
+* Function to unsubscribe a client from its tags                              *
+*                                                                             *
+* Pre-condition:  The nwstub struct & the client are passed to the function   *
+* Post-condition: The client's subscriptions are removed from the tags' &     *
+*                 freed, & any updates queued for the client are dropped.     *
+*                 The no. of tags unsubscribed is returned                    *
+******************************************************************************/
+int unsubscribe_client(nwstub *stub, nwstub_client *client);
+
+/******************************************************************************
+* Function to publish the changes to the tags to the subscribed clients       *
+*                                                                             *
+* Pre-condition:  The nwstub struct is passed to the function                 *
+* Post-condition: The changes since those last read are read from the PDS's   *
+*                 change journal, & queued for the clients subscribed to the  *
+*                 changed tags, & published to the multicast group.  Each     *
+*                 client's queued updates are then pushed to it, if its min.  *
+*                 interval has elapsed, & a keyframe is published if one is   *
+*                 due.  If the journal has overrun, the subscribed &          *
+*                 published tags are read afresh.  The no. of changes read is *
+*                 returned                                                    *
+******************************************************************************/
+int publish_changes(nwstub *stub);
+
+/******************************************************************************
+* Function to read the subscribed tags afresh                                 *
+*                                                                             *
+* Pre-condition:  The nwstub struct is passed to the function                 *
+* Post-condition: Each subscribed tag's value & status are read from the PDS  *
+*                 & queued for the tag's subscribers if they have changed.    *
+*                 The no. of tags read is returned                            *
+******************************************************************************/
+int resync_subscriptions(nwstub *stub);
+
+/******************************************************************************
+* Function to queue a tag's update for its subscriber                         *
+*                                                                             *
+* Pre-condition:  The tag's subscription & its new value & status are passed  *
+*                 to the function                                             *
+* Post-condition: The tag's latest value & status are stored.  If the change  *
+*                 since the value last pushed exceeds the tag's deadband, or  *
+*                 the status has changed, the update is queued, unless one is *
+*                 already queued.  If the client's queue is full, its oldest  *
+*                 update is dropped.  If the update is queued a 1 is returned *
+*                 else a 0 is returned                                        *
+******************************************************************************/
+int queue_update(nwstub_subtag *sub, unsigned short int value,
+                 unsigned short int status);
+
+/******************************************************************************
+* Function to push the updates queued for a subscribed client                 *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the client & the time now (monotonic     *
+*                 nsecs) are passed to the function                           *
+* Post-condition: If the client's min. interval has elapsed, & it isn't       *
+*                 behind with receiving its responses, its queued updates are *
+*                 sent to it in an update frame.  The frame's exception code  *
+*                 tells the client if updates were dropped.  N.B.: A client   *
+*                 in error is closed when epoll reports it.  The no. of       *
+*                 updates pushed is returned                                  *
+******************************************************************************/
+int push_updates(nwstub *stub, nwstub_client *client, unsigned long long now_ns);
+
+/******************************************************************************
+* Function to open the multicast publisher                                    *
+*                                                                             *
+* Pre-condition:  The nwstub struct & the command line args struct, holding   *
+*                 the multicast group, are passed to the function             *
+* Post-condition: A non-blocking socket is opened to send to the group, on    *
+*                 the nwstub's host's interface.  The tags are read, & the    *
+*                 publication starts from the journal's latest change, with a *
+*                 keyframe.  On error a -1 is returned                        *
+******************************************************************************/
+int open_publisher(nwstub *stub, nwstub_args *args);
+
+/******************************************************************************
+* Function to close the multicast publisher                                   *
+*                                                                             *
+* Pre-condition:  The nwstub struct is passed to the function                 *
+* Post-condition: The multicast socket is closed & the published tags are     *
+*                 freed.  The no. of datagrams that couldn't be sent is       *
+*                 returned                                                    *
+******************************************************************************/
+int close_publisher(nwstub *stub);
+
+/******************************************************************************
+* Function to read the published tags afresh                                  *
+*                                                                             *
+* Pre-condition:  The nwstub struct is passed to the function                 *
+* Post-condition: Each tag's value & status are read from the PDS, as of the  *
+*                 journal's last change read, & a keyframe is published.      *
+*                 The no. of tags read is returned                            *
+******************************************************************************/
+int resync_publication(nwstub *stub);
+
+/******************************************************************************
+* Function to stage a tag's change for publication                            *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the tag's ID & its new value & status    *
+*                 are passed to the function                                  *
+* Post-condition: The tag's value & status to publish are stored, & the tag   *
+*                 is added to the batch's changed tags, unless it's already   *
+*                 there, in which case the change is coalesced.  If the tag   *
+*                 is added a 1 is returned else a 0 is returned               *
+******************************************************************************/
+int stage_publication(nwstub *stub, unsigned int id, unsigned short int value,
+                      unsigned short int status);
+
+/******************************************************************************
+* Function to publish a batch of changes to the multicast group               *
+*                                                                             *
+* Pre-condition:  The nwstub struct, with the batch's changes staged, is      *
+*                 passed to the function                                      *
+* Post-condition: The changed tags' latest values are published in a frame    *
+*                 per block, as of the journal's last change read, & the      *
+*                 batch is emptied.  The no. of frames published is returned  *
+******************************************************************************/
+int publish_batch(nwstub *stub);
+
+/******************************************************************************
+* Function to publish a keyframe to the multicast group                       *
+*                                                                             *
+* Pre-condition:  The nwstub struct & the time now (monotonic nsecs) are      *
+*                 passed to the function                                      *
+* Post-condition: All the tags' values are published in a frame per block,    *
+*                 as of the journal's last change read, & the next keyframe   *
+*                 is due after the keyframe interval.  The no. of frames      *
+*                 published is returned                                       *
+******************************************************************************/
+int publish_keyframe(nwstub *stub, unsigned long long now_ns);
+
+/******************************************************************************
+* Function to publish tags to the multicast group                             *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the function ID of the frames, the tags' *
+*                 IDs (in order, or NULL for all the tags) & the no. of tags  *
+*                 are passed to the function                                  *
+* Post-condition: The tags' published values & statuses are sent in frames    *
+*                 holding one block's tags each, as many as fit in a          *
+*                 datagram.  Each frame is stamped with the latest            *
+*                 acquisition time of its tags.  The no. of frames published  *
+*                 is returned                                                 *
+******************************************************************************/
+int publish_frames(nwstub *stub, int func_id, const unsigned int *ids, int nids);
+
+/******************************************************************************
+* Function to send a frame to the multicast group                             *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the frame holding its tags, its function *
+*                 ID, no. of tags, block ID & time are passed to the function *
+* Post-condition: The frame's headers are set, stamped with the next sequence *
+*                 no., & the frame is sent as a datagram.  If it can't be     *
+*                 sent, it's dropped.  The frame's length is returned, or -1  *
+*                 if it was dropped                                           *
+******************************************************************************/
+int send_publication(nwstub *stub, pdsnp_buf *frame, int func_id, int ntags,
+                     int block_id, unsigned long long mtime_ns);
+
+/******************************************************************************
+* Function to set the headers of a published frame                            *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the frame, its length, function ID, no.  *
+*                 of tags, block ID & time are passed to the function         *
+* Post-condition: The frame's v2 header & its publication header are set,     *
+*                 with the values as of the journal's last change read.  The  *
+*                 caller sets the request ID                                  *
+******************************************************************************/
+int set_publication_hdr(nwstub *stub, pdsnp_buf *frame, int len, int func_id,
+                        int ntags, int block_id, unsigned long long mtime_ns);
+
+/******************************************************************************
+* Function to queue a snapshot of the published tags for a client             *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the client & its request frame, holding  *
+*                 the ID of the 1st tag, are passed to the function           *
+* Post-condition: The published tags, from the 1st tag, are queued in the     *
+*                 client's send buffer, as many as fit in a frame, as of the  *
+*                 journal's last change read.  If the tags aren't published,  *
+*                 the response has a function error.  A 1 is returned.  If    *
+*                 the request is invalid a -1 is returned                     *
+******************************************************************************/
+int queue_snapshot(nwstub *stub, nwstub_client *client, const pdsnp_buf *req,
+                   int len);
+
+/******************************************************************************
+* Function to compare two tags' IDs (for qsort)                               *
+*                                                                             *
+* Pre-condition:  Pointers to the two IDs are passed to the function          *
+* Post-condition: A -1, 0 or 1 is returned if the 1st ID is less than, equal  *
+*                 to or greater than the 2nd ID                               *
+******************************************************************************/
+int compare_tag_ids(const void *a, const void *b);
+
+/******************************************************************************
+* Function to receive the data pending on a client's socket                   *
+*                                                                             *
+* Pre-condition:  The client is passed to the function                        *
+* Post-condition: The data pending on the socket is appended to the client's  *
+*                 receive buffer, until there's none left or the buffer is    *
+*                 full.  The no. of bytes received is returned.  If the       *
+*                 client has closed the socket, a 0 is returned.  On error a  *
+*                 -1 is returned                                              *
+******************************************************************************/
+int read_client(nwstub_client *client);
+
+/******************************************************************************
+* Function to send the responses queued for a client                          *
+*                                                                             *
+* Pre-condition:  The client is passed to the function                        *
+* Post-condition: As much of the client's send buffer as the socket will take *
+*                 is sent, & any remainder is kept to send when the socket is *
+*                 writable.  The no. of bytes sent is returned or -1 on error *
+******************************************************************************/
+int flush_client(nwstub_client *client);
+
+/******************************************************************************
+* Function to queue a response to send to a client                            *
+*                                                                             *
+* Pre-condition:  The client, the response & its length are passed to the     *
+*                 function                                                    *
+* Post-condition: The response is appended to the client's send buffer,       *
+*                 which is grown if need be.  It is sent by flush_client().   *
+*                 On error a -1 is returned                                   *
+******************************************************************************/
+int queue_client_data(nwstub_client *client, const pdsnp_buf *buf, int len);
+
+/******************************************************************************
+* Function to grow one of a client's buffers                                  *
+*                                                                             *
+* Pre-condition:  The buffer, its size & the length it must hold are passed   *
+*                 to the function                                             *
+* Post-condition: If the buffer is too small, it is reallocated, doubling its *
+*                 size until it can hold the length, & its new size is        *
+*                 stored.  Its contents are kept.  On error a -1 is returned  *
 ******************************************************************************/
-int process_comms_data(pdscomms *comms);
+int grow_client_buf(void **buf, int *size, int len);
 
 /******************************************************************************
-* Function to check if any data is pending on a socket fd                     *
+* Function to free a client                                                   *
 *                                                                             *
-* Pre-condition:  The fd currently being checked is passed to the function    *
-* Post-condition: The number of bytes pending is returned                     *
+* Pre-condition:  The client is passed to the function                        *
+* Post-condition: The client's buffers are freed, followed by the client      *
 ******************************************************************************/
-int check_data_pending(int fd);
+int free_client(nwstub_client *client);
 
 /******************************************************************************
 * Function to display the comms data (for testing/debugging)                  *
@@ -18,29 +18,148 @@ extern int dbgflag;               /* Declared in the main file */
 extern int dbglvl;                /* Declared in the main file */
 
 /******************************************************************************
-* Function to check if any data is pending on a socket fd                     *
+* Function to receive the data pending on a client's socket                   *
 *                                                                             *
-* Pre-condition:  The fd currently being checked is passed to the function    *
-* Post-condition: The number of bytes pending is returned                     *
+* Pre-condition:  The client is passed to the function                        *
+* Post-condition: The data pending on the socket is appended to the client's  *
+*                 receive buffer, until there's none left or the buffer is    *
+*                 full.  The no. of bytes received is returned.  If the       *
+*                 client has closed the socket, a 0 is returned.  On error a  *
+*                 -1 is returned                                              *
 ******************************************************************************/
-int check_data_pending(int fd)
+int read_client(nwstub_client *client)
 {
-  int nread = 0, i = 0, ok_flag = 0;
+  int nread = 0, readtotal = 0;
 
-  while(!ok_flag && (i < PDSNP_CLNTRDTRIES))
+  while(client->rlen < client->rsize)
   {
-    usleep(PDSNP_CLNTRDPAUSE);    /* Allow for network latency */
-    ioctl(fd, FIONREAD, &nread);  /* Read no. of bytes in read buffer */
+    if((nread = recv(client->fd, client->rbuf + client->rlen, (client->rsize - client->rlen), 0)) > 0)
+    {
+      client->rlen += nread;
+      readtotal += nread;
+    }
+    else if(nread == 0)
+      return 0;
+    else if(errno == EINTR)
+      continue;
+    else if(errno == EAGAIN || errno == EWOULDBLOCK)
+      break;
+    else
+      return -1;
+  }
+  printd("No. of bytes read %d\n", readtotal);
+
+  return readtotal;
+}
 
-    if(nread > 0)
-      ok_flag = 1;
+
+
+/******************************************************************************
+* Function to send the responses queued for a client                          *
+*                                                                             *
+* Pre-condition:  The client is passed to the function                        *
+* Post-condition: As much of the client's send buffer as the socket will take *
+*                 is sent, & any remainder is kept to send when the socket is *
+*                 writable.  The no. of bytes sent is returned or -1 on error *
+******************************************************************************/
+int flush_client(nwstub_client *client)
+{
+  int nwritten = 0, writetotal = 0;
+
+  while(writetotal < client->wlen)
+  {
+    if((nwritten = send(client->fd, client->wbuf + writetotal, (client->wlen - writetotal), 0)) > 0)
+      writetotal += nwritten;
+    else if(nwritten == -1 && errno == EINTR)
+      continue;
+    else if(nwritten == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
     else
-      i++;
+      return -1;
+  }
+
+  if(writetotal > 0)
+  {
+    client->wlen -= writetotal;
+    memmove(client->wbuf, client->wbuf + writetotal, client->wlen);
+  }
+
+  return writetotal;
+}
+
+
+
+/******************************************************************************
+* Function to queue a response to send to a client                            *
+*                                                                             *
+* Pre-condition:  The client, the response & its length are passed to the     *
+*                 function                                                    *
+* Post-condition: The response is appended to the client's send buffer,       *
+*                 which is grown if need be.  It is sent by flush_client().   *
+*                 On error a -1 is returned                                   *
+******************************************************************************/
+int queue_client_data(nwstub_client *client, const pdsnp_buf *buf, int len)
+{
+  if(grow_client_buf((void **) &client->wbuf, &client->wsize, (client->wlen + len)) == -1)
+  {
+    fprintf(stderr, "%s: memory allocation error\n", PROGNAME);
+    return -1;
   }
-  printd("No. of bytes to be read %d\n", nread);
-  printd("No. of secs. to read socket %d\n", i && PDSNP_SEC ? i * PDSNP_CLNTRDPAUSE / PDSNP_SEC : 0);
 
-  return nread;
+  memcpy(client->wbuf + client->wlen, buf, len);
+  client->wlen += len;
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to grow one of a client's buffers                                  *
+*                                                                             *
+* Pre-condition:  The buffer, its size & the length it must hold are passed   *
+*                 to the function                                             *
+* Post-condition: If the buffer is too small, it is reallocated, doubling its *
+*                 size until it can hold the length, & its new size is        *
+*                 stored.  Its contents are kept.  On error a -1 is returned  *
+******************************************************************************/
+int grow_client_buf(void **buf, int *size, int len)
+{
+  void *p = NULL;
+  int newsize = (*size > 0) ? *size : PDS_NWSTUB_BUFLEN;
+
+  if(*buf && len <= *size)
+    return 0;
+
+  while(newsize < len)
+    newsize *= 2;
+
+  if(!(p = realloc(*buf, newsize)))
+    return -1;
+
+  *buf = p;
+  *size = newsize;
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to free a client                                                   *
+*                                                                             *
+* Pre-condition:  The client is passed to the function                        *
+* Post-condition: The client's buffers are freed, followed by the client      *
+******************************************************************************/
+int free_client(nwstub_client *client)
+{
+  if(client->rbuf) free(client->rbuf);
+  if(client->wbuf) free(client->wbuf);
+  if(client->wrreqs) free(client->wrreqs);
+  if(client->wrframe) free(client->wrframe);
+  free(client);
+
+  return 0;
 }
 
 
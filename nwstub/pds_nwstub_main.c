@@ -68,12 +68,8 @@ int main(int argc, char *argv[])
 ******************************************************************************/
 void terminate(void)
 {
-  int status = 0;
-
   fprintf(stderr, "%s: cleaning up and terminating\n", PROGNAME);
 
-  wait(&status);                  /* Prevents child from being a zombie */
-
   exit(0);
 }
 
@@ -91,7 +87,8 @@ void install_signal_handler(void)
   signal(SIGINT, set_quit);
   signal(SIGQUIT, set_quit);
 
-  signal(SIGCHLD, cleanup_child);
+  /* A client may disconnect before its response is sent */
+  signal(SIGPIPE, SIG_IGN);
 }
 
 
@@ -110,23 +107,6 @@ void set_quit(int sig)
 
 
 
-/******************************************************************************
-* Function to handle child signal                                             *
-*                                                                             *
-* Pre-condition:  Signal has been received                                    *
-* Post-condition: Child process is prevented from becoming a zombie process,  *
-*                 signal handler is re-installed                              *
-******************************************************************************/
-void cleanup_child(int sig)
-{
-  int status = 0;
-
-  wait(&status);                  /* Prevents child from being a zombie */
-  install_signal_handler();
-}
-
-
- 
 /******************************************************************************
 * Function to parse the command line arguments                                *
 *                                                                             *
@@ -138,14 +118,18 @@ void cleanup_child(int sig)
 int parse_nwstub_cmdln(int argc, char *argv[], nwstub_args *args)
 {
   int opt = 0;
+  char *p = NULL;
   extern char *optarg;
   extern int opterr, optind;
 
   opterr = 0;                     /* Turn off getopt()'s error messages */
   args->host = PDSNP_DEF_HOST;
   args->port = PDSNP_DEF_PORT;
+  args->mcast_group = NULL;
+  args->mcast_port = PDS_NWSTUB_DEF_MCAST_PORT;
+  args->keyframe = PDS_NWSTUB_DEF_KEYFRAME;
 
-  while((opt = getopt(argc, argv, "h: :p: :d::v")) != -1)
+  while((opt = getopt(argc, argv, "h: :p: :m:k:d::v")) != -1)
   {
     switch(opt)
     {
@@ -159,6 +143,24 @@ int parse_nwstub_cmdln(int argc, char *argv[], nwstub_args *args)
           args->port = (unsigned short int) atoi(optarg);
       break; 
 
+      case 'm' :                  /* The multicast group[:port] to publish to */
+        if(optarg)
+        {
+          args->mcast_group = (char *) optarg;
+
+          if((p = strchr(optarg, ':')))
+          {
+            *p = '\0';
+            args->mcast_port = (unsigned short int) atoi(p + 1);
+          }
+        }
+      break;
+
+      case 'k' :                  /* The keyframe interval (msecs) */
+        if(optarg)
+          args->keyframe = (unsigned int) atoi(optarg);
+      break;
+
       /* Debug switch.  Global debug flag is set */
       case 'd' :
         puts("Started in debug mode");
@@ -203,14 +205,18 @@ int parse_nwstub_cmdln(int argc, char *argv[], nwstub_args *args)
 * Pre-condition:  The command line args struct & the comms struct containing  *
 *                 a valid PDS connection are passed to the function           *
 * Post-condition: The nwstub listens on its well-known port & accepts         *
-*                 incoming client connections.  It acts as a network gateway  *
-*                 to the PDS.  On error a -1 is returned                      *
+*                 incoming client connections.  All clients are serviced by   *
+*                 this process, as their requests arrive, sharing its PDS     *
+*                 connection.  It acts as a network gateway to the PDS.  On   *
+*                 error a -1 is returned                                      *
 ******************************************************************************/
 int nwstub_main(nwstub_args *args, pdscomms *comms)
 {
-  int serverfd = 0, clientfd = 0, clientlen = 0;
-  struct sockaddr_in clientaddr;
-  pid_t childpid = 0;
+  nwstub stub;
+  struct epoll_event ev, events[PDS_NWSTUB_MAXEVENTS];
+  struct rlimit rl;
+  int nevents = 0, tmo = 0;
+  register int i = 0;
 
   if(!dbgflag)
     daemonise();                  /* Daemonise the program */
@@ -226,17 +232,57 @@ int nwstub_main(nwstub_args *args, pdscomms *comms)
 
   install_signal_handler();       /* Handle various signals */ 
 
+  /* Each client holds an open file, so allow as many as the hard limit */
+  if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+  {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  memset(&stub, 0, sizeof(nwstub));
+  stub.comms = comms;
+  stub.mcastfd = -1;
+
   /* Create a server socket and name it */
-  if((serverfd = open_server_socket(args->host, args->port)) == -1)
+  if((stub.serverfd = open_server_socket(args->host, args->port)) == -1)
   {
     fprintf(stderr, "%s: cannot create named server socket\n", PROGNAME);
     return -1;
   }
 
   /* Create a connection queue and wait for clients to attempt connection */
-  if(listen(serverfd, PDSNP_SOCKQ) == -1)
+  if(listen(stub.serverfd, PDS_NWSTUB_SOCKQ) == -1)
   {
     fprintf(stderr, "%s: cannot listen on named server socket\n", PROGNAME);
+    close(stub.serverfd);
+    return -1;
+  }
+
+  fcntl(stub.serverfd, F_SETFL, fcntl(stub.serverfd, F_GETFL) | O_NONBLOCK);
+
+  if((stub.epfd = epoll_create(PDS_NWSTUB_MAXEVENTS)) == -1)
+  {
+    fprintf(stderr, "%s: cannot create epoll instance: %s\n", PROGNAME, strerror(errno));
+    close(stub.serverfd);
+    return -1;
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = PDS_NWSTUB_LISTENER;
+
+  if(epoll_ctl(stub.epfd, EPOLL_CTL_ADD, stub.serverfd, &ev) == -1)
+  {
+    fprintf(stderr, "%s: cannot add server socket to epoll: %s\n", PROGNAME, strerror(errno));
+    close(stub.epfd);
+    close(stub.serverfd);
+    return -1;
+  }
+
+  /* Publish the tags' changes to the multicast group, if one was given */
+  if(args->mcast_group && open_publisher(&stub, args) == -1)
+  {
+    close(stub.epfd);
+    close(stub.serverfd);
     return -1;
   }
 
@@ -244,90 +290,451 @@ int nwstub_main(nwstub_args *args, pdscomms *comms)
 
   while(!quit_flag)
   {
-    dbgmsg("\nServer waiting\n");
+    /* The PDS replies to writes on its message queue, & appends changes to
+       its journal, neither of which can be waited on with the sockets, so
+       whilst any writes are in flight, clients subscribed or the changes
+       published, poll for them */
+    if(stub.wrclients)
+      tmo = PDS_NWSTUB_WRPOLL;
+    else
+      tmo = (stub.subclients || stub.mcastfd != -1) ? PDS_NWSTUB_SUBPOLL : -1;
+
+    if((nevents = epoll_wait(stub.epfd, events, PDS_NWSTUB_MAXEVENTS, tmo)) == -1)
+    {
+      if(errno == EINTR)
+        continue;
 
-    /* Accept a client connection or block if none pending */
-    clientfd = accept(serverfd, (struct sockaddr *)&clientaddr, &clientlen);
+      fprintf(stderr, "%s: error waiting for client activity: %s\n", PROGNAME, strerror(errno));
+      break;
+    }
 
-    if(clientfd != -1)
+    for(i = 0; i < nevents; i++)
     {
-      printd("Adding client on fd %d\n", clientfd);
+      if(events[i].data.ptr == PDS_NWSTUB_LISTENER)
+        accept_clients(&stub);
+      else
+        service_client(&stub, (nwstub_client *) events[i].data.ptr, events[i].events);
+    }
 
-      /* Fork a new backend server process to handle this client connection */
-      if((childpid = fork()) == 0)
-      {
-        close(serverfd);          /* New backend closes listening conn. */
+    if(stub.wrclients)
+      complete_client_writes(&stub);
+
+    if(stub.subclients || stub.mcastfd != -1)
+      publish_changes(&stub);
+  }
+
+  if(stub.mcastfd != -1)
+    close_publisher(&stub);
+
+  if(stub.tagsubs) free(stub.tagsubs);
+  if(stub.changes) free(stub.changes);
+
+  close(stub.epfd);
+  close(stub.serverfd);
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to accept pending client connections                               *
+*                                                                             *
+* Pre-condition:  The nwstub struct is passed to the function                 *
+* Post-condition: Each pending client connection is accepted, made            *
+*                 non-blocking & registered with epoll.  The no. of clients   *
+*                 connected is returned                                       *
+******************************************************************************/
+int accept_clients(nwstub *stub)
+{
+  nwstub_client *client = NULL;
+  struct epoll_event ev;
+  int fd = 0, sopt = 1;
+
+  while((fd = accept(stub->serverfd, NULL, NULL)) != -1)
+  {
+    if(!(client = (nwstub_client *) calloc(1, sizeof(nwstub_client))) ||
+       grow_client_buf((void **) &client->rbuf, &client->rsize, PDS_NWSTUB_BUFLEN) == -1 ||
+       grow_client_buf((void **) &client->wbuf, &client->wsize, PDS_NWSTUB_BUFLEN) == -1)
+    {
+      fprintf(stderr, "%s: memory allocation error\n", PROGNAME);
+      if(client) free_client(client);
+      close(fd);
+      continue;
+    }
 
-        /* New backend services this client until client disconnects */
-        new_backend_main(clientfd, comms);
-        close(clientfd);
-        printd("Removing client on fd %d\n", clientfd);
+    /* Responses are small, so send them without delay */
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &sopt, sizeof(int));
 
-        exit(0);                  /* Kill the new backend server process */
+    client->fd = fd;
+    client->events = EPOLLIN;
+    ev.events = client->events;
+    ev.data.ptr = client;
+
+    if(epoll_ctl(stub->epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+      fprintf(stderr, "%s: cannot add client socket to epoll: %s\n", PROGNAME, strerror(errno));
+      close(fd);
+      free_client(client);
+      continue;
+    }
+
+    stub->nclients++;
+    printd("Adding client on fd %d (%d clients)\n", fd, stub->nclients);
+  }
+
+  return stub->nclients;
+}
+
+
+
+/******************************************************************************
+* Function to close a client connection                                       *
+*                                                                             *
+* Pre-condition:  The nwstub struct & the client are passed to the function   *
+* Post-condition: The client is removed from epoll, from the clients waiting  *
+*                 for writes & from the tags it subscribed to, its socket is  *
+*                 closed & it is freed.  The no. of clients still connected   *
+*                 is returned                                                 *
+******************************************************************************/
+int close_client(nwstub *stub, nwstub_client *client)
+{
+  nwstub_client **pp = NULL;
+
+  printd("Removing client on fd %d\n", client->fd);
+
+  /* N.B.: The writes still complete, but their replies are dropped */
+  if(client->wrwait)
+  {
+    for(pp = &stub->wrclients; *pp; pp = &(*pp)->next_wr)
+    {
+      if(*pp == client)
+      {
+        *pp = client->next_wr;
+        break;
       }
-      close(clientfd);            /* Listening server closes client conn. */
     }
+    stub->nwrites -= client->nwrpending;
   }
 
-  close(serverfd);
+  unsubscribe_client(stub, client);
 
-  return 0;
+  epoll_ctl(stub->epfd, EPOLL_CTL_DEL, client->fd, NULL);
+  close(client->fd);
+  free_client(client);
+
+  return --stub->nclients;
 }
 
 
 
 /******************************************************************************
-* Function to encapsulate the new backend process's core functionality        *
+* Function to service a client's socket activity                              *
 *                                                                             *
-* Pre-condition:  The connected client socket & the comms struct containing   *
-*                 a valid PDS connection are passed to the function           *
-* Post-condition: The new backend server process services this client until   *
-*                 the client disconnects.  On error a -1 is returned          *
+* Pre-condition:  The nwstub struct, the client & its epoll events are passed *
+*                 to the function                                             *
+* Post-condition: Any data pending on the client's socket is received, each   *
+*                 complete request is processed & the responses are sent.  If *
+*                 the client has disconnected or an error occurs, the client  *
+*                 is closed & a -1 is returned                                *
 ******************************************************************************/
-int new_backend_main(int fd, pdscomms *comms)
+int service_client(nwstub *stub, nwstub_client *client, unsigned int events)
 {
-  int retval = -1;
-  int nread = 0, readtotal = 0, writetotal = 0;
-  fd_set fds;
+  int readtotal = 0, writetotal = 0;
 
-  while(!quit_flag)
+  /* The client has closed the socket, or it's in error.  Any requests that
+     it hasn't waited for the responses to are dropped */
+  if(events & (EPOLLERR | EPOLLHUP))
   {
-    nread = readtotal = writetotal = 0;
-    FD_ZERO(&fds);
-    FD_SET(fd, &fds);
+    close_client(stub, client);
+    return -1;
+  }
 
-    /****************** Communicate with the client socket *******************/
+  if(events & EPOLLIN)
+  {
+    printd("Reading client on fd %d\n", client->fd);
 
-    /* Check for socket activity.  Block if none pending */
-    if((select((fd + 1), &fds, NULL, NULL, NULL)) < 1)
+    if((readtotal = read_client(client)) < 1)
+    {
+      close_client(stub, client);
       return -1;
- 
-    /* Ensure that there's data to be read on the socket.  If there isn't any
-       it's probably because the client has closed the socket.  This is not
-       an error condition */
-    if((nread = check_data_pending(fd)) == 0)
-      return 0;
+    }
+  }
+
+  if(process_client_requests(stub, client) == -1 ||
+     (writetotal = flush_client(client)) == -1 ||
+     update_client_events(stub, client) == -1)
+  {
+    close_client(stub, client);
+    return -1;
+  }
 
-    printd("Reading client on fd %d\n", fd);
+  display_comms_footer(stub->comms, writetotal, readtotal);
 
-    if((readtotal = comms_read(fd, comms)) < 0)
-      return -1;
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to process a client's complete requests                            *
+*                                                                             *
+* Pre-condition:  The nwstub struct & the client are passed to the function   *
+* Post-condition: Each complete request in the client's receive buffer is     *
+*                 processed in turn, & its response is queued in the          *
+*                 client's send buffer.  Processing stops at a write, until   *
+*                 it has completed, or when the send buffer is full.  The no. *
+*                 of requests processed is returned.  If the client sent an   *
+*                 invalid request a -1 is returned                            *
+******************************************************************************/
+int process_client_requests(nwstub *stub, nwstub_client *client)
+{
+  pdscomms *comms = stub->comms;
+  pdsnp_buf *req = NULL;
+  int roff = 0, len = 0, nwrites = 0, nrequests = 0, retval = 0;
+
+  while(!client->wrwait && (client->rlen - roff) > 0 &&
+        client->wlen < PDS_NWSTUB_WRHIWAT)
+  {
+    req = client->rbuf + roff;
+
+    /* A v1 request is a fixed length frame, & a v2 request is prefixed by
+       its length */
+    if(PDSNP_GET_FRAME_VER(req) == PDSNP1_VER)
+    {
+      if((len = PDSNP_GET_BUF_LEN(req)) != PDSNP_LEN)
+      {
+        fprintf(stderr, "%s: invalid request length (%d) on fd %d\n", PROGNAME, len, client->fd);
+        return -1;
+      }
+      nwrites = (PDSNP_GET_FUNC_ID(req) == PDSNP_SET_TAG_FUNC_ID) ? 1 : 0;
+    }
+    else
+    {
+      if((client->rlen - roff) < PDSNP2_HDR_LEN)
+        break;
+
+      if((len = PDSNP2_GET_BUF_LEN(req)) < PDSNP2_HDR_LEN || len > PDSNP2_MAX_LEN)
+      {
+        fprintf(stderr, "%s: invalid request length (%d) on fd %d\n", PROGNAME, len, client->fd);
+        return -1;
+      }
+
+      switch(PDSNP2_GET_FUNC_ID(req))
+      {
+        case PDSNP2_SET_TAGS_FUNC_ID :
+        case PDSNP2_SET_HANDLES_FUNC_ID :
+          nwrites = PDSNP2_GET_NTAGS(req);
+        break;
+
+        default :
+          nwrites = 0;
+        break;
+      }
+    }
+
+    /* Wait for the rest of the request, making room for it if need be */
+    if((client->rlen - roff) < len)
+    {
+      if(grow_client_buf((void **) &client->rbuf, &client->rsize, (len + roff)) == -1)
+      {
+        fprintf(stderr, "%s: memory allocation error\n", PROGNAME);
+        return -1;
+      }
+      break;
+    }
+
+    /* Wait for room in the PDS connection's write request table.  N.B.: The
+       client waits with the clients waiting for writes, so that it is tried
+       again as writes complete */
+    if(nwrites > 0 && (stub->nwrites + nwrites) > PDS_NWSTUB_MAXWRITES &&
+       nwrites <= PDSNP2_MAX_WRITES)
+    {
+      client->nwrreqs = client->nwrpending = client->wrlen = 0;
+      client->wrwait = 1;
+      client->next_wr = stub->wrclients;
+      stub->wrclients = client;
+      break;
+    }
 
-    /* Process the data & write the response back to the client */
-    if(process_comms_data(comms))
+    roff += len;
+    nrequests++;
+
+    /* Process the data & queue the response back to the client.  If it's a
+       write, the response is queued once the writes have completed */
+    if(PDSNP_GET_FRAME_VER(req) == PDSNP1_VER)
     {
-      printd("Writing client on fd %d\n", fd);
-      display_comms_data(comms);
+      memcpy(comms->buf, req, len);
+
+      if(process_comms_data(comms, client))
+      {
+        display_comms_data(comms);
+        printd("Comms exception code: %d\n", PDSNP_GET_EX_CODE(comms->buf));
+
+        if(queue_client_data(client, comms->buf, PDSNP_LEN) == -1)
+          return -1;
+        continue;
+      }
+
+      if(grow_client_buf((void **) &client->wrframe, &client->wrsize, PDSNP_LEN) == -1)
+        return -1;
 
-      if((writetotal = comms_write(fd, comms)) < 0)
+      memcpy(client->wrframe, comms->buf, PDSNP_LEN);
+      client->wrlen = PDSNP_LEN;
+    }
+    else
+    {
+      /* N.B.: A batch's response is queued when it's processed */
+      if((retval = process_batch_data(stub, client, req, len)) == -1)
+      {
+        fprintf(stderr, "%s: invalid request on fd %d\n", PROGNAME, client->fd);
         return -1;
+      }
+      else if(retval)
+        continue;
+    }
+
+    /* Wait for the writes to complete */
+    stub->nwrites += client->nwrpending;
+    client->wrwait = 1;
+    client->next_wr = stub->wrclients;
+    stub->wrclients = client;
+  }
+
+  /* Move any partial request to the start of the buffer */
+  if(roff > 0)
+  {
+    client->rlen -= roff;
+    memmove(client->rbuf, client->rbuf + roff, client->rlen);
+  }
+
+  return nrequests;
+}
+
+
+
+/******************************************************************************
+* Function to complete the clients' writes                                    *
+*                                                                             *
+* Pre-condition:  The nwstub struct is passed to the function                 *
+* Post-condition: The clients' writes in flight are polled for completion.    *
+*                 When all of a client's writes have completed, their         *
+*                 response is sent to the client, & any further requests from *
+*                 the client are processed.  The no. of writes completed is   *
+*                 returned                                                    *
+******************************************************************************/
+int complete_client_writes(nwstub *stub)
+{
+  nwstub_client *client = NULL, **pp = NULL, *done = NULL;
+  pdsconn *conn = stub->comms->conn;
+  unsigned short int status = 0;
+  int retval = 0, ncompleted = 0;
+  register int i = 0;
+
+  for(pp = &stub->wrclients; (client = *pp); )
+  {
+    for(i = 0; i < client->nwrreqs && client->nwrpending > 0; i++)
+    {
+      if(!client->wrreqs[i])
+        continue;
+
+      /* N.B.: The writes mostly complete in the order they were sent, so
+               the rest are polled next time */
+      if((retval = PDSpoll_write(conn, client->wrreqs[i], &status)) == 0)
+        break;
+
+      if(retval == 1)
+      {
+        printd("PDSset_tag_async(): write %d completed\n", client->wrreqs[i]);
+      }
+      else
+      {
+        status = (conn->plc_status | PDSNP_COMMS_APP_ERR);
+
+        fprintf(stderr, "%s: PDSpoll_write(): failed to get status of write %d\n", PROGNAME, client->wrreqs[i]);
+      }
+
+      /* Set the write's status in the response */
+      if(PDSNP_GET_FRAME_VER(client->wrframe) == PDSNP1_VER)
+        PDSNP_SET_EX_CODE(client->wrframe, status);
+      else
+      {
+        PDSNP2_SET_U16(PDSNP2_ITEMS(client->wrframe) + i * PDSNP2_STATUS_LEN, status);
+        PDSNP2_SET_EX_CODE(client->wrframe, (PDSNP2_GET_EX_CODE(client->wrframe) | status));
+      }
+
+      client->wrreqs[i] = 0;
+      client->nwrpending--;
+      stub->nwrites--;
+      ncompleted++;
+    }
+
+    if(client->nwrpending > 0)
+    {
+      pp = &client->next_wr;
+      continue;
     }
 
-    display_comms_footer(comms, writetotal, readtotal);
-    printd("Comms exception code: %d\n", PDSNP_GET_EX_CODE(comms->buf));
+    /* N.B.: The client may wait again when its requests are processed, so
+             it's moved to a list of its own first */
+    *pp = client->next_wr;
+    client->next_wr = done;
+    done = client;
+  }
+
+  while((client = done))
+  {
+    done = client->next_wr;
+    client->next_wr = NULL;
+    client->wrwait = 0;
+
+    /* A client waiting for room for its writes has no response */
+    if((client->wrlen > 0 &&
+        queue_client_data(client, client->wrframe, client->wrlen) == -1) ||
+       process_client_requests(stub, client) == -1 ||
+       flush_client(client) == -1 || update_client_events(stub, client) == -1)
+    {
+      close_client(stub, client);
+    }
   }
 
-  return retval;
+  return ncompleted;
+}
+
+
+
+/******************************************************************************
+* Function to update the epoll events a client is registered with             *
+*                                                                             *
+* Pre-condition:  The nwstub struct & the client are passed to the function   *
+* Post-condition: The client waits to receive requests unless it's waiting    *
+*                 for writes or its receive buffer is full, & waits to send   *
+*                 whilst it has responses queued.  On error a -1 is returned  *
+******************************************************************************/
+int update_client_events(nwstub *stub, nwstub_client *client)
+{
+  struct epoll_event ev;
+  unsigned int events = 0;
+
+  if(!client->wrwait && client->rlen < client->rsize)
+    events |= EPOLLIN;
+
+  if(client->wlen > 0)
+    events |= EPOLLOUT;
+
+  if(events == client->events)
+    return 0;
+
+  ev.events = events;
+  ev.data.ptr = client;
+
+  if(epoll_ctl(stub->epfd, EPOLL_CTL_MOD, client->fd, &ev) == -1)
+    return -1;
+
+  client->events = events;
+
+  return 0;
 }
 
 
@@ -335,11 +742,15 @@ int new_backend_main(int fd, pdscomms *comms)
 /******************************************************************************
 * Function to process the received comms data                                 *
 *                                                                             *
-* Pre-condition:  A comms struct is passed to the function                    *
+* Pre-condition:  A comms struct & the client that sent it are passed to the  *
+*                 function                                                    *
 * Post-condition: Data in the structure is processed, a flag is returned      *
-*                 indicating whether a write operation is necessary or not    *
+*                 indicating whether a write operation is necessary or not.   *
+*                 A write to the PLC is sent to the PDS without waiting for   *
+*                 it to complete, & its ID is stored in the client, so the    *
+*                 flag is unset                                               *
 ******************************************************************************/
-int process_comms_data(pdscomms *comms)
+int process_comms_data(pdscomms *comms, nwstub_client *client)
 {
   int write_flag = 0;
   char tagname[PDSNP_TAGNAME_LEN+1] = "\0";
@@ -375,22 +786,36 @@ int process_comms_data(pdscomms *comms)
     case PDSNP_SET_TAG_FUNC_ID :
       PDSNP_GET_TAGNAME(tagname, comms->buf);
       PDSNP_GET_TAGVALUE(tagvalue, comms->buf);
-      sscanf(tagvalue, "%u", &value);
+      sscanf(tagvalue, "%hu", &value);
 
-      /* Ask PDS to set this tag's value & return confirmation to client */
-      if(PDSset_tag(comms->conn, tagname, 1, &value) != -1)
+      /* Ask PDS to set this tag's value.  Confirmation is returned to the
+         client once the write has completed */
+      if(grow_client_buf((void **) &client->wrreqs, &client->wrreqsize, sizeof(int)) != -1 &&
+         (client->wrreqs[0] = PDSset_tag_async(comms->conn, tagname, 1, &value)) != -1)
       {
-        printd("PDSset_tag(): %s = %u\n", tagname, value);
+        printd("PDSset_tag_async(): %s = %u (write %d)\n", tagname, value, client->wrreqs[0]);
 
-        PDSNP_SET_EX_CODE(comms->buf, comms->conn->plc_status);
+        client->nwrreqs = client->nwrpending = 1;
       }
       else
       {
         PDSNP_SET_EX_CODE(comms->buf, (comms->conn->plc_status | PDSNP_COMMS_APP_ERR));
 
-        fprintf(stderr, "%s: PDSset_tag(): failed to set value of %s to %u\n", PROGNAME, tagname, value);
-        fprintf(stderr, "%s: PDSset_tag(): plc_status = %s (%d)\n", PROGNAME, PDSprint_plc_status(comms->conn), PDScheck_plc_status(comms->conn));
+        fprintf(stderr, "%s: PDSset_tag_async(): failed to set value of %s to %u\n", PROGNAME, tagname, value);
+        fprintf(stderr, "%s: PDSset_tag_async(): plc_status = %s (%d)\n", PROGNAME, PDSprint_plc_status(comms->conn), PDScheck_plc_status(comms->conn));
+
+        write_flag = 1;           /* Write back to the client */
       }
+    break;
+
+    case PDSNP_VERSION_FUNC_ID :
+      /* Agree on the latest version that both the client & we speak */
+      if(PDSNP_GET_VER(comms->buf) > PDSNP_VER)
+        PDSNP_SET_VER(comms->buf, PDSNP_VER);
+
+      printd("Negotiated protocol version %d\n", PDSNP_GET_VER(comms->buf));
+
+      PDSNP_SET_EX_CODE(comms->buf, PDSNP_COMMS_OK);
       write_flag = 1;             /* Write back to the client */
     break;
 
@@ -408,3 +833,996 @@ int process_comms_data(pdscomms *comms)
   return write_flag;
 }
 
+
+
+
+/******************************************************************************
+* Function to process a client's batch (v2) request                           *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the client & its request frame are       *
+*                 passed to the function                                      *
+* Post-condition: Each of the batch's tags is got, set, resolved or           *
+*                 subscribed to, or the published tags are snapshotted.  For  *
+*                 a get, resolve, subscribe or snapshot, the response is      *
+*                 queued in the client's send buffer & a 1 is returned.  For  *
+*                 a set, the writes are sent to the PDS without waiting for   *
+*                 them to complete, their IDs are stored in the client, & a 0 *
+*                 is returned.  If the request is invalid a -1 is returned    *
+******************************************************************************/
+int process_batch_data(nwstub *stub, nwstub_client *client,
+                       const pdsnp_buf *req, int len)
+{
+  pdsconn *conn = stub->comms->conn;
+  const pdsnp_buf *items = PDSNP2_ITEMS(req), *p = NULL, *end = req + len;
+  pdsnp_buf *resp = NULL, *q = NULL;
+  nwstub_subtag *sub = NULL;
+  char tagname[PDSNP_TAGNAME_LEN+1] = "\0";
+  pdshandle h = PDS_HANDLE_INVALID;
+  unsigned short int value = 0, status = 0, ex_code = PDSNP_COMMS_OK;
+  int func_id = PDSNP2_GET_FUNC_ID(req), ntags = PDSNP2_GET_NTAGS(req);
+  int by_name = 1, writing = 0, subscribing = 0;
+  int arg_len = 0, item_len = 0, resp_len = 0;
+  register int i = 0;
+
+  dbgmsg("Processing the batch data\n");
+
+  /* Determine which API function the client wishes to call */
+  switch(func_id)
+  {
+    case PDSNP2_GET_TAGS_FUNC_ID :
+      item_len = PDSNP2_VALUE_LEN + PDSNP2_STATUS_LEN;
+    break;
+
+    case PDSNP2_SET_TAGS_FUNC_ID :
+      item_len = PDSNP2_STATUS_LEN;
+      arg_len = PDSNP2_VALUE_LEN;
+      writing = 1;
+    break;
+
+    case PDSNP2_RESOLVE_TAGS_FUNC_ID :
+      item_len = PDSNP2_HANDLE_LEN;
+    break;
+
+    case PDSNP2_GET_HANDLES_FUNC_ID :
+      item_len = PDSNP2_VALUE_LEN + PDSNP2_STATUS_LEN;
+      by_name = 0;
+    break;
+
+    case PDSNP2_SET_HANDLES_FUNC_ID :
+      item_len = PDSNP2_STATUS_LEN;
+      arg_len = PDSNP2_VALUE_LEN;
+      by_name = 0;
+      writing = 1;
+    break;
+
+    /* The tags are preceded by the min. interval between updates */
+    case PDSNP2_SUBSCRIBE_FUNC_ID :
+      item_len = PDSNP2_VALUE_LEN + PDSNP2_STATUS_LEN;
+      arg_len = PDSNP2_DEADBAND_LEN;
+      items += PDSNP2_INTERVAL_LEN;
+      subscribing = 1;
+    break;
+
+    /* A snapshot's request is the 1st tag's ID, rather than a batch */
+    case PDSNP2_SNAPSHOT_FUNC_ID :
+      return queue_snapshot(stub, client, req, len);
+
+    default :
+      fprintf(stderr, "%s: unknown function ID (%d)\n", PROGNAME, func_id);
+
+      ex_code = PDSNP_COMMS_FUNC_ERR;
+      ntags = 0;
+      end = items;                /* Ignore the items */
+    break;
+  }
+
+  if(ntags < 0 || ntags > ((writing) ? PDSNP2_MAX_WRITES : PDSNP2_MAX_TAGS) ||
+     items > end)
+    return -1;
+
+  /* Check that the items fill the frame exactly, before acting on any */
+  for(i = 0, p = items; i < ntags && p < end; i++)
+  {
+    if(by_name)
+    {
+      if(*p > PDSNP_TAGNAME_LEN)
+        break;
+
+      p += PDSNP2_NAMELEN_LEN + *p;
+    }
+    else
+      p += PDSNP2_HANDLE_LEN;
+
+    p += arg_len;
+  }
+
+  if(i < ntags || p != end)
+    return -1;
+
+  /* A set's response is held until its writes have completed */
+  resp_len = PDSNP2_HDR_LEN + ntags * item_len;
+
+  if(writing)
+  {
+    if(grow_client_buf((void **) &client->wrframe, &client->wrsize, resp_len) == -1 ||
+       grow_client_buf((void **) &client->wrreqs, &client->wrreqsize, (ntags * sizeof(int))) == -1)
+      return -1;
+
+    resp = client->wrframe;
+    client->nwrreqs = ntags;
+    client->nwrpending = 0;
+    client->wrlen = resp_len;
+  }
+  else
+  {
+    if(grow_client_buf((void **) &client->wbuf, &client->wsize, (client->wlen + resp_len)) == -1)
+      return -1;
+
+    resp = client->wbuf + client->wlen;
+  }
+
+  /* The tags replace any that the client was subscribed to */
+  if(subscribing && subscribe_client(stub, client, ntags, PDSNP2_GET_U32(PDSNP2_ITEMS(req))) == -1)
+    return -1;
+
+  for(i = 0, p = items, q = PDSNP2_ITEMS(resp); i < ntags; i++)
+  {
+    if(by_name)
+    {
+      memcpy(tagname, p + PDSNP2_NAMELEN_LEN, *p);
+      tagname[*p] = '\0';
+      p += PDSNP2_NAMELEN_LEN + *p;
+
+      h = PDSresolve_tag(conn, tagname);
+    }
+    else
+    {
+      h = (pdshandle) PDSNP2_GET_U32(p);
+      p += PDSNP2_HANDLE_LEN;
+    }
+
+    if(func_id == PDSNP2_RESOLVE_TAGS_FUNC_ID)
+    {
+      if(h == PDS_HANDLE_INVALID)
+        ex_code |= PDSNP_COMMS_APP_ERR;
+
+      PDSNP2_SET_U32(q, (unsigned int) h);
+      q += PDSNP2_HANDLE_LEN;
+    }
+    else if(writing)
+    {
+      value = PDSNP2_GET_U16(p);
+      p += PDSNP2_VALUE_LEN;
+      status = PDSNP_COMMS_OK;
+
+      /* Ask PDS to set this tag's value.  The write's status is set in the
+         response once the write has completed */
+      if((client->wrreqs[i] = PDSset_tag_h_async(conn, h, 1, &value)) != -1)
+        client->nwrpending++;
+      else
+      {
+        client->wrreqs[i] = 0;
+        status = (conn->plc_status | PDSNP_COMMS_APP_ERR);
+        ex_code |= status;
+      }
+
+      PDSNP2_SET_U16(q, status);
+      q += PDSNP2_STATUS_LEN;
+    }
+    else
+    {
+      if(PDSget_tag_h(conn, h, &value, &status) == -1)
+      {
+        value = 0;
+        status = (conn->plc_status | PDSNP_COMMS_APP_ERR);
+      }
+      ex_code |= status;
+
+      /* The tag's value is pushed to the client as it changes */
+      if(subscribing)
+      {
+        sub = &client->subtags[i];
+        sub->id = i;
+        sub->tag = (h == PDS_HANDLE_INVALID) ? -1 : PDS_GET_HANDLE_INDEX(h);
+        sub->deadband = PDSNP2_GET_U16(p);
+        sub->value = sub->sent_value = value;
+        sub->status = sub->sent_status = status;
+        sub->client = client;
+        p += PDSNP2_DEADBAND_LEN;
+
+        if(sub->tag >= stub->ntagsubs)
+          sub->tag = -1;
+        else if(sub->tag != -1)
+        {
+          sub->next = stub->tagsubs[sub->tag];
+          stub->tagsubs[sub->tag] = sub;
+        }
+      }
+
+      PDSNP2_SET_U16(q, value);
+      PDSNP2_SET_U16(q + PDSNP2_VALUE_LEN, status);
+      q += PDSNP2_VALUE_LEN + PDSNP2_STATUS_LEN;
+    }
+  }
+
+  PDSNP2_SET_BUF_LEN(resp, resp_len);
+  PDSNP2_SET_VER(resp, PDSNP2_VER);
+  PDSNP2_SET_FUNC_ID(resp, func_id);
+  PDSNP2_SET_EX_CODE(resp, ex_code);
+  PDSNP2_SET_NTAGS(resp, ntags);
+  PDSNP2_SET_REQ_ID(resp, PDSNP2_GET_REQ_ID(req));
+
+  printd("Batch function %d: %d tags, exception code %d\n", func_id, ntags, ex_code);
+
+  if(writing)
+  {
+    /* If none of the writes could be sent, then respond straight away */
+    if(client->nwrpending > 0)
+      return 0;
+
+    if(queue_client_data(client, client->wrframe, client->wrlen) == -1)
+      return -1;
+  }
+  else
+    client->wlen += resp_len;
+
+  return 1;
+}
+
+
+
+/******************************************************************************
+* Function to subscribe a client to a set of tags                             *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the client, the no. of tags & the min.   *
+*                 interval between updates (in msecs) are passed to the       *
+*                 function                                                    *
+* Post-condition: Any tags the client was subscribed to are unsubscribed, &   *
+*                 room is made for the new tags, which the caller then fills  *
+*                 in.  The change journal is brought up to date first, so     *
+*                 that only changes after the tags are read are pushed.  On   *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+int subscribe_client(nwstub *stub, nwstub_client *client, int ntags,
+                     unsigned int interval)
+{
+  pdsconn *conn = stub->comms->conn;
+
+  unsubscribe_client(stub, client);
+
+  if(ntags < 1)
+    return 0;
+
+  /* The subscriptions are indexed by tag, as the journal's changes are */
+  if(!stub->tagsubs)
+  {
+    if(!(stub->tagsubs = (nwstub_subtag **) calloc(conn->ttags, sizeof(nwstub_subtag *))) ||
+       (!stub->changes &&
+        !(stub->changes = (pdschange *) malloc(PDS_NWSTUB_CHGBATCH * sizeof(pdschange)))))
+    {
+      fprintf(stderr, "%s: memory allocation error\n", PROGNAME);
+      return -1;
+    }
+    stub->ntagsubs = conn->ttags;
+  }
+
+  if(stub->subclients || stub->mcastfd != -1)
+    publish_changes(stub);
+  else
+    stub->jseq = PDSget_change_seq(conn);
+
+  client->subqsize = (ntags < PDS_NWSTUB_SUBQLEN) ? ntags : PDS_NWSTUB_SUBQLEN;
+
+  if(!(client->subtags = (nwstub_subtag *) calloc(ntags, sizeof(nwstub_subtag))) ||
+     !(client->subq = (nwstub_subtag **) calloc(client->subqsize, sizeof(nwstub_subtag *))))
+  {
+    fprintf(stderr, "%s: memory allocation error\n", PROGNAME);
+    return -1;
+  }
+
+  client->nsubtags = ntags;
+  client->interval_ns = interval * 1000000ULL;
+  client->next_push_ns = 0;
+  client->next_sub = stub->subclients;
+  stub->subclients = client;
+
+  printd("Subscribed client on fd %d to %d tags\n", client->fd, ntags);
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to unsubscribe a client from its tags                              *
+*                                                                             *
+* Pre-condition:  The nwstub struct & the client are passed to the function   *
+* Post-condition: The client's subscriptions are removed from the tags' &     *
+*                 freed, & any updates queued for the client are dropped.     *
+*                 The no. of tags unsubscribed is returned                    *
+******************************************************************************/
+int unsubscribe_client(nwstub *stub, nwstub_client *client)
+{
+  nwstub_subtag **sp = NULL;
+  nwstub_client **pp = NULL;
+  int ntags = client->nsubtags;
+  register int i = 0;
+
+  if(!client->subtags)
+    return 0;
+
+  for(i = 0; i < client->nsubtags; i++)
+  {
+    if(client->subtags[i].tag == -1)
+      continue;
+
+    for(sp = &stub->tagsubs[client->subtags[i].tag]; *sp; sp = &(*sp)->next)
+    {
+      if(*sp == &client->subtags[i])
+      {
+        *sp = client->subtags[i].next;
+        break;
+      }
+    }
+  }
+
+  for(pp = &stub->subclients; *pp; pp = &(*pp)->next_sub)
+  {
+    if(*pp == client)
+    {
+      *pp = client->next_sub;
+      break;
+    }
+  }
+
+  free(client->subtags);
+  if(client->subq) free(client->subq);
+
+  client->subtags = NULL;
+  client->subq = NULL;
+  client->nsubtags = client->subqsize = client->subqhead = client->subqlen = 0;
+  client->subdropped = 0;
+  client->next_sub = NULL;
+
+  return ntags;
+}
+
+
+
+/******************************************************************************
+* Function to publish the changes to the tags to the subscribed clients       *
+*                                                                             *
+* Pre-condition:  The nwstub struct is passed to the function                 *
+* Post-condition: The changes since those last read are read from the PDS's   *
+*                 change journal, & queued for the clients subscribed to the  *
+*                 changed tags, & published to the multicast group.  Each     *
+*                 client's queued updates are then pushed to it, if its min.  *
+*                 interval has elapsed, & a keyframe is published if one is   *
+*                 due.  If the journal has overrun, the subscribed &          *
+*                 published tags are read afresh.  The no. of changes read is *
+*                 returned                                                    *
+******************************************************************************/
+int publish_changes(nwstub *stub)
+{
+  pdsconn *conn = stub->comms->conn;
+  nwstub_client *client = NULL;
+  nwstub_subtag *sub = NULL;
+  struct timespec now;
+  unsigned long long now_ns = 0;
+  int n = 0, nchanges = 0;
+  register int i = 0;
+
+  do
+  {
+    n = PDSget_changes_since(conn, stub->jseq, stub->changes, PDS_NWSTUB_CHGBATCH);
+
+    if(n == PDS_JOURNAL_OVERRUN)
+    {
+      /* We've fallen too far behind, so we skip to the journal's head & read
+         the tags afresh.  Only the tags' latest values are pushed */
+      fprintf(stderr, "%s: change journal overrun, reading the subscribed tags afresh\n", PROGNAME);
+      stub->jseq = PDSget_change_seq(conn);
+      resync_subscriptions(stub);
+
+      if(stub->mcastfd != -1)
+        resync_publication(stub);
+      break;
+    }
+    else if(n == -1)
+    {
+      fprintf(stderr, "%s: error reading the change journal\n", PROGNAME);
+      break;
+    }
+
+    for(i = 0; i < n; i++)
+    {
+      if(stub->mcastfd != -1)
+        stage_publication(stub, stub->changes[i].id, stub->changes[i].value, stub->changes[i].status);
+
+      if(stub->changes[i].id >= (unsigned int) stub->ntagsubs)
+        continue;
+
+      for(sub = stub->tagsubs[stub->changes[i].id]; sub; sub = sub->next)
+        queue_update(sub, stub->changes[i].value, stub->changes[i].status);
+    }
+
+    if(n > 0)
+      stub->jseq = stub->changes[n - 1].seq;
+
+    /* The batch's changes are published as of its last change */
+    if(stub->npubids > 0)
+      publish_batch(stub);
+
+    nchanges += n;
+  }
+  while(n == PDS_NWSTUB_CHGBATCH);
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  now_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+  for(client = stub->subclients; client; client = client->next_sub)
+    push_updates(stub, client, now_ns);
+
+  if(stub->mcastfd != -1 && stub->keyframe_ns > 0 && now_ns >= stub->next_key_ns)
+    publish_keyframe(stub, now_ns);
+
+  return nchanges;
+}
+
+
+
+/******************************************************************************
+* Function to read the subscribed tags afresh                                 *
+*                                                                             *
+* Pre-condition:  The nwstub struct is passed to the function                 *
+* Post-condition: Each subscribed tag's value & status are read from the PDS  *
+*                 & queued for the tag's subscribers if they have changed.    *
+*                 The no. of tags read is returned                            *
+******************************************************************************/
+int resync_subscriptions(nwstub *stub)
+{
+  pdsconn *conn = stub->comms->conn;
+  nwstub_subtag *sub = NULL;
+  unsigned short int value = 0, status = 0;
+  register int i = 0;
+  int nread = 0;
+
+  for(i = 0; i < stub->ntagsubs; i++)
+  {
+    if(!stub->tagsubs[i])
+      continue;
+
+    if(PDSget_tag_h(conn, PDS_MAKE_HANDLE(conn->gen, i), &value, &status) == -1)
+    {
+      value = 0;
+      status = (conn->plc_status | PDSNP_COMMS_APP_ERR);
+    }
+
+    for(sub = stub->tagsubs[i]; sub; sub = sub->next)
+      queue_update(sub, value, status);
+
+    nread++;
+  }
+
+  return nread;
+}
+
+
+
+/******************************************************************************
+* Function to queue a tag's update for its subscriber                         *
+*                                                                             *
+* Pre-condition:  The tag's subscription & its new value & status are passed  *
+*                 to the function                                             *
+* Post-condition: The tag's latest value & status are stored.  If the change  *
+*                 since the value last pushed exceeds the tag's deadband, or  *
+*                 the status has changed, the update is queued, unless one is *
+*                 already queued.  If the client's queue is full, its oldest  *
+*                 update is dropped.  If the update is queued a 1 is returned *
+*                 else a 0 is returned                                        *
+******************************************************************************/
+int queue_update(nwstub_subtag *sub, unsigned short int value,
+                 unsigned short int status)
+{
+  nwstub_client *client = sub->client;
+  nwstub_subtag *oldest = NULL;
+
+  sub->value = value;
+  sub->status = status;
+
+  /* A queued update is coalesced, & pushes the tag's latest value */
+  if(sub->queued)
+    return 0;
+
+  if(status == sub->sent_status &&
+     abs((int) value - (int) sub->sent_value) <= (int) sub->deadband)
+    return 0;
+
+  if(client->subqlen == client->subqsize)
+  {
+    oldest = client->subq[client->subqhead];
+    oldest->queued = 0;
+    client->subqhead = (client->subqhead + 1) % client->subqsize;
+    client->subqlen--;
+    client->subdropped = 1;
+  }
+
+  client->subq[(client->subqhead + client->subqlen) % client->subqsize] = sub;
+  client->subqlen++;
+  sub->queued = 1;
+
+  return 1;
+}
+
+
+
+/******************************************************************************
+* Function to push the updates queued for a subscribed client                 *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the client & the time now (monotonic     *
+*                 nsecs) are passed to the function                           *
+* Post-condition: If the client's min. interval has elapsed, & it isn't       *
+*                 behind with receiving its responses, its queued updates are *
+*                 sent to it in an update frame.  The frame's exception code  *
+*                 tells the client if updates were dropped.  N.B.: A client   *
+*                 in error is closed when epoll reports it.  The no. of       *
+*                 updates pushed is returned                                  *
+******************************************************************************/
+int push_updates(nwstub *stub, nwstub_client *client, unsigned long long now_ns)
+{
+  nwstub_subtag *sub = NULL;
+  pdsnp_buf *frame = NULL, *q = NULL;
+  int n = 0, len = 0;
+
+  if(client->subqlen == 0 || now_ns < client->next_push_ns ||
+     client->wlen >= PDS_NWSTUB_WRHIWAT)
+    return 0;
+
+  len = PDSNP2_HDR_LEN + ((client->subqlen < PDSNP2_MAX_TAGS) ? client->subqlen : PDSNP2_MAX_TAGS) * PDSNP2_UPDATE_ITEM_LEN;
+
+  if(grow_client_buf((void **) &client->wbuf, &client->wsize, (client->wlen + len)) == -1)
+  {
+    fprintf(stderr, "%s: memory allocation error\n", PROGNAME);
+    return 0;
+  }
+
+  frame = client->wbuf + client->wlen;
+
+  for(q = PDSNP2_ITEMS(frame); client->subqlen > 0 && n < PDSNP2_MAX_TAGS; )
+  {
+    sub = client->subq[client->subqhead];
+    client->subqhead = (client->subqhead + 1) % client->subqsize;
+    client->subqlen--;
+    sub->queued = 0;
+
+    /* The tag may have changed back since its update was queued */
+    if(sub->value == sub->sent_value && sub->status == sub->sent_status)
+      continue;
+
+    PDSNP2_SET_U32(q, sub->id);
+    PDSNP2_SET_U16(q + PDSNP2_ID_LEN, sub->value);
+    PDSNP2_SET_U16(q + PDSNP2_ID_LEN + PDSNP2_VALUE_LEN, sub->status);
+    q += PDSNP2_UPDATE_ITEM_LEN;
+
+    sub->sent_value = sub->value;
+    sub->sent_status = sub->status;
+    n++;
+  }
+
+  if(n == 0 && !client->subdropped)
+    return 0;
+
+  len = q - frame;
+  PDSNP2_SET_BUF_LEN(frame, len);
+  PDSNP2_SET_VER(frame, PDSNP2_VER);
+  PDSNP2_SET_FUNC_ID(frame, PDSNP2_UPDATE_FUNC_ID);
+  PDSNP2_SET_EX_CODE(frame, ((client->subdropped) ? PDSNP_COMMS_DROPPED : PDSNP_COMMS_OK));
+  PDSNP2_SET_NTAGS(frame, n);
+  PDSNP2_SET_REQ_ID(frame, 0);
+
+  client->wlen += len;
+  client->subdropped = 0;
+  client->next_push_ns = now_ns + client->interval_ns;
+
+  printd("Pushed %d updates to client on fd %d\n", n, client->fd);
+
+  flush_client(client);
+  update_client_events(stub, client);
+
+  return n;
+}
+
+
+
+/******************************************************************************
+* Function to open the multicast publisher                                    *
+*                                                                             *
+* Pre-condition:  The nwstub struct & the command line args struct, holding   *
+*                 the multicast group, are passed to the function             *
+* Post-condition: A non-blocking socket is opened to send to the group, on    *
+*                 the nwstub's host's interface.  The tags are read, & the    *
+*                 publication starts from the journal's latest change, with a *
+*                 keyframe.  On error a -1 is returned                        *
+******************************************************************************/
+int open_publisher(nwstub *stub, nwstub_args *args)
+{
+  pdsconn *conn = stub->comms->conn;
+  int sopt = PDS_NWSTUB_MCAST_SNDBUF;
+
+  if((stub->mcastfd = open_mcast_sender_socket(args->mcast_group, args->mcast_port, args->host, PDS_NWSTUB_MCAST_TTL)) == -1)
+  {
+    fprintf(stderr, "%s: cannot open multicast socket for group %s:%d\n", PROGNAME, args->mcast_group, args->mcast_port);
+    return -1;
+  }
+
+  fcntl(stub->mcastfd, F_SETFL, fcntl(stub->mcastfd, F_GETFL) | O_NONBLOCK);
+  setsockopt(stub->mcastfd, SOL_SOCKET, SO_SNDBUF, &sopt, sizeof(int));
+
+  if(!(stub->pubvalues = (unsigned short int *) malloc(conn->ttags * sizeof(unsigned short int))) ||
+     !(stub->pubstatuses = (unsigned short int *) malloc(conn->ttags * sizeof(unsigned short int))) ||
+     !(stub->pubchanged = (unsigned char *) calloc(conn->ttags, sizeof(unsigned char))) ||
+     !(stub->pubids = (unsigned int *) malloc(conn->ttags * sizeof(unsigned int))) ||
+     (!stub->changes &&
+      !(stub->changes = (pdschange *) malloc(PDS_NWSTUB_CHGBATCH * sizeof(pdschange)))))
+  {
+    fprintf(stderr, "%s: memory allocation error\n", PROGNAME);
+    close_publisher(stub);
+    return -1;
+  }
+
+  stub->npubtags = conn->ttags;
+  stub->npubids = 0;
+  stub->keyframe_ns = args->keyframe * 1000000ULL;
+
+  stub->jseq = PDSget_change_seq(conn);
+  resync_publication(stub);
+
+  printd("Publishing %d tags to multicast group %s:%d\n", stub->npubtags, args->mcast_group, args->mcast_port);
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to close the multicast publisher                                   *
+*                                                                             *
+* Pre-condition:  The nwstub struct is passed to the function                 *
+* Post-condition: The multicast socket is closed & the published tags are     *
+*                 freed.  The no. of datagrams that couldn't be sent is       *
+*                 returned                                                    *
+******************************************************************************/
+int close_publisher(nwstub *stub)
+{
+  if(stub->npubdropped > 0)
+    fprintf(stderr, "%s: %u multicast datagrams could not be sent\n", PROGNAME, stub->npubdropped);
+
+  if(stub->mcastfd != -1) close(stub->mcastfd);
+  if(stub->pubvalues) free(stub->pubvalues);
+  if(stub->pubstatuses) free(stub->pubstatuses);
+  if(stub->pubchanged) free(stub->pubchanged);
+  if(stub->pubids) free(stub->pubids);
+
+  stub->mcastfd = -1;
+  stub->pubvalues = stub->pubstatuses = NULL;
+  stub->pubchanged = NULL;
+  stub->pubids = NULL;
+  stub->npubtags = stub->npubids = 0;
+
+  return stub->npubdropped;
+}
+
+
+
+/******************************************************************************
+* Function to read the published tags afresh                                  *
+*                                                                             *
+* Pre-condition:  The nwstub struct is passed to the function                 *
+* Post-condition: Each tag's value & status are read from the PDS, as of the  *
+*                 journal's last change read, & a keyframe is published.      *
+*                 The no. of tags read is returned                            *
+******************************************************************************/
+int resync_publication(nwstub *stub)
+{
+  pdsconn *conn = stub->comms->conn;
+  struct timespec now;
+  register int i = 0;
+
+  /* N.B.: A tag may have changed since the journal's last change read, in
+           which case its change is published again with the next batch */
+  for(i = 0; i < stub->npubtags; i++)
+  {
+    if(PDSget_tag_h(conn, PDS_MAKE_HANDLE(conn->gen, i), &stub->pubvalues[i], &stub->pubstatuses[i]) == -1)
+    {
+      stub->pubvalues[i] = 0;
+      stub->pubstatuses[i] = (conn->plc_status | PDSNP_COMMS_APP_ERR);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  publish_keyframe(stub, (now.tv_sec * 1000000000ULL + now.tv_nsec));
+
+  return stub->npubtags;
+}
+
+
+
+/******************************************************************************
+* Function to stage a tag's change for publication                            *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the tag's ID & its new value & status    *
+*                 are passed to the function                                  *
+* Post-condition: The tag's value & status to publish are stored, & the tag   *
+*                 is added to the batch's changed tags, unless it's already   *
+*                 there, in which case the change is coalesced.  If the tag   *
+*                 is added a 1 is returned else a 0 is returned               *
+******************************************************************************/
+int stage_publication(nwstub *stub, unsigned int id, unsigned short int value,
+                      unsigned short int status)
+{
+  if(id >= (unsigned int) stub->npubtags)
+    return 0;
+
+  stub->pubvalues[id] = value;
+  stub->pubstatuses[id] = status;
+
+  if(stub->pubchanged[id])
+    return 0;
+
+  stub->pubchanged[id] = 1;
+  stub->pubids[stub->npubids++] = id;
+
+  return 1;
+}
+
+
+
+/******************************************************************************
+* Function to publish a batch of changes to the multicast group               *
+*                                                                             *
+* Pre-condition:  The nwstub struct, with the batch's changes staged, is      *
+*                 passed to the function                                      *
+* Post-condition: The changed tags' latest values are published in a frame    *
+*                 per block, as of the journal's last change read, & the      *
+*                 batch is emptied.  The no. of frames published is returned  *
+******************************************************************************/
+int publish_batch(nwstub *stub)
+{
+  int nframes = 0;
+  register int i = 0;
+
+  /* A block's tags are contiguous, so sorting their IDs groups them */
+  qsort(stub->pubids, stub->npubids, sizeof(unsigned int), compare_tag_ids);
+
+  nframes = publish_frames(stub, PDSNP2_CHANGES_FUNC_ID, stub->pubids, stub->npubids);
+
+  for(i = 0; i < stub->npubids; i++)
+    stub->pubchanged[stub->pubids[i]] = 0;
+
+  stub->npubids = 0;
+
+  return nframes;
+}
+
+
+
+/******************************************************************************
+* Function to publish a keyframe to the multicast group                       *
+*                                                                             *
+* Pre-condition:  The nwstub struct & the time now (monotonic nsecs) are      *
+*                 passed to the function                                      *
+* Post-condition: All the tags' values are published in a frame per block,    *
+*                 as of the journal's last change read, & the next keyframe   *
+*                 is due after the keyframe interval.  The no. of frames      *
+*                 published is returned                                       *
+******************************************************************************/
+int publish_keyframe(nwstub *stub, unsigned long long now_ns)
+{
+  int nframes = 0;
+
+  nframes = publish_frames(stub, PDSNP2_KEYFRAME_FUNC_ID, NULL, stub->npubtags);
+  stub->next_key_ns = now_ns + stub->keyframe_ns;
+
+  printd("Published a keyframe of %d tags in %d frames\n", stub->npubtags, nframes);
+
+  return nframes;
+}
+
+
+
+/******************************************************************************
+* Function to publish tags to the multicast group                             *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the function ID of the frames, the tags' *
+*                 IDs (in order, or NULL for all the tags) & the no. of tags  *
+*                 are passed to the function                                  *
+* Post-condition: The tags' published values & statuses are sent in frames    *
+*                 holding one block's tags each, as many as fit in a          *
+*                 datagram.  Each frame is stamped with the latest            *
+*                 acquisition time of its tags.  The no. of frames published  *
+*                 is returned                                                 *
+******************************************************************************/
+int publish_frames(nwstub *stub, int func_id, const unsigned int *ids, int nids)
+{
+  pdsconn *conn = stub->comms->conn;
+  pdsnp_buf frame[PDSNP2_MAX_PUB_LEN], *q = NULL;
+  unsigned long long mtime_ns = 0;
+  unsigned int id = 0;
+  int block_id = 0, n = 0, nframes = 0;
+  register int i = 0;
+
+  for(i = 0; i < nids; i++)
+  {
+    id = (ids) ? ids[i] : (unsigned int) i;
+
+    if(n > 0 && (conn->data[id].block_id != block_id || n == PDSNP2_MAX_PUB_TAGS))
+    {
+      send_publication(stub, frame, func_id, n, block_id, mtime_ns);
+      n = 0;
+      nframes++;
+    }
+
+    if(n == 0)
+    {
+      block_id = conn->data[id].block_id;
+      mtime_ns = 0;
+      q = PDSNP2_PUB_ITEMS(frame);
+    }
+
+    PDSNP2_SET_U32(q, id);
+    PDSNP2_SET_U16(q + PDSNP2_ID_LEN, stub->pubvalues[id]);
+    PDSNP2_SET_U16(q + PDSNP2_ID_LEN + PDSNP2_VALUE_LEN, stub->pubstatuses[id]);
+    q += PDSNP2_UPDATE_ITEM_LEN;
+    n++;
+
+    if(conn->mtimes_ns[id] > mtime_ns)
+      mtime_ns = conn->mtimes_ns[id];
+  }
+
+  if(n > 0)
+  {
+    send_publication(stub, frame, func_id, n, block_id, mtime_ns);
+    nframes++;
+  }
+
+  return nframes;
+}
+
+
+
+/******************************************************************************
+* Function to send a frame to the multicast group                             *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the frame holding its tags, its function *
+*                 ID, no. of tags, block ID & time are passed to the function *
+* Post-condition: The frame's headers are set, stamped with the next sequence *
+*                 no., & the frame is sent as a datagram.  If it can't be     *
+*                 sent, it's dropped.  The frame's length is returned, or -1  *
+*                 if it was dropped                                           *
+******************************************************************************/
+int send_publication(nwstub *stub, pdsnp_buf *frame, int func_id, int ntags,
+                     int block_id, unsigned long long mtime_ns)
+{
+  int len = PDSNP2_HDR_LEN + PDSNP2_PUB_HDR_LEN + ntags * PDSNP2_UPDATE_ITEM_LEN;
+
+  set_publication_hdr(stub, frame, len, func_id, ntags, block_id, mtime_ns);
+  stub->pubseq++;
+  PDSNP2_SET_REQ_ID(frame, stub->pubseq);
+
+  /* The clients see the gap in the sequence nos. */
+  if(send(stub->mcastfd, frame, len, 0) == -1)
+  {
+    printd("Multicast frame %u dropped: %s\n", stub->pubseq, strerror(errno));
+    stub->npubdropped++;
+    return -1;
+  }
+
+  return len;
+}
+
+
+
+/******************************************************************************
+* Function to set the headers of a published frame                            *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the frame, its length, function ID, no.  *
+*                 of tags, block ID & time are passed to the function         *
+* Post-condition: The frame's v2 header & its publication header are set,     *
+*                 with the values as of the journal's last change read.  The  *
+*                 caller sets the request ID                                  *
+******************************************************************************/
+int set_publication_hdr(nwstub *stub, pdsnp_buf *frame, int len, int func_id,
+                        int ntags, int block_id, unsigned long long mtime_ns)
+{
+  pdsconn *conn = stub->comms->conn;
+
+  PDSNP2_SET_BUF_LEN(frame, len);
+  PDSNP2_SET_VER(frame, PDSNP2_VER);
+  PDSNP2_SET_FUNC_ID(frame, func_id);
+  PDSNP2_SET_EX_CODE(frame, PDSNP_COMMS_OK);
+  PDSNP2_SET_NTAGS(frame, ntags);
+  PDSNP2_SET_JSEQ(frame, stub->jseq);
+  PDSNP2_SET_TIME(frame, mtime_ns);
+  PDSNP2_SET_GEN(frame, (conn->gen & PDS_HANDLE_GEN_MASK));
+  PDSNP2_SET_BLOCK(frame, block_id);
+  PDSNP2_SET_TTAGS(frame, stub->npubtags);
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to queue a snapshot of the published tags for a client             *
+*                                                                             *
+* Pre-condition:  The nwstub struct, the client & its request frame, holding  *
+*                 the ID of the 1st tag, are passed to the function           *
+* Post-condition: The published tags, from the 1st tag, are queued in the     *
+*                 client's send buffer, as many as fit in a frame, as of the  *
+*                 journal's last change read.  If the tags aren't published,  *
+*                 the response has a function error.  A 1 is returned.  If    *
+*                 the request is invalid a -1 is returned                     *
+******************************************************************************/
+int queue_snapshot(nwstub *stub, nwstub_client *client, const pdsnp_buf *req,
+                   int len)
+{
+  pdsconn *conn = stub->comms->conn;
+  pdsnp_buf *resp = NULL, *q = NULL;
+  unsigned long long mtime_ns = 0;
+  unsigned int first = 0, id = 0;
+  int ntags = 0, resp_len = 0;
+
+  if(len != (PDSNP2_HDR_LEN + PDSNP2_ID_LEN) || PDSNP2_GET_NTAGS(req) != 0)
+    return -1;
+
+  first = PDSNP2_GET_U32(PDSNP2_ITEMS(req));
+
+  if(stub->mcastfd != -1 && first < (unsigned int) stub->npubtags)
+    ntags = ((stub->npubtags - first) < PDSNP2_MAX_TAGS) ? (stub->npubtags - first) : PDSNP2_MAX_TAGS;
+
+  resp_len = PDSNP2_HDR_LEN + PDSNP2_PUB_HDR_LEN + ntags * PDSNP2_UPDATE_ITEM_LEN;
+
+  if(grow_client_buf((void **) &client->wbuf, &client->wsize, (client->wlen + resp_len)) == -1)
+    return -1;
+
+  resp = client->wbuf + client->wlen;
+
+  for(id = first, q = PDSNP2_PUB_ITEMS(resp); id < (first + ntags); id++)
+  {
+    PDSNP2_SET_U32(q, id);
+    PDSNP2_SET_U16(q + PDSNP2_ID_LEN, stub->pubvalues[id]);
+    PDSNP2_SET_U16(q + PDSNP2_ID_LEN + PDSNP2_VALUE_LEN, stub->pubstatuses[id]);
+    q += PDSNP2_UPDATE_ITEM_LEN;
+
+    if(conn->mtimes_ns[id] > mtime_ns)
+      mtime_ns = conn->mtimes_ns[id];
+  }
+
+  set_publication_hdr(stub, resp, resp_len, PDSNP2_SNAPSHOT_FUNC_ID, ntags, PDSNP2_NO_BLOCK, mtime_ns);
+  PDSNP2_SET_REQ_ID(resp, PDSNP2_GET_REQ_ID(req));
+
+  if(stub->mcastfd == -1)
+    PDSNP2_SET_EX_CODE(resp, PDSNP_COMMS_FUNC_ERR);
+
+  printd("Snapshot of %d tags from tag %u\n", ntags, first);
+
+  client->wlen += resp_len;
+
+  return 1;
+}
+
+
+
+/******************************************************************************
+* Function to compare two tags' IDs (for qsort)                               *
+*                                                                             *
+* Pre-condition:  Pointers to the two IDs are passed to the function          *
+* Post-condition: A -1, 0 or 1 is returned if the 1st ID is less than, equal  *
+*                 to or greater than the 2nd ID                               *
+******************************************************************************/
+int compare_tag_ids(const void *a, const void *b)
+{
+  unsigned int x = *(const unsigned int *) a, y = *(const unsigned int *) b;
+
+  return (x < y) ? -1 : (x > y);
+}
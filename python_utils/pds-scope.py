@@ -8,11 +8,15 @@
 
 import argparse
 
+import numpy as np
 from matplotlib import pyplot as plt
 from matplotlib import animation
 
 import pds.pds as pds
 
+# Layout of a pdssample struct in a tag's sample history ring
+SAMPLE_DTYPE = np.dtype({'names': ['mtime_ns', 'value', 'status'], 'formats': ['<u8', '<u2', '<u2'], 'offsets': [0, 8, 10], 'itemsize': 16})
+
 class PdsScope(object):
     def __init__(self, tagname, npoints=80, ylim=(), offset=0, scale_factor=1,
                  interval=200, style=None, show_grid=True):
@@ -20,6 +24,9 @@ class PdsScope(object):
         self.tagname = tagname
         self.conn = None
         self.tag = None
+        self.handle = pds.PDS_HANDLE_INVALID
+        self.history = None
+        self.count = 0
         self.fig = None
         self.line = None
         self.data = {'x': [], 'y': []}
@@ -57,6 +64,23 @@ class PdsScope(object):
 
         return self.line,
 
+    def read_samples(self):
+        # If the tag has a history, we take all samples since the last read,
+        # so the signal is plotted at the server's scan rate, rather than
+        # at our sampling interval
+        if self.history is not None:
+            depth = len(self.history)
+            count = pds.PDSget_tag_history_count(self.conn, self.handle)
+
+            # The oldest sample in the ring may be being overwritten
+            n = min((count - self.count) & 0xffffffff, depth - 1)
+            slots = [(count - n + i) & (depth - 1) for i in range(n)]
+            self.count = count
+
+            return [int(v) for v in self.history['value'][slots]]
+        else:
+            return [int(self.tag.value)]
+
     def process_tag(self):
         # Used to ensure the latest data scrolls in the plotting area
         fixed_x = [i for i in range(self.conf['npoints'])]
@@ -68,19 +92,27 @@ class PdsScope(object):
             raise ValueError('Error connecting to the PDS: {}'.format(self.conn.status))
 
         self.tag = pds.PDSget_tag_object(self.conn, self.tagname)
+        self.handle = pds.PDSresolve_tag(self.conn, self.tagname)
+        buf = pds.PDSget_tag_history_buffer(self.conn, self.handle)
+
+        # Read the tag's sample history in place, if it has one
+        if buf is not None:
+            self.history = np.frombuffer(buf, dtype=SAMPLE_DTYPE)
+            self.count = pds.PDSget_tag_history_count(self.conn, self.handle)
 
         while True:
             try:
-                self.data['x'].append(i)
-                i += 1
+                for value in self.read_samples():
+                    self.data['x'].append(i)
+                    i += 1
 
-                y = int(self.tag.value) * self.conf['scale_factor'] + self.conf['offset']
-                self.data['y'].append(y)
+                    y = value * self.conf['scale_factor'] + self.conf['offset']
+                    self.data['y'].append(y)
 
                 # Once we've drawn to the RHS, we start scrolling
                 if len(self.data['x']) > self.conf['npoints']:
                     self.data['x'] = fixed_x[:]
-                    self.data['y'] = self.data['y'][1:]
+                    self.data['y'] = self.data['y'][-self.conf['npoints']:]
 
                 # We must yield an iterable, hence this tuple
                 yield self.data,
@@ -116,6 +148,10 @@ Turn the grid off (-G) and set the style (-s) to a light signal on a dark
 background:
 
 python3 pds-scope.py -o -1 -f 0.001 -y -1.1 1.1 -i 40 sine -G -s dark_background
+
+If the tag's block has a history depth in plc.cnf, then every sample taken by
+the server is plotted, and the interval (-i) only sets the refresh rate of
+the plot.
 """
 
     parser = argparse.ArgumentParser(description='oscilloscope to display the given tag', epilog=epilog, formatter_class=argparse.RawDescriptionHelpFormatter)
@@ -59,6 +59,26 @@ int cip_setup_read_query(unsigned char *query, plc_cnf_block *block)
 
 
 
+/******************************************************************************
+* Function to check if a read block can be coalesced into a read query        *
+*                                                                             *
+* Pre-condition:  The (possibly already coalesced) block of the query & the   *
+*                 following block are passed to the function                  *
+* Post-condition: If the query can be extended to also read the following     *
+*                 block, within the CIP protocol's limits, a 1 is returned    *
+*                 otherwise a 0 is returned                                   *
+******************************************************************************/
+int cip_coalesce_read_blocks(plc_cnf_block *merged, plc_cnf_block *block)
+{
+  unsigned short int size = 0;
+
+  size = CIP_HI_REF(merged->tags[0].ref, block->tags[block->ntags-1].ref);
+
+  return ((CIP_DATA + (size * CIP_WORDSIZE)) <= CIP_MAXBUFLEN);
+}
+
+
+
 /******************************************************************************
 * Function to setup a write PLC query using the tag & message parameters      *
 *                                                                             *
@@ -922,10 +942,10 @@ int cip_refresh_data_tags(pdsconn *conn, pdstrans *trans)
 
       for(i = 0; i < nvalues; i++) 
       {
-        if(i == tag->ref) 
+        if(PDS_TRANS_IN_BLOCK(trans, tag) && i == tag->ref) 
         { 
-          tag->value = (trans->response[CIP_DATA+i] == 0xff ? 1 : 0);
-          tag->mtime = (time_t) time(NULL);
+          PDS_TRANS_VALUE(trans, tag) = (trans->response[CIP_DATA+i] == 0xff ? 1 : 0);
+          PDS_TRANS_STAMP(trans, tag);
           tag++;
         }
       }
@@ -936,10 +956,10 @@ int cip_refresh_data_tags(pdsconn *conn, pdstrans *trans)
 
       for(i = 0; i < nvalues; i++) 
       {
-        if(i == tag->ref) 
+        if(PDS_TRANS_IN_BLOCK(trans, tag) && i == tag->ref) 
         { 
-          tag->value = trans->response[CIP_DATA+i];
-          tag->mtime = (time_t) time(NULL);
+          PDS_TRANS_VALUE(trans, tag) = trans->response[CIP_DATA+i];
+          PDS_TRANS_STAMP(trans, tag);
           tag++;
         }
       }
@@ -950,11 +970,11 @@ int cip_refresh_data_tags(pdsconn *conn, pdstrans *trans)
 
       for(i = 0; i < nvalues; i++) 
       {
-        if(i == tag->ref) 
+        if(PDS_TRANS_IN_BLOCK(trans, tag) && i == tag->ref) 
         { 
-          tag->value = PDS_MAKEWORD(trans->response[CIP_DATA+1+i+i],
+          PDS_TRANS_VALUE(trans, tag) = PDS_MAKEWORD(trans->response[CIP_DATA+1+i+i],
           trans->response[CIP_DATA+i+i]);
-          tag->mtime = (time_t) time(NULL);
+          PDS_TRANS_STAMP(trans, tag);
           tag++;
         }
       }
@@ -968,19 +988,19 @@ int cip_refresh_data_tags(pdsconn *conn, pdstrans *trans)
       {
         /* N.B.: Internal storage in the PDS is 16 bit words so to store a
                  32 bit value it MUST span 2 tags -- hiword loword */
-        if(i == tag->ref) 
+        if(PDS_TRANS_IN_BLOCK(trans, tag) && i == tag->ref) 
         { 
-          tag->value = PDS_MAKEWORD(trans->response[CIP_DATA+3+i+i+i+i],
+          PDS_TRANS_VALUE(trans, tag) = PDS_MAKEWORD(trans->response[CIP_DATA+3+i+i+i+i],
           trans->response[CIP_DATA+2+i+i+i+i]);
-          tag->mtime = (time_t) time(NULL);
+          PDS_TRANS_STAMP(trans, tag);
           tag++;
 
           /* Ensure next tag is configured */
-          if(tag && (i == tag->ref))
+          if(PDS_TRANS_IN_BLOCK(trans, tag) && (i == tag->ref))
           {
-            tag->value = PDS_MAKEWORD(trans->response[CIP_DATA+1+i+i+i+i],
+            PDS_TRANS_VALUE(trans, tag) = PDS_MAKEWORD(trans->response[CIP_DATA+1+i+i+i+i],
             trans->response[CIP_DATA+i+i+i+i]);
-            tag->mtime = (time_t) time(NULL);
+            PDS_TRANS_STAMP(trans, tag);
             tag++;
           }
           else
@@ -1035,11 +1055,13 @@ int cip_parse_plc_routing_path(const char *path, unsigned char *pathbuf)
 /******************************************************************************
 * Function to connect to a PLC (CIP specific)                                 *
 *                                                                             *
-* Pre-condition:  The connection struct is passed to the function             *
-* Post-condition: A connection is established with the PLC.  If an error      *
-*                 occurs a -1 is returned                                     *
+* Pre-condition:  The connection struct, the PLC's socket address, as         *
+*                 returned by resolve_plc_address(), & the connect timeout    *
+*                 (in usecs) are passed to the function                       *
+* Post-condition: A connection is established with the PLC, within the        *
+*                 timeout.  If an error occurs a -1 is returned               *
 ******************************************************************************/
-int cip_connect_to_plc(pdsconn *conn)
+int cip_connect_to_plc(pdsconn *conn, struct sockaddr_in *addr, int tmo)
 {
   pdstrans regtrans;
 
@@ -1057,7 +1079,7 @@ int cip_connect_to_plc(pdsconn *conn)
     __cip_fd = 0;
  
     /* Connect the server to the PLC */
-    if((__cip_fd = open_plc_socket(conn->ip_addr, conn->port)) == -1)
+    if((__cip_fd = open_plc_socket_tmo(addr, tmo)) == -1)
     {
       err(errout, "%s: error opening socket to %s:%u:%s\n", PROGNAME, conn->ip_addr, conn->port, conn->path);
       return -1;
@@ -20,6 +20,7 @@
 #define CIP_IOI_SEGLEN		50     /* Max. IOI segment length */
 #define CIP_PORT		44818  /* CIP standard TCP port */
 #define CIP_BITS_BYTE		8      /* Bits per byte */
+#define CIP_WORDSIZE		2      /* Max. bytes per read element */
 #define CIP_TMO_SECS		2      /* Select timeout interval (secs) */
 #define CIP_TMO_USECS		100000 /* Select timeout interval (usecs) */
 #define CIP_SID_LEN		4      /* Session ID byte length */
@@ -237,6 +238,17 @@ typedef struct cip_cpf_rec
 ******************************************************************************/
 int cip_setup_read_query(unsigned char *query, plc_cnf_block *block);
 
+/******************************************************************************
+* Function to check if a read block can be coalesced into a read query        *
+*                                                                             *
+* Pre-condition:  The (possibly already coalesced) block of the query & the   *
+*                 following block are passed to the function                  *
+* Post-condition: If the query can be extended to also read the following     *
+*                 block, within the CIP protocol's limits, a 1 is returned    *
+*                 otherwise a 0 is returned                                   *
+******************************************************************************/
+int cip_coalesce_read_blocks(plc_cnf_block *merged, plc_cnf_block *block);
+
 /******************************************************************************
 * Function to setup a write PLC query using the tag & message parameters      *
 *                                                                             *
@@ -403,11 +415,13 @@ int cip_parse_plc_routing_path(const char *path, unsigned char *pathbuf);
 /******************************************************************************
 * Function to connect to a PLC (CIP specific)                                 *
 *                                                                             *
-* Pre-condition:  The connection struct is passed to the function             *
-* Post-condition: A connection is established with the PLC.  If an error      *
-*                 occurs a -1 is returned                                     *
+* Pre-condition:  The connection struct, the PLC's socket address, as         *
+*                 returned by resolve_plc_address(), & the connect timeout    *
+*                 (in usecs) are passed to the function                       *
+* Post-condition: A connection is established with the PLC, within the        *
+*                 timeout.  If an error occurs a -1 is returned               *
 ******************************************************************************/
-int cip_connect_to_plc(pdsconn *conn);
+int cip_connect_to_plc(pdsconn *conn, struct sockaddr_in *addr, int tmo);
 
 /******************************************************************************
 * Function to disconnect from a PLC (CIP specific)                            *
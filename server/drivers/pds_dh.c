@@ -56,6 +56,26 @@ int dh_setup_read_query(unsigned char *query, plc_cnf_block *block)
 
 
 
+/******************************************************************************
+* Function to check if a read block can be coalesced into a read query        *
+*                                                                             *
+* Pre-condition:  The (possibly already coalesced) block of the query & the   *
+*                 following block are passed to the function                  *
+* Post-condition: If the query can be extended to also read the following     *
+*                 block, within the DH protocol's limits, a 1 is returned     *
+*                 otherwise a 0 is returned                                   *
+******************************************************************************/
+int dh_coalesce_read_blocks(plc_cnf_block *merged, plc_cnf_block *block)
+{
+  unsigned short int ttrans = 0;
+
+  ttrans = DH_HI_REF(0, block->tags[block->ntags-1].ref);
+
+  return ((ttrans * DH_WORDSIZE) <= DH_RDDATA_MAX);
+}
+
+
+
 /******************************************************************************
 * Function to setup a write PLC query using the tag & message parameters      *
 *                                                                             *
@@ -699,10 +719,10 @@ int dh_refresh_data_tags(pdsconn *conn, pdstrans *trans)
 
       for(i = 0, base = tag; i < nvalues; i++) 
       {
-        if(i == tag->ref) 
+        if(PDS_TRANS_IN_BLOCK(trans, tag) && i == tag->ref) 
         { 
-          tag->value = PDS_MAKEWORD(trans->response[DH_HI_DATA+i+i], trans->response[DH_LO_DATA+i+i]);
-          tag->mtime = (time_t) time(NULL);
+          PDS_TRANS_VALUE(trans, tag) = PDS_MAKEWORD(trans->response[DH_HI_DATA+i+i], trans->response[DH_LO_DATA+i+i]);
+          PDS_TRANS_STAMP(trans, tag);
           tag++;
         }
       }
@@ -186,6 +186,17 @@
 ******************************************************************************/
 int dh_setup_read_query(unsigned char *query, plc_cnf_block *block);
 
+/******************************************************************************
+* Function to check if a read block can be coalesced into a read query        *
+*                                                                             *
+* Pre-condition:  The (possibly already coalesced) block of the query & the   *
+*                 following block are passed to the function                  *
+* Post-condition: If the query can be extended to also read the following     *
+*                 block, within the DH protocol's limits, a 1 is returned     *
+*                 otherwise a 0 is returned                                   *
+******************************************************************************/
+int dh_coalesce_read_blocks(plc_cnf_block *merged, plc_cnf_block *block);
+
 /******************************************************************************
 * Function to setup a write PLC query using the tag & message parameters      *
 *                                                                             *
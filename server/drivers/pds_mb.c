@@ -48,6 +48,29 @@ int mb_setup_read_query(unsigned char *query, plc_cnf_block *block)
 
 
 
+/******************************************************************************
+* Function to check if a read block can be coalesced into a read query        *
+*                                                                             *
+* Pre-condition:  The (possibly already coalesced) block of the query & the   *
+*                 following block are passed to the function                  *
+* Post-condition: If the query can be extended to also read the following     *
+*                 block, within the ModBus protocol's limits, a 1 is returned *
+*                 otherwise a 0 is returned                                   *
+******************************************************************************/
+int mb_coalesce_read_blocks(plc_cnf_block *merged, plc_cnf_block *block)
+{
+  unsigned short int function = 0, nrefs = 0;
+
+  function = MB_GET_FUNC(merged->function);
+  function = MB_WRRD_MAP(function);
+  nrefs = MB_HI_REF(merged->tags[0].ref, block->tags[block->ntags-1].ref);
+
+  /* N.B.: Upto 125 registers or 2000 coils/inputs can be read at once */
+  return (MB_DATABYTES(function, nrefs) <= MB_RDDATA_MAX);
+}
+
+
+
 /******************************************************************************
 * Function to setup a write PLC query using the tag & message parameters      *
 *                                                                             *
@@ -78,6 +101,48 @@ int mb_setup_write_query(unsigned char *query, pdstag *tag, pdsmsg *msg)
 
 
 
+/******************************************************************************
+* Function to append a write message's data to a coalesced write message      *
+*                                                                             *
+* Pre-condition:  The tag struct for the coalesced message's first reference, *
+*                 the coalesced message & the message to be appended are      *
+*                 passed to the function                                      *
+* Post-condition: The message's data is appended to the coalesced message's   *
+*                 data, packing coils MB_BITS_BYTE per value as required by   *
+*                 the query.  The coalesced no. of references is returned or  *
+*                 -1 if an error occurs                                       *
+******************************************************************************/
+int mb_coalesce_write_values(pdstag *tag, pdsmsg *merged, pdsmsg *msg)
+{
+  unsigned short int i = 0, n = 0;
+
+  if((merged->ntags + msg->ntags) > PDS_NTAGVALUES)
+    return -1;
+
+  if(MB_GET_FUNC(tag->function) == MB_MC_WRITE)
+  {
+    /* Copy each coil from its position in the message to the next position
+       in the coalesced message */
+    for(i = 0, n = merged->ntags; i < msg->ntags; i++, n++)
+    {
+      if((msg->tagvalues[i / MB_BITS_BYTE] >> (i % MB_BITS_BYTE)) & 0x01)
+        merged->tagvalues[n / MB_BITS_BYTE] |= (0x01 << (n % MB_BITS_BYTE));
+      else
+        merged->tagvalues[n / MB_BITS_BYTE] &= ~(0x01 << (n % MB_BITS_BYTE));
+    }
+  }
+  else
+  {
+    memcpy(&merged->tagvalues[merged->ntags], msg->tagvalues,
+           (msg->ntags * sizeof(unsigned short int)));
+  }
+  merged->ntags += msg->ntags;
+
+  return merged->ntags;
+}
+
+
+
 /******************************************************************************
 * Function to setup a status PLC query using the connection parameters        *
 *                                                                             *
@@ -367,6 +432,10 @@ short int mb_instantiate_prepared_query(pdstrans *trans)
       for(i = 0; i < 5; i++)      /* Zero the first 5 (0 to 4) elements */ 
         trans->buf[i] = 0;        /* - id id proto-id proto-id hi-len */
 
+      /* Stamp the transaction ID, so pipelined responses can be matched */
+      trans->buf[MB_TCPIP_HI_TRANS_ID] = PDS_GETHIBYTE(trans->trans_id);
+      trans->buf[MB_TCPIP_LO_TRANS_ID] = PDS_GETLOBYTE(trans->trans_id);
+
       /* The next byte (following no. of bytes in buffer) is determined
          by the type of the query's function (plus nrefs if write query) */
       switch(MB_FUNCTYPE(function))
@@ -587,10 +656,10 @@ int mb_refresh_data_tags(pdsconn *conn, pdstrans *trans)
       /* Get values of upto MB_BITS_BYTE bits */
       for(x = 0; x < MB_BITS_BYTE; x++)
       {
-        if(bit == (tag->ref - base->ref)) 
+        if(PDS_TRANS_IN_BLOCK(trans, tag) && bit == (tag->ref - base->ref)) 
         { 
-          tag->value = PDS_GETBIT(trans->response[MB_HI_DATA+i], x);
-          tag->mtime = (time_t) time(NULL);
+          PDS_TRANS_VALUE(trans, tag) = PDS_GETBIT(trans->response[MB_HI_DATA+i], x);
+          PDS_TRANS_STAMP(trans, tag);
           tag++;
         }
         bit++;
@@ -603,11 +672,11 @@ int mb_refresh_data_tags(pdsconn *conn, pdstrans *trans)
   {
     for(i = 0, base = tag; i < nvalues; i++) 
     {
-      if(i == (tag->ref - base->ref)) 
+      if(PDS_TRANS_IN_BLOCK(trans, tag) && i == (tag->ref - base->ref)) 
       { 
-        tag->value = PDS_MAKEWORD(trans->response[MB_HI_DATA+i+i],
+        PDS_TRANS_VALUE(trans, tag) = PDS_MAKEWORD(trans->response[MB_HI_DATA+i+i],
         trans->response[MB_LO_DATA+i+i]);
-        tag->mtime = (time_t) time(NULL);
+        PDS_TRANS_STAMP(trans, tag);
         tag++;
       }
     }
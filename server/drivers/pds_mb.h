@@ -65,6 +65,12 @@
 #define MB_TCPIP_PRELEN		6
 #define MB_TCPIP_POSTLEN	0
 
+/* ModBus/TCP MBAP header transaction ID & length field positions */
+#define MB_TCPIP_HI_TRANS_ID	0
+#define MB_TCPIP_LO_TRANS_ID	1
+#define MB_TCPIP_HI_LEN		4
+#define MB_TCPIP_LO_LEN		5
+
 #define MB_CS_BASE	000000    /* Base address of Coils */
 #define MB_IS_BASE	100000    /* Base address of Discrete Inputs */
 #define MB_HR_BASE	400000    /* Base address of Holding Registers */
@@ -194,6 +200,17 @@ PDS_WR_FUNC :\
 ******************************************************************************/
 int mb_setup_read_query(unsigned char *query, plc_cnf_block *block);
 
+/******************************************************************************
+* Function to check if a read block can be coalesced into a read query        *
+*                                                                             *
+* Pre-condition:  The (possibly already coalesced) block of the query & the   *
+*                 following block are passed to the function                  *
+* Post-condition: If the query can be extended to also read the following     *
+*                 block, within the ModBus protocol's limits, a 1 is returned *
+*                 otherwise a 0 is returned                                   *
+******************************************************************************/
+int mb_coalesce_read_blocks(plc_cnf_block *merged, plc_cnf_block *block);
+
 /******************************************************************************
 * Function to setup a write PLC query using the tag & message parameters      *
 *                                                                             *
@@ -206,6 +223,19 @@ int mb_setup_read_query(unsigned char *query, plc_cnf_block *block);
 ******************************************************************************/
 int mb_setup_write_query(unsigned char *query, pdstag *tag, pdsmsg *msg);
 
+/******************************************************************************
+* Function to append a write message's data to a coalesced write message      *
+*                                                                             *
+* Pre-condition:  The tag struct for the coalesced message's first reference, *
+*                 the coalesced message & the message to be appended are      *
+*                 passed to the function                                      *
+* Post-condition: The message's data is appended to the coalesced message's   *
+*                 data, packing coils MB_BITS_BYTE per value as required by   *
+*                 the query.  The coalesced no. of references is returned or  *
+*                 -1 if an error occurs                                       *
+******************************************************************************/
+int mb_coalesce_write_values(pdstag *tag, pdsmsg *merged, pdsmsg *msg);
+
 /******************************************************************************
 * Function to setup a status PLC query using the connection parameters        *
 *                                                                             *
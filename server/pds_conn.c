@@ -11,6 +11,7 @@
 extern int quit_flag;             /* Declared in the main file */
 extern int errout;                /* Declared in the main file */
 extern int dbgflag;               /* Declared in the main file */
+extern unsigned int runmode;      /* Declared in the main file */
 
 /******************************************************************************
 * Function to initialise the server connection                                *
@@ -23,12 +24,21 @@ extern int dbgflag;               /* Declared in the main file */
 ******************************************************************************/
 int init_server_connection(plc_cnf *conf, pdsconn *conn)
 {
+  register int i = 0;
+
   conn->nblocks = conf->nblocks;            /* No. of blocks in config */
   conn->nplcs = conf->nplcs;                /* No. of PLCs in config */
   conn->ndata_tags = conf->ndata_tags;      /* No. of data tags in config */
   conn->nstatus_tags = conf->nstatus_tags;  /* No. of status tags in config */
   conn->ttags = conf->ttags;                /* Total no. of tags in config */ 
 
+  /* Each tag of a block with a history depth keeps that many samples */
+  for(i = 0, conn->nsamples = 0; i < conf->nblocks; i++)
+    conn->nsamples += (conf->blocks[i].ntags * conf->blocks[i].history);
+
+  /* In seqlock refresh mode, clients read without holding the semaphore */
+  conn->seqlock = (PDS_GET_RM_REFRESH(runmode) == PDS_RM_REFRESH_SEQLOCK);
+
   if(init_semaphores(conn) == -1) /* Setup semaphore for connection */ 
   {
     err(errout, "%s: error initialising semaphore\n", PROGNAME);
@@ -54,6 +64,11 @@ int init_server_connection(plc_cnf *conf, pdsconn *conn)
     return -1;
   }
 
+  /* Set the segment's generation no.  Clients stamp resolved tag handles
+     with this, so handles resolved against a previous server instance are
+     rejected rather than silently indexing the wrong tag */
+  conn->gen = (int) (((unsigned int) time(NULL) ^ (unsigned int) getpid()) & PDS_HANDLE_GEN_MASK);
+
   /* Set the server's Front-end/Back-end protocol version.  This ensures that
      any client that connects to the server must have been compiled against
      the same libraries/headers etc. to be able to talk to this server */
@@ -153,7 +168,39 @@ int init_semaphores(pdsconn *conn)
 ******************************************************************************/
 int init_shared_mem(pdsconn *conn)
 {
-  conn->shmsize = conn->ttags * sizeof(pdstag); 
+  pdsseg seg;
+
+  /* Size the tag name index as a power of 2, with at least
+     PDS_HASH_SLOTS_TAG slots per tag, so that probe sequences stay short */
+  for(conn->nhash = 1; conn->nhash < (conn->ttags * PDS_HASH_SLOTS_TAG); conn->nhash <<= 1);
+
+  /* Size the change journal as a power of 2, with at least
+     PDS_JOURNAL_RECS_TAG records per tag, so that a mirroring client can
+     fall a few refresh cycles behind without overrunning it */
+  for(conn->njournal = PDS_JOURNAL_MIN_RECS; conn->njournal < (conn->ttags * PDS_JOURNAL_RECS_TAG); conn->njournal <<= 1);
+
+  /* Lay out the segment.  The header & the tags' metadata are read-only
+     once mapped, so the hot data start on a page of their own.  Each hot
+     data array starts on a cache line */
+  memset(&seg, 0, sizeof(pdsseg));
+  seg.ttags = conn->ttags;
+  seg.values = PDS_SEG_ALIGN(PDS_SEG_HDR_LEN + (conn->ttags * sizeof(pdstag)), getpagesize());
+  seg.statuses = PDS_SEG_ALIGN(seg.values + (conn->ttags * sizeof(unsigned short int)), PDS_SEG_CACHE_LINE);
+  seg.mtimes = PDS_SEG_ALIGN(seg.statuses + (conn->ttags * sizeof(unsigned short int)), PDS_SEG_CACHE_LINE);
+  seg.mtimes_ns = PDS_SEG_ALIGN(seg.mtimes + (conn->ttags * sizeof(time_t)), PDS_SEG_CACHE_LINE);
+  seg.acq = PDS_SEG_ALIGN(seg.mtimes_ns + (conn->ttags * sizeof(unsigned long long)), PDS_SEG_CACHE_LINE);
+  seg.seq = PDS_SEG_ALIGN(seg.acq + (PDS_GET_NSEQ(conn) * sizeof(pdsacq)), PDS_SEG_CACHE_LINE);
+  seg.chg = PDS_SEG_ALIGN(seg.seq + (PDS_GET_NSEQ(conn) * sizeof(unsigned int)), PDS_SEG_CACHE_LINE);
+  seg.journal = PDS_SEG_ALIGN(seg.chg + (PDS_GET_NCHG(conn) * sizeof(unsigned int)), PDS_SEG_CACHE_LINE);
+  seg.njournal = conn->njournal;
+  seg.hist = PDS_SEG_ALIGN(seg.journal + PDS_SEG_CACHE_LINE + (conn->njournal * sizeof(pdschange)), PDS_SEG_CACHE_LINE);
+  seg.samples = PDS_SEG_ALIGN(seg.hist + (conn->nblocks * sizeof(pdshist)), PDS_SEG_CACHE_LINE);
+  seg.nsamples = conn->nsamples;
+  seg.snap = PDS_SEG_ALIGN(seg.samples + (conn->nsamples * sizeof(pdssample)), PDS_SEG_CACHE_LINE);
+  seg.hash = seg.snap + PDS_SNAP_LEN(conn->ttags);
+  seg.size = seg.hash + (conn->nhash * sizeof(unsigned int));
+
+  conn->shmsize = seg.size; 
   conn->shmflags = PDS_SHMFLAGS | IPC_CREAT | IPC_EXCL;
 
   /* Create and attach a shared memory segment */
@@ -163,12 +210,37 @@ int init_shared_mem(pdsconn *conn)
     return -1;
   }
 
+  /* Write the segment's header, so that clients can find each region */
+  memcpy(conn->shm, &seg, sizeof(pdsseg));
+  conn->seg = (pdsseg *) conn->shm;
+
   /* Assign tag pointers to the start of the data & status tags */
-  conn->data = (pdstag *) conn->shm;
-  conn->status = (pdstag *) (conn->shm + (conn->ndata_tags * sizeof(pdstag)));
+  conn->data = (pdstag *) (conn->shm + PDS_SEG_HDR_LEN);
+  conn->status = conn->data + conn->ndata_tags;
+
+  /* Assign pointers to the start of the hot data, acquisition times, seq.
+     nos., change counters, change journal, sample histories, snapshots &
+     index */
+  conn->values = (unsigned short int *) (conn->shm + seg.values);
+  conn->statuses = (unsigned short int *) (conn->shm + seg.statuses);
+  conn->mtimes = (time_t *) (conn->shm + seg.mtimes);
+  conn->mtimes_ns = (unsigned long long *) (conn->shm + seg.mtimes_ns);
+  conn->acq = (pdsacq *) (conn->shm + seg.acq);
+  conn->seq = (unsigned int *) (conn->shm + seg.seq);
+  conn->chg = (unsigned int *) (conn->shm + seg.chg);
+  conn->jseq = (unsigned long long *) (conn->shm + seg.journal);
+  conn->journal = (pdschange *) (conn->shm + seg.journal + PDS_SEG_CACHE_LINE);
+  conn->hist = (pdshist *) (conn->shm + seg.hist);
+  conn->samples = (pdssample *) (conn->shm + seg.samples);
+  conn->snap = (unsigned int *) (conn->shm + seg.snap);
+  conn->hash = (unsigned int *) (conn->shm + seg.hash);
 
   printd("Shared memory attached at %p, using ID %d\n", (int) conn->shm, conn->shmid);
-  printd("No. of tags in segment: %d\n", (conn->shmsize > 0 ? (conn->shmsize / sizeof(pdstag)) : 0));
+  printd("No. of tags in segment: %d\n", conn->ttags);
+  printd("No. of tag name index slots: %d\n", conn->nhash);
+  printd("No. of change journal records: %d\n", conn->njournal);
+  printd("No. of history samples: %d\n", conn->nsamples);
+  printd("Size of hot data in segment: %d bytes\n", (seg.seq - seg.values));
 
   return 0;
 }
@@ -203,6 +275,100 @@ int init_msg_queue(pdsconn *conn)
 
 
 
+/******************************************************************************
+* Function to add the per-block & per-PLC SPI tags to the SPI tag list        *
+*                                                                             *
+* Pre-condition:  The PLC configuration struct & the SPI tag list are passed  *
+*                 to the function                                             *
+* Post-condition: The list's tags are replaced by a copy, with a read overrun *
+*                 counter tag appended for each block, circuit breaker        *
+*                 state, connect timeout & connect latency tags appended for  *
+*                 each PLC & a scan cycle time tag appended for each possible *
+*                 scan engine shard in this configuration.  The no. of SPI    *
+*                 tags is returned.  If an error occurs a -1 is returned      *
+******************************************************************************/
+int add_SPI_config_tags(plc_cnf *conf, pds_spi_tag_list *tag_list)
+{
+  pds_spi_tag *tags = NULL, *tag = NULL;
+  int nextra = conf->nblocks + (conf->nplcs * 3) + PDS_SCAN_MAX_SHARDS(conf);
+  register int i = 0;
+
+  if(!(tags = (pds_spi_tag *) calloc((tag_list->ntags + nextra), sizeof(pds_spi_tag))))
+  {
+    err(errout, "%s: memory allocation error\n", PROGNAME);
+    return -1;
+  }
+
+  memcpy(tags, tag_list->tags, (tag_list->ntags * sizeof(pds_spi_tag)));
+  tag = &tags[tag_list->ntags];
+
+  for(i = 0; i < conf->nblocks; i++, tag++)
+  {
+    sprintf(tag->name, PDS_RD_OVERRUNS_FORMAT, i);
+    tag->value = 0;
+    tag->perms = PDS_SPI_PERM_RD;
+  }
+
+  for(i = 0; i < conf->nplcs; i++, tag++)
+  {
+    sprintf(tag->name, PDS_BRK_STATE_FORMAT, i);
+    tag->value = PDS_BRK_CLOSED;
+    tag->perms = PDS_SPI_PERM_RD;
+  }
+
+  for(i = 0; i < conf->nplcs; i++, tag++)
+  {
+    sprintf(tag->name, PDS_CONNECT_TMO_FORMAT, i);
+    tag->value = PDS_CONNECT_TMO;
+    tag->perms = PDS_SPI_PERM_RDWR;
+  }
+
+  for(i = 0; i < conf->nplcs; i++, tag++)
+  {
+    sprintf(tag->name, PDS_CONNECT_TIME_FORMAT, i);
+    tag->value = 0;
+    tag->perms = PDS_SPI_PERM_RD;
+  }
+
+  for(i = 0; i < PDS_SCAN_MAX_SHARDS(conf); i++, tag++)
+  {
+    sprintf(tag->name, PDS_SCAN_CYCLE_TIME_FORMAT, i);
+    tag->value = 0;
+    tag->perms = PDS_SPI_PERM_RD;
+  }
+
+  /* N.B.: The copy lasts for the life of the server */
+  tag_list->tags = tags;
+  tag_list->ntags += nextra;
+
+  return tag_list->ntags;
+}
+
+
+
+/******************************************************************************
+* Function to get a pointer to a per-PLC SPI tag                              *
+*                                                                             *
+* Pre-condition:  The SPI connection struct, the tag's name format & the      *
+*                 PLC's index in the configuration are passed to the function *
+* Post-condition: A pointer to the PLC's SPI tag is returned.  If an error    *
+*                 occurs a (int *) -1 is returned                             *
+******************************************************************************/
+int* get_SPI_plc_tag_ptr(pds_spi_conn *spi_conn, char *format, int plc_id)
+{
+  char tagname[PDS_SPI_TAGNAME_LEN] = "\0";
+  int *ptr = NULL;
+
+  sprintf(tagname, format, plc_id);
+
+  if((ptr = PDS_SPIget_tag_ptr(spi_conn, tagname)) == (int *) -1)
+    err(errout, "%s: failed to get SPI tag %s\n", PROGNAME, tagname);
+
+  return ptr;
+}
+
+
+
 /******************************************************************************
 * Function to initialise the SPI server connection                            *
 *                                                                             *
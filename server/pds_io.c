@@ -7,6 +7,9 @@
 ******************************************************************************/
 
 #include "pds_srv.h"
+#include "drivers/pds_mb.h"
+#include "drivers/pds_dh.h"
+#include "drivers/pds_cip.h"
 
 extern int quit_flag;             /* Declared in the main file */
 extern int errout;                /* Declared in the main file */
@@ -46,6 +49,12 @@ int pds_server(plc_cnf *conf, pdsconn *parent_conn,
     return -1;
   }
 
+  if(add_SPI_config_tags(conf, spi_tag_list) == -1)
+  {
+    err(errout, "%s: error adding per-block & per-PLC SPI tags\n", PROGNAME);
+    return -1;
+  }
+
   if(init_SPI_server_connection(spi_tag_list, parent_spi_conn) == -1)
   {
     err(errout, "%s: error initialising SPI server connection\n", PROGNAME);
@@ -84,9 +93,9 @@ int pds_server(plc_cnf *conf, pdsconn *parent_conn,
       dbgmsg("Starting the write process...\n");
 
       /* Handle any write data to PLC/connect to server requests from client
-         programs in a continous loop, polling for client messages */
+         programs in a continous loop, waiting for client messages */
 
-      handle_write_requests(parent_conn, parent_spi_conn);
+      handle_write_requests(conf, parent_conn, parent_spi_conn);
 
       kill(chld, SIGTERM);        /* Ensure the child process is terminated */
     break;
@@ -121,17 +130,78 @@ int pds_server(plc_cnf *conf, pdsconn *parent_conn,
 int handle_read_requests(plc_cnf *conf, pdsconn *conn, pds_spi_conn *spi_conn)
 {
   pdsqueries *queries = NULL;
+  pdspool *pool = NULL;
+  pdsscanworkers *workers = NULL;
+  pid_t publisher = -1;
+  int nsync = 0;
+  register int i = 0;
 
   /* Setup the queries struct for all read queries in this configuration */
-  if((queries = setup_read_queries(conf, conn)) == NULL)
+  if((queries = setup_read_queries(conf, conn, spi_conn)) == NULL)
   {
     err(errout, "%s: failed to setup the read queries\n", PROGNAME);
     return -1;
   }
 
-  /* Continuously run the read queries for this configuration */
-  execute_read_queries(conn, spi_conn, queries);
+  /* Optionally hand the queries of PLCs that can be scanned asynchronously
+     to the scan engine's worker processes */
+  if(PDS_GET_RM_SCAN(runmode))
+  {
+    if((workers = start_scan_workers(conf, conn, spi_conn, queries)) == NULL)
+    {
+      err(errout, "%s: failed to start the scan engine\n", PROGNAME);
+      free_read_queries(queries);
+      return -1;
+    }
+
+    /* Reap our children ourselves, so that a worker's exit is seen */
+    if(workers->nworkers > 0)
+      signal(SIGCHLD, notify_child);
+  }
+
+  for(i = 0; i < queries->nqueries; i++)
+  {
+    if(!queries->queries[i].async)
+      nsync++;
+  }
+
+  /* Publish snapshots of the tags at their own rate, independently of the
+     blocks' poll rates */
+  if((publisher = start_snapshot_publisher(conn, spi_conn)) == -1)
+  {
+    err(errout, "%s: failed to start the snapshot publisher\n", PROGNAME);
+    stop_scan_workers(workers);
+    free_read_queries(queries);
+    return -1;
+  }
+
+  /* Setup the pool of connections to the PLCs in this configuration */
+  if((pool = setup_conn_pool(conf, spi_conn)) == NULL)
+  {
+    err(errout, "%s: failed to setup the connection pool\n", PROGNAME);
+    stop_snapshot_publisher(publisher);
+    stop_scan_workers(workers);
+    free_read_queries(queries);
+    return -1;
+  }
+
+  /* Continuously run the read queries for this configuration.  If the scan
+     engine has all of them, then just watch its workers until terminated.
+     N.B.: A worker exiting interrupts the sleep */
+  if(nsync > 0)
+    execute_read_queries(conn, spi_conn, queries, pool, workers);
+  else
+  {
+    while(!quit_flag)
+    {
+      check_scan_workers(workers);
+      sleep(PDS_SCAN_RESTART_PAUSE);
+    }
+  }
 
+  stop_snapshot_publisher(publisher);
+  stop_scan_workers(workers);
+  free_conn_pool(pool);
   free_read_queries(queries);
 
   return (!quit_flag) ? -1 : 0;
@@ -142,19 +212,33 @@ int handle_read_requests(plc_cnf *conf, pdsconn *conn, pds_spi_conn *spi_conn)
 /******************************************************************************
 * Function to setup all read/mapped-write block queries in this configuration *
 *                                                                             *
-* Pre-condition:  The PLC configuration struct and the connection struct are  *
+* Pre-condition:  The PLC configuration struct and the connection structs are *
 *                 passed to the function                                      *
 * Post-condition: A query is constructed for each read/mapped-write block in  *
 *                 this configuration and a pointer to the queries struct is   *
-*                 returned.  If an error occurs a null is returned            *
+*                 returned.  Unless disabled, blocks on the same PLC whose    *
+*                 references are within the coalesce gap of each other are    *
+*                 read by a single query.  If an error occurs a null is       *
+*                 returned                                                    *
 ******************************************************************************/
-pdsqueries* setup_read_queries(plc_cnf *conf, pdsconn *conn) 
+pdsqueries* setup_read_queries(plc_cnf *conf, pdsconn *conn,
+                               pds_spi_conn *spi_conn) 
 {
   pdsqueries *queries = NULL;
+  pdsquery *query = NULL;
+  plc_cnf_block **blocks = NULL, *merged = NULL;
   pdstag *tag = NULL;
-  register unsigned short int i = 0, j = 0, b = 0;
+  int *pds_coalesce_gap = NULL;
+  register unsigned short int i = 0, j = 0, b = 0, n = 0, k = 0;
  
-  if(!(queries = (pdsqueries *) malloc(sizeof(pdsqueries))))
+  /* Ensure we have the SPI tags we require */
+  if((pds_coalesce_gap = PDS_SPIget_tag_ptr(spi_conn, "PDS_COALESCE_GAP")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_COALESCE_GAP\n", PROGNAME);
+    return NULL;
+  }
+
+  if(!(queries = (pdsqueries *) calloc(1, sizeof(pdsqueries))))
   {
     err(errout, "%s: memory allocation error\n", PROGNAME);
     return NULL;
@@ -163,89 +247,306 @@ pdsqueries* setup_read_queries(plc_cnf *conf, pdsconn *conn)
   /* Array to hold all the read/mapped-write query structures */
   queries->queries = (pdsquery *) calloc(conf->nblocks, sizeof(pdsquery));
 
-  if(!queries->queries)
+  /* The blocks, in the order in which they're assigned to queries & a
+     working copy of the block that the current query reads */
+  blocks = (plc_cnf_block **) calloc(conf->nblocks, sizeof(plc_cnf_block *));
+  merged = (plc_cnf_block *) malloc(sizeof(plc_cnf_block));
+
+  if(!queries->queries || !blocks || !merged)
   {
     err(errout, "%s: memory allocation error\n", PROGNAME);
+    free(blocks);
+    free(merged);
+    free_read_queries(queries);
     return NULL;
   }
 
-  /* Construct the query for each read/mapped-write block */
-  for(i = 0, b = 0; b < conf->nblocks; b++)
+  for(b = 0; b < conf->nblocks; b++)
+    blocks[b] = &conf->blocks[b];
+
+  /* Sort the blocks so that those which can share a query are adjacent */
+  if(*pds_coalesce_gap >= 0)
+    qsort(blocks, conf->nblocks, sizeof(plc_cnf_block *), compare_read_blocks);
+
+  /* Construct the query for each read/mapped-write block (or run of blocks
+     that can be coalesced) */
+  for(i = 0, b = 0; b < conf->nblocks; b += n)
   {
-    queries->queries[i].protocol = conf->blocks[b].protocol;
-    queries->queries[i].block_id = b;
-    strcpy(queries->queries[i].ip_addr, conf->blocks[b].ip_addr);
-    queries->queries[i].port = conf->blocks[b].port;
-    strcpy(queries->queries[i].tty_dev, conf->blocks[b].tty_dev);
-    strcpy(queries->queries[i].path, conf->blocks[b].path);
-    queries->queries[i].pollrate = conf->blocks[b].pollrate;
+    query = &queries->queries[i];
+    queries->nqueries = i + 1;
+    memcpy(merged, blocks[b], sizeof(plc_cnf_block));
+
+    for(n = 1; (b + n) < conf->nblocks && *pds_coalesce_gap >= 0; n++)
+    {
+      if(!coalesce_read_block(merged, blocks[b + n], *pds_coalesce_gap))
+        break;
+    }
+
+    query->protocol = merged->protocol;
+    query->block_id = blocks[b] - conf->blocks;
+    strcpy(query->ip_addr, merged->ip_addr);
+    query->port = merged->port;
+    strcpy(query->tty_dev, merged->tty_dev);
+    strcpy(query->path, merged->path);
+    query->pollrate = merged->pollrate;
+    query->ntags = merged->ntags;
+
+    /* Assign the blocks that this query reads */
+    if(!(query->blocks = (pdsqblock *) calloc(n, sizeof(pdsqblock))))
+    {
+      err(errout, "%s: memory allocation error\n", PROGNAME);
+      break;
+    }
+
+    for(j = 0; j < n; j++)
+    {
+      query->blocks[j].block_id = blocks[b + j] - conf->blocks;
+      query->blocks[j].ntags = blocks[b + j]->ntags;
+    }
+
+    query->nblocks = n;
+
+    /* The drivers refresh a coalesced query's tags from a copy of its blocks'
+       tags, laid out contiguously */
+    if(query->nblocks > 1)
+    {
+      if(!(query->tags = (pdstag *) calloc(query->ntags, sizeof(pdstag))))
+      {
+        err(errout, "%s: memory allocation error\n", PROGNAME);
+        break;
+      }
+
+      for(j = 0, k = 0; j < query->nblocks; k += query->blocks[j].ntags, j++)
+      {
+        memcpy(&query->tags[k], PDS_GET_BLOCK_START(query->blocks[j].block_id),
+               (query->blocks[j].ntags * sizeof(pdstag)));
+      }
+    }
 
     /* Assign a pointer to this query's PLC status word */
     for(j = 0, tag = conn->status; j < conn->nstatus_tags; j++, tag++)
     {
-      switch(conf->blocks[b].protocol)
+      switch(query->protocol)
       {
         case MB_TCPIP :
         case MB_SERIAL_TCPIP :
         case DH_SERIAL_TCPIP :
         case CIP_TCPIP :
-          if((strcmp(queries->queries[i].ip_addr, tag->ip_addr) == 0) && 
-             (queries->queries[i].port == tag->port) &&
-             (strcmp(queries->queries[i].path, tag->path) == 0))
+          if((strcmp(query->ip_addr, tag->ip_addr) == 0) && 
+             (query->port == tag->port) &&
+             (strcmp(query->path, tag->path) == 0))
           {
-            queries->queries[i].status = (unsigned short int *) &tag->status;
+            query->status = &PDS_TAG_STATUS(conn, tag);
           } 
         break;
 
         case MB_SERIAL :
         case DH_SERIAL :
-          if((strcmp(queries->queries[i].tty_dev, tag->tty_dev) == 0) && 
-             (strcmp(queries->queries[i].path, tag->path) == 0))
+          if((strcmp(query->tty_dev, tag->tty_dev) == 0) && 
+             (strcmp(query->path, tag->path) == 0))
           {
-            queries->queries[i].status = (unsigned short int *) &tag->status;
+            query->status = &PDS_TAG_STATUS(conn, tag);
           } 
         break;
       }
     }
 
     /* Set the initial error count value for this query */
-    queries->queries[i].errx = 0;
+    query->errx = 0;
+
+    /* Queries are run synchronously unless claimed by the scan engine */
+    query->async = 0;
 
     /* Set the query and its length */
-    switch(conf->blocks[b].protocol)
+    switch(query->protocol)
     {
       case MB_TCPIP :
       case MB_SERIAL_TCPIP :
       case MB_SERIAL :
-        queries->queries[i].qlen = mb_setup_read_query(queries->queries[i].query, &conf->blocks[b]);
+        query->qlen = mb_setup_read_query(query->query, merged);
       break;
 
       case DH_SERIAL_TCPIP :
       case DH_SERIAL :
-        queries->queries[i].qlen = dh_setup_read_query(queries->queries[i].query, &conf->blocks[b]);
+        query->qlen = dh_setup_read_query(query->query, merged);
       break;
 
       case CIP_TCPIP :
-        queries->queries[i].qlen = cip_setup_read_query(queries->queries[i].query, &conf->blocks[b]);
+        query->qlen = cip_setup_read_query(query->query, merged);
       break;
     }
 
-    if(queries->queries[i].qlen < 0)
+    if(query->qlen < 0)
     {
-      err(errout, "%s: failed to setup query for block %d\n", PROGNAME, b);
-      return NULL;
+      err(errout, "%s: failed to setup query for block %d\n", PROGNAME, query->block_id);
+      break;
     } 
 
     i++;                          /* Increment the query counter */
   }
 
+  free(blocks);
+  free(merged);
+
+  if(b < conf->nblocks)
+  {
+    free_read_queries(queries);
+    return NULL;
+  }
+
   queries->nqueries = i;          /* Set the no. of queries */
 
+  if(*pds_coalesce_gap >= 0)
+  {
+    err(errout, "%s: coalesced %d blocks into %d read queries\n", PROGNAME,
+        conf->nblocks, queries->nqueries);
+  }
+
   return queries;
 }
 
 
 
+/******************************************************************************
+* Function to compare the keys of two read blocks that must match if the      *
+* blocks are to be read by the same query                                     *
+*                                                                             *
+* Pre-condition:  Pointers to the two blocks are passed to the function       *
+* Post-condition: An integer less than, equal to or greater than zero is      *
+*                 returned if the 1st block's keys are found to be less than, *
+*                 to match or to be greater than the 2nd block's keys         *
+******************************************************************************/
+int compare_read_block_keys(plc_cnf_block *a, plc_cnf_block *b)
+{
+  int c = 0;
+
+  if(a->protocol != b->protocol)
+    return (a->protocol < b->protocol) ? -1 : 1;
+
+  if((c = strcmp(a->ip_addr, b->ip_addr)) != 0)
+    return c;
+
+  if(a->port != b->port)
+    return (a->port < b->port) ? -1 : 1;
+
+  if((c = strcmp(a->tty_dev, b->tty_dev)) != 0)
+    return c;
+
+  if((c = strcmp(a->path, b->path)) != 0)
+    return c;
+
+  if(a->function != b->function)
+    return (a->function < b->function) ? -1 : 1;
+
+  if(a->type != b->type)
+    return (a->type < b->type) ? -1 : 1;
+
+  if(a->base_addr != b->base_addr)
+    return (a->base_addr < b->base_addr) ? -1 : 1;
+
+  if((c = strcmp(a->ascii_addr, b->ascii_addr)) != 0)
+    return c;
+
+  if(a->pollrate != b->pollrate)
+    return (a->pollrate < b->pollrate) ? -1 : 1;
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to compare two read blocks, for sorting with qsort(3)              *
+*                                                                             *
+* Pre-condition:  Pointers to the two block pointers are passed to the        *
+*                 function                                                    *
+* Post-condition: The blocks are ordered by their keys & then by their 1st    *
+*                 reference, so blocks that can be coalesced are adjacent.    *
+*                 Otherwise the configured order of the blocks is kept        *
+******************************************************************************/
+int compare_read_blocks(const void *p1, const void *p2)
+{
+  plc_cnf_block *a = *(plc_cnf_block **) p1, *b = *(plc_cnf_block **) p2;
+  unsigned int ra = 0, rb = 0;
+  int c = 0;
+
+  if((c = compare_read_block_keys(a, b)) != 0)
+    return c;
+
+  ra = (a->ntags > 0) ? a->tags[0].ref : 0;
+  rb = (b->ntags > 0) ? b->tags[0].ref : 0;
+
+  if(ra != rb)
+    return (ra < rb) ? -1 : 1;
+
+  return (a < b) ? -1 : (a > b);
+}
+
+
+
+/******************************************************************************
+* Function to coalesce a read block into the block read by a query            *
+*                                                                             *
+* Pre-condition:  The block read by the query, the following block & the      *
+*                 max. no. of unconfigured references that may be read        *
+*                 between them are passed to the function                     *
+* Post-condition: If both blocks are on the same PLC, have the same function, *
+*                 type & poll rate, the following block's references start    *
+*                 within the gap after the query's & the combined block is    *
+*                 within the protocol's limits, then the following block's    *
+*                 tags are appended to the query's block & a 1 is returned.   *
+*                 Otherwise a 0 is returned                                   *
+******************************************************************************/
+int coalesce_read_block(plc_cnf_block *merged, plc_cnf_block *block, int gap)
+{
+  unsigned int last = 0, first = 0;
+  int fits = 0;
+
+  if(merged->ntags == 0 || block->ntags == 0)
+    return 0;
+
+  if(compare_read_block_keys(merged, block) != 0)
+    return 0;
+
+  /* N.B.: The drivers require a block's references to be ascending */
+  last = merged->tags[merged->ntags-1].ref;
+  first = block->tags[0].ref;
+
+  if(first <= last || (first - last - 1) > (unsigned int) gap)
+    return 0;
+
+  if((merged->ntags + block->ntags) > PLC_CNF_TAGS_BLK)
+    return 0;
+
+  switch(merged->protocol)
+  {
+    case MB_TCPIP :
+    case MB_SERIAL_TCPIP :
+    case MB_SERIAL :
+      fits = mb_coalesce_read_blocks(merged, block);
+    break;
+
+    case DH_SERIAL_TCPIP :
+    case DH_SERIAL :
+      fits = dh_coalesce_read_blocks(merged, block);
+    break;
+
+    case CIP_TCPIP :
+      fits = cip_coalesce_read_blocks(merged, block);
+    break;
+  }
+
+  if(!fits)
+    return 0;
+
+  memcpy(&merged->tags[merged->ntags], block->tags, (block->ntags * sizeof(plc_cnf_tag)));
+  merged->ntags += block->ntags;
+
+  return 1;
+}
+
+
+
 /******************************************************************************
 * Function to free memory for all read queries                                *
 *                                                                             *
@@ -256,11 +557,21 @@ pdsqueries* setup_read_queries(plc_cnf *conf, pdsconn *conn)
 int free_read_queries(pdsqueries *queries)
 {
   int i = -1;
+  register int j = 0;
 
   if(queries)
   {
     if(queries->queries)
     {
+      for(j = 0; j < queries->nqueries; j++)
+      {
+        if(queries->queries[j].blocks)
+          free(queries->queries[j].blocks);
+
+        if(queries->queries[j].tags)
+          free(queries->queries[j].tags);
+      }
+
       free(queries->queries);
       i = queries->nqueries;
     }  
@@ -272,21 +583,303 @@ int free_read_queries(pdsqueries *queries)
  
 
 
+/******************************************************************************
+* Function to setup the read schedule of the synchronous read queries         *
+*                                                                             *
+* Pre-condition:  The SPI connection struct & the queries struct are passed   *
+*                 to the function                                             *
+* Post-condition: Each query that isn't run by the scan engine is scheduled   *
+*                 to be due now & is assigned its block's SPI overrun         *
+*                 counter.  A pointer to the schedule is returned.  If an     *
+*                 error occurs a null is returned                             *
+******************************************************************************/
+pdsrdsched* setup_read_schedule(pds_spi_conn *spi_conn, pdsqueries *queries)
+{
+  pdsrdsched *sched = NULL;
+  char tagname[PDS_SPI_TAGNAME_LEN] = "\0";
+  struct timespec now;
+  register int i = 0;
+
+  if(!(sched = (pdsrdsched *) calloc(1, sizeof(pdsrdsched))))
+  {
+    err(errout, "%s: memory allocation error\n", PROGNAME);
+    return NULL;
+  }
+
+  if(!(sched->heap = (pdsquery **) calloc(queries->nqueries, sizeof(pdsquery *))))
+  {
+    err(errout, "%s: memory allocation error\n", PROGNAME);
+    free_read_schedule(sched);
+    return NULL;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  /* N.B.: As all queries are due at the same time, they're already in heap
+           order */
+  for(i = 0; i < queries->nqueries; i++)
+  {
+    if(queries->queries[i].async)
+      continue;
+
+    sprintf(tagname, PDS_RD_OVERRUNS_FORMAT, queries->queries[i].block_id);
+
+    if((queries->queries[i].overruns = PDS_SPIget_tag_ptr(spi_conn, tagname)) == (int *) -1)
+    {
+      err(errout, "%s: failed to get SPI tag %s\n", PROGNAME, tagname);
+      free_read_schedule(sched);
+      return NULL;
+    }
+
+    queries->queries[i].due = now;
+    sched->heap[sched->nqueries++] = &queries->queries[i];
+  }
+
+  return sched;
+}
+
+
+
+/******************************************************************************
+* Function to free the read schedule                                          *
+*                                                                             *
+* Pre-condition:  The read schedule is passed to the function                 *
+* Post-condition: Memory is freed for the read schedule.  The no. of          *
+*                 scheduled queries is returned or a -1 on error              *
+******************************************************************************/
+int free_read_schedule(pdsrdsched *sched)
+{
+  int i = -1;
+
+  if(sched)
+  {
+    i = sched->nqueries;
+
+    if(sched->heap)
+      free(sched->heap);
+
+    free(sched);
+  }
+
+  return i;
+}
+
+
+
+/******************************************************************************
+* Function to wait for the next query in the read schedule to be due          *
+*                                                                             *
+* Pre-condition:  The read schedule is passed to the function                 *
+* Post-condition: The process sleeps until the deadline of the earliest query *
+*                 in the schedule.  If the sleep is interrupted, or there are *
+*                 no queries to wait for, a -1 is returned                    *
+******************************************************************************/
+int wait_read_schedule(pdsrdsched *sched)
+{
+  if(sched->nqueries == 0)
+  {
+    pause();
+    return -1;
+  }
+
+  /* N.B.: An absolute deadline doesn't drift, however long the queries took */
+  if(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sched->heap[0]->due, NULL) != 0)
+    return -1;
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to reschedule the earliest query in the read schedule              *
+*                                                                             *
+* Pre-condition:  The read schedule, with a query due, & the current time are *
+*                 passed to the function                                      *
+* Post-condition: The earliest query's next deadline is set to one poll rate  *
+*                 after its current deadline & the query is moved to its new  *
+*                 place in the schedule.  If that deadline has already        *
+*                 passed, the query has overrun, so its SPI overrun counter   *
+*                 is incremented & its next deadline is now.  A pointer to    *
+*                 the query is returned                                       *
+******************************************************************************/
+pdsquery* reschedule_read_query(pdsrdsched *sched, struct timespec *now)
+{
+  pdsquery *query = sched->heap[0], *tmp = NULL;
+  register int i = 0, child = 0;
+
+  query->due.tv_sec += query->pollrate / 1000000;
+  query->due.tv_nsec += (query->pollrate % 1000000) * 1000L;
+
+  if(query->due.tv_nsec >= 1000000000L)
+  {
+    query->due.tv_sec++;
+    query->due.tv_nsec -= 1000000000L;
+  }
+
+  /* Don't try to catch up any missed polls */
+  if(!PDS_TS_BEFORE(now, &query->due))
+  {
+    if(query->pollrate > 0)
+      (*query->overruns)++;
+
+    query->due = *now;
+  }
+
+  /* Sift the query down to its place in the heap */
+  for(i = 0; (child = (2 * i) + 1) < sched->nqueries; i = child)
+  {
+    if((child + 1) < sched->nqueries &&
+       PDS_TS_BEFORE(&sched->heap[child + 1]->due, &sched->heap[child]->due))
+      child++;
+
+    if(!PDS_TS_BEFORE(&sched->heap[child]->due, &sched->heap[i]->due))
+      break;
+
+    tmp = sched->heap[i];
+    sched->heap[i] = sched->heap[child];
+    sched->heap[child] = tmp;
+  }
+
+  return query;
+}
+
+
+
+/******************************************************************************
+* Function to gather the hot data of a read query's blocks                    *
+*                                                                             *
+* Pre-condition:  The connection struct, the query & storage for a private    *
+*                 copy of its values & mtimes (in nsecs) are passed to the    *
+*                 function                                                    *
+* Post-condition: The values & mtimes of each block read by the query are     *
+*                 copied from shared memory, in turn, into the private copy.  *
+*                 The no. of tags gathered is returned                        *
+******************************************************************************/
+int gather_query_blocks(pdsconn *conn, pdsquery *query,
+                        unsigned short int *values,
+                        unsigned long long *mtimes_ns)
+{
+  pdstag *block_start = NULL;
+  register unsigned short int i = 0, n = 0;
+
+  for(i = 0; i < query->nblocks; n += query->blocks[i].ntags, i++)
+  {
+    block_start = PDS_GET_BLOCK_START(query->blocks[i].block_id);
+
+    memcpy(&values[n], &PDS_TAG_VALUE(conn, block_start), (query->blocks[i].ntags * sizeof(unsigned short int)));
+    memcpy(&mtimes_ns[n], &PDS_TAG_MTIME_NS(conn, block_start), (query->blocks[i].ntags * sizeof(unsigned long long)));
+  }
+
+  return n;
+}
+
+
+
+/******************************************************************************
+* Function to scatter the hot data of a read query back to its blocks         *
+*                                                                             *
+* Pre-condition:  The connection struct, the query, a private copy of its     *
+*                 refreshed values & mtimes (in nsecs) & the query's          *
+*                 acquisition times are passed to the function                *
+* Post-condition: The private copy is copied, in turn, into the shared memory *
+*                 of each block read by the query, along with the             *
+*                 acquisition times & the mtimes in secs.  In seqlock mode,   *
+*                 each block is published under its own sequence counter,     *
+*                 otherwise the caller must hold the semaphore.  Each block   *
+*                 with a history is sampled.  Each changed tag is appended to *
+*                 the change journal & clients are notified of each block     *
+*                 whose values have changed.  The no. of tags scattered is    *
+*                 returned                                                    *
+******************************************************************************/
+int scatter_query_blocks(pdsconn *conn, pdsquery *query,
+                         unsigned short int *values,
+                         unsigned long long *mtimes_ns, pdsacq *acq)
+{
+  pdstag *block_start = NULL, *tag = NULL;
+  unsigned short int old_values[PLC_CNF_TAGS_BLK];
+  time_t mtimes[PLC_CNF_TAGS_BLK], mtime = 0;
+  unsigned long long mtime_ns = 0;
+  register unsigned short int i = 0, j = 0, n = 0;
+  int changed = 0;
+
+  for(i = 0; i < query->nblocks; n += query->blocks[i].ntags, i++)
+  {
+    block_start = PDS_GET_BLOCK_START(query->blocks[i].block_id);
+
+    /* Derive the mtimes in secs.  The tags refreshed by a response share
+       its mtime, so the division is rarely repeated */
+    for(j = 0; j < query->blocks[i].ntags; j++)
+    {
+      if(mtimes_ns[n + j] != mtime_ns)
+      {
+        mtime_ns = mtimes_ns[n + j];
+        mtime = (time_t) (mtime_ns / 1000000000ULL);
+      }
+      mtimes[j] = mtime;
+    }
+
+    /* N.B.: Only the server writes the values, so this is a stable read.
+             The old values are kept so that the changed tags can be
+             journalled once the new values are visible */
+    if((changed = memcmp(&PDS_TAG_VALUE(conn, block_start), &values[n], (query->blocks[i].ntags * sizeof(unsigned short int)))))
+      memcpy(old_values, &PDS_TAG_VALUE(conn, block_start), (query->blocks[i].ntags * sizeof(unsigned short int)));
+
+    if(PDS_GET_RM_REFRESH(runmode) == PDS_RM_REFRESH_SEQLOCK)
+      publish_block(conn, block_start, &values[n], mtimes, &mtimes_ns[n], acq, query->blocks[i].ntags);
+    else
+    {
+      memcpy(&PDS_TAG_VALUE(conn, block_start), &values[n], (query->blocks[i].ntags * sizeof(unsigned short int)));
+      memcpy(&PDS_TAG_MTIME(conn, block_start), mtimes, (query->blocks[i].ntags * sizeof(time_t)));
+      memcpy(&PDS_TAG_MTIME_NS(conn, block_start), &mtimes_ns[n], (query->blocks[i].ntags * sizeof(unsigned long long)));
+      PDS_BLOCK_ACQ(conn, query->blocks[i].block_id) = *acq;
+    }
+
+    sample_block_history(conn, block_start, query->blocks[i].ntags);
+
+    if(changed)
+    {
+      for(j = 0, tag = block_start; j < query->blocks[i].ntags; j++, tag++)
+      {
+        if(old_values[j] != values[n + j])
+          journal_tag_change(conn, tag, values[n + j], PDS_TAG_STATUS(conn, tag), mtimes[j]);
+      }
+
+      notify_block_change(conn, query->blocks[i].block_id);
+    }
+  }
+
+  return n;
+}
+
+
+
 /******************************************************************************
 * Function to execute all read queries for this configuration                 *
 *                                                                             *
-* Pre-condition:  The connection structs and the queries struct are passed to *
-*                 the function                                                *
+* Pre-condition:  The connection structs, the queries struct, the PLC         *
+*                 connection pool & the scan engine's workers (or a null) are *
+*                 passed to the function                                      *
 * Post-condition: All tags in the data blocks for this configuration are      *
 *                 queried from the PLC and their values are placed in memory  *
-*                 variables in the shared memory segment.  If an error occurs *
+*                 variables in the shared memory segment.  Each block is      *
+*                 queried at its poll rate, when its deadline is due.  Any    *
+*                 workers that have exited are restarted.  If an error occurs *
 *                 a -1 is returned                                            *
 ******************************************************************************/
 int execute_read_queries(pdsconn *conn, pds_spi_conn *spi_conn,
-                         pdsqueries *queries)
+                         pdsqueries *queries, pdspool *pool,
+                         pdsscanworkers *workers)
 {
-  register unsigned short int i = 0;
+  register int n = 0;
+  pdsrdsched *sched = NULL;
+  pdsquery *query = NULL;
+  pdspoolconn *pc = NULL;
+  struct timespec now;
   pdstrans trans, status_trans;
+  unsigned short int *scratch_values = NULL;
+  unsigned long long *scratch_mtimes_ns = NULL;
+  int refreshed = -1, brk = PDS_BRK_CLOSED;
   int *pds_online = NULL, *pds_rdpause_all = NULL;
   int *pds_rdpause_block = NULL, *pds_dbgpause = NULL;
 
@@ -315,9 +908,40 @@ int execute_read_queries(pdsconn *conn, pds_spi_conn *spi_conn,
     return -1;
   }
 
+  /* The drivers refresh a private copy of each query's hot data which is
+     then copied to its blocks in shared memory, so that a refresh that
+     changes a block's values can be detected & notified to clients */
+  scratch_values = (unsigned short int *) calloc(PLC_CNF_TAGS_BLK, sizeof(unsigned short int));
+  scratch_mtimes_ns = (unsigned long long *) calloc(PLC_CNF_TAGS_BLK, sizeof(unsigned long long));
+
+  if(!scratch_values || !scratch_mtimes_ns)
+  {
+    err(errout, "%s: memory allocation error\n", PROGNAME);
+    free(scratch_values);
+    free(scratch_mtimes_ns);
+    return -1;
+  }
+
+  /* Each block is polled at its own rate, by a schedule of its deadlines */
+  if(!(sched = setup_read_schedule(spi_conn, queries)))
+  {
+    err(errout, "%s: failed to setup the read schedule\n", PROGNAME);
+    free(scratch_values);
+    free(scratch_mtimes_ns);
+    return -1;
+  }
+
   /* Continuously read data from PLC into shared memory */
   while(!quit_flag)
   {
+    /* Restart any of the scan engine's workers that have exited */
+    if(workers && workers->nworkers > 0)
+      check_scan_workers(workers);
+
+    /* Sleep until the next query is due */
+    if(wait_read_schedule(sched) == -1)
+      continue;
+
     /* Check refresh mode.  If 'all', hold semaphore for all blocks */
     if(PDS_GET_RM_REFRESH(runmode) == PDS_RM_REFRESH_ALL)
     {
@@ -341,39 +965,57 @@ int execute_read_queries(pdsconn *conn, pds_spi_conn *spi_conn,
       err(errout, "%s: PDS has been put online\n", PROGNAME);
     }
 
-    /* Run each query in this configuration in turn */
-    for(i = 0; i < queries->nqueries; i++)
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    /* Run each query that's now due, earliest deadline first.  N.B.: A query
+       runs at most once per pass, even if it's already due again */
+    for(n = sched->nqueries; n > 0 && !PDS_TS_BEFORE(&now, &sched->heap[0]->due); n--)
     {
+      query = reschedule_read_query(sched, &now);
+
       memset(&trans, 0, sizeof(pdstrans));
       memset(&status_trans, 0, sizeof(pdstrans));
+      refreshed = -1;
 
       /* Assign this query's properties */
-      conn->protocol = queries->queries[i].protocol;
-      strcpy(conn->ip_addr, queries->queries[i].ip_addr);
-      conn->port = queries->queries[i].port;
-      strcpy(conn->tty_dev, queries->queries[i].tty_dev);
-      strcpy(conn->path, queries->queries[i].path);
-
-      trans.protocol = queries->queries[i].protocol;
-      trans.block_id = queries->queries[i].block_id;
-      trans.block_start = PDS_GET_BLOCK_START(trans.block_id);
-      trans.pollrate = queries->queries[i].pollrate;
-      memcpy(trans.query, queries->queries[i].query, queries->queries[i].qlen);
-      trans.qlen = queries->queries[i].qlen;
-      trans.status = queries->queries[i].status; /* N.B.: Already a pointer */
-      trans.errx = &queries->queries[i].errx;
+      conn->protocol = query->protocol;
+      strcpy(conn->ip_addr, query->ip_addr);
+      conn->port = query->port;
+      strcpy(conn->tty_dev, query->tty_dev);
+      strcpy(conn->path, query->path);
+
+      trans.protocol = query->protocol;
+      trans.block_id = query->block_id;
+      trans.block_start = (query->nblocks > 1) ? query->tags : PDS_GET_BLOCK_START(trans.block_id);
+      trans.ntags = query->ntags;
+      trans.values = scratch_values;
+      trans.mtimes_ns = scratch_mtimes_ns;
+      trans.pollrate = query->pollrate;
+      memcpy(trans.query, query->query, query->qlen);
+      trans.qlen = query->qlen;
+      trans.status = query->status; /* N.B.: Already a pointer */
+      trans.errx = &query->errx;
+
+      /* Refresh a private copy of the query's blocks' hot data */
+      gather_query_blocks(conn, query, scratch_values, scratch_mtimes_ns);
 
       /* Optionally setup a status query */
       if(PDS_GET_RM_STATUS(runmode))
       {
-        status_trans.protocol = queries->queries[i].protocol;
-        status_trans.block_id = queries->queries[i].block_id;
+        status_trans.protocol = query->protocol;
+        status_trans.block_id = query->block_id;
         status_trans.block_start = PDS_GET_BLOCK_START(status_trans.block_id);
-        status_trans.pollrate = queries->queries[i].pollrate;
-        status_trans.status = queries->queries[i].status;
-        status_trans.errx = &queries->queries[i].errx;
+        status_trans.pollrate = query->pollrate;
+        status_trans.status = query->status;
+        status_trans.errx = &query->errx;
       }
 
+      /* Skip this PLC whilst its circuit breaker is open */
+      if(!(pc = get_pool_conn(pool, conn)))
+        brk = PDS_BRK_CLOSED;
+      else if((brk = check_plc_breaker(&pc->breaker)) == PDS_BRK_OPEN)
+        continue;
+
       /* Check refresh mode.  If 'block', hold semaphore on per block basis */
       if(PDS_GET_RM_REFRESH(runmode) == PDS_RM_REFRESH_BLOCK)
       {
@@ -381,15 +1023,23 @@ int execute_read_queries(pdsconn *conn, pds_spi_conn *spi_conn,
           continue;
       }
 
+      /* A half-open circuit breaker lets a trial query through, whatever the
+         PLC's status, as its outcome decides if the breaker closes */
+      if(brk == PDS_BRK_HALF_OPEN)
+      {
+        *trans.status = PDS_PLC_BREAKER;
+        *trans.errx = 0;
+      }
+
       /* Check if a status condition exists for this query on this PLC */
-      if(*trans.status > 0)
+      else if((*trans.status & PDS_PLC_BREAKER_RST) > 0)
       {
         (*trans.errx)++;
 
         /* Reset any status bits that have reached their max. error count */
         reset_tags_status(conn, trans.status, trans.errx);
 
-        if(*trans.status > 0)
+        if((*trans.status & PDS_PLC_BREAKER_RST) > 0)
         {
           /* It's crucial that we release here, otherwise the `continue`
              will allow us to hold the semaphore again, and then we'll
@@ -401,8 +1051,8 @@ int execute_read_queries(pdsconn *conn, pds_spi_conn *spi_conn,
         }
       }
 
-      /* Connect the server to the PLC */
-      if(connect_to_plc(conn) == -1)
+      /* Connect the server to the PLC (reusing any pooled connection) */
+      if(acquire_plc_connection(pool, conn) == -1)
       {
         *trans.status |= PDS_PLC_CONNERR;
         (*trans.errx)++;
@@ -470,7 +1120,7 @@ int execute_read_queries(pdsconn *conn, pds_spi_conn *spi_conn,
               case MB_TCPIP :
               case MB_SERIAL_TCPIP :
               case MB_SERIAL :
-                if(mb_refresh_data_tags(conn, &trans) == -1)
+                if((refreshed = mb_refresh_data_tags(conn, &trans)) == -1)
                 {
                   *trans.status |= PDS_PLC_RESPERR;
                   (*trans.errx)++;
@@ -480,7 +1130,7 @@ int execute_read_queries(pdsconn *conn, pds_spi_conn *spi_conn,
 
               case DH_SERIAL_TCPIP :
               case DH_SERIAL :
-                if(dh_refresh_data_tags(conn, &trans) == -1)
+                if((refreshed = dh_refresh_data_tags(conn, &trans)) == -1)
                 {
                   *trans.status |= PDS_PLC_RESPERR;
                   (*trans.errx)++;
@@ -489,7 +1139,7 @@ int execute_read_queries(pdsconn *conn, pds_spi_conn *spi_conn,
               break;
 
               case CIP_TCPIP :
-                if(cip_refresh_data_tags(conn, &trans) == -1)
+                if((refreshed = cip_refresh_data_tags(conn, &trans)) == -1)
                 {
                   *trans.status |= PDS_PLC_RESPERR;
                   (*trans.errx)++;
@@ -497,11 +1147,17 @@ int execute_read_queries(pdsconn *conn, pds_spi_conn *spi_conn,
                 }
               break;
             }
+
+            /* Copy the refreshed blocks to shared memory.  A query that
+               failed to refresh leaves its blocks as they were */
+            if(refreshed != -1)
+              scatter_query_blocks(conn, query, scratch_values, scratch_mtimes_ns, &trans.acq);
           }
         } 
       }
 
-      disconnect_from_plc(conn);
+      /* Keep the connection open for the next cycle unless it has failed */
+      release_plc_connection(pool, conn, *trans.status);
 
       /* Check refresh mode.  If 'block', release semaphore after each block */
       if(PDS_GET_RM_REFRESH(runmode) == PDS_RM_REFRESH_BLOCK)
@@ -510,9 +1166,6 @@ int execute_read_queries(pdsconn *conn, pds_spi_conn *spi_conn,
         usleep(*pds_rdpause_block);
       }
 
-      /* Pause the specified time from the configuration */
-      usleep(trans.pollrate);
-
       /* Debug option to pause after each query */
       if(dbglvl == 4) sleep(*pds_dbgpause);
     }
@@ -525,110 +1178,64 @@ int execute_read_queries(pdsconn *conn, pds_spi_conn *spi_conn,
     }
   }
 
+  free_read_schedule(sched);
+
+  if(scratch_values)
+    free(scratch_values);
+
+  if(scratch_mtimes_ns)
+    free(scratch_mtimes_ns);
+
   return (!quit_flag) ? -1 : 0;
 }
 
 
 
 /******************************************************************************
-* Function to connect to a PLC                                                *
+* Function to stamp a transaction with the time its query was sent            *
 *                                                                             *
-* Pre-condition:  The connection struct is passed to the function             *
-* Post-condition: A connection is established with the PLC.  If an error      *
-*                 occurs a -1 is returned                                     *
+* Pre-condition:  The transaction struct is passed to the function            *
+* Post-condition: The real & monotonic times now are stored in the            *
+*                 transaction, as the time its query was sent.  The real time *
+*                 (in nsecs) is returned                                      *
 ******************************************************************************/
-int connect_to_plc(pdsconn *conn)
+unsigned long long stamp_query_sent(pdstrans *trans)
 {
-  /* Connect to this PLC */
-  switch(conn->protocol)
-  {
-    case MB_TCPIP :
-    case MB_SERIAL_TCPIP :
-    case DH_SERIAL_TCPIP :
-      if((conn->fd = open_plc_socket(conn->ip_addr, conn->port)) == -1)
-      {
-        err(errout, "%s: error opening socket to %s:%u:%s\n", PROGNAME, conn->ip_addr, conn->port, conn->path);
-        return -1;
-      }
-    break;
-
-    case CIP_TCPIP :
-      if(cip_connect_to_plc(conn) == -1)
-        return -1;
-    break;
-
-    case MB_SERIAL :
-      mb_init_tty_struct(&conn->tio);
-
-      if((conn->fd = open_plc_tty(conn->tty_dev, &conn->tio)) == -1)
-      {
-        err(errout, "%s: error opening serial port to %s:%s\n", PROGNAME, conn->tty_dev, conn->path);
-        return -1;
-      }
-    break;
-
-    case DH_SERIAL :
-      dh_init_tty_struct(&conn->tio);
+  struct timespec now;
 
-      if((conn->fd = open_plc_tty(conn->tty_dev, &conn->tio)) == -1)
-      {
-        err(errout, "%s: error opening serial port to %s:%s\n", PROGNAME, conn->tty_dev, conn->path);
-        return -1;
-      }
-    break;
+  clock_gettime(CLOCK_REALTIME, &now);
+  trans->acq.sent_ns = PDS_TIMESPEC_NS(now);
 
-    default :
-      return -1;
-    break;
-  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  trans->sent_mono_ns = PDS_TIMESPEC_NS(now);
 
-  return 0;
+  return trans->acq.sent_ns;
 }
 
 
 
 /******************************************************************************
-* Function to disconnect from a PLC                                           *
+* Function to stamp a transaction with the time its response was received     *
 *                                                                             *
-* Pre-condition:  The connection struct is passed to the function             *
-* Post-condition: The connection is finished with the PLC.  If an error       *
-*                 occurs a -1 is returned                                     *
+* Pre-condition:  The transaction struct is passed to the function            *
+* Post-condition: The real & monotonic times now are stored in the            *
+*                 transaction, as the time its response was received, & the   *
+*                 response latency is calculated from the monotonic times.    *
+*                 The drivers stamp the tags they refresh with this time.     *
+*                 The real time (in nsecs) is returned                        *
 ******************************************************************************/
-int disconnect_from_plc(pdsconn *conn)
+unsigned long long stamp_response_received(pdstrans *trans)
 {
-  /* Disconnect from this PLC */
-  switch(conn->protocol)
-  {
-    case MB_TCPIP :
-    case MB_SERIAL_TCPIP :
-    case DH_SERIAL_TCPIP :
-      if(close(conn->fd) == -1)
-      {
-        err(errout, "%s: error closing socket to %s:%u:%s\n", PROGNAME, conn->ip_addr, conn->port, conn->path);
-        return -1;
-      }
-    break;
+  struct timespec now;
 
-    case CIP_TCPIP :
-      if(cip_disconnect_from_plc(conn) == -1)
-        return -1;
-    break;
-
-    case MB_SERIAL :
-    case DH_SERIAL :
-      if(close_plc_tty(conn->fd, &conn->tio) == -1)
-      {
-        err(errout, "%s: error closing serial port to %s:%s\n", PROGNAME, conn->tty_dev, conn->path);
-        return -1;
-      }
-    break;
+  clock_gettime(CLOCK_REALTIME, &now);
+  trans->acq.rcvd_ns = PDS_TIMESPEC_NS(now);
 
-    default :
-      return -1;
-    break;
-  }
+  /* N.B.: The monotonic clock isn't stepped, so the latency is exact */
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  trans->acq.latency_ns = PDS_TIMESPEC_NS(now) - trans->sent_mono_ns;
 
-  return 0;
+  return trans->acq.rcvd_ns;
 }
 
 
@@ -638,18 +1245,15 @@ int disconnect_from_plc(pdsconn *conn)
 *                                                                             *
 * Pre-condition:  The connection struct & a transaction struct containing the *
 *                 query & storage for the response are passed to the function *
-* Post-condition: The query is ran against the PLC.  The response is checked  *
-*                 for exceptions and returned in the response buffer.  The    *
-*                 no. of bytes in the response is returned or a -1 on error   *
+* Post-condition: The query is ran against the PLC & stamped with the times   *
+*                 it was sent & its response received.  The response is       *
+*                 checked for exceptions and returned in the response buffer. *
+*                 The no. of bytes in the response is returned or a -1 on     *
+*                 error                                                       *
 ******************************************************************************/
 int read_from_plc(pdsconn *conn, pdstrans *trans)
 {
   short int nbytes = -1;
-  int excode = 0;
-  char exstr[PDS_EXSTRLEN] = "\0", fqid[PDS_PLC_FQID_LEN] = "\0";
-
-  /* Get this PLC's fully-qualified ID */
-  PDS_GET_PLC_FQID(fqid, conn);
 
   /* Run the query against the PLC */
   switch(trans->protocol)
@@ -662,7 +1266,9 @@ int read_from_plc(pdsconn *conn, pdstrans *trans)
       printd("--> Query %d, Trans. %d\n", trans->block_id, trans->trans_id);
       if(dbgflag) PDS_PRINT_BARRAYX(trans->buf, trans->blen);
 
+      stamp_query_sent(trans);
       nbytes = mb_run_plc_query(conn->fd, trans);
+      stamp_response_received(trans);
 
       printd("<-- Response %d, Trans. %d\n", trans->block_id, trans->trans_id);
       if(dbgflag) PDS_PRINT_BARRAYX(trans->buf, trans->blen);
@@ -677,7 +1283,9 @@ int read_from_plc(pdsconn *conn, pdstrans *trans)
       printd("--> Query %d, Trans. %d\n", trans->block_id, trans->trans_id);
       if(dbgflag) PDS_PRINT_BARRAYX(trans->buf, trans->blen);
 
+      stamp_query_sent(trans);
       nbytes = dh_run_plc_query(conn->fd, trans);
+      stamp_response_received(trans);
 
       printd("<-- Response %d, Trans. %d\n", trans->block_id, trans->trans_id);
       if(dbgflag) PDS_PRINT_BARRAYX(trans->buf, trans->blen);
@@ -691,7 +1299,9 @@ int read_from_plc(pdsconn *conn, pdstrans *trans)
       printd("--> Query %d, Trans. %d\n", trans->block_id, trans->trans_id);
       if(dbgflag) PDS_PRINT_BARRAYX(trans->buf, trans->blen);
 
+      stamp_query_sent(trans);
       nbytes = cip_run_plc_query(conn->fd, trans);
+      stamp_response_received(trans);
 
       printd("<-- Response %d, Trans. %d\n", trans->block_id, trans->trans_id);
       if(dbgflag) PDS_PRINT_BARRAYX(trans->buf, trans->blen);
@@ -700,8 +1310,35 @@ int read_from_plc(pdsconn *conn, pdstrans *trans)
     break;
   }
 
-  if(nbytes == -1)
+  return check_read_response(conn, trans, nbytes);
+}
+
+
+
+/******************************************************************************
+* Function to check a PLC's response to a read query                          *
+*                                                                             *
+* Pre-condition:  The connection struct, a transaction struct containing the  *
+*                 cleaned response & the no. of bytes received are passed to  *
+*                 the function                                                *
+* Post-condition: The response is checked for exceptions.  On error, the      *
+*                 PLC's status word is set accordingly.  The no. of bytes in  *
+*                 the response is returned or a -1 on error                   *
+******************************************************************************/
+int check_read_response(pdsconn *conn, pdstrans *trans, short int nbytes)
+{
+  int excode = 0;
+  char exstr[PDS_EXSTRLEN] = "\0", fqid[PDS_PLC_FQID_LEN] = "\0";
+
+  /* Get this PLC's fully-qualified ID */
+  PDS_GET_PLC_FQID(fqid, conn);
+
+  /* N.B.: A zero byte response means the PLC has closed the (pooled)
+           connection, so treat it as a comms error to force a reconnect */
+  if(nbytes < 1)
   {
+    nbytes = -1;
+
     if(!quit_flag)
     {
       err(errout, "%s: error running read query to %s errx %d\n", PROGNAME, fqid, *trans->errx);
@@ -757,17 +1394,27 @@ int read_from_plc(pdsconn *conn, pdstrans *trans)
 /******************************************************************************
 * Function to handle - write data to PLC/client initialisation - requests     *
 *                                                                             *
-* Pre-condition:  The connection structs are passed to the function           *
+* Pre-condition:  The PLC configuration struct and the connection structs are *
+*                 passed to the function                                      *
 * Post-condition: Client requests to write data to the PLC and a client's     *
-*                 initial request to connect to the server are handled.  If   *
-*                 an error occurs a -1 is returned                            *
+*                 initial request to connect to the server are handled as     *
+*                 they arrive.  Each burst of requests is drained from the    *
+*                 queue before waiting again, queued writes to contiguous     *
+*                 references being coalesced.  If an error occurs a -1 is     *
+*                 returned                                                    *
 ******************************************************************************/
-int handle_write_requests(pdsconn *conn, pds_spi_conn *spi_conn)
+int handle_write_requests(plc_cnf *conf, pdsconn *conn, pds_spi_conn *spi_conn)
 {
-  pdsmsg msg;
-  int nbytes = 0;
+  pdsmsg msg, merged;
+  pdswrbatch batch;
+  pdspool *pool = NULL;
+  struct timeval start, end;
+  int nbytes = 0, msgflg = 0, nmerged = 0;
+  register int i = 0, j = 0;
   long int msgtype = -PDS_INITMSG;
   int *pds_online = NULL, *pds_wrpause = NULL;
+  int *pds_wrq_depth = NULL, *pds_wrsvc_time = NULL, *pds_wr_count = NULL;
+  int *pds_wr_coalesced = NULL;
 
   /* N.B.: Setting the msgtype to 'minus init message' means that all
            messages with init's priority or higher will be read from the 
@@ -788,7 +1435,42 @@ int handle_write_requests(pdsconn *conn, pds_spi_conn *spi_conn)
     return -1;
   }
 
-  /* Continuously poll the message queue for client requests */
+  if((pds_wrq_depth = PDS_SPIget_tag_ptr(spi_conn, "PDS_WRQ_DEPTH")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_WRQ_DEPTH\n", PROGNAME);
+    return -1;
+  }
+
+  if((pds_wrsvc_time = PDS_SPIget_tag_ptr(spi_conn, "PDS_WRSVC_TIME")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_WRSVC_TIME\n", PROGNAME);
+    return -1;
+  }
+
+  if((pds_wr_count = PDS_SPIget_tag_ptr(spi_conn, "PDS_WR_COUNT")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_WR_COUNT\n", PROGNAME);
+    return -1;
+  }
+
+  if((pds_wr_coalesced = PDS_SPIget_tag_ptr(spi_conn, "PDS_WR_COALESCED")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_WR_COALESCED\n", PROGNAME);
+    return -1;
+  }
+
+  /* Setup the pool of connections to the PLCs in this configuration */
+  if((pool = setup_conn_pool(conf, spi_conn)) == NULL)
+  {
+    err(errout, "%s: failed to setup the connection pool\n", PROGNAME);
+    return -1;
+  }
+
+  /* Serial ports are held open for a burst of requests, & freed for the
+     read process once the burst has been serviced */
+  pool->keep_serial = 1;
+
+  /* Wait on the message queue for client requests */
   while(!quit_flag)
   {
     if(!*pds_online)
@@ -805,27 +1487,81 @@ int handle_write_requests(pdsconn *conn, pds_spi_conn *spi_conn)
     nbytes = 0;
     memset(&msg, 0, sizeof(pdsmsg));
 
-    /* Get the next message in the queue */
-    if((nbytes = msgrcv(conn->msgid, (void *) &msg, conn->msgsize, msgtype, 0)) < conn->msgsize)
+    /* Block until a request arrives, then keep reading without waiting
+       until the queue has been drained */
+    if((nbytes = msgrcv(conn->msgid, (void *) &msg, conn->msgsize, msgtype, msgflg)) < conn->msgsize)
     {
-      err(errout, "%s: error reading from message queue\n", PROGNAME);
+      if(nbytes == -1 && errno == ENOMSG)
+      {
+        /* The burst has been serviced.  Free any serial ports for the read
+           process and go back to waiting */
+        *pds_wrq_depth = 0;
+        msgflg = 0;
+        close_serial_pool_conns(pool);
+
+        if(*pds_wrpause > 0)
+          usleep(*pds_wrpause);
+      }
+      else if(nbytes == -1 && errno == EINTR)
+        continue;
+      else if(nbytes == -1 && (errno == EIDRM || errno == EINVAL))
+      {
+        err(errout, "%s: message queue has been removed\n", PROGNAME);
+        break;
+      }
+      else
+        err(errout, "%s: error reading from message queue\n", PROGNAME);
+
       continue;
     }
 
+    msgflg = IPC_NOWAIT;
+
     switch(msg.msgtype)
     {
       case PDS_WRMSG :            /* Client request to write data to PLC */
-        write_to_plc(conn, &msg);
+        /* Gather any other writes already queued behind this one, so that
+           writes to contiguous references can share a PLC transaction */
+        memcpy(&batch.msgs[0], &msg, sizeof(pdsmsg));
+
+        for(batch.nmsgs = 1; batch.nmsgs < PDS_WRBATCH_MAX; batch.nmsgs++)
+        {
+          if(msgrcv(conn->msgid, (void *) &batch.msgs[batch.nmsgs], conn->msgsize, PDS_WRMSG, IPC_NOWAIT) < conn->msgsize)
+            break;
+        }
 
-        /* Set the 'write data to PLC response' message type */
-        msg.msgtype = PDS_WRMSG_RESP;
+        /* Record how many write requests are waiting to be serviced.
+           N.B.: The queue's msg_qnum isn't used, as it also counts the
+                 replies that clients have yet to collect */
+        *pds_wrq_depth = batch.nmsgs;
 
-        /* Send the 'write data to PLC' response */
-        if((nbytes = msgsnd(conn->msgid, (void *) &msg, conn->msgsize, 0)) == -1)
+        for(i = 0; i < batch.nmsgs; i += nmerged)
         {
-          err(errout, "%s: error writing data response to message queue\n",
-          PROGNAME);
-          break;
+          nmerged = coalesce_write_requests(conn, &batch, i, &merged);
+
+          gettimeofday(&start, NULL);
+          write_to_plc(conn, &merged, pool);
+          gettimeofday(&end, NULL);
+
+          /* Record this write's service time (usec) */
+          *pds_wrsvc_time = (int) ((end.tv_sec - start.tv_sec) * 1000000 +
+                                   (end.tv_usec - start.tv_usec));
+          *pds_wr_count += nmerged;
+          *pds_wr_coalesced += (nmerged - 1);
+          *pds_wrq_depth -= nmerged;
+
+          /* Send each originating client its 'write data to PLC' response */
+          for(j = i; j < i + nmerged; j++)
+          {
+            batch.msgs[j].status = merged.status;
+            batch.msgs[j].msgtype = PDS_WRMSG_RESP_TYPE(batch.msgs[j].pid);
+
+            if(send_write_response(conn, &batch.msgs[j]) == -1)
+            {
+              err(errout, "%s: error writing data response to message queue\n",
+              PROGNAME);
+            }
+          }
         }
       break;
 
@@ -833,8 +1569,12 @@ int handle_write_requests(pdsconn *conn, pds_spi_conn *spi_conn)
         /* Send client the necessary connection data */
         msg.semid = conn->semid;
         msg.shmid = conn->shmid;
+        msg.nblocks = conn->nblocks;
         msg.ndata_tags = conn->ndata_tags;
         msg.nstatus_tags = conn->nstatus_tags;
+        msg.nhash = conn->nhash;
+        msg.seqlock = conn->seqlock;
+        msg.gen = conn->gen;
         msg.febe_proto_ver = conn->febe_proto_ver; 
 
         /* Set the 'request for init. response' message type */
@@ -849,63 +1589,94 @@ int handle_write_requests(pdsconn *conn, pds_spi_conn *spi_conn)
         }
       break;
     }
-
-    usleep(*pds_wrpause);
   }
 
+  free_conn_pool(pool);
+
   return (!quit_flag) ? -1 : 0;
 }
 
 
 
+/******************************************************************************
+* Function to send a client its 'write data to PLC' response                  *
+*                                                                             *
+* Pre-condition:  The connection struct & the response message are passed to  *
+*                 the function                                                *
+* Post-condition: The response is sent to the requesting client without       *
+*                 blocking the dispatcher.  If the message queue is full, the *
+*                 send is retried until the client collects its replies.  If  *
+*                 the client has exited, the response is dropped, as no one   *
+*                 could ever read it.  If an error occurs a -1 is returned    *
+******************************************************************************/
+int send_write_response(pdsconn *conn, pdsmsg *msg)
+{
+  /* Don't queue a reply for a client that has since exited */
+  if(kill(msg->pid, 0) == -1 && errno == ESRCH)
+    return 0;
+
+  while(msgsnd(conn->msgid, (void *) msg, conn->msgsize, IPC_NOWAIT) == -1)
+  {
+    if(errno == EINTR)
+      continue;
+    else if(errno != EAGAIN)
+      return -1;
+
+    /* The queue is full.  Drop the reply if its client has exited in the
+       meantime, otherwise wait for the clients to collect their replies */
+    if((kill(msg->pid, 0) == -1 && errno == ESRCH) || quit_flag)
+      return 0;
+
+    usleep(PDS_WRRESP_PAUSE);
+  }
+
+  return 0;
+}
+
+
+
 /******************************************************************************
 * Function to write client data to the PLC                                    *
 *                                                                             *
-* Pre-condition:  The connection struct and the message struct containing     *
-*                 data to write to the PLC are passed to the function         *
+* Pre-condition:  The connection struct, the message struct containing data   *
+*                 to write to the PLC and the connection pool are passed to   *
+*                 the function                                                *
 * Post-condition: The PLC query is constructed with data in the message and   *
-*                 then written to the PLC.  If an error occurs a -1 is        *
-*                 returned                                                    *
+*                 then written to the PLC over a pooled connection.  If an    *
+*                 error occurs a -1 is returned                               *
 ******************************************************************************/
-int write_to_plc(pdsconn *conn, pdsmsg *msg)
+int write_to_plc(pdsconn *conn, pdsmsg *msg, pdspool *pool)
 {
-  register unsigned short int i = 0;
-  short int len = strlen(msg->tag.name), found = 0, nbytes = 0;
+  short int found = 0, nbytes = 0;
   static unsigned short int errx = 0;
   int excode = 0;
   char exstr[PDS_EXSTRLEN] = "\0", fqid[PDS_PLC_FQID_LEN] = "\0";
   pdstag *tag = NULL;
+  pdspoolconn *pc = NULL;
   pdstrans trans;
 
-  msg->tag.status = 0;
+  msg->status = 0;
   memset(&trans, 0, sizeof(pdstrans));
 
   /* Before reading data from shared mem., hold the semaphore */
   while((semset(conn->semid, PDS_SEMHLD, 0) == -1) && (!quit_flag))
     continue;
 
-  /* Search for tagname ensuring string is not just a substring of tag */
-  for(i = 0, tag = (pdstag *) conn->data; i < conn->ndata_tags; i++, tag++)
+  /* Lookup the tagname in the index.  Only data tags can be written to */
+  if((tag = find_tag(conn, msg->tag.name)) && (tag < conn->status))
   {
-    if(memcmp(tag->name, msg->tag.name, len) == 0)
-    {
-      if(len == strlen(tag->name)) 
-      {
-        conn->protocol = tag->protocol;
-        strcpy(conn->ip_addr, tag->ip_addr);
-        conn->port = tag->port;
-        strcpy(conn->tty_dev, tag->tty_dev);
-        strcpy(conn->path, tag->path);
-        msg->tag.status = tag->status; /* This allows us to return status */
-        trans.protocol = tag->protocol;
-        trans.block_id = tag->block_id;
-        trans.block_start = PDS_GET_BLOCK_START(trans.block_id);
-        trans.status = &msg->tag.status;
-        trans.errx = &errx;
-        found = 1;
-        break;
-      }
-    }
+    conn->protocol = tag->protocol;
+    strcpy(conn->ip_addr, tag->ip_addr);
+    conn->port = tag->port;
+    strcpy(conn->tty_dev, tag->tty_dev);
+    strcpy(conn->path, tag->path);
+    msg->status = PDS_TAG_STATUS(conn, tag); /* This allows us to return status */
+    trans.protocol = tag->protocol;
+    trans.block_id = tag->block_id;
+    trans.block_start = PDS_GET_BLOCK_START(trans.block_id);
+    trans.status = &msg->status;
+    trans.errx = &errx;
+    found = 1;
   }
 
   /* After reading data from shared mem., release the semaphore */
@@ -921,7 +1692,7 @@ int write_to_plc(pdsconn *conn, pdsmsg *msg)
   PDS_GET_PLC_FQID(fqid, conn);
  
   /* Don't write data to PLC if PLC is OFFLINE */
-  if(msg->tag.status & PDS_PLC_OFFLINE)
+  if(msg->status & PDS_PLC_OFFLINE)
   {
     /* N.B.:  No need to write an error log message if PLC is offline.  This
               will be handled by the continuous read queries.  This avoids
@@ -929,6 +1700,13 @@ int write_to_plc(pdsconn *conn, pdsmsg *msg)
     return -1;
   }
 
+  /* Don't write data to PLC whilst its circuit breaker is open */
+  if((pc = get_pool_conn(pool, conn)) && check_plc_breaker(&pc->breaker) == PDS_BRK_OPEN)
+  {
+    msg->status |= PDS_PLC_BREAKER;
+    return -1;
+  }
+
   /* Build the query */
   switch(trans.protocol)
   {
@@ -951,11 +1729,12 @@ int write_to_plc(pdsconn *conn, pdsmsg *msg)
     break;
   }
 
-  /* Connect the server to the PLC */
-  if(connect_to_plc(conn) == -1)
+  /* Connect the server to the PLC (reusing any pooled connection) */
+  if(acquire_plc_connection(pool, conn) == -1)
   {
-    msg->tag.status |= PDS_PLC_CONNERR;
-    set_tags_status(conn, msg->tag.status);
+    msg->status |= PDS_PLC_CONNERR;
+    set_tags_status(conn, msg->status);
+    release_plc_connection(pool, conn, PDS_PLC_CONNERR);
     return -1;
   } 
 
@@ -1008,7 +1787,9 @@ int write_to_plc(pdsconn *conn, pdsmsg *msg)
     break;
   }
 
-  disconnect_from_plc(conn);
+  /* Keep the connection open for the next write unless it has failed.  N.B.:
+     Only this write's outcome counts, not the tag's last read status */
+  release_plc_connection(pool, conn, (nbytes == -1) ? PDS_PLC_COMMSERR : 0);
 
   if(nbytes == -1)
   {
@@ -1016,8 +1797,8 @@ int write_to_plc(pdsconn *conn, pdsmsg *msg)
     {
       err(errout, "%s: error running write query to %s errx %d\n", PROGNAME, fqid, ++errx);
 
-      msg->tag.status |= PDS_PLC_COMMSERR;
-      set_tags_status(conn, msg->tag.status);
+      msg->status |= PDS_PLC_COMMSERR;
+      set_tags_status(conn, msg->status);
       return -1;
     }
   }
@@ -1050,8 +1831,8 @@ int write_to_plc(pdsconn *conn, pdsmsg *msg)
     {
       err(errout, "%s: write PLC response error - %s - on %s\n", PROGNAME, exstr, fqid);
 
-      msg->tag.status |= PDS_PLC_RESPERR;
-      set_tags_status(conn, msg->tag.status);
+      msg->status |= PDS_PLC_RESPERR;
+      set_tags_status(conn, msg->status);
       return -1;
     }
   }
@@ -1061,18 +1842,126 @@ int write_to_plc(pdsconn *conn, pdsmsg *msg)
 
 
 
+/******************************************************************************
+* Function to determine if writes to a tag's block can be coalesced           *
+*                                                                             *
+* Pre-condition:  The tag struct is passed to the function                    *
+* Post-condition: If the tag's protocol & function support writing a range of *
+*                 contiguous references in a single transaction, then a 1 is  *
+*                 returned, otherwise a 0 is returned                         *
+******************************************************************************/
+int can_coalesce_write(pdstag *tag)
+{
+  int len = 0;
+
+  switch(tag->protocol)
+  {
+    case MB_TCPIP :
+    case MB_SERIAL_TCPIP :
+    case MB_SERIAL :
+      /* Force Multiple Coils & Preset Multiple Registers */
+      return (tag->function == PDS_BWRITE || tag->function == PDS_WWRITE);
+    break;
+
+    case DH_SERIAL_TCPIP :
+    case DH_SERIAL :
+      /* Word range writes start at the block's address, so a range can only
+         be written from the block's first word */
+      return (tag->function == PDS_WWRITE && tag->ref == 0);
+    break;
+
+    case CIP_TCPIP :
+      /* Only 16 bit word arrays can be written as a range of elements */
+      len = strlen(tag->ascii_addr);
+
+      return (tag->function == PDS_WWRITE && len > 2 &&
+              tag->ascii_addr[len-2] == '[' && tag->ascii_addr[len-1] == ']');
+    break;
+  }
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to coalesce a batch's queued writes into a single write            *
+*                                                                             *
+* Pre-condition:  The connection struct, the batch of write messages, the     *
+*                 index of the first message to write & storage for the       *
+*                 coalesced message are passed to the function                *
+* Post-condition: The first message and any following messages to the same    *
+*                 block with contiguous references are merged into the        *
+*                 coalesced message.  The no. of messages merged is returned  *
+******************************************************************************/
+int coalesce_write_requests(pdsconn *conn, pdswrbatch *batch, int first,
+                            pdsmsg *merged)
+{
+  register int i = 0;
+  unsigned int next = 0;
+  pdstag *base = NULL, *tag = NULL;
+  pdsmsg *msg = NULL;
+
+  memcpy(merged, &batch->msgs[first], sizeof(pdsmsg));
+
+  /* N.B.: The tags' metadata is read-only once the segment is mapped, so
+           the semaphore needn't be held for these lookups */
+  if(!(base = find_tag(conn, merged->tag.name)) || (base >= conn->status) ||
+     (merged->ntags < 1) || !can_coalesce_write(base))
+    return 1;
+
+  next = base->ref + merged->ntags;
+
+  /* Only merge messages in the order they were queued, so that successive
+     writes to the same reference are still written in order */
+  for(i = first + 1; i < batch->nmsgs; i++)
+  {
+    msg = &batch->msgs[i];
+
+    if(!(tag = find_tag(conn, msg->tag.name)) || (tag >= conn->status) ||
+       (tag->block_id != base->block_id) || (tag->ref != next) ||
+       (msg->ntags < 1) || ((merged->ntags + msg->ntags) > PDS_NTAGVALUES))
+      break;
+
+    switch(base->protocol)
+    {
+      case MB_TCPIP :
+      case MB_SERIAL_TCPIP :
+      case MB_SERIAL :
+        mb_coalesce_write_values(base, merged, msg);
+      break;
+
+      default :
+        memcpy(&merged->tagvalues[merged->ntags], msg->tagvalues,
+               (msg->ntags * sizeof(unsigned short int)));
+        merged->ntags += msg->ntags;
+      break;
+    }
+
+    next += msg->ntags;
+  }
+
+  return (i - first);
+}
+
+
+
 /******************************************************************************
 * Function to set tag's status words                                          *
 *                                                                             *
 * Pre-condition:  The connection struct and the PLC's status value are passed *
 *                 to the function                                             *
 * Post-condition: All tags on this PLC have their status words set to the     *
-*                 PLC's status value.  A count of updated tags is returned    *
+*                 PLC's status value.  Each changed tag is appended to the    *
+*                 change journal & clients are notified of each block whose   *
+*                 tags' statuses have changed.  A count of updated tags is    *
+*                 returned                                                    *
 ******************************************************************************/
 int set_tags_status(pdsconn *conn, unsigned short int status)
 {
   register int i = 0, updated = 0;
-  pdstag *tag = NULL;
+  pdstag *tag = NULL, *match = NULL;
+  int changed = -1;
 
   /* Cycle through ALL tags and match each tag's PLC.  The reason we set the
      status tag with it's status is because a write query doesn't carry a 
@@ -1081,6 +1970,8 @@ int set_tags_status(pdsconn *conn, unsigned short int status)
 
   for(i = 0, tag = (pdstag *) conn->data; i < conn->ttags; i++, tag++)
   {
+    match = NULL;
+
     switch(conn->protocol)
     {
       case MB_TCPIP :
@@ -1089,24 +1980,38 @@ int set_tags_status(pdsconn *conn, unsigned short int status)
       case CIP_TCPIP :
         if((strcmp(conn->ip_addr, tag->ip_addr) == 0) &&
            (conn->port == tag->port) && (strcmp(conn->path, tag->path) == 0))
-        {
-          tag->status = status;
-          updated++;
-        }
+          match = tag;
       break;
 
       case MB_SERIAL :
       case DH_SERIAL :
         if((strcmp(conn->tty_dev, tag->tty_dev) == 0) &&
            (strcmp(conn->path, tag->path) == 0))
-        {
-          tag->status = status;
-          updated++;
-        }
+          match = tag;
       break;
     }
+
+    if(match)
+    {
+      /* A block's tags are contiguous, so notify each changed block once,
+         after all of its tags' statuses have been set */
+      if(PDS_TAG_STATUS(conn, match) != status)
+      {
+        if(changed != -1 && changed != match->block_id)
+          notify_block_change(conn, changed);
+
+        changed = match->block_id;
+        PDS_TAG_STATUS(conn, match) = status;
+        journal_tag_change(conn, match, PDS_TAG_VALUE(conn, match), status, PDS_TAG_MTIME(conn, match));
+      }
+
+      updated++;
+    }
   }
 
+  if(changed != -1)
+    notify_block_change(conn, changed);
+
   return updated;
 }
 
@@ -146,6 +146,9 @@ void install_signal_handler(void)
   signal(SIGINT, set_quit);
   signal(SIGQUIT, set_quit);
 
+  /* A PLC dropping a pooled connection is handled as a comms error */
+  signal(SIGPIPE, SIG_IGN);
+
   signal(SIGCHLD, cleanup_child);
 }
 
@@ -181,6 +184,21 @@ void cleanup_child(int sig)
 }
 
 
+
+/******************************************************************************
+* Function to handle child signal in the read process                         *
+*                                                                             *
+* Pre-condition:  Signal has been received                                    *
+* Post-condition: Child process is left to be reaped by check_scan_workers(), *
+*                 so that a scan worker's exit is seen, signal handler is     *
+*                 re-installed                                                *
+******************************************************************************/
+void notify_child(int sig)
+{
+  signal(SIGCHLD, notify_child);
+}
+
+
  
 /******************************************************************************
 * Function to parse the server's command line arguments                       *
@@ -207,7 +225,7 @@ int parse_pds_cmdln(int argc, char *argv[], pds_cmdln *args)
   args->key = (key_t) PDS_IPCKEY;
   args->runmode = 0;
 
-  while((opt = getopt(argc, argv, "D:c:L:l:k:r:S:sd::vh")) != -1)
+  while((opt = getopt(argc, argv, "D:c:L:l:k:r:S:sad::vh")) != -1)
   {
     switch(opt)
     {
@@ -245,11 +263,14 @@ int parse_pds_cmdln(int argc, char *argv[], pds_cmdln *args)
       case 'r' :
         if(optarg)
         {
-          /* Set refresh bit in runmode according to option */
+          /* Set refresh mode in runmode according to option.  If given
+             more than once, the last refresh mode wins */
           if(strcasecmp(optarg, "all") == 0)
-            args->runmode |= PDS_RM_REFRESH_ALL;
+            args->runmode = PDS_SET_RM_REFRESH(args->runmode, PDS_RM_REFRESH_ALL);
           else if(strcasecmp(optarg, "block") == 0)
-            args->runmode |= PDS_RM_REFRESH_BLOCK;
+            args->runmode = PDS_SET_RM_REFRESH(args->runmode, PDS_RM_REFRESH_BLOCK);
+          else if(strcasecmp(optarg, "seqlock") == 0)
+            args->runmode = PDS_SET_RM_REFRESH(args->runmode, PDS_RM_REFRESH_SEQLOCK);
           else
           {
             fprintf(stderr, "%s: invalid refresh mode '%s'\n",
@@ -265,6 +286,12 @@ int parse_pds_cmdln(int argc, char *argv[], pds_cmdln *args)
         args->runmode |= PDS_RM_QUERY_STATUS;
       break; 
 
+      /* The server's asynchronous scan mode */
+      case 'a' :
+        /* Set scan bit in runmode */
+        args->runmode |= PDS_RM_SCAN_ASYNC;
+      break; 
+
       /* Set initial value for the given SPI tag */
       case 'S' :
         if(optarg)
@@ -280,10 +307,14 @@ int parse_pds_cmdln(int argc, char *argv[], pds_cmdln *args)
 "  -L log_dir -- the path to the PDS log dir (default = %s)\n"
 "  -l filename -- name for the PDS log file (default = %s)\n"
 "  -k IPC_key -- an alternative to the standard PDS IPC key (default = %d)\n"
-"  -r {all|block} -- the default refresh mode (default = all)\n"
+"  -r {all|block|seqlock} -- the default refresh mode (default = all)\n"
 "  the semaphore is released after ALL blocks in the config\n"
-"  are refreshed or after each BLOCK in the config\n"
+"  are refreshed or after each BLOCK in the config.  In SEQLOCK\n"
+"  mode each block is published under a sequence counter and\n"
+"  clients read without taking the semaphore\n"
 "  -s -- run a PLC status query before each data query\n"
+"  -a -- scan ModBus/TCP PLCs asynchronously in an epoll-based engine,\n"
+"  sharded over PDS_SCAN_SHARDS worker processes (set with -S)\n"
 "  -S name=value -- set an initial value for the given SPI tag\n"
 "  -d[1-4] -- debug (and optional level)\n"
 "  level 4 gives a %d second pause between each read query\n"
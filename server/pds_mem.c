@@ -6,11 +6,16 @@
 * DATE:     1999-09-22                                                        *
 ******************************************************************************/
 
+#include <sched.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
 #include "pds_srv.h"
 
 extern int quit_flag;             /* Declared in the main file */
 extern int errout;                /* Declared in the main file */
 extern int dbgflag;               /* Declared in the main file */
+extern unsigned int runmode;      /* Declared in the main file */
 
 /******************************************************************************
 * Globals                                                                     *
@@ -89,6 +94,7 @@ int release_shm(void *shm, int shmid)
 int map_shm(plc_cnf *conf, pdsconn *conn)
 {
   register int i = 0, j = 0, tag_count = 0;
+  unsigned int sample_count = 0;
   pdstag *p = NULL;
 
   if(!(block_index = (pdstag **) calloc(conf->nblocks, sizeof(pdstag *))))
@@ -97,12 +103,19 @@ int map_shm(plc_cnf *conf, pdsconn *conn)
     return -1;
   }
  
-  p = (pdstag *) conn->shm;
+  p = conn->data;
  
   for(i = 0; i < conf->nblocks; i++)
   {
     block_index[i] = p;           /* Add this block's 1st tag to index */
 
+    /* Each of this block's tags has a ring of its history depth samples */
+    conn->hist[i].count = 0;
+    conn->hist[i].depth = conf->blocks[i].history;
+    conn->hist[i].first = tag_count;
+    conn->hist[i].samples = sample_count;
+    sample_count += (conf->blocks[i].ntags * conf->blocks[i].history);
+
     /* Map configuration file data tags to memory structure tags */
     for(j = 0; j < conf->blocks[i].ntags; j++, p++) 
     {
@@ -119,10 +132,7 @@ int map_shm(plc_cnf *conf, pdsconn *conn)
       p->ref = conf->blocks[i].tags[j].ref;
       strcpy(p->ascii_ref, conf->blocks[i].tags[j].ascii_ref);
       strcpy(p->name, conf->blocks[i].tags[j].name);
-      p->value = 0;
       p->type = conf->blocks[i].type;
-      p->status = 0;
-      p->mtime = 0;
     }
   }
 
@@ -142,17 +152,111 @@ int map_shm(plc_cnf *conf, pdsconn *conn)
     p->ref = 0;
     p->ascii_ref[0] = '\0';
     sprintf(p->name, "%s%d", PDS_PLC_PREFIX, i);
-    p->value = 0;
     p->type = 0;
-    p->status = 0;
-    p->mtime = 0;
   }
+
+  /* N.B.: The tags' hot data were zeroed when the segment was created */
+
+  /* There is a block sequence counter for each data block & each PLC
+     (status tag) */
+  memset((void *) conn->seq, 0, (PDS_GET_NSEQ(conn) * sizeof(unsigned int)));
+
+  /* ...& a change counter, after the segment-wide change counter */
+  memset((void *) conn->chg, 0, (PDS_GET_NCHG(conn) * sizeof(unsigned int)));
+
+  /* The change journal is empty, so the 1st change appended is seq. no. 1 */
+  *conn->jseq = 0;
+  memset((void *) conn->journal, 0, (conn->njournal * sizeof(pdschange)));
+
+  /* N.B.: The sample histories were zeroed when the segment was created */
+
+  /* Index the tags in order, so a duplicated name resolves to its 1st tag,
+     as a scan would */
+  memset(conn->hash, 0, (conn->nhash * sizeof(unsigned int)));
+
+  for(i = 0, p = conn->data; i < tag_count; i++, p++)
+  {
+    if(index_tag(conn, p) == -1)
+    {
+      err(errout, "%s: error indexing tag %s\n", PROGNAME, p->name);
+      return -1;
+    }
+  }
+
+  /* The segment's header & the tags' metadata are now read-only */
+  if(mprotect(conn->shm, conn->seg->values, PROT_READ) == -1)
+    err(errout, "%s: error protecting the tags' metadata\n", PROGNAME);
  
   return tag_count;
 }
 
 
 
+/******************************************************************************
+* Function to add a tag to the tag name index                                 *
+*                                                                             *
+* Pre-condition:  The connection struct & a pointer to the tag in shared      *
+*                 memory are passed to the function                           *
+* Post-condition: The tag's index is stored in the 1st free slot of its probe *
+*                 sequence, unless a tag of the same name is already indexed. *
+*                 The slot is returned or -1 if the index is full             *
+******************************************************************************/
+int index_tag(pdsconn *conn, pdstag *tag)
+{
+  register int i = 0, n = 0;
+  unsigned int h = 0;
+
+  PDS_HASH_TAGNAME(h, tag->name);
+
+  for(i = PDS_HASH_SLOT(h, conn->nhash), n = 0; n < conn->nhash; i = PDS_HASH_NEXT_SLOT(i, conn->nhash), n++)
+  {
+    if(conn->hash[i] == PDS_HASH_EMPTY)
+    {
+      conn->hash[i] = (tag - conn->data) + 1;
+      return i;
+    }
+
+    if(strcmp(conn->data[conn->hash[i] - 1].name, tag->name) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+
+
+/******************************************************************************
+* Function to find a tag by name using the tag name index                     *
+*                                                                             *
+* Pre-condition:  The connection struct & the tag name are passed to the      *
+*                 function                                                    *
+* Post-condition: A pointer to the tag in shared memory is returned or a null *
+*                 if the tag name is not found                                *
+******************************************************************************/
+pdstag* find_tag(pdsconn *conn, const char *tagname)
+{
+  register int i = 0, n = 0;
+  unsigned int h = 0;
+  pdstag *tag = NULL;
+
+  PDS_HASH_TAGNAME(h, tagname);
+
+  for(i = PDS_HASH_SLOT(h, conn->nhash), n = 0; n < conn->nhash; i = PDS_HASH_NEXT_SLOT(i, conn->nhash), n++)
+  {
+    if(conn->hash[i] == PDS_HASH_EMPTY)
+      break;
+
+    tag = &conn->data[conn->hash[i] - 1];
+
+    if(strcmp(tag->name, tagname) == 0)
+      return tag;
+  }
+
+  return NULL;
+}
+
+
+
 /******************************************************************************
 * Function to set the value of a semaphore                                    *
 *                                                                             *
@@ -174,6 +278,406 @@ int semset(int id, int op, int snum)
 
 
 
+/******************************************************************************
+* Function to publish a block of tags under its sequence counter              *
+*                                                                             *
+* Pre-condition:  The connection struct, a pointer to the block's 1st tag in  *
+*                 shared memory, a private copy of the block's values &       *
+*                 mtimes (in secs & nsecs) holding the new data, the block's  *
+*                 acquisition times & the no. of tags in the block are passed *
+*                 to the function                                             *
+* Post-condition: The new values are copied into shared memory whilst the     *
+*                 block's sequence counter is odd, so that readers retry      *
+*                 rather than see a partially refreshed block.  The no. of    *
+*                 tags published is returned                                  *
+******************************************************************************/
+int publish_block(pdsconn *conn, pdstag *block_start,
+                  unsigned short int *values, time_t *mtimes,
+                  unsigned long long *mtimes_ns, pdsacq *acq,
+                  unsigned short int ntags)
+{
+  volatile unsigned int *seq = &conn->seq[block_start->block_id];
+
+  PDS_SEQ_WRITE_BEGIN(*seq);
+
+  /* N.B.: A block's tags are contiguous, so are its hot data */
+  memcpy(&PDS_TAG_VALUE(conn, block_start), values, (ntags * sizeof(unsigned short int)));
+  memcpy(&PDS_TAG_MTIME(conn, block_start), mtimes, (ntags * sizeof(time_t)));
+  memcpy(&PDS_TAG_MTIME_NS(conn, block_start), mtimes_ns, (ntags * sizeof(unsigned long long)));
+  PDS_BLOCK_ACQ(conn, block_start->block_id) = *acq;
+
+  PDS_SEQ_WRITE_END(*seq);
+
+  return ntags;
+}
+
+
+
+/******************************************************************************
+* Function to notify clients that a block has changed                         *
+*                                                                             *
+* Pre-condition:  The connection struct & the block's ID are passed to the    *
+*                 function                                                    *
+* Post-condition: The block's change counter & the segment-wide change        *
+*                 counter are bumped, & any clients waiting on the latter are *
+*                 woken.  The segment-wide change counter is returned         *
+******************************************************************************/
+unsigned int notify_block_change(pdsconn *conn, unsigned short int block_id)
+{
+  unsigned int chg = 0;
+
+  /* N.B.: The read & write processes & the scan workers all notify changes,
+           & the atomic adds are also full barriers, so a client that is
+           about to wait either sees the block's new count, or is woken */
+  __sync_fetch_and_add(&PDS_BLOCK_CHG(conn, block_id), 1);
+  chg = __sync_add_and_fetch(&conn->chg[PDS_CHG_FUTEX], 1);
+
+  /* Only make the syscall if a client is waiting */
+  if(conn->chg[PDS_CHG_WAITERS] > 0)
+    PDS_CHG_WAKE(&conn->chg[PDS_CHG_FUTEX]);
+
+  return chg;
+}
+
+
+
+/******************************************************************************
+* Function to append a tag's change to the change journal                     *
+*                                                                             *
+* Pre-condition:  The connection struct, a pointer to the tag in shared       *
+*                 memory & the tag's new value, status & mtime are passed to  *
+*                 the function                                                *
+* Post-condition: The next sequence no. is claimed & the change is written to *
+*                 its record in the ring, overwriting the oldest change.      *
+*                 The change's sequence no. is returned                       *
+******************************************************************************/
+unsigned long long journal_tag_change(pdsconn *conn, pdstag *tag,
+                                      unsigned short int value,
+                                      unsigned short int status, time_t mtime)
+{
+  volatile pdschange *rec = NULL;
+  unsigned long long seq = 0;
+
+  /* N.B.: The read & write processes & the scan workers all append changes,
+           so each claims its sequence no. (& so its record) atomically */
+  seq = __sync_add_and_fetch(conn->jseq, 1);
+  rec = &conn->journal[PDS_JOURNAL_SLOT(seq, conn->njournal)];
+
+  /* The record's seq. no. only matches once the record is complete, so that
+     readers never take a half-written record */
+  rec->seq = 0;
+  PDS_SEQ_BARRIER();
+
+  rec->id = tag->id;
+  rec->value = value;
+  rec->status = status;
+  rec->mtime = mtime;
+
+  PDS_SEQ_BARRIER();
+  rec->seq = seq;
+
+  return seq;
+}
+
+
+
+/******************************************************************************
+* Function to take a sample of a block's tags for their history               *
+*                                                                             *
+* Pre-condition:  The connection struct, a pointer to the block's 1st tag in  *
+*                 shared memory & the no. of tags in the block are passed to  *
+*                 the function                                                *
+* Post-condition: If the block has a history, each tag's current value &      *
+*                 status are written to the next slot of its ring, stamped    *
+*                 with the time the block's last response was received, &     *
+*                 then the block's sample count is bumped.  The no. of tags   *
+*                 sampled is returned                                         *
+******************************************************************************/
+int sample_block_history(pdsconn *conn, pdstag *block_start,
+                         unsigned short int ntags)
+{
+  pdshist *hist = &conn->hist[block_start->block_id];
+  volatile pdssample *sample = NULL;
+  pdstag *tag = NULL;
+  unsigned long long mtime_ns = 0;
+  register unsigned short int i = 0;
+  unsigned int slot = 0;
+
+  if(hist->depth == 0)
+    return 0;
+
+  mtime_ns = PDS_BLOCK_ACQ(conn, block_start->block_id).rcvd_ns;
+
+  /* N.B.: A block is only ever refreshed by one process at a time, so the
+           block's history has a single writer */
+  slot = PDS_HIST_SLOT(hist->count, hist->depth);
+
+  for(i = 0, tag = block_start; i < ntags; i++, tag++)
+  {
+    sample = &PDS_HIST_TAG_SAMPLES(conn, hist, tag)[slot];
+    sample->mtime_ns = mtime_ns;
+    sample->value = PDS_TAG_VALUE(conn, tag);
+    sample->status = PDS_TAG_STATUS(conn, tag);
+  }
+
+  /* The sample is only counted once complete, so readers never take it
+     whilst it's being written */
+  PDS_SEQ_BARRIER();
+  hist->count++;
+
+  return ntags;
+}
+
+
+
+/******************************************************************************
+* Function to start the snapshot publisher process                            *
+*                                                                             *
+* Pre-condition:  The connection structs are passed to the function           *
+* Post-condition: A process is forked to publish snapshots of the tags, at    *
+*                 the rate set by its SPI tag.  The publisher's pid is        *
+*                 returned or a -1 on error                                   *
+******************************************************************************/
+pid_t start_snapshot_publisher(pdsconn *conn, pds_spi_conn *spi_conn)
+{
+  pid_t pid = 0;
+
+  switch((pid = fork()))
+  {
+    case -1 :
+      err(errout, "%s: error creating snapshot publisher process\n", PROGNAME);
+    break;
+
+    case  0 :                     /* The snapshot publisher process */
+      printd("Starting snapshot publisher...\n");
+
+      /* Don't outlive the read process */
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+      run_snapshot_publisher(conn, spi_conn);
+
+      /* N.B.: The publisher shares the read process' connections, so exit
+               without any of the process' exit handling */
+      _exit(0);
+    break;
+  }
+
+  return pid;
+}
+
+
+
+/******************************************************************************
+* Function to stop the snapshot publisher process                             *
+*                                                                             *
+* Pre-condition:  The publisher's pid is passed to the function               *
+* Post-condition: The publisher is terminated & waited for.  On error a -1 is *
+*                 returned                                                    *
+******************************************************************************/
+int stop_snapshot_publisher(pid_t pid)
+{
+  int status = 0;
+
+  if(pid < 1)
+    return -1;
+
+  kill(pid, SIGTERM);
+
+  /* N.B.: The publisher may already have been reaped by the SIGCHLD handler */
+  waitpid(pid, &status, 0);
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to run the snapshot publisher                                      *
+*                                                                             *
+* Pre-condition:  The connection structs are passed to the function           *
+* Post-condition: A snapshot of the tags is published at the rate set by its  *
+*                 SPI tag, until the quit flag is set.  The publication rate  *
+*                 is independent of the blocks' poll rates, & can be changed  *
+*                 whilst running.  If it's 0, publication is paused.  Any     *
+*                 snapshot that can't be taken consistently is counted by an  *
+*                 SPI tag & skipped.  On error a -1 is returned               *
+******************************************************************************/
+int run_snapshot_publisher(pdsconn *conn, pds_spi_conn *spi_conn)
+{
+  int *pds_snapshot_rate = NULL, *pds_snapshot_misses = NULL;
+  unsigned int *seqs = NULL;
+  struct timespec due, now;
+
+  /* Ensure we have the SPI tags we require */
+  if((pds_snapshot_rate = PDS_SPIget_tag_ptr(spi_conn, "PDS_SNAPSHOT_RATE")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_SNAPSHOT_RATE\n", PROGNAME);
+    return -1;
+  }
+
+  if((pds_snapshot_misses = PDS_SPIget_tag_ptr(spi_conn, "PDS_SNAPSHOT_MISSES")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_SNAPSHOT_MISSES\n", PROGNAME);
+    return -1;
+  }
+
+  /* Storage for the block sequence counters seen at the start of a copy */
+  if(!(seqs = (unsigned int *) calloc(PDS_GET_NSEQ(conn), sizeof(unsigned int))))
+  {
+    err(errout, "%s: memory allocation error\n", PROGNAME);
+    return -1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &due);
+
+  while(!quit_flag)
+  {
+    if(*pds_snapshot_rate <= 0)
+    {
+      sleep(PDS_SNAPSHOT_IDLE);
+      clock_gettime(CLOCK_MONOTONIC, &due);
+      continue;
+    }
+
+    if(publish_snapshot(conn, seqs) == 0)
+      (*pds_snapshot_misses)++;
+
+    due.tv_sec += *pds_snapshot_rate / 1000000;
+    due.tv_nsec += (*pds_snapshot_rate % 1000000) * 1000L;
+
+    if(due.tv_nsec >= 1000000000L)
+    {
+      due.tv_sec++;
+      due.tv_nsec -= 1000000000L;
+    }
+
+    /* Don't try to catch up any missed publications */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if(PDS_TS_BEFORE(&due, &now))
+      due = now;
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+  }
+
+  free(seqs);
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to publish a snapshot of the tags                                  *
+*                                                                             *
+* Pre-condition:  The connection struct & storage for the block sequence      *
+*                 counters are passed to the function                         *
+* Post-condition: A consistent image of the tags is taken into the snapshot   *
+*                 buffer that isn't the latest & then the snapshot epoch is   *
+*                 bumped, so that it becomes the latest.  The new epoch is    *
+*                 returned.  If an image couldn't be taken, a 0 is returned   *
+******************************************************************************/
+unsigned int publish_snapshot(pdsconn *conn, unsigned int *seqs)
+{
+  pdsimage *image = NULL;
+  unsigned int epoch = *conn->snap + 1;
+
+  /* Skip the epoch 0, which means no snapshot has been published, whilst
+     keeping the buffers alternating */
+  if(epoch == 0)
+    epoch = 2;
+
+  /* N.B.: The publisher is the only writer of the snapshots, & clients only
+           copy the latest, so this buffer is free to be overwritten */
+  image = PDS_SNAP_IMAGE(conn, epoch);
+
+  if(take_snapshot(conn, image, seqs) == -1)
+    return 0;
+
+  image->epoch = epoch;
+
+  /* The image is only published once complete */
+  PDS_SEQ_BARRIER();
+  *conn->snap = epoch;
+
+  return epoch;
+}
+
+
+
+/******************************************************************************
+* Function to take a consistent image of the tags                             *
+*                                                                             *
+* Pre-condition:  The connection struct, the image to write & storage for the *
+*                 block sequence counters are passed to the function          *
+* Post-condition: The tags' values & statuses are copied into the image.      *
+*                 Check refresh mode.  If 'seqlock', the copy is retried      *
+*                 until no block was published whilst copying.  Otherwise,    *
+*                 the semaphore is held whilst copying.  The no. of tags      *
+*                 copied is returned.  On error a -1 is returned              *
+******************************************************************************/
+int take_snapshot(pdsconn *conn, pdsimage *image, unsigned int *seqs)
+{
+  struct timespec now;
+  register int i = 0, try = 0;
+  int nseq = PDS_GET_NSEQ(conn);
+
+  if(PDS_GET_RM_REFRESH(runmode) != PDS_RM_REFRESH_SEQLOCK)
+  {
+    if(semset(conn->semid, PDS_SEMHLD, 0) == -1)
+      return -1;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    memcpy(PDS_IMAGE_VALUES(image), conn->values, (conn->ttags * sizeof(unsigned short int)));
+    memcpy(PDS_IMAGE_VALUES(image) + conn->ttags, conn->statuses, (conn->ttags * sizeof(unsigned short int)));
+
+    semset(conn->semid, PDS_SEMREL, 0);
+  }
+  else
+  {
+    for(try = 0; try < PDS_SNAPSHOT_RETRIES; try++)
+    {
+      for(i = 0; i < nseq; i++)
+      {
+        if(PDS_SEQ_IS_WRITING((seqs[i] = conn->seq[i])))
+          break;
+      }
+
+      /* A block is being published, so give its writer a chance to finish */
+      if(i < nseq)
+      {
+        sched_yield();
+        continue;
+      }
+
+      PDS_SEQ_BARRIER();
+
+      clock_gettime(CLOCK_REALTIME, &now);
+      memcpy(PDS_IMAGE_VALUES(image), conn->values, (conn->ttags * sizeof(unsigned short int)));
+      memcpy(PDS_IMAGE_VALUES(image) + conn->ttags, conn->statuses, (conn->ttags * sizeof(unsigned short int)));
+
+      PDS_SEQ_BARRIER();
+
+      /* If no block was published whilst we were copying, the image is
+         consistent across all blocks */
+      for(i = 0; i < nseq && conn->seq[i] == seqs[i]; i++);
+
+      if(i == nseq)
+        break;
+    }
+
+    if(try == PDS_SNAPSHOT_RETRIES)
+      return -1;
+  }
+
+  image->mtime_ns = PDS_TIMESPEC_NS(now);
+  image->ntags = conn->ttags;
+
+  return conn->ttags;
+}
+
+
+
 /******************************************************************************
 * Function to map SPI tags to memory variable tags in shared memory           *
 *                                                                             *
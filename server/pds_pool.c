@@ -0,0 +1,608 @@
+/******************************************************************************
+* PROJECT:  PLC data server                                                   *
+* MODULE:   pds_pool.c                                                        *
+* PURPOSE:  The PLC connection pool functions module                          *
+* AUTHOR:   Paul M. Breen                                                     *
+* DATE:     2026-10-17                                                        *
+******************************************************************************/
+
+#include "pds_srv.h"
+#include "drivers/pds_mb.h"
+#include "drivers/pds_dh.h"
+#include "drivers/pds_cip.h"
+
+extern int quit_flag;             /* Declared in the main file */
+extern int errout;                /* Declared in the main file */
+extern int dbgflag;               /* Declared in the main file */
+
+/******************************************************************************
+* Function to setup the PLC connection pool for this configuration            *
+*                                                                             *
+* Pre-condition:  The PLC configuration struct and the SPI connection struct  *
+*                 are passed to the function                                  *
+* Post-condition: An empty pool entry is created for each PLC in this         *
+*                 configuration and a pointer to the pool struct is returned. *
+*                 If an error occurs a null is returned                       *
+******************************************************************************/
+pdspool* setup_conn_pool(plc_cnf *conf, pds_spi_conn *spi_conn)
+{
+  pdspool *pool = NULL;
+  pdspoolconn *pc = NULL;
+  plc_cnf_plc *plc = NULL;
+  register unsigned short int i = 0;
+
+  if(!(pool = (pdspool *) malloc(sizeof(pdspool))))
+  {
+    err(errout, "%s: memory allocation error\n", PROGNAME);
+    return NULL;
+  }
+
+  /* Array to hold a pooled connection for each unique PLC */
+  pool->conns = (pdspoolconn *) calloc(conf->nplcs, sizeof(pdspoolconn));
+
+  if(!pool->conns)
+  {
+    err(errout, "%s: memory allocation error\n", PROGNAME);
+    free(pool);
+    return NULL;
+  }
+
+  /* Key each entry on its PLC's fully-qualified ID.  Connections are only
+     opened on demand, when a query is first run against the PLC */
+  for(i = 0, pc = pool->conns, plc = conf->plcs; i < conf->nplcs; i++, pc++, plc++)
+  {
+    PDS_GET_PLC_FQID(pc->fqid, plc);
+    pc->protocol = plc->protocol;
+    strcpy(pc->ip_addr, plc->ip_addr);
+    pc->port = plc->port;
+    strcpy(pc->tty_dev, plc->tty_dev);
+    strcpy(pc->path, plc->path);
+    pc->fd = PDS_POOL_FD_NONE;
+    pc->resolved = 0;
+  }
+
+  pool->nconns = i;               /* Set the no. of pooled connections */
+  pool->keep_serial = 0;          /* Serial ports are closed on release */
+
+  /* Each PLC has its own connect timeout, latency & circuit breaker */
+  for(i = 0, pc = pool->conns; i < pool->nconns; i++, pc++)
+  {
+    if((pc->connect_tmo = get_SPI_plc_tag_ptr(spi_conn, PDS_CONNECT_TMO_FORMAT, i)) == (int *) -1 ||
+       (pc->connect_time = get_SPI_plc_tag_ptr(spi_conn, PDS_CONNECT_TIME_FORMAT, i)) == (int *) -1)
+    {
+      free_conn_pool(pool);
+      return NULL;
+    }
+
+    if(setup_plc_breaker(&pc->breaker, spi_conn, i) == -1)
+    {
+      err(errout, "%s: failed to setup the circuit breaker for %s\n", PROGNAME, pc->fqid);
+      free_conn_pool(pool);
+      return NULL;
+    }
+  }
+
+  /* Ensure we have the SPI tags we require */
+  if((pool->hits = PDS_SPIget_tag_ptr(spi_conn, "PDS_POOL_HITS")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_POOL_HITS\n", PROGNAME);
+    free_conn_pool(pool);
+    return NULL;
+  }
+
+  if((pool->misses = PDS_SPIget_tag_ptr(spi_conn, "PDS_POOL_MISSES")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_POOL_MISSES\n", PROGNAME);
+    free_conn_pool(pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
+
+
+/******************************************************************************
+* Function to close all pooled PLC connections and free the pool              *
+*                                                                             *
+* Pre-condition:  The pool struct is passed to the function                   *
+* Post-condition: Any open connections in the pool are closed and memory is   *
+*                 freed for the pool struct.  If an error occurs a -1 is      *
+*                 returned                                                    *
+******************************************************************************/
+int free_conn_pool(pdspool *pool)
+{
+  int i = -1;
+
+  if(pool)
+  {
+    if(pool->conns)
+    {
+      for(i = 0; i < pool->nconns; i++)
+      {
+        if(pool->conns[i].fd != PDS_POOL_FD_NONE)
+          close_pool_conn(pool, &pool->conns[i]);
+      }
+
+      free(pool->conns);
+    }
+    free(pool);
+  }
+
+  return i;
+}
+
+
+
+/******************************************************************************
+* Function to get the pool entry for the connection's PLC                     *
+*                                                                             *
+* Pre-condition:  The pool struct and the connection struct are passed to the *
+*                 function                                                    *
+* Post-condition: A pointer to the pool entry matching the PLC's              *
+*                 fully-qualified ID is returned or a null if this PLC is not *
+*                 in the pool                                                 *
+******************************************************************************/
+pdspoolconn* get_pool_conn(pdspool *pool, pdsconn *conn)
+{
+  register int i = 0;
+  char fqid[PDS_PLC_FQID_LEN] = "\0";
+
+  /* Get this PLC's fully-qualified ID */
+  PDS_GET_PLC_FQID(fqid, conn);
+
+  for(i = 0; i < pool->nconns; i++)
+  {
+    if(strcmp(pool->conns[i].fqid, fqid) == 0)
+      return &pool->conns[i];
+  }
+
+  return NULL;
+}
+
+
+
+/******************************************************************************
+* Function to acquire a connection to a PLC from the pool                     *
+*                                                                             *
+* Pre-condition:  The pool struct and the connection struct are passed to the *
+*                 function                                                    *
+* Post-condition: If the pool holds an open connection to the PLC it is       *
+*                 reused, otherwise a new connection is established, within   *
+*                 the PLC's connect timeout, and added to the pool.  The      *
+*                 connection's fd is set & a new connection's latency is      *
+*                 recorded.  If an error occurs a -1 is returned              *
+******************************************************************************/
+int acquire_plc_connection(pdspool *pool, pdsconn *conn)
+{
+  register int i = 0;
+  pdspoolconn *pc = NULL;
+  char fqid[PDS_PLC_FQID_LEN] = "\0";
+  struct timespec start, now;
+
+  if(!(pc = get_pool_conn(pool, conn)))
+  {
+    PDS_GET_PLC_FQID(fqid, conn);
+    err(errout, "%s: error finding pooled connection for %s\n", PROGNAME, fqid);
+    return -1;
+  }
+
+  /* N.B.: The CIP driver keeps its own registered session open, so always
+           defer to it and just account for whether the session was reused */
+  if(pc->protocol == CIP_TCPIP)
+  {
+    /* Only resolve the PLC's address once */
+    if(!pc->resolved)
+    {
+      if(resolve_plc_address(pc->ip_addr, pc->port, &pc->addr) == -1)
+      {
+        err(errout, "%s: error resolving address of %s\n", PROGNAME, pc->fqid);
+        return -1;
+      }
+      pc->resolved = 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if((conn->fd = cip_connect_to_plc(conn, &pc->addr, PDS_GET_CONNECT_TMO(*pc->connect_tmo))) == -1)
+    {
+      pc->fd = PDS_POOL_FD_NONE;
+      (*pool->misses)++;
+      return -1;
+    }
+
+    if(conn->fd == pc->fd)
+      (*pool->hits)++;
+    else
+    {
+      (*pool->misses)++;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      *pc->connect_time = (int) PDS_TS_USECS(&start, &now);
+    }
+
+    pc->fd = conn->fd;
+    return 0;
+  }
+
+  /* Reuse the pooled connection if it's still open */
+  if(pc->fd != PDS_POOL_FD_NONE)
+  {
+    conn->fd = pc->fd;
+    (*pool->hits)++;
+    return 0;
+  }
+
+  /* Several PLCs can be multidropped on the same serial port.  If another
+     entry already has this port open, then share its fd */
+  if(PDS_GET_PROTOTYPE(pc->protocol) == PDS_SERIAL_PROTO)
+  {
+    for(i = 0; i < pool->nconns; i++)
+    {
+      if((pool->conns[i].fd != PDS_POOL_FD_NONE) &&
+         (strcmp(pool->conns[i].tty_dev, pc->tty_dev) == 0))
+      {
+        pc->fd = pool->conns[i].fd;
+        memcpy(&pc->tio, &pool->conns[i].tio, sizeof(struct termios));
+        conn->fd = pc->fd;
+        (*pool->hits)++;
+        return 0;
+      }
+    }
+  }
+
+  (*pool->misses)++;
+
+  /* Open a new connection to this PLC */
+  switch(pc->protocol)
+  {
+    case MB_TCPIP :
+    case MB_SERIAL_TCPIP :
+    case DH_SERIAL_TCPIP :
+      /* Only resolve the PLC's address once */
+      if(!pc->resolved)
+      {
+        if(resolve_plc_address(pc->ip_addr, pc->port, &pc->addr) == -1)
+        {
+          err(errout, "%s: error resolving address of %s\n", PROGNAME, pc->fqid);
+          return -1;
+        }
+        pc->resolved = 1;
+      }
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+
+      if((pc->fd = open_plc_socket_tmo(&pc->addr, PDS_GET_CONNECT_TMO(*pc->connect_tmo))) == -1)
+      {
+        err(errout, "%s: error opening socket to %s\n", PROGNAME, pc->fqid);
+        pc->fd = PDS_POOL_FD_NONE;
+        return -1;
+      }
+
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      *pc->connect_time = (int) PDS_TS_USECS(&start, &now);
+    break;
+
+    case MB_SERIAL :
+    case DH_SERIAL :
+      if(pc->protocol == MB_SERIAL)
+        mb_init_tty_struct(&pc->tio);
+      else
+        dh_init_tty_struct(&pc->tio);
+
+      /* N.B.: On return, tio holds the port's original settings */
+      if((pc->fd = open_plc_tty(pc->tty_dev, &pc->tio)) == -1)
+      {
+        err(errout, "%s: error opening serial port to %s\n", PROGNAME, pc->fqid);
+        pc->fd = PDS_POOL_FD_NONE;
+        return -1;
+      }
+    break;
+
+    default :
+      return -1;
+    break;
+  }
+
+  printd("Opened pooled connection to %s on fd %d\n", pc->fqid, pc->fd);
+
+  conn->fd = pc->fd;
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to release a connection to a PLC back to the pool                  *
+*                                                                             *
+* Pre-condition:  The pool struct, the connection struct and the PLC's status *
+*                 value are passed to the function                            *
+* Post-condition: The status is fed to the PLC's circuit breaker.  The        *
+*                 connection is kept open for reuse unless the status shows a *
+*                 connection or comms error, or it's a serial port & the pool *
+*                 doesn't keep serial ports open, in which case it is closed  *
+*                 and dropped from the pool.  If an error occurs a -1 is      *
+*                 returned                                                    *
+******************************************************************************/
+int release_plc_connection(pdspool *pool, pdsconn *conn,
+                           unsigned short int status)
+{
+  pdspoolconn *pc = NULL;
+
+  if(!(pc = get_pool_conn(pool, conn)))
+    return -1;
+
+  update_plc_breaker(conn, &pc->breaker, status);
+
+  /* Keep the connection open unless it's no longer trustworthy.  It will be
+     re-established on the next acquire */
+  if((status & PDS_POOL_DROP_BITMASK) && (pc->fd != PDS_POOL_FD_NONE))
+    return close_pool_conn(pool, pc);
+
+  /* A serial port is opened exclusively, so it can only be held open by the
+     process that frees it when it's done (see close_serial_pool_conns()) */
+  if(!pool->keep_serial && (pc->fd != PDS_POOL_FD_NONE) &&
+     (PDS_GET_PROTOTYPE(pc->protocol) == PDS_SERIAL_PROTO))
+    return close_pool_conn(pool, pc);
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to close a pooled PLC connection                                   *
+*                                                                             *
+* Pre-condition:  The pool struct and the pool entry are passed to the        *
+*                 function                                                    *
+* Post-condition: The entry's connection is closed & marked as closed.  Any   *
+*                 entries sharing the same fd are also marked as closed.  If  *
+*                 an error occurs a -1 is returned                            *
+******************************************************************************/
+int close_pool_conn(pdspool *pool, pdspoolconn *pc)
+{
+  register int i = 0;
+  int retval = 0;
+  pdsconn cipconn;
+
+  printd("Closing pooled connection to %s on fd %d\n", pc->fqid, pc->fd);
+
+  switch(pc->protocol)
+  {
+    case MB_TCPIP :
+    case MB_SERIAL_TCPIP :
+    case DH_SERIAL_TCPIP :
+      if((retval = close(pc->fd)) == -1)
+        err(errout, "%s: error closing socket to %s\n", PROGNAME, pc->fqid);
+    break;
+
+    case CIP_TCPIP :
+      /* The CIP driver only unregisters & closes its session on error */
+      memset(&cipconn, 0, sizeof(pdsconn));
+      cipconn.protocol = pc->protocol;
+      strcpy(cipconn.ip_addr, pc->ip_addr);
+      cipconn.port = pc->port;
+      strcpy(cipconn.path, pc->path);
+      cipconn.plc_status = PDS_PLC_COMMSERR;
+
+      retval = cip_disconnect_from_plc(&cipconn);
+    break;
+
+    case MB_SERIAL :
+    case DH_SERIAL :
+      if((retval = close_plc_tty(pc->fd, &pc->tio)) == -1)
+        err(errout, "%s: error closing serial port to %s\n", PROGNAME, pc->fqid);
+    break;
+  }
+
+  /* Mark any other entries sharing this fd (multidropped serial PLCs or the
+     CIP driver's session) as closed */
+  for(i = 0; i < pool->nconns; i++)
+  {
+    if(pool->conns[i].fd == pc->fd && &pool->conns[i] != pc)
+      pool->conns[i].fd = PDS_POOL_FD_NONE;
+  }
+
+  pc->fd = PDS_POOL_FD_NONE;
+
+  return retval;
+}
+
+
+
+/******************************************************************************
+* Function to close all pooled serial PLC connections                         *
+*                                                                             *
+* Pre-condition:  The pool struct is passed to the function                   *
+* Post-condition: Any open serial port connections in the pool are closed, so *
+*                 that the port is free for use by the other process.  A      *
+*                 count of closed connections is returned                     *
+******************************************************************************/
+int close_serial_pool_conns(pdspool *pool)
+{
+  register int i = 0;
+  int nclosed = 0;
+
+  for(i = 0; i < pool->nconns; i++)
+  {
+    /* N.B.: Multidropped entries sharing this fd are marked as closed too */
+    if((pool->conns[i].fd != PDS_POOL_FD_NONE) &&
+       (PDS_GET_PROTOTYPE(pool->conns[i].protocol) == PDS_SERIAL_PROTO))
+    {
+      close_pool_conn(pool, &pool->conns[i]);
+      nclosed++;
+    }
+  }
+
+  return nclosed;
+}
+
+
+
+/******************************************************************************
+* Function to setup a PLC's circuit breaker                                   *
+*                                                                             *
+* Pre-condition:  The breaker, the SPI connection struct & the PLC's index in *
+*                 the configuration are passed to the function                *
+* Post-condition: The breaker is closed & is assigned the SPI tags that       *
+*                 configure it & expose its state.  If an error occurs a -1   *
+*                 is returned                                                 *
+******************************************************************************/
+int setup_plc_breaker(pdsbreaker *brk, pds_spi_conn *spi_conn, int plc_id)
+{
+  char tagname[PDS_SPI_TAGNAME_LEN] = "\0";
+
+  memset(brk, 0, sizeof(pdsbreaker));
+  brk->state = PDS_BRK_CLOSED;
+
+  /* N.B.: The read & write processes' breakers jitter differently */
+  brk->seed = ((unsigned int) getpid() << 8) ^ (unsigned int) plc_id;
+
+  /* Ensure we have the SPI tags we require */
+  if((brk->threshold = PDS_SPIget_tag_ptr(spi_conn, "PDS_BRK_THRESHOLD")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_BRK_THRESHOLD\n", PROGNAME);
+    return -1;
+  }
+
+  if((brk->backoff = PDS_SPIget_tag_ptr(spi_conn, "PDS_BRK_BACKOFF")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_BRK_BACKOFF\n", PROGNAME);
+    return -1;
+  }
+
+  if((brk->backoff_max = PDS_SPIget_tag_ptr(spi_conn, "PDS_BRK_BACKOFF_MAX")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_BRK_BACKOFF_MAX\n", PROGNAME);
+    return -1;
+  }
+
+  if((brk->trips = PDS_SPIget_tag_ptr(spi_conn, "PDS_BRK_TRIPS")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_BRK_TRIPS\n", PROGNAME);
+    return -1;
+  }
+
+  sprintf(tagname, PDS_BRK_STATE_FORMAT, plc_id);
+
+  if((brk->spi_state = PDS_SPIget_tag_ptr(spi_conn, tagname)) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag %s\n", PROGNAME, tagname);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to check if a PLC's circuit breaker lets a query through           *
+*                                                                             *
+* Pre-condition:  The breaker is passed to the function                       *
+* Post-condition: An open breaker whose backoff has expired is half-opened,   *
+*                 to let a trial query through.  The breaker's state is       *
+*                 returned.  Only an open breaker stops a query               *
+******************************************************************************/
+int check_plc_breaker(pdsbreaker *brk)
+{
+  struct timespec now;
+
+  if(brk->state != PDS_BRK_OPEN)
+    return brk->state;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  if(PDS_TS_BEFORE(&now, &brk->retry))
+    return PDS_BRK_OPEN;
+
+  brk->state = *brk->spi_state = PDS_BRK_HALF_OPEN;
+
+  return brk->state;
+}
+
+
+
+/******************************************************************************
+* Function to update a PLC's circuit breaker with a query's outcome           *
+*                                                                             *
+* Pre-condition:  The connection struct, the PLC's breaker & the PLC's status *
+*                 after the query are passed to the function                  *
+* Post-condition: A connection or comms error counts as a failure, otherwise  *
+*                 the breaker is closed.  The breaker is opened by a failed   *
+*                 trial query or by too many consecutive failures, for a      *
+*                 backoff that doubles with each consecutive trip, upto a     *
+*                 max.  Half of the backoff is random, so that PLCs don't     *
+*                 retry in lock step.  The PLC's tags' status shows whether   *
+*                 the breaker is open.  The breaker's state is returned       *
+******************************************************************************/
+int update_plc_breaker(pdsconn *conn, pdsbreaker *brk,
+                       unsigned short int status)
+{
+  struct timespec now;
+  long backoff = 0;
+  char fqid[PDS_PLC_FQID_LEN] = "\0";
+  register int i = 0;
+
+  /* Get this PLC's fully-qualified ID */
+  PDS_GET_PLC_FQID(fqid, conn);
+
+  if(!(status & PDS_POOL_DROP_BITMASK))
+  {
+    /* N.B.: The other process' breaker may have set the status bit */
+    if(brk->state != PDS_BRK_CLOSED || (status & PDS_PLC_BREAKER))
+    {
+      if(brk->state != PDS_BRK_CLOSED)
+        err(errout, "%s: circuit breaker closed on %s\n", PROGNAME, fqid);
+
+      set_tags_status(conn, (status & PDS_PLC_BREAKER_RST));
+    }
+
+    brk->state = *brk->spi_state = PDS_BRK_CLOSED;
+    brk->nfails = brk->ntrips = 0;
+
+    return brk->state;
+  }
+
+  /* Transactions already in flight when the breaker opened don't count */
+  if(brk->state == PDS_BRK_OPEN)
+    return brk->state;
+
+  brk->nfails++;
+
+  /* N.B.: A threshold of 0 disables the breaker */
+  if(*brk->threshold <= 0 ||
+     (brk->state == PDS_BRK_CLOSED && brk->nfails < *brk->threshold))
+    return brk->state;
+
+  if(brk->ntrips < PDS_BRK_TRIPS_MAX)
+    brk->ntrips++;
+
+  for(i = 1, backoff = *brk->backoff; i < brk->ntrips && backoff < *brk->backoff_max; i++)
+    backoff *= 2;
+
+  if(backoff > *brk->backoff_max)
+    backoff = *brk->backoff_max;
+
+  /* Wait between half & all of the backoff */
+  backoff = (backoff / 2) + (rand_r(&brk->seed) % ((backoff / 2) + 1));
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  brk->retry.tv_sec = now.tv_sec + (backoff / 1000000);
+  brk->retry.tv_nsec = now.tv_nsec + ((backoff % 1000000) * 1000L);
+
+  if(brk->retry.tv_nsec >= 1000000000L)
+  {
+    brk->retry.tv_sec++;
+    brk->retry.tv_nsec -= 1000000000L;
+  }
+
+  brk->state = *brk->spi_state = PDS_BRK_OPEN;
+  (*brk->trips)++;
+
+  err(errout, "%s: circuit breaker opened on %s for %ld ms after %u failures\n", PROGNAME, fqid, (backoff / 1000), brk->nfails);
+
+  set_tags_status(conn, (status | PDS_PLC_BREAKER));
+
+  return brk->state;
+}
@@ -0,0 +1,1569 @@
+/******************************************************************************
+* PROJECT:  PLC data server                                                   *
+* MODULE:   pds_scan.c                                                        *
+* PURPOSE:  The asynchronous scan engine functions module                     *
+* AUTHOR:   Paul M. Breen                                                     *
+* DATE:     2026-10-17                                                        *
+******************************************************************************/
+
+#define _GNU_SOURCE               /* For sched_setaffinity() & CPU_SET() */
+
+#include <sched.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+
+#include "drivers/pds_mb.h"
+
+extern int quit_flag;             /* Declared in the main file */
+extern int errout;                /* Declared in the main file */
+extern int dbgflag;               /* Declared in the main file */
+extern unsigned int runmode;      /* Declared in the main file */
+extern pdstag **block_index;      /* Declared in the mem. management file */
+
+/* Get pointer to 1st tag in specified block from global block index */
+#define PDS_GET_BLOCK_START(n)	((pdstag *) block_index[(n)])
+
+/* A scan engine transaction's timeout (in usecs) */
+#define PDS_SCAN_TMO		((MB_TMO_SECS * 1000000L) + MB_TMO_USECS)
+#define PDS_SCAN_TMO_TICKS	((PDS_SCAN_TMO + PDS_SCAN_TICK - 1) / PDS_SCAN_TICK)
+
+/******************************************************************************
+* Function to start the scan engine's worker processes                        *
+*                                                                             *
+* Pre-condition:  The PLC configuration struct, the connection structs & the  *
+*                 queries struct are passed to the function                   *
+* Post-condition: The queries of PLCs that can be scanned asynchronously are  *
+*                 marked as such & a worker process is forked for each shard  *
+*                 of these PLCs, to run them in the scan engine.  A pointer   *
+*                 to the workers struct is returned or a null on error        *
+******************************************************************************/
+pdsscanworkers* start_scan_workers(plc_cnf *conf, pdsconn *conn,
+                                   pds_spi_conn *spi_conn,
+                                   pdsqueries *queries)
+{
+  pdsscanworkers *workers = NULL;
+  int *pds_scan_shards = NULL;
+  int nshards = 0, nasync = 0;
+  register int i = 0, shard = 0;
+
+  /* Ensure we have the SPI tags we require */
+  if((pds_scan_shards = PDS_SPIget_tag_ptr(spi_conn, "PDS_SCAN_SHARDS")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_SCAN_SHARDS\n", PROGNAME);
+    return NULL;
+  }
+
+  /* There's no point in having more shards than PLCs */
+  nshards = *pds_scan_shards;
+
+  if(nshards > PDS_SCAN_MAX_SHARDS(conf))
+    nshards = PDS_SCAN_MAX_SHARDS(conf);
+  if(nshards < 1)
+    nshards = 1;
+
+  if(!(workers = (pdsscanworkers *) calloc(1, sizeof(pdsscanworkers))) ||
+     !(workers->pids = (pid_t *) calloc(nshards, sizeof(pid_t))))
+  {
+    err(errout, "%s: memory allocation error\n", PROGNAME);
+    if(workers) free(workers);
+    return NULL;
+  }
+
+  /* A worker is restarted from the read process' state */
+  workers->conf = conf;
+  workers->conn = conn;
+  workers->spi_conn = spi_conn;
+  workers->queries = queries;
+
+  /* The scan engine runs single data transactions, so when status queries
+     are also required, all queries stay in the synchronous loop */
+  if(PDS_GET_RM_STATUS(runmode))
+  {
+    err(errout, "%s: status queries are not run by the scan engine\n", PROGNAME);
+    return workers;
+  }
+
+  /* Claim the queries of PLCs that the scan engine can run */
+  for(i = 0; i < queries->nqueries; i++)
+  {
+    if(PDS_SCAN_IS_ASYNC(queries->queries[i].protocol))
+    {
+      queries->queries[i].async = 1;
+      nasync++;
+    }
+  }
+
+  if(nasync == 0)
+    return workers;
+
+  for(shard = 0; shard < nshards; shard++)
+  {
+    if((workers->pids[shard] = start_scan_worker(workers, shard, nshards, 0)) == -1)
+    {
+      err(errout, "%s: error creating scan worker process\n", PROGNAME);
+      workers->nworkers = shard;
+      stop_scan_workers(workers);
+
+      for(i = 0; i < queries->nqueries; i++)
+        queries->queries[i].async = 0;
+
+      return NULL;
+    }
+  }
+
+  workers->nworkers = nshards;
+
+  return workers;
+}
+
+
+
+/******************************************************************************
+* Function to start a scan engine worker process                              *
+*                                                                             *
+* Pre-condition:  The workers struct, the worker's shard, the no. of shards & *
+*                 a pause (in secs) before it starts scanning are passed to   *
+*                 the function                                                *
+* Post-condition: A worker process is forked to run the shard's PLCs in the   *
+*                 scan engine.  The worker's pid is returned or -1 on error   *
+******************************************************************************/
+pid_t start_scan_worker(pdsscanworkers *workers, int shard, int nshards,
+                        int delay)
+{
+  pid_t pid = -1;
+
+  switch((pid = fork()))
+  {
+    case -1 :
+      return -1;
+    break;
+
+    case  0 :                     /* The scan worker process */
+      printd("Starting scan worker %d of %d...\n", (shard + 1), nshards);
+
+      /* Don't outlive the read process */
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+      /* N.B.: A restarted worker pauses, so that a worker that can't run
+               isn't restarted in a tight loop */
+      if(delay > 0)
+        sleep(delay);
+
+      pin_scan_worker(shard);
+      run_scan_worker(workers->conf, workers->conn, workers->spi_conn, workers->queries, shard, nshards);
+
+      /* N.B.: The worker shares the read process' connections, so exit
+               without any of the process' exit handling */
+      _exit(0);
+    break;
+  }
+
+  return pid;
+}
+
+
+
+/******************************************************************************
+* Function to stop the scan engine's worker processes                         *
+*                                                                             *
+* Pre-condition:  The workers struct is passed to the function                *
+* Post-condition: Each worker is terminated & waited for.  Memory is freed    *
+*                 for the workers struct.  The no. of workers stopped is      *
+*                 returned or a -1 on error                                   *
+******************************************************************************/
+int stop_scan_workers(pdsscanworkers *workers)
+{
+  register int i = 0;
+  int status = 0, nworkers = 0;
+
+  if(!workers)
+    return -1;
+
+  nworkers = workers->nworkers;
+
+  for(i = 0; i < nworkers; i++)
+  {
+    if(workers->pids[i] > 0)
+      kill(workers->pids[i], SIGTERM);
+  }
+
+  /* N.B.: A worker may already have been reaped by the SIGCHLD handler */
+  for(i = 0; i < nworkers; i++)
+  {
+    if(workers->pids[i] > 0)
+      waitpid(workers->pids[i], &status, 0);
+  }
+
+  free(workers->pids);
+  free(workers);
+
+  return nworkers;
+}
+
+
+
+/******************************************************************************
+* Function to check the scan engine's worker processes                        *
+*                                                                             *
+* Pre-condition:  The workers struct is passed to the function                *
+* Post-condition: Any of the read process' children that have exited are      *
+*                 reaped.  If a worker has exited, the tags of its shard's    *
+*                 PLCs have their status set to a comms error & the worker is *
+*                 restarted, after a pause.  The no. of workers restarted is  *
+*                 returned or a -1 on error                                   *
+******************************************************************************/
+int check_scan_workers(pdsscanworkers *workers)
+{
+  pid_t pid = -1;
+  int status = 0, nrestarted = 0;
+  register int shard = 0;
+
+  if(!workers)
+    return -1;
+
+  /* N.B.: Other children, such as the snapshot publisher, are just reaped */
+  while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+  {
+    for(shard = 0; shard < workers->nworkers; shard++)
+    {
+      if(workers->pids[shard] == pid)
+        break;
+    }
+
+    if(shard == workers->nworkers)
+      continue;
+
+    err(errout, "%s: scan worker %d exited, restarting it\n", PROGNAME, shard);
+
+    /* Its shard's tags aren't being refreshed until the worker restarts */
+    fail_scan_shard(workers, shard);
+
+    if((workers->pids[shard] = start_scan_worker(workers, shard, workers->nworkers, PDS_SCAN_RESTART_PAUSE)) == -1)
+      err(errout, "%s: error restarting scan worker %d\n", PROGNAME, shard);
+    else
+      nrestarted++;
+  }
+
+  return nrestarted;
+}
+
+
+
+/******************************************************************************
+* Function to fail a shard's queries in the scan engine                       *
+*                                                                             *
+* Pre-condition:  The workers struct & the shard are passed to the function   *
+* Post-condition: Each of the shard's asynchronous queries has its status set *
+*                 to a comms error, as are its PLC's tags.  The no. of        *
+*                 queries failed is returned                                  *
+******************************************************************************/
+int fail_scan_shard(pdsscanworkers *workers, int shard)
+{
+  plc_cnf *conf = workers->conf;
+  plc_cnf_plc *cnfplc = NULL;
+  pdsquery *query = NULL;
+  char fqid[PDS_PLC_FQID_LEN] = "\0", qfqid[PDS_PLC_FQID_LEN] = "\0";
+  int nfailed = 0;
+  register int i = 0, j = 0;
+
+  /* N.B.: A PLC's shard is its position in the configuration, modulo the
+           no. of shards, as in setup_scan_engine() */
+  for(i = 0, cnfplc = conf->plcs; i < conf->nplcs; i++, cnfplc++)
+  {
+    if((i % workers->nworkers) != shard || !PDS_SCAN_IS_ASYNC(cnfplc->protocol))
+      continue;
+
+    PDS_GET_PLC_FQID(fqid, cnfplc);
+
+    for(j = 0, query = workers->queries->queries; j < workers->queries->nqueries; j++, query++)
+    {
+      PDS_GET_PLC_FQID(qfqid, query);
+
+      if(!query->async || strcmp(qfqid, fqid) != 0)
+        continue;
+
+      set_scan_query_conn(workers->conn, query);
+
+      *query->status |= PDS_PLC_COMMSERR;
+      query->errx++;
+      set_tags_status(workers->conn, *query->status);
+      nfailed++;
+    }
+  }
+
+  return nfailed;
+}
+
+
+
+/******************************************************************************
+* Function to pin a scan worker process to a CPU                              *
+*                                                                             *
+* Pre-condition:  The worker's shard is passed to the function                *
+* Post-condition: The calling process is pinned to a CPU chosen by its shard, *
+*                 so that shards are spread across the online CPUs.  If an    *
+*                 error occurs a -1 is returned                               *
+******************************************************************************/
+int pin_scan_worker(int shard)
+{
+  cpu_set_t cpus;
+  long nprocs = 0;
+
+  if((nprocs = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+    nprocs = 1;
+
+  CPU_ZERO(&cpus);
+  CPU_SET((shard % nprocs), &cpus);
+
+  if(sched_setaffinity(0, sizeof(cpu_set_t), &cpus) == -1)
+  {
+    err(errout, "%s: error pinning scan worker %d to CPU %ld\n", PROGNAME, shard, (shard % nprocs));
+    return -1;
+  }
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to run a scan worker process' shard of PLCs                        *
+*                                                                             *
+* Pre-condition:  The PLC configuration struct, the connection structs, the   *
+*                 queries struct, the worker's shard & the no. of shards are  *
+*                 passed to the function                                      *
+* Post-condition: The shard's scan engine is setup & its PLCs are             *
+*                 continuously scanned until the quit flag is set.  If an     *
+*                 error occurs a -1 is returned                               *
+******************************************************************************/
+int run_scan_worker(plc_cnf *conf, pdsconn *conn, pds_spi_conn *spi_conn,
+                    pdsqueries *queries, int shard, int nshards)
+{
+  pdsscan *scan = NULL;
+  int retval = 0;
+
+  if((scan = setup_scan_engine(conf, conn, spi_conn, queries, shard, nshards)) == NULL)
+  {
+    err(errout, "%s: failed to setup the scan engine for shard %d\n", PROGNAME, shard);
+    return -1;
+  }
+
+  retval = run_scan_engine(conn, scan);
+
+  free_scan_engine(scan);
+
+  return retval;
+}
+
+
+
+/******************************************************************************
+* Function to setup the scan engine for a shard of PLCs                       *
+*                                                                             *
+* Pre-condition:  The PLC configuration struct, the connection structs, the   *
+*                 queries struct, the shard & the no. of shards are passed to *
+*                 the function                                                *
+* Post-condition: An entry is created for each PLC in the shard holding its   *
+*                 asynchronous queries & its pipeline, along with the shard's *
+*                 epoll fd & its timer wheel.  A pointer to the scan engine   *
+*                 struct is returned.  If an error occurs a null is returned  *
+******************************************************************************/
+pdsscan* setup_scan_engine(plc_cnf *conf, pdsconn *conn,
+                           pds_spi_conn *spi_conn, pdsqueries *queries,
+                           int shard, int nshards)
+{
+  pdsscan *scan = NULL;
+  pdsscanplc *plc = NULL;
+  plc_cnf_plc *cnfplc = NULL;
+  pdsquery *query = NULL;
+  char fqid[PDS_PLC_FQID_LEN] = "\0";
+  register int i = 0, j = 0;
+
+  if(!(scan = (pdsscan *) calloc(1, sizeof(pdsscan))))
+  {
+    err(errout, "%s: memory allocation error\n", PROGNAME);
+    return NULL;
+  }
+
+  scan->shard = shard;
+  scan->nshards = nshards;
+  scan->epfd = -1;
+
+  /* Ensure we have the SPI tags we require */
+  if((scan->online = PDS_SPIget_tag_ptr(spi_conn, "PDS_ONLINE")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_ONLINE\n", PROGNAME);
+    free_scan_engine(scan);
+    return NULL;
+  }
+
+  if((scan->rdpause_all = PDS_SPIget_tag_ptr(spi_conn, "PDS_RDPAUSE_ALL")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_RDPAUSE_ALL\n", PROGNAME);
+    free_scan_engine(scan);
+    return NULL;
+  }
+
+  if((scan->rdpause_block = PDS_SPIget_tag_ptr(spi_conn, "PDS_RDPAUSE_BLOCK")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_RDPAUSE_BLOCK\n", PROGNAME);
+    free_scan_engine(scan);
+    return NULL;
+  }
+
+  if((scan->cycle_time = PDS_SPIget_tag_ptr(spi_conn, "PDS_SCAN_CYCLE_TIME")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_SCAN_CYCLE_TIME\n", PROGNAME);
+    free_scan_engine(scan);
+    return NULL;
+  }
+
+  if((scan->timeouts = PDS_SPIget_tag_ptr(spi_conn, "PDS_SCAN_TIMEOUTS")) == (int *) -1)
+  {
+    err(errout, "%s: failed to get SPI tag PDS_SCAN_TIMEOUTS\n", PROGNAME);
+    free_scan_engine(scan);
+    return NULL;
+  }
+
+  /* The slowest shard's cycle time is found from all the shards' */
+  if(!(scan->shard_cycle_times = (int **) calloc(nshards, sizeof(int *))))
+  {
+    err(errout, "%s: memory allocation error\n", PROGNAME);
+    free_scan_engine(scan);
+    return NULL;
+  }
+
+  for(i = 0; i < nshards; i++)
+  {
+    if((scan->shard_cycle_times[i] = get_SPI_plc_tag_ptr(spi_conn, PDS_SCAN_CYCLE_TIME_FORMAT, i)) == (int *) -1)
+    {
+      free_scan_engine(scan);
+      return NULL;
+    }
+  }
+
+  /* Array to hold an entry for each PLC in this shard */
+  if(!(scan->plcs = (pdsscanplc *) calloc(conf->nplcs, sizeof(pdsscanplc))))
+  {
+    err(errout, "%s: memory allocation error\n", PROGNAME);
+    free_scan_engine(scan);
+    return NULL;
+  }
+
+  /* A PLC's shard is its position in the configuration, modulo the no. of
+     shards.  Each PLC entry holds pointers to its asynchronous queries */
+  for(i = 0, cnfplc = conf->plcs; i < conf->nplcs; i++, cnfplc++)
+  {
+    if((i % nshards) != shard || !PDS_SCAN_IS_ASYNC(cnfplc->protocol))
+      continue;
+
+    plc = &scan->plcs[scan->nplcs];
+    PDS_GET_PLC_FQID(plc->fqid, cnfplc);
+    plc->fd = PDS_POOL_FD_NONE;
+    plc->state = PDS_SCAN_IDLE;
+
+    if((plc->connect_tmo = get_SPI_plc_tag_ptr(spi_conn, PDS_CONNECT_TMO_FORMAT, i)) == (int *) -1 ||
+       (plc->connect_time = get_SPI_plc_tag_ptr(spi_conn, PDS_CONNECT_TIME_FORMAT, i)) == (int *) -1)
+    {
+      free_scan_engine(scan);
+      return NULL;
+    }
+
+    if(setup_plc_breaker(&plc->breaker, spi_conn, i) == -1)
+    {
+      err(errout, "%s: failed to setup the circuit breaker for %s\n", PROGNAME, plc->fqid);
+      free_scan_engine(scan);
+      return NULL;
+    }
+
+    if(!(plc->queries = (pdsquery **) calloc(queries->nqueries, sizeof(pdsquery *))))
+    {
+      err(errout, "%s: memory allocation error\n", PROGNAME);
+      free_scan_engine(scan);
+      return NULL;
+    }
+
+    for(j = 0, query = queries->queries; j < queries->nqueries; j++, query++)
+    {
+      PDS_GET_PLC_FQID(fqid, query);
+
+      if(query->async && strcmp(fqid, plc->fqid) == 0)
+        plc->queries[plc->nqueries++] = query;
+    }
+
+    if(plc->nqueries == 0)
+    {
+      free(plc->queries);
+      memset(plc, 0, sizeof(pdsscanplc));
+      continue;
+    }
+
+    /* A pipelined PLC has up to its depth of queries in flight at once,
+       matched to their responses by the MBAP transaction ID */
+    if((plc->depth = cnfplc->depth) < 1)
+      plc->depth = PDS_SCAN_DEPTH;
+    if(plc->depth > PDS_SCAN_DEPTH_MAX)
+      plc->depth = PDS_SCAN_DEPTH_MAX;
+
+    for(j = 0; j < plc->nqueries; j++)
+    {
+      if(plc->queries[j]->pollrate > plc->pollrate)
+        plc->pollrate = plc->queries[j]->pollrate;
+    }
+
+    /* N.B.: The PLC is counted first, so it's freed with the scan engine */
+    scan->nplcs++;
+
+    plc->slots = (pdsscanslot *) calloc(plc->depth, sizeof(pdsscanslot));
+    plc->sbuf = (unsigned char *) calloc(plc->depth, PDS_MAXBUFLEN);
+
+    if(!plc->slots || !plc->sbuf)
+    {
+      err(errout, "%s: memory allocation error\n", PROGNAME);
+      free_scan_engine(scan);
+      return NULL;
+    }
+  }
+
+  /* The driver refreshes a private copy of each query's hot data which is
+     then copied to its blocks in shared memory, so that a refresh that
+     changes a block's values can be notified to clients */
+  scan->scratch_values = (unsigned short int *) calloc(PLC_CNF_TAGS_BLK, sizeof(unsigned short int));
+  scan->scratch_mtimes_ns = (unsigned long long *) calloc(PLC_CNF_TAGS_BLK, sizeof(unsigned long long));
+
+  if(!scan->scratch_values || !scan->scratch_mtimes_ns)
+  {
+    err(errout, "%s: memory allocation error\n", PROGNAME);
+    free_scan_engine(scan);
+    return NULL;
+  }
+
+  if((scan->epfd = epoll_create(PDS_SCAN_MAXEVENTS)) == -1)
+  {
+    err(errout, "%s: error creating epoll fd\n", PROGNAME);
+    free_scan_engine(scan);
+    return NULL;
+  }
+
+  /* Tick 0 of the timer wheel is now */
+  clock_gettime(CLOCK_MONOTONIC, &scan->epoch);
+  scan->tick = 0;
+
+  return scan;
+}
+
+
+
+/******************************************************************************
+* Function to free the scan engine                                            *
+*                                                                             *
+* Pre-condition:  The scan engine struct is passed to the function            *
+* Post-condition: Any open PLC connections & the epoll fd are closed and      *
+*                 memory is freed for the scan engine struct.  If an error    *
+*                 occurs a -1 is returned                                     *
+******************************************************************************/
+int free_scan_engine(pdsscan *scan)
+{
+  register int i = -1;
+
+  if(scan)
+  {
+    if(scan->plcs)
+    {
+      for(i = 0; i < scan->nplcs; i++)
+      {
+        close_scan_plc(scan, &scan->plcs[i]);
+
+        if(scan->plcs[i].queries)
+          free(scan->plcs[i].queries);
+
+        if(scan->plcs[i].slots)
+          free(scan->plcs[i].slots);
+
+        if(scan->plcs[i].sbuf)
+          free(scan->plcs[i].sbuf);
+      }
+
+      free(scan->plcs);
+    }
+
+    if(scan->scratch_values)
+      free(scan->scratch_values);
+
+    if(scan->scratch_mtimes_ns)
+      free(scan->scratch_mtimes_ns);
+
+    if(scan->shard_cycle_times)
+      free(scan->shard_cycle_times);
+
+    if(scan->epfd != -1)
+      close(scan->epfd);
+
+    free(scan);
+  }
+
+  return i;
+}
+
+
+
+/******************************************************************************
+* Function to run the scan engine                                             *
+*                                                                             *
+* Pre-condition:  The connection struct & the scan engine struct are passed   *
+*                 to the function                                             *
+* Post-condition: Each PLC in the shard is continuously scanned, with up to   *
+*                 its pipeline depth of transactions in flight to each PLC at *
+*                 once.  Readiness of the PLCs' sockets is waited for in a    *
+*                 single epoll fd & timeouts & poll rates are run from the    *
+*                 timer wheel.  If an error occurs a -1 is returned           *
+******************************************************************************/
+int run_scan_engine(pdsconn *conn, pdsscan *scan)
+{
+  struct epoll_event events[PDS_SCAN_MAXEVENTS];
+  register int i = 0;
+  int nevents = 0;
+
+  /* Start each PLC's first scan cycle on the next tick */
+  for(i = 0; i < scan->nplcs; i++)
+    arm_scan_timer(scan, &scan->plcs[i], 0);
+
+  while(!quit_flag)
+  {
+    if(!*scan->online)
+    {
+      /* Periodically poll the online status.  Any transactions in flight
+         will time out once back online */
+      err(errout, "%s: PDS has been put offline\n", PROGNAME);
+
+      while(!*scan->online && !quit_flag)
+        sleep(PDS_ONLINE_PAUSE);
+
+      err(errout, "%s: PDS has been put online\n", PROGNAME);
+    }
+
+    /* Wake up at least every tick to run the timer wheel */
+    if((nevents = epoll_wait(scan->epfd, events, PDS_SCAN_MAXEVENTS, (PDS_SCAN_TICK / 1000))) == -1)
+    {
+      if(errno == EINTR)
+        continue;
+
+      err(errout, "%s: error waiting on epoll fd\n", PROGNAME);
+      break;
+    }
+
+    for(i = 0; i < nevents; i++)
+      handle_scan_event(conn, scan, (pdsscanplc *) events[i].data.ptr, events[i].events);
+
+    expire_scan_timers(conn, scan);
+  }
+
+  return (!quit_flag) ? -1 : 0;
+}
+
+
+
+/******************************************************************************
+* Function to get the scan engine's current timer wheel tick                  *
+*                                                                             *
+* Pre-condition:  The scan engine struct is passed to the function            *
+* Post-condition: The no. of ticks elapsed since the timer wheel's epoch is   *
+*                 returned                                                    *
+******************************************************************************/
+unsigned int get_scan_tick(pdsscan *scan)
+{
+  struct timespec now;
+  long usecs = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  usecs = ((now.tv_sec - scan->epoch.tv_sec) * 1000000L) +
+          ((now.tv_nsec - scan->epoch.tv_nsec) / 1000L);
+
+  return (unsigned int) (usecs / PDS_SCAN_TICK);
+}
+
+
+
+/******************************************************************************
+* Function to arm a PLC's timer in the scan engine's timer wheel              *
+*                                                                             *
+* Pre-condition:  The scan engine struct, the PLC entry & the delay (in       *
+*                 usecs) are passed to the function                           *
+* Post-condition: Any armed timer is disarmed & the PLC is added to the slot  *
+*                 of the tick at which the delay expires.  A delay of longer  *
+*                 than a turn of the wheel is counted down in rounds.  The    *
+*                 slot is returned                                            *
+******************************************************************************/
+int arm_scan_timer(pdsscan *scan, pdsscanplc *plc, long usecs)
+{
+  unsigned int ticks = 0;
+
+  if(plc->tarmed)
+    disarm_scan_timer(scan, plc);
+
+  /* Expire no sooner than the next tick */
+  if((ticks = (unsigned int) ((usecs + PDS_SCAN_TICK - 1) / PDS_SCAN_TICK)) < 1)
+    ticks = 1;
+
+  plc->tslot = (scan->tick + ticks) & (PDS_SCAN_WHEEL_SLOTS - 1);
+  plc->trounds = (ticks - 1) / PDS_SCAN_WHEEL_SLOTS;
+
+  plc->tprev = NULL;
+  plc->tnext = scan->wheel[plc->tslot];
+
+  if(plc->tnext)
+    plc->tnext->tprev = plc;
+
+  scan->wheel[plc->tslot] = plc;
+  plc->tarmed = 1;
+
+  return plc->tslot;
+}
+
+
+
+/******************************************************************************
+* Function to disarm a PLC's timer in the scan engine's timer wheel           *
+*                                                                             *
+* Pre-condition:  The scan engine struct & the PLC entry are passed to the    *
+*                 function                                                    *
+* Post-condition: If armed, the PLC is removed from its timer wheel slot.     *
+*                 If an error occurs a -1 is returned                         *
+******************************************************************************/
+int disarm_scan_timer(pdsscan *scan, pdsscanplc *plc)
+{
+  if(!plc->tarmed)
+    return -1;
+
+  if(plc->tprev)
+    plc->tprev->tnext = plc->tnext;
+  else
+    scan->wheel[plc->tslot] = plc->tnext;
+
+  if(plc->tnext)
+    plc->tnext->tprev = plc->tprev;
+
+  plc->tnext = plc->tprev = NULL;
+  plc->tarmed = 0;
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to expire the scan engine's timers                                 *
+*                                                                             *
+* Pre-condition:  The connection struct & the scan engine struct are passed   *
+*                 to the function                                             *
+* Post-condition: The timer wheel is advanced to the current tick.  Each PLC  *
+*                 whose timer expires on a passed tick either starts its next *
+*                 query or has its transaction in flight timed out.  The no.  *
+*                 of expired timers is returned                               *
+******************************************************************************/
+int expire_scan_timers(pdsconn *conn, pdsscan *scan)
+{
+  pdsscanplc *plc = NULL, *next = NULL;
+  unsigned int now = 0;
+  int nexpired = 0;
+
+  now = get_scan_tick(scan);
+
+  while(scan->tick != now)
+  {
+    scan->tick++;
+
+    for(plc = scan->wheel[scan->tick & (PDS_SCAN_WHEEL_SLOTS - 1)]; plc; plc = next)
+    {
+      next = plc->tnext;
+
+      if(plc->trounds > 0)
+      {
+        plc->trounds--;
+        continue;
+      }
+
+      disarm_scan_timer(scan, plc);
+      handle_scan_timeout(conn, scan, plc);
+      nexpired++;
+    }
+  }
+
+  return nexpired;
+}
+
+
+
+/******************************************************************************
+* Function to handle a PLC's expired timer                                    *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct & the PLC     *
+*                 entry are passed to the function                            *
+* Post-condition: An idle PLC has its pipeline filled with its next queries.  *
+*                 Otherwise the PLC's connection attempt or its oldest        *
+*                 transaction in flight has timed out, so the PLC's status is *
+*                 set accordingly.  If an error occurs a -1 is returned       *
+******************************************************************************/
+int handle_scan_timeout(pdsconn *conn, pdsscan *scan, pdsscanplc *plc)
+{
+  pdsscanslot *slot = NULL;
+
+  switch(plc->state)
+  {
+    case PDS_SCAN_IDLE :
+      return fill_scan_pipeline(conn, scan, plc);
+    break;
+
+    case PDS_SCAN_CONNECTING :
+      (*scan->timeouts)++;
+      err(errout, "%s: timed out connecting to %s\n", PROGNAME, plc->fqid);
+      return fail_scan_connect(conn, scan, plc);
+    break;
+
+    default :
+      if(!(slot = get_oldest_scan_slot(plc)))
+        return -1;
+
+      /* The timer is armed for the oldest transaction's deadline, but check
+         in case the transaction it was armed for has since completed */
+      if((int) (slot->deadline - scan->tick) > 0)
+        return arm_scan_deadline(scan, plc);
+
+      (*scan->timeouts)++;
+      err(errout, "%s: timed out waiting for response from %s\n", PROGNAME, plc->fqid);
+      return complete_scan_query(conn, scan, plc, slot, -1);
+    break;
+  }
+
+  return -1;
+}
+
+
+
+/******************************************************************************
+* Function to handle an event on a PLC's socket                               *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct, the PLC      *
+*                 entry & the epoll events are passed to the function         *
+* Post-condition: The PLC's transactions in flight are progressed according   *
+*                 to its state.  A completed connection's latency is          *
+*                 recorded.  If an error occurs a -1 is returned              *
+******************************************************************************/
+int handle_scan_event(pdsconn *conn, pdsscan *scan, pdsscanplc *plc,
+                      unsigned int events)
+{
+  int soerr = 0;
+  socklen_t len = sizeof(soerr);
+  struct timespec now;
+
+  switch(plc->state)
+  {
+    case PDS_SCAN_CONNECTING :
+      /* The connection has completed, successfully or not */
+      if(getsockopt(plc->fd, SOL_SOCKET, SO_ERROR, &soerr, &len) == -1 ||
+         soerr != 0)
+      {
+        err(errout, "%s: error opening socket to %s\n", PROGNAME, plc->fqid);
+        return fail_scan_connect(conn, scan, plc);
+      }
+
+      printd("Opened scan connection to %s on fd %d\n", plc->fqid, plc->fd);
+
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      *plc->connect_time = (int) PDS_TS_USECS(&plc->connect_start, &now);
+
+      plc->state = PDS_SCAN_IDLE;
+
+      return fill_scan_pipeline(conn, scan, plc);
+    break;
+
+    case PDS_SCAN_BUSY :
+      /* N.B.: Sending may fail & so drop the connection */
+      if(events & EPOLLOUT)
+        write_scan_queries(conn, scan, plc);
+
+      if(plc->state == PDS_SCAN_BUSY)
+        return read_scan_responses(conn, scan, plc);
+    break;
+
+    default :
+      /* An idle connection has been closed or has stale data from a timed
+         out transaction.  It's reopened for the PLC's next query */
+      close_scan_plc(scan, plc);
+    break;
+  }
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to assign a scan engine query's properties to the connection       *
+*                                                                             *
+* Pre-condition:  The connection struct & the query are passed to the         *
+*                 function                                                    *
+* Post-condition: The connection's PLC properties are those of the query's    *
+*                 PLC                                                         *
+******************************************************************************/
+void set_scan_query_conn(pdsconn *conn, pdsquery *query)
+{
+  conn->protocol = query->protocol;
+  strcpy(conn->ip_addr, query->ip_addr);
+  conn->port = query->port;
+  strcpy(conn->tty_dev, query->tty_dev);
+  strcpy(conn->path, query->path);
+}
+
+
+
+/******************************************************************************
+* Function to fill a PLC's pipeline with its next queries in the scan engine  *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct & the PLC     *
+*                 entry are passed to the function                            *
+* Post-condition: A transaction is setup for each of the PLC's next queries,  *
+*                 until its pipeline depth are in flight.  Unless a status    *
+*                 condition exists on the PLC, or its circuit breaker is      *
+*                 open, each query is queued to be sent, first connecting to  *
+*                 the PLC if necessary.  The queued queries are sent          *
+*                 back-to-back.  If an error occurs a -1 is returned          *
+******************************************************************************/
+int fill_scan_pipeline(pdsconn *conn, pdsscan *scan, pdsscanplc *plc)
+{
+  pdsscanslot *slot = NULL;
+  pdsquery *query = NULL;
+  pdstrans *trans = NULL;
+  int brk = PDS_BRK_CLOSED;
+  register int i = 0;
+
+  if(!plc->incycle)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &plc->cycle_start);
+    plc->incycle = 1;
+  }
+
+  while(plc->next < plc->nqueries && plc->nflight < plc->depth)
+  {
+    query = plc->queries[plc->next];
+
+    /* Assign this query's properties */
+    set_scan_query_conn(conn, query);
+
+    /* Check if a status condition exists for this query on this PLC, or if
+       its circuit breaker is open.  A half-open breaker lets a trial query
+       through, whatever the PLC's status.  N.B.: A query is only checked
+       once, even if the PLC has to be connected */
+    if(!plc->checked)
+    {
+      if((brk = check_plc_breaker(&plc->breaker)) == PDS_BRK_HALF_OPEN)
+      {
+        *query->status = PDS_PLC_BREAKER;
+        query->errx = 0;
+      }
+      else if(brk == PDS_BRK_OPEN || (*query->status & PDS_PLC_BREAKER_RST) > 0)
+      {
+        if(brk == PDS_BRK_CLOSED)
+        {
+          query->errx++;
+
+          /* Reset any status bits that have reached their max. error count */
+          reset_tags_status(conn, query->status, &query->errx);
+        }
+
+        if(brk == PDS_BRK_OPEN || (*query->status & PDS_PLC_BREAKER_RST) > 0)
+        {
+          plc->next++;
+          plc->ndone++;
+
+          if(plc->depth == 1)
+            return next_scan_query(conn, scan, plc, query);
+
+          continue;
+        }
+      }
+
+      plc->checked = 1;
+    }
+
+    if(plc->fd == PDS_POOL_FD_NONE)
+      return connect_scan_plc(conn, scan, plc);
+
+    /* Find a free slot for this query's transaction */
+    for(i = 0, slot = plc->slots; i < plc->depth && slot->inflight; i++, slot++)
+      ;
+
+    trans = &slot->trans;
+    memset(trans, 0, sizeof(pdstrans));
+    trans->protocol = query->protocol;
+    trans->block_id = query->block_id;
+    trans->block_start = (query->nblocks > 1) ? query->tags : PDS_GET_BLOCK_START(trans->block_id);
+    trans->ntags = query->ntags;
+    trans->pollrate = query->pollrate;
+    memcpy(trans->query, query->query, query->qlen);
+    trans->qlen = query->qlen;
+    trans->status = query->status;  /* N.B.: Already a pointer */
+    trans->errx = &query->errx;
+
+    /* N.B.: The query is stamped as sent when queued, as it's written as
+             soon as the PLC's socket will take it */
+    mb_instantiate_prepared_query(trans);
+    stamp_query_sent(trans);
+
+    printd("--> Query %d, Trans. %d\n", trans->block_id, trans->trans_id);
+    if(dbgflag) PDS_PRINT_BARRAYX(trans->buf, trans->blen);
+
+    /* Queue the query behind any queries that are still being sent */
+    if(plc->sent > 0)
+    {
+      plc->slen -= plc->sent;
+      memmove(plc->sbuf, &plc->sbuf[plc->sent], plc->slen);
+      plc->sent = 0;
+    }
+
+    memcpy(&plc->sbuf[plc->slen], trans->buf, trans->blen);
+    plc->slen += trans->blen;
+
+    slot->query = plc->next;
+    slot->deadline = scan->tick + PDS_SCAN_TMO_TICKS;
+    slot->inflight = 1;
+
+    plc->nflight++;
+    plc->next++;
+    plc->checked = 0;
+  }
+
+  /* All of the cycle's remaining queries were skipped */
+  if(plc->nflight == 0)
+    return next_scan_query(conn, scan, plc, plc->queries[plc->nqueries - 1]);
+
+  plc->state = PDS_SCAN_BUSY;
+  arm_scan_deadline(scan, plc);
+
+  return write_scan_queries(conn, scan, plc);
+}
+
+
+
+/******************************************************************************
+* Function to start connecting to a PLC in the scan engine                    *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct & the PLC     *
+*                 entry are passed to the function                            *
+* Post-condition: A non-blocking connection to the PLC is started & its       *
+*                 socket is added to the epoll fd, to wait for the connection *
+*                 to complete, upto the PLC's connect timeout.  If an error   *
+*                 occurs a -1 is returned                                     *
+******************************************************************************/
+int connect_scan_plc(pdsconn *conn, pdsscan *scan, pdsscanplc *plc)
+{
+  struct epoll_event ev;
+
+  /* Only resolve the PLC's address once */
+  if(!plc->resolved)
+  {
+    if(resolve_plc_address(conn->ip_addr, conn->port, &plc->addr) == -1)
+    {
+      err(errout, "%s: error resolving address of %s\n", PROGNAME, plc->fqid);
+      return fail_scan_connect(conn, scan, plc);
+    }
+    plc->resolved = 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &plc->connect_start);
+
+  if((plc->fd = open_plc_socket_nb(&plc->addr)) == -1)
+  {
+    err(errout, "%s: error opening socket to %s\n", PROGNAME, plc->fqid);
+    plc->fd = PDS_POOL_FD_NONE;
+    return fail_scan_connect(conn, scan, plc);
+  }
+
+  memset(&ev, 0, sizeof(struct epoll_event));
+  ev.events = EPOLLOUT;
+  ev.data.ptr = plc;
+
+  if(epoll_ctl(scan->epfd, EPOLL_CTL_ADD, plc->fd, &ev) == -1)
+  {
+    err(errout, "%s: error adding socket to %s to epoll fd\n", PROGNAME, plc->fqid);
+    return fail_scan_connect(conn, scan, plc);
+  }
+
+  plc->state = PDS_SCAN_CONNECTING;
+  arm_scan_timer(scan, plc, PDS_GET_CONNECT_TMO(*plc->connect_tmo));
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to fail a connection to a PLC in the scan engine                   *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct & the PLC     *
+*                 entry are passed to the function                            *
+* Post-condition: The PLC's status is set to show a connection error & is fed *
+*                 to its circuit breaker.  Its socket is closed & its next    *
+*                 query is scheduled.  If an error occurs a -1 is returned    *
+******************************************************************************/
+int fail_scan_connect(pdsconn *conn, pdsscan *scan, pdsscanplc *plc)
+{
+  pdsquery *query = plc->queries[plc->next];
+
+  disarm_scan_timer(scan, plc);
+  set_scan_query_conn(conn, query);
+
+  *query->status |= PDS_PLC_CONNERR;
+  query->errx++;
+  set_tags_status(conn, *query->status);
+  update_plc_breaker(conn, &plc->breaker, *query->status);
+
+  close_scan_plc(scan, plc);
+
+  plc->next++;
+  plc->ndone++;
+  plc->checked = 0;
+
+  return next_scan_query(conn, scan, plc, query);
+}
+
+
+
+/******************************************************************************
+* Function to write a PLC's queued queries to its socket in the scan engine   *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct & the PLC     *
+*                 entry are passed to the function                            *
+* Post-condition: As much of the queued queries as the socket will take is    *
+*                 sent.  The PLC waits for its responses & if any queries are *
+*                 left unsent, for the socket to be writable.  If an error    *
+*                 occurs a -1 is returned                                     *
+******************************************************************************/
+int write_scan_queries(pdsconn *conn, pdsscan *scan, pdsscanplc *plc)
+{
+  int nbytes = 0;
+
+  while(plc->sent < plc->slen)
+  {
+    if((nbytes = send(plc->fd, &plc->sbuf[plc->sent], (plc->slen - plc->sent), 0)) == -1)
+    {
+      if(errno == EINTR)
+        continue;
+
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+        return watch_scan_plc(scan, plc, (EPOLLIN | EPOLLOUT));
+
+      err(errout, "%s: error sending on socket to %s\n", PROGNAME, plc->fqid);
+      return complete_scan_query(conn, scan, plc, get_oldest_scan_slot(plc), -1);
+    }
+
+    plc->sent += nbytes;
+  }
+
+  /* All the queued queries have been sent, so wait for the responses */
+  plc->slen = plc->sent = 0;
+
+  return watch_scan_plc(scan, plc, EPOLLIN);
+}
+
+
+
+/******************************************************************************
+* Function to read a PLC's responses from its socket in the scan engine       *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct & the PLC     *
+*                 entry are passed to the function                            *
+* Post-condition: Any available data is appended to the received responses.   *
+*                 Each whole response, as given by its ModBus/TCP header      *
+*                 length, is matched to its transaction in flight by its      *
+*                 header transaction ID & the transaction is completed.  A    *
+*                 response that matches no transaction in flight, such as a   *
+*                 late response, is discarded.  If an error occurs a -1 is    *
+*                 returned                                                    *
+******************************************************************************/
+int read_scan_responses(pdsconn *conn, pdsscan *scan, pdsscanplc *plc)
+{
+  pdsscanslot *slot = NULL;
+  unsigned short int trans_id = 0;
+  int nbytes = 0, expected = 0;
+
+  for(;;)
+  {
+    if((nbytes = recv(plc->fd, &plc->rbuf[plc->rlen], (sizeof(plc->rbuf) - plc->rlen), 0)) == -1)
+    {
+      if(errno == EINTR)
+        continue;
+
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+
+      err(errout, "%s: error receiving on socket to %s\n", PROGNAME, plc->fqid);
+      return complete_scan_query(conn, scan, plc, get_oldest_scan_slot(plc), -1);
+    }
+
+    /* N.B.: The PLC has closed the connection */
+    if(nbytes == 0)
+      return complete_scan_query(conn, scan, plc, get_oldest_scan_slot(plc), 0);
+
+    plc->rlen += nbytes;
+
+    /* The MBAP header holds the no. of bytes that follow it */
+    while(plc->rlen >= MB_TCPIP_PRELEN)
+    {
+      expected = MB_TCPIP_PRELEN + PDS_MAKEWORD(plc->rbuf[MB_TCPIP_HI_LEN], plc->rbuf[MB_TCPIP_LO_LEN]);
+
+      if(expected > MB_MAXBUFLEN)
+      {
+        err(errout, "%s: invalid response length %d from %s\n", PROGNAME, expected, plc->fqid);
+        return complete_scan_query(conn, scan, plc, get_oldest_scan_slot(plc), -1);
+      }
+
+      if(plc->rlen < expected)
+        break;
+
+      trans_id = PDS_MAKEWORD(plc->rbuf[MB_TCPIP_HI_TRANS_ID], plc->rbuf[MB_TCPIP_LO_TRANS_ID]);
+
+      if((slot = get_scan_slot(plc, trans_id)))
+      {
+        stamp_response_received(&slot->trans);
+        memcpy(slot->trans.buf, plc->rbuf, expected);
+        slot->trans.blen = expected;
+      }
+      else
+        printd("Discarding response for unknown Trans. %d from %s\n", trans_id, plc->fqid);
+
+      plc->rlen -= expected;
+      memmove(plc->rbuf, &plc->rbuf[expected], plc->rlen);
+
+      if(slot)
+      {
+        complete_scan_query(conn, scan, plc, slot, expected);
+
+        /* The PLC has no more transactions in flight on this connection */
+        if(plc->state != PDS_SCAN_BUSY)
+          return 0;
+      }
+    }
+  }
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to complete a PLC's transaction in the scan engine                 *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct, the PLC      *
+*                 entry, the transaction's slot & the no. of bytes in the     *
+*                 response (or -1 on error) are passed to the function        *
+* Post-condition: The response is checked & the block's tags are refreshed    *
+*                 from it.  The outcome is fed to the PLC's circuit breaker.  *
+*                 On error, the PLC's status is set & its socket is closed,   *
+*                 abandoning its other transactions in flight.  The PLC's     *
+*                 next query is scheduled.  If an error occurs a -1 is        *
+*                 returned                                                    *
+******************************************************************************/
+int complete_scan_query(pdsconn *conn, pdsscan *scan, pdsscanplc *plc,
+                        pdsscanslot *slot, short int nbytes)
+{
+  pdstrans *trans = NULL;
+  pdsquery *query = NULL;
+  int refreshed = -1;
+
+  if(!slot)
+    return -1;
+
+  trans = &slot->trans;
+  query = plc->queries[slot->query];
+
+  slot->inflight = 0;
+  plc->nflight--;
+  plc->ndone++;
+
+  /* N.B.: The connection is shared by all PLCs in the shard, so reassign
+           this query's properties before setting any tags' status */
+  set_scan_query_conn(conn, query);
+
+  printd("<-- Response %d, Trans. %d\n", trans->block_id, trans->trans_id);
+  if(dbgflag) PDS_PRINT_BARRAYX(trans->buf, trans->blen);
+
+  if(nbytes > 0)
+    mb_clean_plc_response(trans);
+
+  if(check_read_response(conn, trans, nbytes) != -1)
+  {
+    /* Refresh a private copy of the query's hot data & then copy it to its
+       blocks, so that changes can be notified to clients.  Check refresh
+       mode.  If 'seqlock', the blocks are published.  Otherwise, hold the
+       semaphore whilst refreshing the blocks, as the PLCs' responses arrive
+       independently of each other */
+    gather_query_blocks(conn, query, scan->scratch_values, scan->scratch_mtimes_ns);
+    trans->values = scan->scratch_values;
+    trans->mtimes_ns = scan->scratch_mtimes_ns;
+
+    if(PDS_GET_RM_REFRESH(runmode) == PDS_RM_REFRESH_SEQLOCK)
+    {
+      if((refreshed = mb_refresh_data_tags(conn, trans)) != -1)
+        scatter_query_blocks(conn, query, scan->scratch_values, scan->scratch_mtimes_ns, &trans->acq);
+    }
+    else if(semset(conn->semid, PDS_SEMHLD, 0) != -1)
+    {
+      if((refreshed = mb_refresh_data_tags(conn, trans)) != -1)
+        scatter_query_blocks(conn, query, scan->scratch_values, scan->scratch_mtimes_ns, &trans->acq);
+
+      semset(conn->semid, PDS_SEMREL, 0);
+    }
+    else
+      refreshed = 0;
+
+    if(refreshed == -1)
+    {
+      *trans->status |= PDS_PLC_RESPERR;
+      (*trans->errx)++;
+      set_tags_status(conn, *trans->status);
+    }
+  }
+
+  update_plc_breaker(conn, &plc->breaker, *trans->status);
+
+  /* Keep the connection open for the next query unless it has failed */
+  if(*trans->status & PDS_POOL_DROP_BITMASK)
+    close_scan_plc(scan, plc);
+  else if(plc->nflight > 0)
+    arm_scan_deadline(scan, plc);
+
+  return next_scan_query(conn, scan, plc, query);
+}
+
+
+
+/******************************************************************************
+* Function to schedule a PLC's next query in the scan engine                  *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct, the PLC      *
+*                 entry & the query just done are passed to the function      *
+* Post-condition: With a pipeline depth of 1, the PLC's timer is armed for    *
+*                 the query's poll rate, plus the refresh mode's pause.  With *
+*                 a deeper pipeline, the pipeline is refilled at once & the   *
+*                 timer is only armed at the end of a scan cycle, for the     *
+*                 PLC's longest poll rate.  At the end of a scan cycle, the   *
+*                 cycle time is recorded & the shard's slowest PLC's cycle    *
+*                 time is published, as is the slowest shard's.  If an error  *
+*                 occurs a -1 is returned                                     *
+******************************************************************************/
+int next_scan_query(pdsconn *conn, pdsscan *scan, pdsscanplc *plc,
+                    pdsquery *query)
+{
+  struct timespec now;
+  long delay = 0;
+  int slowest = 0;
+  register int i = 0;
+
+  if(plc->ndone < plc->nqueries)
+  {
+    /* Keep a deep pipeline full.  Once the cycle's last queries are in
+       flight, wait for their responses */
+    if(plc->depth > 1)
+      return (plc->next < plc->nqueries) ? fill_scan_pipeline(conn, scan, plc) : 0;
+
+    /* Pause the specified time from the configuration */
+    delay = query->pollrate;
+  }
+  else
+  {
+    plc->next = plc->ndone = 0;
+    plc->incycle = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    plc->cycle_time = (int) (((now.tv_sec - plc->cycle_start.tv_sec) * 1000000L) +
+                             ((now.tv_nsec - plc->cycle_start.tv_nsec) / 1000L));
+
+    /* The shard's scan cycle is as long as its slowest PLC's */
+    for(i = 0, slowest = 0; i < scan->nplcs; i++)
+    {
+      if(scan->plcs[i].cycle_time > slowest)
+        slowest = scan->plcs[i].cycle_time;
+    }
+    *scan->shard_cycle_times[scan->shard] = slowest;
+
+    /* N.B.: The shards overwrite each other's maximum, so it's found afresh
+             from all the shards' cycle times */
+    for(i = 0; i < scan->nshards; i++)
+    {
+      if(*scan->shard_cycle_times[i] > slowest)
+        slowest = *scan->shard_cycle_times[i];
+    }
+    *scan->cycle_time = slowest;
+
+    /* Pause the specified time from the configuration.  N.B.: A pipelined
+       PLC's blocks are all polled at the rate of its slowest block */
+    delay = (plc->depth > 1) ? plc->pollrate : query->pollrate;
+
+    if(PDS_GET_RM_REFRESH(runmode) == PDS_RM_REFRESH_ALL)
+      delay += *scan->rdpause_all;
+  }
+
+  /* N.B.: Clients never wait on a seqlock, so it needs no pause */
+  if(PDS_GET_RM_REFRESH(runmode) == PDS_RM_REFRESH_BLOCK)
+    delay += *scan->rdpause_block;
+
+  /* Stop watching the socket until the next query */
+  plc->state = PDS_SCAN_IDLE;
+
+  if(plc->fd != PDS_POOL_FD_NONE)
+    watch_scan_plc(scan, plc, 0);
+
+  return arm_scan_timer(scan, plc, delay);
+}
+
+
+
+/******************************************************************************
+* Function to get a PLC's transaction in flight by its transaction ID         *
+*                                                                             *
+* Pre-condition:  The PLC entry & the transaction ID are passed to the        *
+*                 function                                                    *
+* Post-condition: A pointer to the transaction's slot is returned or a null   *
+*                 if no transaction in flight has the ID                      *
+******************************************************************************/
+pdsscanslot* get_scan_slot(pdsscanplc *plc, unsigned short int trans_id)
+{
+  pdsscanslot *slot = NULL;
+  register int i = 0;
+
+  for(i = 0, slot = plc->slots; i < plc->depth; i++, slot++)
+  {
+    if(slot->inflight && slot->trans.trans_id == trans_id)
+      return slot;
+  }
+
+  return NULL;
+}
+
+
+
+/******************************************************************************
+* Function to get a PLC's oldest transaction in flight                        *
+*                                                                             *
+* Pre-condition:  The PLC entry is passed to the function                     *
+* Post-condition: A pointer to the slot of the transaction with the earliest  *
+*                 deadline is returned or a null if none are in flight        *
+******************************************************************************/
+pdsscanslot* get_oldest_scan_slot(pdsscanplc *plc)
+{
+  pdsscanslot *slot = NULL, *oldest = NULL;
+  register int i = 0;
+
+  for(i = 0, slot = plc->slots; i < plc->depth; i++, slot++)
+  {
+    if(slot->inflight &&
+       (!oldest || (int) (slot->deadline - oldest->deadline) < 0))
+      oldest = slot;
+  }
+
+  return oldest;
+}
+
+
+
+/******************************************************************************
+* Function to arm a PLC's timer for its oldest transaction's deadline         *
+*                                                                             *
+* Pre-condition:  The scan engine struct & the PLC entry are passed to the    *
+*                 function                                                    *
+* Post-condition: The PLC's timer is armed to expire at the deadline of its   *
+*                 oldest transaction in flight.  The timer's slot is returned *
+*                 or a -1 if no transactions are in flight                    *
+******************************************************************************/
+int arm_scan_deadline(pdsscan *scan, pdsscanplc *plc)
+{
+  pdsscanslot *slot = NULL;
+  int ticks = 0;
+
+  if(!(slot = get_oldest_scan_slot(plc)))
+    return -1;
+
+  if((ticks = (int) (slot->deadline - scan->tick)) < 0)
+    ticks = 0;
+
+  return arm_scan_timer(scan, plc, ((long) ticks * PDS_SCAN_TICK));
+}
+
+
+
+/******************************************************************************
+* Function to set the events to wait for on a PLC's socket                    *
+*                                                                             *
+* Pre-condition:  The scan engine struct, the PLC entry & the epoll events    *
+*                 are passed to the function                                  *
+* Post-condition: The PLC's socket is watched for the given events in the     *
+*                 epoll fd.  If an error occurs a -1 is returned              *
+******************************************************************************/
+int watch_scan_plc(pdsscan *scan, pdsscanplc *plc, unsigned int events)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(struct epoll_event));
+  ev.events = events;
+  ev.data.ptr = plc;
+
+  if(epoll_ctl(scan->epfd, EPOLL_CTL_MOD, plc->fd, &ev) == -1)
+  {
+    err(errout, "%s: error modifying socket to %s in epoll fd\n", PROGNAME, plc->fqid);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to close a PLC's socket in the scan engine                         *
+*                                                                             *
+* Pre-condition:  The scan engine struct & the PLC entry are passed to the    *
+*                 function                                                    *
+* Post-condition: Any transactions in flight are abandoned & counted as done. *
+*                 If open, the PLC's socket is removed from the epoll fd,     *
+*                 closed & marked as closed.  The PLC is left idle.  If an    *
+*                 error occurs a -1 is returned                               *
+******************************************************************************/
+int close_scan_plc(pdsscan *scan, pdsscanplc *plc)
+{
+  register int i = 0;
+  int retval = 0;
+
+  plc->state = PDS_SCAN_IDLE;
+
+  /* N.B.: Responses can't be matched across connections */
+  for(i = 0; plc->slots && i < plc->depth; i++)
+  {
+    if(plc->slots[i].inflight)
+    {
+      plc->slots[i].inflight = 0;
+      plc->ndone++;
+    }
+  }
+
+  plc->nflight = 0;
+  plc->slen = plc->sent = plc->rlen = 0;
+
+  if(plc->fd == PDS_POOL_FD_NONE)
+    return 0;
+
+  printd("Closing scan connection to %s on fd %d\n", plc->fqid, plc->fd);
+
+  epoll_ctl(scan->epfd, EPOLL_CTL_DEL, plc->fd, NULL);
+
+  if((retval = close(plc->fd)) == -1)
+    err(errout, "%s: error closing socket to %s\n", PROGNAME, plc->fqid);
+
+  plc->fd = PDS_POOL_FD_NONE;
+
+  return retval;
+}
+
+
@@ -14,6 +14,9 @@
 #include <stdio.h>
 #include <signal.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/mman.h>
 
 #include <daemon.h>
 #include <debug.h>
@@ -46,10 +49,52 @@
 
 #define PDS_RDPAUSE_ALL		500000 /* usec refresh pause (read all) */
 #define PDS_RDPAUSE_BLOCK	0      /* usec refresh pause (read block) */
-#define PDS_WRPAUSE		100000 /* usec poll pause (write) */
+#define PDS_WRPAUSE		0      /* usec pause after a drained burst (write) */
+#define PDS_WRRESP_PAUSE	10000  /* usec pause while the queue is full */
 #define PDS_DBGPAUSE		2      /* Debug pause (secs.) */
 #define PDS_ONLINE		1      /* PDS online/offline status (bool) */
 #define PDS_ONLINE_PAUSE	10     /* Online status check pause (secs.) */
+#define PDS_COALESCE_GAP	0      /* Max. unconfigured refs read between
+                                          coalesced blocks (-1 = disabled) */
+#define PDS_SNAPSHOT_RATE	100000 /* usec snapshot publication rate
+                                          (0 = disabled) */
+#define PDS_SNAPSHOT_IDLE	1      /* Disabled snapshot check pause (secs.) */
+#define PDS_SNAPSHOT_RETRIES	100    /* Max. tries for a consistent snapshot
+                                          in seqlock refresh mode */
+
+/* Name format of a block's SPI read overrun counter tag */
+#define PDS_RD_OVERRUNS_FORMAT	"PDS_RD_OVERRUNS_%d"
+
+/* PLC connections.  A TCP/IP connect that doesn't complete within a PLC's
+   PDS_CONNECT_TMO_<n> is abandoned, & its latency is kept in its
+   PDS_CONNECT_TIME_<n>.  A timeout that isn't positive means the default */
+#define PDS_CONNECT_TMO		3000000  /* usec default connect timeout */
+#define PDS_CONNECT_TMO_FORMAT	"PDS_CONNECT_TMO_%d"
+#define PDS_CONNECT_TIME_FORMAT	"PDS_CONNECT_TIME_%d"
+
+#define PDS_GET_CONNECT_TMO(t)	(((t) > 0) ? (t) : PDS_CONNECT_TMO)
+
+/* PLC circuit breaker.  After PDS_BRK_THRESHOLD consecutive failures, a
+   PLC is skipped for an exponentially increasing (& jittered) backoff,
+   after which a single trial query is let through */
+#define PDS_BRK_THRESHOLD	3        /* Failures to open (0 = disabled) */
+#define PDS_BRK_BACKOFF		1000000  /* usec initial backoff */
+#define PDS_BRK_BACKOFF_MAX	60000000 /* usec max. backoff */
+#define PDS_BRK_TRIPS_MAX	30       /* Max. backoff doublings */
+#define PDS_BRK_STATE_FORMAT	"PDS_BRK_STATE_%d"
+
+#define PDS_BRK_CLOSED		0      /* PLC is queried as normal */
+#define PDS_BRK_OPEN		1      /* PLC is skipped until its retry time */
+#define PDS_BRK_HALF_OPEN	2      /* A trial query is let through */
+
+/* Is timespec a before timespec b? */
+#define PDS_TS_BEFORE(a, b)	(((a)->tv_sec < (b)->tv_sec) ||\
+                                 (((a)->tv_sec == (b)->tv_sec) &&\
+                                  ((a)->tv_nsec < (b)->tv_nsec)))
+
+/* Elapsed usecs from timespec a to timespec b */
+#define PDS_TS_USECS(a, b)	((((b)->tv_sec - (a)->tv_sec) * 1000000L) +\
+                                 (((b)->tv_nsec - (a)->tv_nsec) / 1000L))
 
 #define PDS_L1_ERRX		10     /* Max. error counts */
 #define PDS_L2_ERRX		5 
@@ -66,16 +111,69 @@
 
 #define PDS_RM_REFRESH_ALL		0x01
 #define PDS_RM_REFRESH_BLOCK		0x02
+#define PDS_RM_REFRESH_SEQLOCK		0x03
 #define PDS_RM_REFRESH_DEFAULT		PDS_RM_REFRESH_ALL
 
+/* N.B.: The refresh modes are values of a 2-bit field, not separate bits */
 #define PDS_RM_REFRESH_BITMASK		0x03
 #define PDS_GET_RM_REFRESH(r)		((r) & PDS_RM_REFRESH_BITMASK)
+#define PDS_SET_RM_REFRESH(r, m)	(((r) & ~PDS_RM_REFRESH_BITMASK) | (m))
 
 #define PDS_RM_QUERY_STATUS		0x04
 
 #define PDS_RM_STATUS_BITMASK		0x04
 #define PDS_GET_RM_STATUS(r)		((r) & PDS_RM_STATUS_BITMASK)
 
+#define PDS_RM_SCAN_ASYNC		0x08
+
+#define PDS_RM_SCAN_BITMASK		0x08
+#define PDS_GET_RM_SCAN(r)		((r) & PDS_RM_SCAN_BITMASK)
+
+/* Protocols the scan engine can run.  A ModBus/TCP response carries its own
+   length in the MBAP header, so it can be framed as it arrives */
+#define PDS_SCAN_IS_ASYNC(p)		((p) == MB_TCPIP)
+
+#define PDS_SCAN_SHARDS			1      /* No. of scan worker processes */
+#define PDS_SCAN_SHARDS_MAX		64     /* Max. scan worker processes */
+#define PDS_SCAN_TICK			10000  /* usec timer wheel tick */
+#define PDS_SCAN_WHEEL_SLOTS		512    /* Timer wheel slots (power of 2) */
+#define PDS_SCAN_MAXEVENTS		64     /* Max. epoll events per wait */
+#define PDS_SCAN_DEPTH			1      /* Default PLC pipeline depth */
+#define PDS_SCAN_DEPTH_MAX		16     /* Max. PLC pipeline depth */
+#define PDS_SCAN_RESTART_PAUSE		5      /* Restarted worker's pause (secs.) */
+
+/* There's no point in having more shards than PLCs.  Each shard publishes
+   its own scan cycle time in its PDS_SCAN_CYCLE_TIME_<n>, & the slowest
+   shard's is published in PDS_SCAN_CYCLE_TIME */
+#define PDS_SCAN_MAX_SHARDS(c)\
+(((c)->nplcs < PDS_SCAN_SHARDS_MAX) ? (c)->nplcs : PDS_SCAN_SHARDS_MAX)
+#define PDS_SCAN_CYCLE_TIME_FORMAT	"PDS_SCAN_CYCLE_TIME_%d"
+
+/* States of a PLC in the scan engine */
+#define PDS_SCAN_IDLE			0      /* No transactions in flight */
+#define PDS_SCAN_CONNECTING		1      /* Waiting for the connection */
+#define PDS_SCAN_BUSY			2      /* Transactions in flight */
+
+/* A transaction's hot data for a tag in its block.  The drivers refresh
+   the block's tags through these, so in seqlock mode they can refresh a
+   private copy of the block's hot data.  Each refreshed tag is stamped
+   with the time the transaction's response was received, so the clock is
+   only read once per transaction */
+#define PDS_TRANS_IN_BLOCK(t, tag)	(((tag) - (t)->block_start) < (t)->ntags)
+#define PDS_TRANS_VALUE(t, tag)		((t)->values[(tag) - (t)->block_start])
+#define PDS_TRANS_MTIME_NS(t, tag)	((t)->mtimes_ns[(tag) - (t)->block_start])
+#define PDS_TRANS_STAMP(t, tag)		(PDS_TRANS_MTIME_NS(t, tag) = (t)->acq.rcvd_ns)
+
+#define PDS_TIMESPEC_NS(ts)\
+(((unsigned long long) (ts).tv_sec * 1000000000ULL) + (ts).tv_nsec)
+
+#define PDS_POOL_FD_NONE		-1     /* Pooled connection is closed */
+
+#define PDS_WRBATCH_MAX			64     /* Max. queued writes per batch */
+
+/* Connection errors that cause a pooled connection to be dropped */
+#define PDS_POOL_DROP_BITMASK		(PDS_PLC_CONNERR | PDS_PLC_COMMSERR)
+
 #define PDS_SPI_KV_DELIM                "="
 #define PDS_SPI_KV_N_TOKENS             2
 
@@ -118,6 +216,15 @@ union semun
 
 #endif
 
+/******************************************************************************
+* The server's query block struct definition                                  *
+******************************************************************************/
+typedef struct pdsqblock_rec
+{
+  unsigned short int block_id;         /* Block ID */
+  unsigned short int ntags;            /* No. of tags in this block */
+} pdsqblock;
+
 /******************************************************************************
 * The server's query struct definition                                        *
 ******************************************************************************/
@@ -130,10 +237,17 @@ typedef struct pdsquery_rec
   char tty_dev[PDS_TTY_DEV_LEN];       /* TTY device */
   char path[PDS_PLC_PATH_LEN];         /* Routing path of PLC */
   int pollrate;                        /* Block's poll rate (in usecs) */
+  unsigned short int ntags;            /* No. of tags in this block */
   unsigned char query[PDS_MAXBUFLEN];  /* Query */
   short int qlen;                      /* Query length */
   unsigned short int *status;          /* Status word pointer */
   unsigned short int errx;             /* Error counter */
+  unsigned short int async;            /* Query is run by the scan engine */
+  struct timespec due;                 /* Time the query is next due */
+  int *overruns;                       /* SPI read overrun counter pointer */
+  unsigned short int nblocks;          /* No. of blocks read by this query */
+  pdsqblock *blocks;                   /* Array of blocks read by this query */
+  pdstag *tags;                        /* Copy of coalesced blocks' tags */
 } pdsquery;
 
 /******************************************************************************
@@ -145,6 +259,15 @@ typedef struct pdsqueries_rec
   pdsquery *queries;                   /* Array of query structures */
 } pdsqueries;
 
+/******************************************************************************
+* The server's read schedule struct definition                                *
+******************************************************************************/
+typedef struct pdsrdsched_rec
+{
+  int nqueries;                        /* No. of scheduled queries */
+  pdsquery **heap;                     /* Queries, min-heap ordered by due */
+} pdsrdsched;
+
 /******************************************************************************
 * The server's transaction struct definition                                  *
 ******************************************************************************/
@@ -153,6 +276,9 @@ typedef struct pdstrans_rec
   unsigned short int protocol;              /* Comms protocol */
   unsigned short int block_id;              /* Block ID */
   pdstag *block_start;                      /* Pointer to 1st tag in block */
+  unsigned short int ntags;                 /* No. of tags in block */
+  unsigned short int *values;               /* Block's tags' values */
+  unsigned long long *mtimes_ns;            /* Block's tags' mtimes (nsecs) */
   int pollrate;                             /* Block's poll rate (in usecs) */
 
   unsigned char query[PDS_MAXBUFLEN];       /* Query */
@@ -168,8 +294,154 @@ typedef struct pdstrans_rec
   unsigned short int *errx;                 /* Error counter pointer */
 
   unsigned short int trans_id;              /* Transaction ID */
+
+  pdsacq acq;                               /* Query's acquisition times */
+  unsigned long long sent_mono_ns;          /* Query sent (monotonic nsecs) */
 } pdstrans;
 
+/******************************************************************************
+* The server's PLC circuit breaker struct definition                          *
+******************************************************************************/
+typedef struct pdsbreaker_rec
+{
+  unsigned short int state;                 /* Breaker state */
+  unsigned int nfails;                      /* Consecutive failures */
+  unsigned short int ntrips;                /* Consecutive trips */
+  struct timespec retry;                    /* Time an open breaker retries */
+  unsigned int seed;                        /* Backoff jitter seed */
+  int *threshold;                           /* SPI failures to open tag */
+  int *backoff;                             /* SPI initial backoff tag */
+  int *backoff_max;                         /* SPI max. backoff tag */
+  int *trips;                               /* SPI breaker trip counter */
+  int *spi_state;                           /* SPI breaker state tag */
+} pdsbreaker;
+
+/******************************************************************************
+* The server's pooled PLC connection struct definition                        *
+******************************************************************************/
+typedef struct pdspoolconn_rec
+{
+  char fqid[PDS_PLC_FQID_LEN];              /* PLC's fully-qualified ID */
+  unsigned short int protocol;              /* Comms protocol */
+  char ip_addr[PDS_IP_ADDR_LEN];            /* IP address */
+  unsigned short int port;                  /* TCP port */
+  char tty_dev[PDS_TTY_DEV_LEN];            /* TTY device */
+  char path[PDS_PLC_PATH_LEN];              /* Routing path of PLC */
+  int fd;                                   /* Open fd or PDS_POOL_FD_NONE */
+  struct termios tio;                       /* TTY device's original settings */
+  struct sockaddr_in addr;                  /* Cached resolved address */
+  unsigned short int resolved;              /* Address has been resolved */
+  int *connect_tmo;                         /* SPI connect timeout tag */
+  int *connect_time;                        /* SPI connect latency tag */
+  pdsbreaker breaker;                       /* PLC's circuit breaker */
+} pdspoolconn;
+
+/******************************************************************************
+* The server's PLC connection pool struct definition                          *
+******************************************************************************/
+typedef struct pdspool_rec
+{
+  int nconns;                               /* No. of PLCs in the pool */
+  pdspoolconn *conns;                       /* Array of pooled connections */
+  int *hits;                                /* SPI pool hit counter */
+  int *misses;                              /* SPI pool miss counter */
+  int keep_serial;                          /* Keep serial ports open (bool) */
+} pdspool;
+
+/******************************************************************************
+* The server's batch of queued client write requests struct definition        *
+******************************************************************************/
+typedef struct pdswrbatch_rec
+{
+  int nmsgs;                                /* No. of messages in the batch */
+  pdsmsg msgs[PDS_WRBATCH_MAX];             /* The client write messages */
+} pdswrbatch;
+
+/******************************************************************************
+* The server's scan engine pipelined transaction struct definition            *
+******************************************************************************/
+typedef struct pdsscanslot_rec
+{
+  pdstrans trans;                           /* The slot's transaction */
+  int query;                                /* Index of its PLC's query */
+  unsigned short int inflight;              /* Transaction is in flight */
+  unsigned int deadline;                    /* Tick at which it times out */
+} pdsscanslot;
+
+/******************************************************************************
+* The server's scan engine PLC struct definition                              *
+******************************************************************************/
+typedef struct pdsscanplc_rec
+{
+  char fqid[PDS_PLC_FQID_LEN];              /* PLC's fully-qualified ID */
+  struct sockaddr_in addr;                  /* Cached resolved address */
+  unsigned short int resolved;              /* Address has been resolved */
+  int *connect_tmo;                         /* SPI connect timeout tag */
+  int *connect_time;                        /* SPI connect latency tag */
+  struct timespec connect_start;            /* Start of the connect */
+  int fd;                                   /* Open fd or PDS_POOL_FD_NONE */
+  unsigned short int state;                 /* PLC's scan state */
+  int nqueries;                             /* No. of this PLC's queries */
+  pdsquery **queries;                       /* This PLC's queries */
+  int pollrate;                             /* Longest poll rate (in usecs) */
+  int next;                                 /* Index of the next query */
+  unsigned short int checked;               /* Next query's status checked */
+  int ndone;                                /* Queries done this cycle */
+  int depth;                                /* Pipeline depth */
+  int nflight;                              /* No. of transactions in flight */
+  pdsscanslot *slots;                       /* Pipelined transactions */
+  unsigned char *sbuf;                      /* Queries waiting to be sent */
+  int slen;                                 /* Send buffer length */
+  int sent;                                 /* Bytes of the buffer sent */
+  unsigned char rbuf[2 * PDS_MAXBUFLEN];    /* Responses being received */
+  int rlen;                                 /* Receive buffer length */
+  unsigned short int incycle;               /* A scan cycle is in progress */
+  struct timespec cycle_start;              /* Start of this scan cycle */
+  int cycle_time;                           /* Last scan cycle time (usecs) */
+  struct pdsscanplc_rec *tnext;             /* Next PLC in timer slot */
+  struct pdsscanplc_rec *tprev;             /* Previous PLC in timer slot */
+  unsigned int tslot;                       /* Timer wheel slot */
+  unsigned int trounds;                     /* Timer wheel rounds to go */
+  unsigned short int tarmed;                /* Timer is armed */
+  pdsbreaker breaker;                       /* PLC's circuit breaker */
+} pdsscanplc;
+
+/******************************************************************************
+* The server's scan engine struct definition                                  *
+******************************************************************************/
+typedef struct pdsscan_rec
+{
+  int shard;                                /* This worker's shard */
+  int nshards;                              /* No. of shards */
+  int epfd;                                 /* The epoll fd */
+  int nplcs;                                /* No. of PLCs in this shard */
+  pdsscanplc *plcs;                         /* Array of this shard's PLCs */
+  pdsscanplc *wheel[PDS_SCAN_WHEEL_SLOTS];  /* Timer wheel slots */
+  unsigned int tick;                        /* Current timer wheel tick */
+  struct timespec epoch;                    /* Time of timer wheel tick 0 */
+  unsigned short int *scratch_values;       /* Private copy of query values */
+  unsigned long long *scratch_mtimes_ns;    /* Private copy of query mtimes */
+  int *online;                              /* SPI online status */
+  int *rdpause_all;                         /* SPI refresh pause (all) */
+  int *rdpause_block;                       /* SPI refresh pause (block) */
+  int *cycle_time;                          /* SPI slowest scan cycle time */
+  int **shard_cycle_times;                  /* SPI each shard's cycle time */
+  int *timeouts;                            /* SPI transaction timeouts */
+} pdsscan;
+
+/******************************************************************************
+* The server's scan engine worker processes struct definition                 *
+******************************************************************************/
+typedef struct pdsscanworkers_rec
+{
+  int nworkers;                             /* No. of workers (shards) */
+  pid_t *pids;                              /* Each shard's worker's pid */
+  plc_cnf *conf;                            /* The PLC configuration */
+  pdsconn *conn;                            /* The read process' connection */
+  pds_spi_conn *spi_conn;                   /* The read process' SPI conn. */
+  pdsqueries *queries;                      /* The read queries */
+} pdsscanworkers;
+
 /******************************************************************************
 * The server's SPI default configuration settings                             *
 ******************************************************************************/
@@ -179,7 +451,23 @@ static pds_spi_tag __spi_tags[] =
   {"PDS_RDPAUSE_BLOCK", PDS_RDPAUSE_BLOCK, PDS_SPI_PERM_RDWR},
   {"PDS_WRPAUSE", PDS_WRPAUSE, PDS_SPI_PERM_RDWR},
   {"PDS_DBGPAUSE", PDS_DBGPAUSE, PDS_SPI_PERM_RDWR},
-  {"PDS_ONLINE", PDS_ONLINE, PDS_SPI_PERM_RDWR}
+  {"PDS_ONLINE", PDS_ONLINE, PDS_SPI_PERM_RDWR},
+  {"PDS_POOL_HITS", 0, PDS_SPI_PERM_RD},
+  {"PDS_POOL_MISSES", 0, PDS_SPI_PERM_RD},
+  {"PDS_WRQ_DEPTH", 0, PDS_SPI_PERM_RD},
+  {"PDS_WRSVC_TIME", 0, PDS_SPI_PERM_RD},
+  {"PDS_WR_COUNT", 0, PDS_SPI_PERM_RD},
+  {"PDS_WR_COALESCED", 0, PDS_SPI_PERM_RD},
+  {"PDS_SCAN_SHARDS", PDS_SCAN_SHARDS, PDS_SPI_PERM_RDWR},
+  {"PDS_SCAN_CYCLE_TIME", 0, PDS_SPI_PERM_RD},
+  {"PDS_SCAN_TIMEOUTS", 0, PDS_SPI_PERM_RD},
+  {"PDS_COALESCE_GAP", PDS_COALESCE_GAP, PDS_SPI_PERM_RDWR},
+  {"PDS_BRK_THRESHOLD", PDS_BRK_THRESHOLD, PDS_SPI_PERM_RDWR},
+  {"PDS_BRK_BACKOFF", PDS_BRK_BACKOFF, PDS_SPI_PERM_RDWR},
+  {"PDS_BRK_BACKOFF_MAX", PDS_BRK_BACKOFF_MAX, PDS_SPI_PERM_RDWR},
+  {"PDS_BRK_TRIPS", 0, PDS_SPI_PERM_RD},
+  {"PDS_SNAPSHOT_RATE", PDS_SNAPSHOT_RATE, PDS_SPI_PERM_RDWR},
+  {"PDS_SNAPSHOT_MISSES", 0, PDS_SPI_PERM_RD}
 };
 
 static pds_spi_tag_list __spi_tag_list =
@@ -222,6 +510,16 @@ void set_quit(int sig);
 ******************************************************************************/
 void cleanup_child(int sig);
 
+/******************************************************************************
+* Function to handle child signal in the read process                         *
+*                                                                             *
+* Pre-condition:  Signal has been received                                    *
+* Post-condition: Child process is left to be reaped by check_scan_workers(), *
+*                 so that a scan worker's exit is seen, signal handler is     *
+*                 re-installed                                                *
+******************************************************************************/
+void notify_child(int sig);
+
 /******************************************************************************
 * Function to parse the server's command line arguments                       *
 *                                                                             *
@@ -335,6 +633,30 @@ int init_shared_mem(pdsconn *conn);
 ******************************************************************************/
 int init_msg_queue(pdsconn *conn);
 
+/******************************************************************************
+* Function to add the per-block & per-PLC SPI tags to the SPI tag list        *
+*                                                                             *
+* Pre-condition:  The PLC configuration struct & the SPI tag list are passed  *
+*                 to the function                                             *
+* Post-condition: The list's tags are replaced by a copy, with a read overrun *
+*                 counter tag appended for each block, circuit breaker        *
+*                 state, connect timeout & connect latency tags appended for  *
+*                 each PLC & a scan cycle time tag appended for each possible *
+*                 scan engine shard in this configuration.  The no. of SPI    *
+*                 tags is returned.  If an error occurs a -1 is returned      *
+******************************************************************************/
+int add_SPI_config_tags(plc_cnf *conf, pds_spi_tag_list *tag_list);
+
+/******************************************************************************
+* Function to get a pointer to a per-PLC SPI tag                              *
+*                                                                             *
+* Pre-condition:  The SPI connection struct, the tag's name format & the      *
+*                 PLC's index in the configuration are passed to the function *
+* Post-condition: A pointer to the PLC's SPI tag is returned.  If an error    *
+*                 occurs a (int *) -1 is returned                             *
+******************************************************************************/
+int* get_SPI_plc_tag_ptr(pds_spi_conn *spi_conn, char *format, int plc_id);
+
 /******************************************************************************
 * Function to initialise the SPI server connection                            *
 *                                                                             *
@@ -399,6 +721,27 @@ int release_shm(void *shm, int shmid);
 ******************************************************************************/
 int map_shm(plc_cnf *conf, pdsconn *conn);
 
+/******************************************************************************
+* Function to add a tag to the tag name index                                 *
+*                                                                             *
+* Pre-condition:  The connection struct & a pointer to the tag in shared      *
+*                 memory are passed to the function                           *
+* Post-condition: The tag's index is stored in the 1st free slot of its probe *
+*                 sequence, unless a tag of the same name is already indexed. *
+*                 The slot is returned or -1 if the index is full             *
+******************************************************************************/
+int index_tag(pdsconn *conn, pdstag *tag);
+
+/******************************************************************************
+* Function to find a tag by name using the tag name index                     *
+*                                                                             *
+* Pre-condition:  The connection struct & the tag name are passed to the      *
+*                 function                                                    *
+* Post-condition: A pointer to the tag in shared memory is returned or a null *
+*                 if the tag name is not found                                *
+******************************************************************************/
+pdstag* find_tag(pdsconn *conn, const char *tagname);
+
 /******************************************************************************
 * Function to set the value of a semaphore                                    *
 *                                                                             *
@@ -409,6 +752,121 @@ int map_shm(plc_cnf *conf, pdsconn *conn);
 ******************************************************************************/
 int semset(int id, int op, int snum);
 
+/******************************************************************************
+* Function to publish a block of tags under its sequence counter              *
+*                                                                             *
+* Pre-condition:  The connection struct, a pointer to the block's 1st tag in  *
+*                 shared memory, a private copy of the block's values &       *
+*                 mtimes (in secs & nsecs) holding the new data, the block's  *
+*                 acquisition times & the no. of tags in the block are passed *
+*                 to the function                                             *
+* Post-condition: The new values are copied into shared memory whilst the     *
+*                 block's sequence counter is odd, so that readers retry      *
+*                 rather than see a partially refreshed block.  The no. of    *
+*                 tags published is returned                                  *
+******************************************************************************/
+int publish_block(pdsconn *conn, pdstag *block_start,
+                  unsigned short int *values, time_t *mtimes,
+                  unsigned long long *mtimes_ns, pdsacq *acq,
+                  unsigned short int ntags);
+
+/******************************************************************************
+* Function to notify clients that a block has changed                         *
+*                                                                             *
+* Pre-condition:  The connection struct & the block's ID are passed to the    *
+*                 function                                                    *
+* Post-condition: The block's change counter & the segment-wide change        *
+*                 counter are bumped, & any clients waiting on the latter are *
+*                 woken.  The segment-wide change counter is returned         *
+******************************************************************************/
+unsigned int notify_block_change(pdsconn *conn, unsigned short int block_id);
+
+/******************************************************************************
+* Function to append a tag's change to the change journal                     *
+*                                                                             *
+* Pre-condition:  The connection struct, a pointer to the tag in shared       *
+*                 memory & the tag's new value, status & mtime are passed to  *
+*                 the function                                                *
+* Post-condition: The next sequence no. is claimed & the change is written to *
+*                 its record in the ring, overwriting the oldest change.      *
+*                 The change's sequence no. is returned                       *
+******************************************************************************/
+unsigned long long journal_tag_change(pdsconn *conn, pdstag *tag,
+                                      unsigned short int value,
+                                      unsigned short int status, time_t mtime);
+
+/******************************************************************************
+* Function to take a sample of a block's tags for their history               *
+*                                                                             *
+* Pre-condition:  The connection struct, a pointer to the block's 1st tag in  *
+*                 shared memory & the no. of tags in the block are passed to  *
+*                 the function                                                *
+* Post-condition: If the block has a history, each tag's current value &      *
+*                 status are written to the next slot of its ring, stamped    *
+*                 with the time the block's last response was received, &     *
+*                 then the block's sample count is bumped.  The no. of tags   *
+*                 sampled is returned                                         *
+******************************************************************************/
+int sample_block_history(pdsconn *conn, pdstag *block_start,
+                         unsigned short int ntags);
+
+/******************************************************************************
+* Function to start the snapshot publisher process                            *
+*                                                                             *
+* Pre-condition:  The connection structs are passed to the function           *
+* Post-condition: A process is forked to publish snapshots of the tags, at    *
+*                 the rate set by its SPI tag.  The publisher's pid is        *
+*                 returned or a -1 on error                                   *
+******************************************************************************/
+pid_t start_snapshot_publisher(pdsconn *conn, pds_spi_conn *spi_conn);
+
+/******************************************************************************
+* Function to stop the snapshot publisher process                             *
+*                                                                             *
+* Pre-condition:  The publisher's pid is passed to the function               *
+* Post-condition: The publisher is terminated & waited for.  On error a -1 is *
+*                 returned                                                    *
+******************************************************************************/
+int stop_snapshot_publisher(pid_t pid);
+
+/******************************************************************************
+* Function to run the snapshot publisher                                      *
+*                                                                             *
+* Pre-condition:  The connection structs are passed to the function           *
+* Post-condition: A snapshot of the tags is published at the rate set by its  *
+*                 SPI tag, until the quit flag is set.  The publication rate  *
+*                 is independent of the blocks' poll rates, & can be changed  *
+*                 whilst running.  If it's 0, publication is paused.  Any     *
+*                 snapshot that can't be taken consistently is counted by an  *
+*                 SPI tag & skipped.  On error a -1 is returned               *
+******************************************************************************/
+int run_snapshot_publisher(pdsconn *conn, pds_spi_conn *spi_conn);
+
+/******************************************************************************
+* Function to publish a snapshot of the tags                                  *
+*                                                                             *
+* Pre-condition:  The connection struct & storage for the block sequence      *
+*                 counters are passed to the function                         *
+* Post-condition: A consistent image of the tags is taken into the snapshot   *
+*                 buffer that isn't the latest & then the snapshot epoch is   *
+*                 bumped, so that it becomes the latest.  The new epoch is    *
+*                 returned.  If an image couldn't be taken, a 0 is returned   *
+******************************************************************************/
+unsigned int publish_snapshot(pdsconn *conn, unsigned int *seqs);
+
+/******************************************************************************
+* Function to take a consistent image of the tags                             *
+*                                                                             *
+* Pre-condition:  The connection struct, the image to write & storage for the *
+*                 block sequence counters are passed to the function          *
+* Post-condition: The tags' values & statuses are copied into the image.      *
+*                 Check refresh mode.  If 'seqlock', the copy is retried      *
+*                 until no block was published whilst copying.  Otherwise,    *
+*                 the semaphore is held whilst copying.  The no. of tags      *
+*                 copied is returned.  On error a -1 is returned              *
+******************************************************************************/
+int take_snapshot(pdsconn *conn, pdsimage *image, unsigned int *seqs);
+
 /******************************************************************************
 * Function to map SPI tags to memory variable tags in shared memory           *
 *                                                                             *
@@ -448,13 +906,54 @@ int handle_read_requests(plc_cnf *conf, pdsconn *conn, pds_spi_conn *spi_conn);
 /******************************************************************************
 * Function to setup all read/mapped-write block queries in this configuration *
 *                                                                             *
-* Pre-condition:  The PLC configuration struct and the connection struct are  *
+* Pre-condition:  The PLC configuration struct and the connection structs are *
 *                 passed to the function                                      *
 * Post-condition: A query is constructed for each read/mapped-write block in  *
 *                 this configuration and a pointer to the queries struct is   *
-*                 returned.  If an error occurs a null is returned            *
+*                 returned.  Unless disabled, blocks on the same PLC whose    *
+*                 references are within the coalesce gap of each other are    *
+*                 read by a single query.  If an error occurs a null is       *
+*                 returned                                                    *
+******************************************************************************/
+pdsqueries* setup_read_queries(plc_cnf *conf, pdsconn *conn,
+                               pds_spi_conn *spi_conn);
+
+/******************************************************************************
+* Function to compare the keys of two read blocks that must match if the      *
+* blocks are to be read by the same query                                     *
+*                                                                             *
+* Pre-condition:  Pointers to the two blocks are passed to the function       *
+* Post-condition: An integer less than, equal to or greater than zero is      *
+*                 returned if the 1st block's keys are found to be less than, *
+*                 to match or to be greater than the 2nd block's keys         *
+******************************************************************************/
+int compare_read_block_keys(plc_cnf_block *a, plc_cnf_block *b);
+
+/******************************************************************************
+* Function to compare two read blocks, for sorting with qsort(3)              *
+*                                                                             *
+* Pre-condition:  Pointers to the two block pointers are passed to the        *
+*                 function                                                    *
+* Post-condition: The blocks are ordered by their keys & then by their 1st    *
+*                 reference, so blocks that can be coalesced are adjacent.    *
+*                 Otherwise the configured order of the blocks is kept        *
+******************************************************************************/
+int compare_read_blocks(const void *p1, const void *p2);
+
+/******************************************************************************
+* Function to coalesce a read block into the block read by a query            *
+*                                                                             *
+* Pre-condition:  The block read by the query, the following block & the      *
+*                 max. no. of unconfigured references that may be read        *
+*                 between them are passed to the function                     *
+* Post-condition: If both blocks are on the same PLC, have the same function, *
+*                 type & poll rate, the following block's references start    *
+*                 within the gap after the query's & the combined block is    *
+*                 within the protocol's limits, then the following block's    *
+*                 tags are appended to the query's block & a 1 is returned.   *
+*                 Otherwise a 0 is returned                                   *
 ******************************************************************************/
-pdsqueries* setup_read_queries(plc_cnf *conf, pdsconn *conn);
+int coalesce_read_block(plc_cnf_block *merged, plc_cnf_block *block, int gap);
 
 /******************************************************************************
 * Function to free memory for all read queries                                *
@@ -465,50 +964,210 @@ pdsqueries* setup_read_queries(plc_cnf *conf, pdsconn *conn);
 ******************************************************************************/
 int free_read_queries(pdsqueries *queries);
 
+/******************************************************************************
+* Function to setup the read schedule of the synchronous read queries         *
+*                                                                             *
+* Pre-condition:  The SPI connection struct & the queries struct are passed   *
+*                 to the function                                             *
+* Post-condition: Each query that isn't run by the scan engine is scheduled   *
+*                 to be due now & is assigned its block's SPI overrun         *
+*                 counter.  A pointer to the schedule is returned.  If an     *
+*                 error occurs a null is returned                             *
+******************************************************************************/
+pdsrdsched* setup_read_schedule(pds_spi_conn *spi_conn, pdsqueries *queries);
+
+/******************************************************************************
+* Function to free the read schedule                                          *
+*                                                                             *
+* Pre-condition:  The read schedule is passed to the function                 *
+* Post-condition: Memory is freed for the read schedule.  The no. of          *
+*                 scheduled queries is returned or a -1 on error              *
+******************************************************************************/
+int free_read_schedule(pdsrdsched *sched);
+
+/******************************************************************************
+* Function to wait for the next query in the read schedule to be due          *
+*                                                                             *
+* Pre-condition:  The read schedule is passed to the function                 *
+* Post-condition: The process sleeps until the deadline of the earliest query *
+*                 in the schedule.  If the sleep is interrupted, or there are *
+*                 no queries to wait for, a -1 is returned                    *
+******************************************************************************/
+int wait_read_schedule(pdsrdsched *sched);
+
+/******************************************************************************
+* Function to reschedule the earliest query in the read schedule              *
+*                                                                             *
+* Pre-condition:  The read schedule, with a query due, & the current time are *
+*                 passed to the function                                      *
+* Post-condition: The earliest query's next deadline is set to one poll rate  *
+*                 after its current deadline & the query is moved to its new  *
+*                 place in the schedule.  If that deadline has already        *
+*                 passed, the query has overrun, so its SPI overrun counter   *
+*                 is incremented & its next deadline is now.  A pointer to    *
+*                 the query is returned                                       *
+******************************************************************************/
+pdsquery* reschedule_read_query(pdsrdsched *sched, struct timespec *now);
+
+/******************************************************************************
+* Function to gather the hot data of a read query's blocks                    *
+*                                                                             *
+* Pre-condition:  The connection struct, the query & storage for a private    *
+*                 copy of its values & mtimes (in nsecs) are passed to the    *
+*                 function                                                    *
+* Post-condition: The values & mtimes of each block read by the query are     *
+*                 copied from shared memory, in turn, into the private copy.  *
+*                 The no. of tags gathered is returned                        *
+******************************************************************************/
+int gather_query_blocks(pdsconn *conn, pdsquery *query,
+                        unsigned short int *values,
+                        unsigned long long *mtimes_ns);
+
+/******************************************************************************
+* Function to scatter the hot data of a read query back to its blocks         *
+*                                                                             *
+* Pre-condition:  The connection struct, the query, a private copy of its     *
+*                 refreshed values & mtimes (in nsecs) & the query's          *
+*                 acquisition times are passed to the function                *
+* Post-condition: The private copy is copied, in turn, into the shared memory *
+*                 of each block read by the query, along with the             *
+*                 acquisition times & the mtimes in secs.  In seqlock mode,   *
+*                 each block is published under its own sequence counter,     *
+*                 otherwise the caller must hold the semaphore.  Each block   *
+*                 with a history is sampled.  Each changed tag is appended to *
+*                 the change journal & clients are notified of each block     *
+*                 whose values have changed.  The no. of tags scattered is    *
+*                 returned                                                    *
+******************************************************************************/
+int scatter_query_blocks(pdsconn *conn, pdsquery *query,
+                         unsigned short int *values,
+                         unsigned long long *mtimes_ns, pdsacq *acq);
+
 /******************************************************************************
 * Function to execute all read queries for this configuration                 *
 *                                                                             *
-* Pre-condition:  The connection structs and the queries struct are passed to *
-*                 the function                                                *
+* Pre-condition:  The connection structs, the queries struct, the PLC         *
+*                 connection pool & the scan engine's workers (or a null) are *
+*                 passed to the function                                      *
 * Post-condition: All tags in the data blocks for this configuration are      *
 *                 queried from the PLC and their values are placed in memory  *
-*                 variables in the shared memory segment.  If an error occurs *
+*                 variables in the shared memory segment.  Each block is      *
+*                 queried at its poll rate, when its deadline is due.  Any    *
+*                 workers that have exited are restarted.  If an error occurs *
 *                 a -1 is returned                                            *
 ******************************************************************************/
 int execute_read_queries(pdsconn *conn, pds_spi_conn *spi_conn,
-                         pdsqueries *queries);
+                         pdsqueries *queries, pdspool *pool,
+                         pdsscanworkers *workers);
+
+/******************************************************************************
+* Function to stamp a transaction with the time its query was sent            *
+*                                                                             *
+* Pre-condition:  The transaction struct is passed to the function            *
+* Post-condition: The real & monotonic times now are stored in the            *
+*                 transaction, as the time its query was sent.  The real time *
+*                 (in nsecs) is returned                                      *
+******************************************************************************/
+unsigned long long stamp_query_sent(pdstrans *trans);
+
+/******************************************************************************
+* Function to stamp a transaction with the time its response was received     *
+*                                                                             *
+* Pre-condition:  The transaction struct is passed to the function            *
+* Post-condition: The real & monotonic times now are stored in the            *
+*                 transaction, as the time its response was received, & the   *
+*                 response latency is calculated from the monotonic times.    *
+*                 The drivers stamp the tags they refresh with this time.     *
+*                 The real time (in nsecs) is returned                        *
+******************************************************************************/
+unsigned long long stamp_response_received(pdstrans *trans);
 
 /******************************************************************************
 * Function to read data from a PLC                                            *
 *                                                                             *
 * Pre-condition:  The connection struct & a transaction struct containing the *
 *                 query & storage for the response are passed to the function *
-* Post-condition: The query is ran against the PLC.  The response is checked  *
-*                 for exceptions and returned in the response buffer.  The    *
-*                 no. of bytes in the response is returned or a -1 on error   *
+* Post-condition: The query is ran against the PLC & stamped with the times   *
+*                 it was sent & its response received.  The response is       *
+*                 checked for exceptions and returned in the response buffer. *
+*                 The no. of bytes in the response is returned or a -1 on     *
+*                 error                                                       *
 ******************************************************************************/
 int read_from_plc(pdsconn *conn, pdstrans *trans);
 
+/******************************************************************************
+* Function to check a PLC's response to a read query                          *
+*                                                                             *
+* Pre-condition:  The connection struct, a transaction struct containing the  *
+*                 cleaned response & the no. of bytes received are passed to  *
+*                 the function                                                *
+* Post-condition: The response is checked for exceptions.  On error, the      *
+*                 PLC's status word is set accordingly.  The no. of bytes in  *
+*                 the response is returned or a -1 on error                   *
+******************************************************************************/
+int check_read_response(pdsconn *conn, pdstrans *trans, short int nbytes);
+
 /******************************************************************************
 * Function to handle - write data to PLC/client initialisation - requests     *
 *                                                                             *
-* Pre-condition:  The connection structs are passed to the function           *
+* Pre-condition:  The PLC configuration struct and the connection structs are *
+*                 passed to the function                                      *
 * Post-condition: Client requests to write data to the PLC and a client's     *
-*                 initial request to connect to the server are handled.  If   *
-*                 an error occurs a -1 is returned                            *
+*                 initial request to connect to the server are handled as     *
+*                 they arrive.  Each burst of requests is drained from the    *
+*                 queue before waiting again, queued writes to contiguous     *
+*                 references being coalesced.  If an error occurs a -1 is     *
+*                 returned                                                    *
+******************************************************************************/
+int handle_write_requests(plc_cnf *conf, pdsconn *conn, pds_spi_conn *spi_conn);
+
+/******************************************************************************
+* Function to send a client its 'write data to PLC' response                  *
+*                                                                             *
+* Pre-condition:  The connection struct & the response message are passed to  *
+*                 the function                                                *
+* Post-condition: The response is sent to the requesting client without       *
+*                 blocking the dispatcher.  If the message queue is full, the *
+*                 send is retried until the client collects its replies.  If  *
+*                 the client has exited, the response is dropped, as no one   *
+*                 could ever read it.  If an error occurs a -1 is returned    *
 ******************************************************************************/
-int handle_write_requests(pdsconn *conn, pds_spi_conn *spi_conn);
+int send_write_response(pdsconn *conn, pdsmsg *msg);
 
 /******************************************************************************
 * Function to write client data to the PLC                                    *
 *                                                                             *
-* Pre-condition:  The connection struct and the message struct containing     *
-*                 data to write to the PLC are passed to the function         *
+* Pre-condition:  The connection struct, the message struct containing data   *
+*                 to write to the PLC and the connection pool are passed to   *
+*                 the function                                                *
 * Post-condition: The PLC query is constructed with data in the message and   *
-*                 then written to the PLC.  If an error occurs a -1 is        *
-*                 returned                                                    *
+*                 then written to the PLC over a pooled connection.  If an    *
+*                 error occurs a -1 is returned                               *
 ******************************************************************************/
-int write_to_plc(pdsconn *conn, pdsmsg *msg);
+int write_to_plc(pdsconn *conn, pdsmsg *msg, pdspool *pool);
+
+/******************************************************************************
+* Function to determine if writes to a tag's block can be coalesced           *
+*                                                                             *
+* Pre-condition:  The tag struct is passed to the function                    *
+* Post-condition: If the tag's protocol & function support writing a range of *
+*                 contiguous references in a single transaction, then a 1 is  *
+*                 returned, otherwise a 0 is returned                         *
+******************************************************************************/
+int can_coalesce_write(pdstag *tag);
+
+/******************************************************************************
+* Function to coalesce a batch's queued writes into a single write            *
+*                                                                             *
+* Pre-condition:  The connection struct, the batch of write messages, the     *
+*                 index of the first message to write & storage for the       *
+*                 coalesced message are passed to the function                *
+* Post-condition: The first message and any following messages to the same    *
+*                 block with contiguous references are merged into the        *
+*                 coalesced message.  The no. of messages merged is returned  *
+******************************************************************************/
+int coalesce_write_requests(pdsconn *conn, pdswrbatch *batch, int first,
+                            pdsmsg *merged);
 
 /******************************************************************************
 * Function to set tag's status words                                          *
@@ -516,7 +1175,10 @@ int write_to_plc(pdsconn *conn, pdsmsg *msg);
 * Pre-condition:  The connection struct and the PLC's status value are passed *
 *                 to the function                                             *
 * Post-condition: All tags on this PLC have their status words set to the     *
-*                 PLC's status value.  A count of updated tags is returned    *
+*                 PLC's status value.  Each changed tag is appended to the    *
+*                 change journal & clients are notified of each block whose   *
+*                 tags' statuses have changed.  A count of updated tags is    *
+*                 returned                                                    *
 ******************************************************************************/
 int set_tags_status(pdsconn *conn, unsigned short int status);
 
@@ -534,5 +1196,468 @@ int set_tags_status(pdsconn *conn, unsigned short int status);
 int reset_tags_status(pdsconn *conn, unsigned short int *status,
                       unsigned short int *errx);
 
+/******************************************************************************
+* Function to setup the PLC connection pool for this configuration            *
+*                                                                             *
+* Pre-condition:  The PLC configuration struct and the SPI connection struct  *
+*                 are passed to the function                                  *
+* Post-condition: An empty pool entry is created for each PLC in this         *
+*                 configuration and a pointer to the pool struct is returned. *
+*                 If an error occurs a null is returned                       *
+******************************************************************************/
+pdspool* setup_conn_pool(plc_cnf *conf, pds_spi_conn *spi_conn);
+
+/******************************************************************************
+* Function to close all pooled PLC connections and free the pool              *
+*                                                                             *
+* Pre-condition:  The pool struct is passed to the function                   *
+* Post-condition: Any open connections in the pool are closed and memory is   *
+*                 freed for the pool struct.  If an error occurs a -1 is      *
+*                 returned                                                    *
+******************************************************************************/
+int free_conn_pool(pdspool *pool);
+
+/******************************************************************************
+* Function to get the pool entry for the connection's PLC                     *
+*                                                                             *
+* Pre-condition:  The pool struct and the connection struct are passed to the *
+*                 function                                                    *
+* Post-condition: A pointer to the pool entry matching the PLC's              *
+*                 fully-qualified ID is returned or a null if this PLC is not *
+*                 in the pool                                                 *
+******************************************************************************/
+pdspoolconn* get_pool_conn(pdspool *pool, pdsconn *conn);
+
+/******************************************************************************
+* Function to acquire a connection to a PLC from the pool                     *
+*                                                                             *
+* Pre-condition:  The pool struct and the connection struct are passed to the *
+*                 function                                                    *
+* Post-condition: If the pool holds an open connection to the PLC it is       *
+*                 reused, otherwise a new connection is established, within   *
+*                 the PLC's connect timeout, and added to the pool.  The      *
+*                 connection's fd is set & a new connection's latency is      *
+*                 recorded.  If an error occurs a -1 is returned              *
+******************************************************************************/
+int acquire_plc_connection(pdspool *pool, pdsconn *conn);
+
+/******************************************************************************
+* Function to release a connection to a PLC back to the pool                  *
+*                                                                             *
+* Pre-condition:  The pool struct, the connection struct and the PLC's status *
+*                 value are passed to the function                            *
+* Post-condition: The status is fed to the PLC's circuit breaker.  The        *
+*                 connection is kept open for reuse unless the status shows a *
+*                 connection or comms error, or it's a serial port & the pool *
+*                 doesn't keep serial ports open, in which case it is closed  *
+*                 and dropped from the pool.  If an error occurs a -1 is      *
+*                 returned                                                    *
+******************************************************************************/
+int release_plc_connection(pdspool *pool, pdsconn *conn,
+                           unsigned short int status);
+
+/******************************************************************************
+* Function to close a pooled PLC connection                                   *
+*                                                                             *
+* Pre-condition:  The pool struct and the pool entry are passed to the        *
+*                 function                                                    *
+* Post-condition: The entry's connection is closed & marked as closed.  Any   *
+*                 entries sharing the same fd are also marked as closed.  If  *
+*                 an error occurs a -1 is returned                            *
+******************************************************************************/
+int close_pool_conn(pdspool *pool, pdspoolconn *pc);
+
+/******************************************************************************
+* Function to close all pooled serial PLC connections                         *
+*                                                                             *
+* Pre-condition:  The pool struct is passed to the function                   *
+* Post-condition: Any open serial port connections in the pool are closed, so *
+*                 that the port is free for use by the other process.  A      *
+*                 count of closed connections is returned                     *
+******************************************************************************/
+int close_serial_pool_conns(pdspool *pool);
+
+/******************************************************************************
+* Function to setup a PLC's circuit breaker                                   *
+*                                                                             *
+* Pre-condition:  The breaker, the SPI connection struct & the PLC's index in *
+*                 the configuration are passed to the function                *
+* Post-condition: The breaker is closed & is assigned the SPI tags that       *
+*                 configure it & expose its state.  If an error occurs a -1   *
+*                 is returned                                                 *
+******************************************************************************/
+int setup_plc_breaker(pdsbreaker *brk, pds_spi_conn *spi_conn, int plc_id);
+
+/******************************************************************************
+* Function to check if a PLC's circuit breaker lets a query through           *
+*                                                                             *
+* Pre-condition:  The breaker is passed to the function                       *
+* Post-condition: An open breaker whose backoff has expired is half-opened,   *
+*                 to let a trial query through.  The breaker's state is       *
+*                 returned.  Only an open breaker stops a query               *
+******************************************************************************/
+int check_plc_breaker(pdsbreaker *brk);
+
+/******************************************************************************
+* Function to update a PLC's circuit breaker with a query's outcome           *
+*                                                                             *
+* Pre-condition:  The connection struct, the PLC's breaker & the PLC's status *
+*                 after the query are passed to the function                  *
+* Post-condition: A connection or comms error counts as a failure, otherwise  *
+*                 the breaker is closed.  The breaker is opened by a failed   *
+*                 trial query or by too many consecutive failures, for a      *
+*                 backoff that doubles with each consecutive trip, upto a     *
+*                 max.  Half of the backoff is random, so that PLCs don't     *
+*                 retry in lock step.  The PLC's tags' status shows whether   *
+*                 the breaker is open.  The breaker's state is returned       *
+******************************************************************************/
+int update_plc_breaker(pdsconn *conn, pdsbreaker *brk,
+                       unsigned short int status);
+
+/******************************************************************************
+* Function to start the scan engine's worker processes                        *
+*                                                                             *
+* Pre-condition:  The PLC configuration struct, the connection structs & the  *
+*                 queries struct are passed to the function                   *
+* Post-condition: The queries of PLCs that can be scanned asynchronously are  *
+*                 marked as such & a worker process is forked for each shard  *
+*                 of these PLCs, to run them in the scan engine.  A pointer   *
+*                 to the workers struct is returned or a null on error        *
+******************************************************************************/
+pdsscanworkers* start_scan_workers(plc_cnf *conf, pdsconn *conn,
+                                   pds_spi_conn *spi_conn,
+                                   pdsqueries *queries);
+
+/******************************************************************************
+* Function to start a scan engine worker process                              *
+*                                                                             *
+* Pre-condition:  The workers struct, the worker's shard, the no. of shards & *
+*                 a pause (in secs) before it starts scanning are passed to   *
+*                 the function                                                *
+* Post-condition: A worker process is forked to run the shard's PLCs in the   *
+*                 scan engine.  The worker's pid is returned or -1 on error   *
+******************************************************************************/
+pid_t start_scan_worker(pdsscanworkers *workers, int shard, int nshards,
+                        int delay);
+
+/******************************************************************************
+* Function to stop the scan engine's worker processes                         *
+*                                                                             *
+* Pre-condition:  The workers struct is passed to the function                *
+* Post-condition: Each worker is terminated & waited for.  Memory is freed    *
+*                 for the workers struct.  The no. of workers stopped is      *
+*                 returned or a -1 on error                                   *
+******************************************************************************/
+int stop_scan_workers(pdsscanworkers *workers);
+
+/******************************************************************************
+* Function to check the scan engine's worker processes                        *
+*                                                                             *
+* Pre-condition:  The workers struct is passed to the function                *
+* Post-condition: Any of the read process' children that have exited are      *
+*                 reaped.  If a worker has exited, the tags of its shard's    *
+*                 PLCs have their status set to a comms error & the worker is *
+*                 restarted, after a pause.  The no. of workers restarted is  *
+*                 returned or a -1 on error                                   *
+******************************************************************************/
+int check_scan_workers(pdsscanworkers *workers);
+
+/******************************************************************************
+* Function to fail a shard's queries in the scan engine                       *
+*                                                                             *
+* Pre-condition:  The workers struct & the shard are passed to the function   *
+* Post-condition: Each of the shard's asynchronous queries has its status set *
+*                 to a comms error, as are its PLC's tags.  The no. of        *
+*                 queries failed is returned                                  *
+******************************************************************************/
+int fail_scan_shard(pdsscanworkers *workers, int shard);
+
+/******************************************************************************
+* Function to pin a scan worker process to a CPU                              *
+*                                                                             *
+* Pre-condition:  The worker's shard is passed to the function                *
+* Post-condition: The calling process is pinned to a CPU chosen by its shard, *
+*                 so that shards are spread across the online CPUs.  If an    *
+*                 error occurs a -1 is returned                               *
+******************************************************************************/
+int pin_scan_worker(int shard);
+
+/******************************************************************************
+* Function to run a scan worker process' shard of PLCs                        *
+*                                                                             *
+* Pre-condition:  The PLC configuration struct, the connection structs, the   *
+*                 queries struct, the worker's shard & the no. of shards are  *
+*                 passed to the function                                      *
+* Post-condition: The shard's scan engine is setup & its PLCs are             *
+*                 continuously scanned until the quit flag is set.  If an     *
+*                 error occurs a -1 is returned                               *
+******************************************************************************/
+int run_scan_worker(plc_cnf *conf, pdsconn *conn, pds_spi_conn *spi_conn,
+                    pdsqueries *queries, int shard, int nshards);
+
+/******************************************************************************
+* Function to setup the scan engine for a shard of PLCs                       *
+*                                                                             *
+* Pre-condition:  The PLC configuration struct, the connection structs, the   *
+*                 queries struct, the shard & the no. of shards are passed to *
+*                 the function                                                *
+* Post-condition: An entry is created for each PLC in the shard holding its   *
+*                 asynchronous queries & its pipeline, along with the shard's *
+*                 epoll fd & its timer wheel.  A pointer to the scan engine   *
+*                 struct is returned.  If an error occurs a null is returned  *
+******************************************************************************/
+pdsscan* setup_scan_engine(plc_cnf *conf, pdsconn *conn,
+                           pds_spi_conn *spi_conn, pdsqueries *queries,
+                           int shard, int nshards);
+
+/******************************************************************************
+* Function to free the scan engine                                            *
+*                                                                             *
+* Pre-condition:  The scan engine struct is passed to the function            *
+* Post-condition: Any open PLC connections & the epoll fd are closed and      *
+*                 memory is freed for the scan engine struct.  If an error    *
+*                 occurs a -1 is returned                                     *
+******************************************************************************/
+int free_scan_engine(pdsscan *scan);
+
+/******************************************************************************
+* Function to run the scan engine                                             *
+*                                                                             *
+* Pre-condition:  The connection struct & the scan engine struct are passed   *
+*                 to the function                                             *
+* Post-condition: Each PLC in the shard is continuously scanned, with up to   *
+*                 its pipeline depth of transactions in flight to each PLC at *
+*                 once.  Readiness of the PLCs' sockets is waited for in a    *
+*                 single epoll fd & timeouts & poll rates are run from the    *
+*                 timer wheel.  If an error occurs a -1 is returned           *
+******************************************************************************/
+int run_scan_engine(pdsconn *conn, pdsscan *scan);
+
+/******************************************************************************
+* Function to get the scan engine's current timer wheel tick                  *
+*                                                                             *
+* Pre-condition:  The scan engine struct is passed to the function            *
+* Post-condition: The no. of ticks elapsed since the timer wheel's epoch is   *
+*                 returned                                                    *
+******************************************************************************/
+unsigned int get_scan_tick(pdsscan *scan);
+
+/******************************************************************************
+* Function to arm a PLC's timer in the scan engine's timer wheel              *
+*                                                                             *
+* Pre-condition:  The scan engine struct, the PLC entry & the delay (in       *
+*                 usecs) are passed to the function                           *
+* Post-condition: Any armed timer is disarmed & the PLC is added to the slot  *
+*                 of the tick at which the delay expires.  A delay of longer  *
+*                 than a turn of the wheel is counted down in rounds.  The    *
+*                 slot is returned                                            *
+******************************************************************************/
+int arm_scan_timer(pdsscan *scan, pdsscanplc *plc, long usecs);
+
+/******************************************************************************
+* Function to disarm a PLC's timer in the scan engine's timer wheel           *
+*                                                                             *
+* Pre-condition:  The scan engine struct & the PLC entry are passed to the    *
+*                 function                                                    *
+* Post-condition: If armed, the PLC is removed from its timer wheel slot.     *
+*                 If an error occurs a -1 is returned                         *
+******************************************************************************/
+int disarm_scan_timer(pdsscan *scan, pdsscanplc *plc);
+
+/******************************************************************************
+* Function to expire the scan engine's timers                                 *
+*                                                                             *
+* Pre-condition:  The connection struct & the scan engine struct are passed   *
+*                 to the function                                             *
+* Post-condition: The timer wheel is advanced to the current tick.  Each PLC  *
+*                 whose timer expires on a passed tick either starts its next *
+*                 query or has its transaction in flight timed out.  The no.  *
+*                 of expired timers is returned                               *
+******************************************************************************/
+int expire_scan_timers(pdsconn *conn, pdsscan *scan);
+
+/******************************************************************************
+* Function to handle a PLC's expired timer                                    *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct & the PLC     *
+*                 entry are passed to the function                            *
+* Post-condition: An idle PLC has its pipeline filled with its next queries.  *
+*                 Otherwise the PLC's connection attempt or its oldest        *
+*                 transaction in flight has timed out, so the PLC's status is *
+*                 set accordingly.  If an error occurs a -1 is returned       *
+******************************************************************************/
+int handle_scan_timeout(pdsconn *conn, pdsscan *scan, pdsscanplc *plc);
+
+/******************************************************************************
+* Function to handle an event on a PLC's socket                               *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct, the PLC      *
+*                 entry & the epoll events are passed to the function         *
+* Post-condition: The PLC's transactions in flight are progressed according   *
+*                 to its state.  A completed connection's latency is          *
+*                 recorded.  If an error occurs a -1 is returned              *
+******************************************************************************/
+int handle_scan_event(pdsconn *conn, pdsscan *scan, pdsscanplc *plc,
+                      unsigned int events);
+
+/******************************************************************************
+* Function to assign a scan engine query's properties to the connection       *
+*                                                                             *
+* Pre-condition:  The connection struct & the query are passed to the         *
+*                 function                                                    *
+* Post-condition: The connection's PLC properties are those of the query's    *
+*                 PLC                                                         *
+******************************************************************************/
+void set_scan_query_conn(pdsconn *conn, pdsquery *query);
+
+/******************************************************************************
+* Function to fill a PLC's pipeline with its next queries in the scan engine  *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct & the PLC     *
+*                 entry are passed to the function                            *
+* Post-condition: A transaction is setup for each of the PLC's next queries,  *
+*                 until its pipeline depth are in flight.  Unless a status    *
+*                 condition exists on the PLC, or its circuit breaker is      *
+*                 open, each query is queued to be sent, first connecting to  *
+*                 the PLC if necessary.  The queued queries are sent          *
+*                 back-to-back.  If an error occurs a -1 is returned          *
+******************************************************************************/
+int fill_scan_pipeline(pdsconn *conn, pdsscan *scan, pdsscanplc *plc);
+
+/******************************************************************************
+* Function to start connecting to a PLC in the scan engine                    *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct & the PLC     *
+*                 entry are passed to the function                            *
+* Post-condition: A non-blocking connection to the PLC is started & its       *
+*                 socket is added to the epoll fd, to wait for the connection *
+*                 to complete, upto the PLC's connect timeout.  If an error   *
+*                 occurs a -1 is returned                                     *
+******************************************************************************/
+int connect_scan_plc(pdsconn *conn, pdsscan *scan, pdsscanplc *plc);
+
+/******************************************************************************
+* Function to fail a connection to a PLC in the scan engine                   *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct & the PLC     *
+*                 entry are passed to the function                            *
+* Post-condition: The PLC's status is set to show a connection error & is fed *
+*                 to its circuit breaker.  Its socket is closed & its next    *
+*                 query is scheduled.  If an error occurs a -1 is returned    *
+******************************************************************************/
+int fail_scan_connect(pdsconn *conn, pdsscan *scan, pdsscanplc *plc);
+
+/******************************************************************************
+* Function to write a PLC's queued queries to its socket in the scan engine   *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct & the PLC     *
+*                 entry are passed to the function                            *
+* Post-condition: As much of the queued queries as the socket will take is    *
+*                 sent.  The PLC waits for its responses & if any queries are *
+*                 left unsent, for the socket to be writable.  If an error    *
+*                 occurs a -1 is returned                                     *
+******************************************************************************/
+int write_scan_queries(pdsconn *conn, pdsscan *scan, pdsscanplc *plc);
+
+/******************************************************************************
+* Function to read a PLC's responses from its socket in the scan engine       *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct & the PLC     *
+*                 entry are passed to the function                            *
+* Post-condition: Any available data is appended to the received responses.   *
+*                 Each whole response, as given by its ModBus/TCP header      *
+*                 length, is matched to its transaction in flight by its      *
+*                 header transaction ID & the transaction is completed.  A    *
+*                 response that matches no transaction in flight, such as a   *
+*                 late response, is discarded.  If an error occurs a -1 is    *
+*                 returned                                                    *
+******************************************************************************/
+int read_scan_responses(pdsconn *conn, pdsscan *scan, pdsscanplc *plc);
+
+/******************************************************************************
+* Function to complete a PLC's transaction in the scan engine                 *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct, the PLC      *
+*                 entry, the transaction's slot & the no. of bytes in the     *
+*                 response (or -1 on error) are passed to the function        *
+* Post-condition: The response is checked & the block's tags are refreshed    *
+*                 from it.  The outcome is fed to the PLC's circuit breaker.  *
+*                 On error, the PLC's status is set & its socket is closed,   *
+*                 abandoning its other transactions in flight.  The PLC's     *
+*                 next query is scheduled.  If an error occurs a -1 is        *
+*                 returned                                                    *
+******************************************************************************/
+int complete_scan_query(pdsconn *conn, pdsscan *scan, pdsscanplc *plc,
+                        pdsscanslot *slot, short int nbytes);
+
+/******************************************************************************
+* Function to schedule a PLC's next query in the scan engine                  *
+*                                                                             *
+* Pre-condition:  The connection struct, the scan engine struct, the PLC      *
+*                 entry & the query just done are passed to the function      *
+* Post-condition: With a pipeline depth of 1, the PLC's timer is armed for    *
+*                 the query's poll rate, plus the refresh mode's pause.  With *
+*                 a deeper pipeline, the pipeline is refilled at once & the   *
+*                 timer is only armed at the end of a scan cycle, for the     *
+*                 PLC's longest poll rate.  At the end of a scan cycle, the   *
+*                 cycle time is recorded & the shard's slowest PLC's cycle    *
+*                 time is published, as is the slowest shard's.  If an error  *
+*                 occurs a -1 is returned                                     *
+******************************************************************************/
+int next_scan_query(pdsconn *conn, pdsscan *scan, pdsscanplc *plc,
+                    pdsquery *query);
+
+/******************************************************************************
+* Function to get a PLC's transaction in flight by its transaction ID         *
+*                                                                             *
+* Pre-condition:  The PLC entry & the transaction ID are passed to the        *
+*                 function                                                    *
+* Post-condition: A pointer to the transaction's slot is returned or a null   *
+*                 if no transaction in flight has the ID                      *
+******************************************************************************/
+pdsscanslot* get_scan_slot(pdsscanplc *plc, unsigned short int trans_id);
+
+/******************************************************************************
+* Function to get a PLC's oldest transaction in flight                        *
+*                                                                             *
+* Pre-condition:  The PLC entry is passed to the function                     *
+* Post-condition: A pointer to the slot of the transaction with the earliest  *
+*                 deadline is returned or a null if none are in flight        *
+******************************************************************************/
+pdsscanslot* get_oldest_scan_slot(pdsscanplc *plc);
+
+/******************************************************************************
+* Function to arm a PLC's timer for its oldest transaction's deadline         *
+*                                                                             *
+* Pre-condition:  The scan engine struct & the PLC entry are passed to the    *
+*                 function                                                    *
+* Post-condition: The PLC's timer is armed to expire at the deadline of its   *
+*                 oldest transaction in flight.  The timer's slot is returned *
+*                 or a -1 if no transactions are in flight                    *
+******************************************************************************/
+int arm_scan_deadline(pdsscan *scan, pdsscanplc *plc);
+
+/******************************************************************************
+* Function to set the events to wait for on a PLC's socket                    *
+*                                                                             *
+* Pre-condition:  The scan engine struct, the PLC entry & the epoll events    *
+*                 are passed to the function                                  *
+* Post-condition: The PLC's socket is watched for the given events in the     *
+*                 epoll fd.  If an error occurs a -1 is returned              *
+******************************************************************************/
+int watch_scan_plc(pdsscan *scan, pdsscanplc *plc, unsigned int events);
+
+/******************************************************************************
+* Function to close a PLC's socket in the scan engine                         *
+*                                                                             *
+* Pre-condition:  The scan engine struct & the PLC entry are passed to the    *
+*                 function                                                    *
+* Post-condition: Any transactions in flight are abandoned & counted as done. *
+*                 If open, the PLC's socket is removed from the epoll fd,     *
+*                 closed & marked as closed.  The PLC is left idle.  If an    *
+*                 error occurs a -1 is returned                               *
+******************************************************************************/
+int close_scan_plc(pdsscan *scan, pdsscanplc *plc);
+
 #endif
 
@@ -11,35 +11,189 @@
 extern int errout;                /* Declared in the main file */
 
 /******************************************************************************
-* Function to open a TCP/IP socket connection                                 *
+* Function to resolve a PLC's network address                                 *
 *                                                                             *
-* Pre-condition:  Host name (or IP address) and port number are passed to the *
-*                 function                                                    *
-* Post-condition: Socket connection is established with host, socket file     *
-*                 descriptor is returned or -1 on error                       *
+* Pre-condition:  Host name (or IP address), port number & storage for the    *
+*                 socket address are passed to the function                   *
+* Post-condition: The host is resolved and the socket address is stored in    *
+*                 addr.  On error a -1 is returned                            *
 ******************************************************************************/
-int open_plc_socket(char *host, unsigned short port)
+int resolve_plc_address(char *host, unsigned short port,
+                        struct sockaddr_in *addr)
 {
-  int sockfd = -1;
   struct hostent *hostinfo = NULL;
-  extern int h_errno;
 
-  /* Create and connect to socket */
-  if((sockfd = open_client_socket(host, port)) == -1)
+  if(!(hostinfo = (struct hostent *) gethostbyname(host)))
   {
-    err(errout, "error opening client socket to PLC '%s'\n", host);
+    err(errout, "error resolving host info for host '%s'\n", host);
+    return -1;
+  }
 
-    if(h_errno != 0)
-    {
-      err(errout, "error resolving host info for host '%s'\n", host);
-    }
+  memset(addr, 0, sizeof(struct sockaddr_in));
+  addr->sin_family = AF_INET;
+  addr->sin_addr = *(struct in_addr *) *hostinfo->h_addr_list;
+  addr->sin_port = htons(port);
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to start a non-blocking TCP/IP socket connection                   *
+*                                                                             *
+* Pre-condition:  A socket address, as returned by resolve_plc_address(), is  *
+*                 passed to the function                                      *
+* Post-condition: A non-blocking socket is created & its connection to host   *
+*                 is started.  The connection may still be in progress, in    *
+*                 which case the socket becomes writable once it completes.   *
+*                 Socket file descriptor is returned or -1 on error           *
+******************************************************************************/
+int open_plc_socket_nb(struct sockaddr_in *addr)
+{
+  int sockfd = -1, flags = 0;
+
+  /* Create a non-blocking socket */
+  if((sockfd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+  {
+    err(errout, "error creating client socket to PLC '%s'\n",
+    inet_ntoa(addr->sin_addr));
+    return -1;
   }
 
+  if((flags = fcntl(sockfd, F_GETFL, 0)) == -1 ||
+     fcntl(sockfd, F_SETFL, (flags | O_NONBLOCK)) == -1)
+  {
+    err(errout, "error setting client socket to PLC '%s' non-blocking\n",
+    inet_ntoa(addr->sin_addr));
+    close(sockfd);
+    return -1;
+  }
+
+  /* Start the connection.  The caller waits for it to complete */
+  if(connect(sockfd, (struct sockaddr *) addr, sizeof(struct sockaddr_in)) == -1 &&
+     errno != EINPROGRESS)
+  {
+    err(errout, "error opening client socket to PLC '%s'\n",
+    inet_ntoa(addr->sin_addr));
+    close(sockfd);
+    return -1;
+  }
+
+  set_plc_socket_opts(sockfd);
+
   return sockfd;
 }
 
 
 
+/******************************************************************************
+* Function to open a TCP/IP socket connection within a timeout                *
+*                                                                             *
+* Pre-condition:  A socket address, as returned by resolve_plc_address(), and *
+*                 the connect timeout (in usecs) are passed to the function   *
+* Post-condition: Socket connection is established with host, unless it does  *
+*                 not complete within the timeout.  The socket is returned to *
+*                 blocking mode.  Socket file descriptor is returned or -1 on *
+*                 error                                                       *
+******************************************************************************/
+int open_plc_socket_tmo(struct sockaddr_in *addr, long tmo)
+{
+  int sockfd = -1, flags = 0, soerr = 0, retval = 0;
+  socklen_t len = sizeof(soerr);
+  struct pollfd pfd;
+
+  /* N.B.: A PLC that silently drops SYNs would otherwise block us for the
+           kernel's full SYN retry time */
+  if((sockfd = open_plc_socket_nb(addr)) == -1)
+    return -1;
+
+  pfd.fd = sockfd;
+  pfd.events = POLLOUT;
+
+  /* N.B.: A negative timeout would have poll() wait indefinitely */
+  if(tmo < 0)
+    tmo = 0;
+
+  do
+  {
+    retval = poll(&pfd, 1, (int) ((tmo + 999L) / 1000L));
+  }
+  while(retval == -1 && errno == EINTR);
+
+  if(retval == 0)
+  {
+    err(errout, "timed out opening client socket to PLC '%s'\n",
+    inet_ntoa(addr->sin_addr));
+    close(sockfd);
+    return -1;
+  }
+
+  if(retval == -1 ||
+     getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &soerr, &len) == -1 ||
+     soerr != 0)
+  {
+    err(errout, "error opening client socket to PLC '%s'\n",
+    inet_ntoa(addr->sin_addr));
+    close(sockfd);
+    return -1;
+  }
+
+  /* The drivers expect a blocking socket */
+  if((flags = fcntl(sockfd, F_GETFL, 0)) == -1 ||
+     fcntl(sockfd, F_SETFL, (flags & ~O_NONBLOCK)) == -1)
+  {
+    err(errout, "error setting client socket to PLC '%s' blocking\n",
+    inet_ntoa(addr->sin_addr));
+    close(sockfd);
+    return -1;
+  }
+
+  return sockfd;
+}
+
+
+
+/******************************************************************************
+* Function to set the socket options of a PLC connection                      *
+*                                                                             *
+* Pre-condition:  A TCP/IP socket file descriptor is passed to the function   *
+* Post-condition: Nagle's algorithm is disabled, as queries are small &       *
+*                 latency sensitive, & keepalives are enabled, so that a dead *
+*                 PLC is detected on an idle connection.  If an error occurs  *
+*                 a -1 is returned                                            *
+******************************************************************************/
+int set_plc_socket_opts(int sockfd)
+{
+  int sopt = 1, retval = 0;
+
+  if(setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &sopt, sizeof(int)) == -1)
+  {
+    err(errout, "error setting TCP_NODELAY on client socket to PLC\n");
+    retval = -1;
+  }
+
+  if(setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, &sopt, sizeof(int)) == -1)
+  {
+    err(errout, "error setting SO_KEEPALIVE on client socket to PLC\n");
+    retval = -1;
+  }
+
+#ifdef TCP_KEEPIDLE
+  /* N.B.: The default keepalive time is 2 hours, far too long for a PLC */
+  sopt = PDS_KEEPALIVE_IDLE;
+  setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPIDLE, &sopt, sizeof(int));
+  sopt = PDS_KEEPALIVE_INTVL;
+  setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPINTVL, &sopt, sizeof(int));
+  sopt = PDS_KEEPALIVE_CNT;
+  setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPCNT, &sopt, sizeof(int));
+#endif
+
+  return retval;
+}
+
+
+
 /******************************************************************************
 * Function to open a serial TTY device port                                   *
 *                                                                             *
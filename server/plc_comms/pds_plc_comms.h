@@ -15,15 +15,19 @@
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
+#include <arpa/inet.h>
 
 #include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <unistd.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <sys/fcntl.h>
+#include <poll.h>
 #include <termios.h>
 
 /******************************************************************************
@@ -46,19 +50,60 @@
 
 #define PDS_TTY_RD_PAUSE	5000
 
+/* Keepalive settings for PLC connections */
+#define PDS_KEEPALIVE_IDLE	10     /* secs idle before first probe */
+#define PDS_KEEPALIVE_INTVL	5      /* secs between probes */
+#define PDS_KEEPALIVE_CNT	3      /* Unanswered probes to drop */
+
 /******************************************************************************
 * Function prototypes                                                         *
 ******************************************************************************/
 
 /******************************************************************************
-* Function to open a TCP/IP socket connection                                 *
+* Function to resolve a PLC's network address                                 *
 *                                                                             *
-* Pre-condition:  Host name (or IP address) and port number are passed to the *
-*                 function                                                    *
-* Post-condition: Socket connection is established with host, socket file     *
-*                 descriptor is returned or -1 on error                       *
+* Pre-condition:  Host name (or IP address), port number & storage for the    *
+*                 socket address are passed to the function                   *
+* Post-condition: The host is resolved and the socket address is stored in    *
+*                 addr.  On error a -1 is returned                            *
+******************************************************************************/
+int resolve_plc_address(char *host, unsigned short port,
+                        struct sockaddr_in *addr);
+
+/******************************************************************************
+* Function to start a non-blocking TCP/IP socket connection                   *
+*                                                                             *
+* Pre-condition:  A socket address, as returned by resolve_plc_address(), is  *
+*                 passed to the function                                      *
+* Post-condition: A non-blocking socket is created & its connection to host   *
+*                 is started.  The connection may still be in progress, in    *
+*                 which case the socket becomes writable once it completes.   *
+*                 Socket file descriptor is returned or -1 on error           *
+******************************************************************************/
+int open_plc_socket_nb(struct sockaddr_in *addr);
+
+/******************************************************************************
+* Function to open a TCP/IP socket connection within a timeout                *
+*                                                                             *
+* Pre-condition:  A socket address, as returned by resolve_plc_address(), and *
+*                 the connect timeout (in usecs) are passed to the function   *
+* Post-condition: Socket connection is established with host, unless it does  *
+*                 not complete within the timeout.  The socket is returned to *
+*                 blocking mode.  Socket file descriptor is returned or -1 on *
+*                 error                                                       *
+******************************************************************************/
+int open_plc_socket_tmo(struct sockaddr_in *addr, long tmo);
+
+/******************************************************************************
+* Function to set the socket options of a PLC connection                      *
+*                                                                             *
+* Pre-condition:  A TCP/IP socket file descriptor is passed to the function   *
+* Post-condition: Nagle's algorithm is disabled, as queries are small &       *
+*                 latency sensitive, & keepalives are enabled, so that a dead *
+*                 PLC is detected on an idle connection.  If an error occurs  *
+*                 a -1 is returned                                            *
 ******************************************************************************/
-int open_plc_socket(char *host, unsigned short port);
+int set_plc_socket_opts(int sockfd);
 
 /******************************************************************************
 * Function to connect to PLC network socket                                   *
@@ -40,6 +40,7 @@
 #define PLC_CNF_PLC_ADDR_LEN	PDS_PLC_ADDR_LEN
 #define PLC_CNF_PLC_REF_LEN	PDS_PLC_REF_LEN
 #define PLC_CNF_PLC_PATH_LEN	PDS_PLC_PATH_LEN
+#define PLC_CNF_MAX_HISTORY	65536
 
 /******************************************************************************
 * Stucture definitions                                                        *
@@ -72,6 +73,8 @@ typedef struct plc_cnf_block_rec
   unsigned int base_addr;                   /* Block's base address */
   char ascii_addr[PLC_CNF_PLC_ADDR_LEN];    /* Block's logical address */
   int pollrate;                             /* Block's poll rate (in usecs) */
+  unsigned short int depth;                 /* PLC's pipeline depth (opt.) */
+  unsigned int history;                     /* Samples kept per tag (opt.) */
   unsigned short int ntags;                 /* No. of tags in this block */
 
   /******************* The tags configured for this block ********************/
@@ -88,6 +91,7 @@ typedef struct plc_cnf_plc_rec
   unsigned short int port;                  /* TCP port */
   char tty_dev[PLC_CNF_TTY_DEV_LEN];        /* TTY device (string) */
   char path[PLC_CNF_PLC_PATH_LEN];          /* Routing path (string) */
+  unsigned short int depth;                 /* Pipeline depth (0 = default) */
 } plc_cnf_plc;
 
 /******************************************************************************
@@ -56,7 +56,7 @@ int main(int argc, char *argv[])
           printf("%-49s|%19s|%10d\n", tmpstr, p->ascii_addr, p->ref);
         break;
       }
-      conn->plc_status |= p->status;   /* Set the query's status */
+      conn->plc_status |= PDStag_get_status(p); /* Set the query's status */
     }
     UNDERLINE(80);
 
@@ -73,7 +73,7 @@ int main(int argc, char *argv[])
       else
         sprintf(tmpstr, "%s:%d:%s %s", p->ip_addr, p->port, p->path, p->name);
 
-      printf("%-49s|%19d|%10s\n", tmpstr, p->status, p->path);
+      printf("%-49s|%19d|%10s\n", tmpstr, PDStag_get_status(p), p->path);
     }
     UNDERLINE(80);
 
@@ -49,17 +49,17 @@ int main(int argc, char *argv[])
         break;
 
         case 's' :                /* The set (value) operation */
-          p->status = args.tagvalue;
+          PDS_TAG_STATUS(conn, p) = args.tagvalue;
           printf("%hu\n", PDStag_get_status(p));
         break;
 
         case 'b' :                /* The set (bit) operation */
-          p->status |= args.tagvalue;
+          PDS_TAG_STATUS(conn, p) |= args.tagvalue;
           printf("%hu\n", PDStag_get_status(p));
         break;
 
         case 'c' :                /* The clear (bit) operation */
-          p->status &= args.tagvalue;
+          PDS_TAG_STATUS(conn, p) &= args.tagvalue;
           printf("%hu\n", PDStag_get_status(p));
         break;
       }
@@ -0,0 +1,563 @@
+/******************************************************************************
+* PROJECT:  PDS Utilities                                                     *
+* MODULE:   hist.c                                                            *
+* PURPOSE:  Historian - archives the tags' changes, as read from the server's *
+*           change journal, to rolling memory-mapped columnar files           *
+* AUTHOR:   Paul M. Breen                                                     *
+* DATE:     2026-10-17                                                        *
+******************************************************************************/
+
+#include "hist.h"
+
+/******************************************************************************
+* Globals                                                                     *
+******************************************************************************/
+int quit_flag = 0;                /* Global quit flag */
+int errout = ERR_PRN;             /* Error output (stderr or log file) */
+
+/******************************************************************************
+* The main function.                                                          *
+******************************************************************************/
+int main(int argc, char *argv[])
+{
+  pdsconn *conn = NULL;
+  hist_args args;
+  hist_arch arch;
+  char logfile[PATH_MAX] = "\0";
+  int retval = 0;
+
+  memset(&args, 0, sizeof(hist_args));
+  strcpy(args.dir, HIST_DEF_DIR);
+  args.capacity = HIST_DEF_CAPACITY;
+  args.span = HIST_DEF_SPAN;
+
+  parse_hist_cmdln(argc, argv, &args);
+
+  if(args.capacity < HIST_MIN_CAPACITY || args.capacity > HIST_MAX_CAPACITY ||
+     args.span < 1)
+  {
+    fprintf(stderr, "Usage: %s [-d dir] [-n capacity] [-s span] [-D]\n", PROGNAME);
+    fprintf(stderr, "%s: capacity must be %d-%d records & span >= 1 sec\n", PROGNAME, HIST_MIN_CAPACITY, HIST_MAX_CAPACITY);
+    exit(1);
+  }
+
+  /* When running as a daemon, errors are logged in the archive directory */
+  if(args.daemon)
+  {
+    sprintf(logfile, "%s/%s", args.dir, HIST_LOGFILE);
+
+    if(daemonise() == -1 || !err_openlog(logfile, ERR_FILEMODE))
+    {
+      fprintf(stderr, "%s: error starting as a daemon\n", PROGNAME);
+      exit(1);
+    }
+    errout = ERR_LOG;
+  }
+
+  install_signal_handler();
+
+  /* Connect to the server */
+  if(!(conn = (pdsconn *) PDSconnect(PDS_IPCKEY)))
+  {
+    err(errout, "%s: PDS memory allocation error\n", PROGNAME);
+    exit(1);
+  }
+
+  if(PDScheck_conn_status(conn) == PDS_CONN_OK)
+  {
+    memset(&arch, 0, sizeof(hist_arch));
+    strcpy(arch.dir, args.dir);
+    arch.capacity = args.capacity;
+    arch.span_ns = args.span * 1000000000ULL;
+    arch.fd = -1;
+    arch.ntags = PDSconn_get_ttags(conn);
+    arch.tags = PDSconn_get_data(conn);
+
+    if((arch.values = calloc(arch.ntags, sizeof(unsigned short int))) &&
+       (arch.statuses = calloc(arch.ntags, sizeof(unsigned short int))))
+    {
+      retval = archive_changes(conn, &arch);
+      close_archive_file(&arch);
+    }
+    else
+    {
+      err(errout, "%s: memory allocation error\n", PROGNAME);
+      retval = -1;
+    }
+
+    if(arch.values) free(arch.values);
+    if(arch.statuses) free(arch.statuses);
+
+    PDSdisconnect(conn);
+  }
+  else
+  {
+    err(errout, "%s: error connecting to the PDS\n", PROGNAME);
+    err(errout, "%s: %s\n", PROGNAME, PDSprint_conn_status(conn));
+    exit(1);
+  }
+
+  if(args.daemon)
+    err_closelog();
+
+  return (retval == -1 ? 1 : 0);
+}
+
+
+
+/******************************************************************************
+* Function to parse the command line arguments                                *
+*                                                                             *
+* Pre-condition:  The command line arguments and a struct for storage are     *
+*                 passed to the function                                      *
+* Post-condition: Arguments are parsed and if found are stored in the         *
+*                 appropriate member of the structure                         *
+******************************************************************************/
+int parse_hist_cmdln(int argc, char *argv[], hist_args *args)
+{
+  int opt = 0;
+  extern char *optarg;
+  extern int opterr, optind;
+
+  opterr = 0;                     /* Turn off getopt()'s error messages */
+
+  while((opt = getopt(argc, argv, "d:n:s:D")) != -1)
+  {
+    switch(opt)
+    {
+      case 'd' :                  /* The archive directory */
+        strncpy(args->dir, optarg, PATH_MAX - 1);
+      break;
+
+      case 'n' :                  /* The max. no. of records per file */
+        args->capacity = (unsigned int) strtoul(optarg, NULL, 10);
+      break;
+
+      case 's' :                  /* The max. span of a file (secs) */
+        args->span = atoi(optarg);
+      break;
+
+      case 'D' :                  /* Run as a daemon */
+        args->daemon = 1;
+      break;
+
+      /* Option should be followed by a command line argument */
+      case ':' :
+        fputs("Option should take an argument\n", stderr);
+      break;
+
+      /* Unknown option */
+      case '?' :
+        fputs("Unknown option\n", stderr);
+      break;
+    }
+  }
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to install a signal handler                                        *
+*                                                                             *
+* Pre-condition:  Program is running, signal is received                      *
+* Post-condition: Signal handler is called                                    *
+******************************************************************************/
+void install_signal_handler()
+{
+  signal(SIGTERM, set_quit);
+  signal(SIGINT, set_quit);
+  signal(SIGQUIT, set_quit);
+}
+
+
+
+/******************************************************************************
+* Function to handle quit signals                                             *
+*                                                                             *
+* Pre-condition:  Signal has been received                                    *
+* Post-condition: Quit flag is set, signal handler is re-installed            *
+******************************************************************************/
+void set_quit()
+{
+  quit_flag = 1;
+  install_signal_handler();
+}
+
+
+
+/******************************************************************************
+* Function to archive the changes to the tags                                 *
+*                                                                             *
+* Pre-condition:  A valid server connection & the archive are passed to the   *
+*                 function                                                    *
+* Post-condition: The tags' changes are read from the server's change journal *
+*                 & appended to the archive, until the quit flag is set.  If  *
+*                 the journal overruns, the tags are read afresh & any        *
+*                 changes archived.  On error a -1 is returned                *
+******************************************************************************/
+int archive_changes(pdsconn *conn, hist_arch *arch)
+{
+  pdschange *changes = NULL;
+  pdshandle *handles = NULL;
+  unsigned long long seq = 0, now_ns = 0;
+  int nhandles = 0, n = 0, retval = 0;
+  register int i = 0;
+
+  if(!(changes = malloc(HIST_BATCH * sizeof(pdschange))) ||
+     !(handles = malloc(arch->ntags * sizeof(pdshandle))))
+  {
+    err(errout, "%s: memory allocation error\n", PROGNAME);
+    if(changes) free(changes);
+    return -1;
+  }
+
+  /* We wait on each block (or status tag) via a handle on its 1st tag */
+  for(i = 0; i < arch->ntags; i++)
+  {
+    if(i == 0 || arch->tags[i].block_id != arch->tags[i - 1].block_id)
+      handles[nhandles++] = PDS_MAKE_HANDLE(conn->gen, i);
+  }
+
+  /* Take the journal's position before reading the tags, so that any change
+     made whilst reading them is still read from the journal */
+  seq = PDSget_change_seq(conn);
+  now_ns = get_time_ns();
+
+  /* The tags' values now are the 1st file's base values */
+  if(resync_tags(conn, arch, now_ns) == -1 || open_archive_file(arch, now_ns) == -1)
+    retval = -1;
+
+  while(!quit_flag && retval != -1)
+  {
+    n = PDSget_changes_since(conn, seq, changes, HIST_BATCH);
+    now_ns = get_time_ns();
+
+    if(n == PDS_JOURNAL_OVERRUN)
+    {
+      /* We've fallen too far behind, so we skip to the journal's head & read
+         the tags afresh.  Any intermediate changes are lost */
+      err(errout, "%s: change journal overrun, reading the tags afresh\n", PROGNAME);
+      seq = PDSget_change_seq(conn);
+
+      if(resync_tags(conn, arch, now_ns) == -1)
+        retval = -1;
+    }
+    else if(n == -1)
+    {
+      err(errout, "%s: error reading the change journal\n", PROGNAME);
+      retval = -1;
+    }
+    else
+    {
+      /* N.B.: The records are stamped with the time they were read (rather
+               than the tag's mtime, which only has a resolution of 1 sec) */
+      for(i = 0; i < n && retval != -1; i++)
+        retval = append_change(arch, changes[i].id, changes[i].value, changes[i].status, now_ns);
+
+      if(n > 0)
+        seq = changes[n - 1].seq;
+    }
+
+    /* Make the appended records visible to readers */
+    commit_archive_file(arch);
+
+    /* Only wait once the journal has been drained.  N.B.: The timeout lets
+       us periodically check the quit flag */
+    if(retval != -1 && n < HIST_BATCH)
+    {
+      if(PDSwait_for_change(conn, handles, nhandles, HIST_WAIT_TMO) == -1)
+      {
+        err(errout, "%s: error waiting for a change to the tags\n", PROGNAME);
+        retval = -1;
+      }
+    }
+  }
+
+  free(changes);
+  free(handles);
+
+  return retval;
+}
+
+
+
+/******************************************************************************
+* Function to read the tags afresh                                            *
+*                                                                             *
+* Pre-condition:  A valid server connection, the archive & the time now are   *
+*                 passed to the function                                      *
+* Post-condition: Each tag's value & status are read from the server & any    *
+*                 that differ from the last archived are appended to the      *
+*                 archive.  The no. of changes appended is returned.  On      *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+int resync_tags(pdsconn *conn, hist_arch *arch, unsigned long long now_ns)
+{
+  unsigned short int value = 0, status = 0;
+  register int i = 0;
+  int nchanged = 0;
+
+  for(i = 0; i < arch->ntags; i++)
+  {
+    if(PDSget_tag_h(conn, PDS_MAKE_HANDLE(conn->gen, i), &value, &status) == -1)
+    {
+      err(errout, "%s: error reading tag %s\n", PROGNAME, arch->tags[i].name);
+      return -1;
+    }
+
+    /* If no file is open, these are just the base values for the next */
+    if(!arch->hdr)
+    {
+      arch->values[i] = value;
+      arch->statuses[i] = status;
+    }
+    else if(value != arch->values[i] || status != arch->statuses[i])
+    {
+      if(append_change(arch, i, value, status, now_ns) == -1)
+        return -1;
+
+      nchanged++;
+    }
+  }
+
+  return nchanged;
+}
+
+
+
+/******************************************************************************
+* Function to start a new archive file                                        *
+*                                                                             *
+* Pre-condition:  The archive & the time now are passed to the function       *
+* Post-condition: Any current archive file is closed & a new file is created, *
+*                 sized for the archive's capacity & mapped.  The file's tag  *
+*                 index holds the tags' last archived values.  On error a -1  *
+*                 is returned                                                 *
+******************************************************************************/
+int open_archive_file(hist_arch *arch, unsigned long long now_ns)
+{
+  pdsarch_hdr hdr;
+  pdsarch_tag *tags = NULL;
+  char tmstamp[PDS_ARCH_FILE_TMSTAMP_LEN] = "\0";
+  char path[PATH_MAX] = "\0";
+  time_t now = (time_t) (now_ns / 1000000000ULL);
+  size_t page = getpagesize();
+  void *p = NULL;
+  register int i = 0;
+  int fd = -1;
+
+  if(arch->hdr && close_archive_file(arch) == -1)
+    return -1;
+
+  /* Each region starts on a page, & the value column allows for the largest
+     delta of each record.  N.B.: Until written, the columns take no disk
+     space, as the file is sparse */
+  memset(&hdr, 0, sizeof(pdsarch_hdr));
+  hdr.magic = PDS_ARCH_MAGIC;
+  hdr.version = PDS_ARCH_VERSION;
+  hdr.ntags = arch->ntags;
+  hdr.capacity = arch->capacity;
+  hdr.first_ns = now_ns;
+  hdr.last_ns = now_ns;
+  hdr.tags = PDS_ARCH_HDR_LEN;
+  hdr.times = PDS_ARCH_ALIGN(hdr.tags + (arch->ntags * sizeof(pdsarch_tag)), page);
+  hdr.ids = PDS_ARCH_ALIGN(hdr.times + (arch->capacity * sizeof(unsigned long long)), page);
+  hdr.statuses = PDS_ARCH_ALIGN(hdr.ids + (arch->capacity * sizeof(unsigned int)), page);
+  hdr.values = PDS_ARCH_ALIGN(hdr.statuses + (arch->capacity * sizeof(unsigned short int)), page);
+  hdr.size = PDS_ARCH_ALIGN(hdr.values + (arch->capacity * PDS_ARCH_DELTA_MAXLEN), page);
+
+  strftime(tmstamp, PDS_ARCH_FILE_TMSTAMP_LEN, PDS_ARCH_FILE_TMSTAMP_FMT, gmtime(&now));
+
+  /* Never overwrite an existing file (e.g., from a previous run started
+     within the same second) */
+  do
+  {
+    sprintf(path, PDS_ARCH_FILE_FMT, arch->dir, tmstamp, arch->nfiles++);
+  }
+  while((fd = open(path, O_RDWR | O_CREAT | O_EXCL, PDS_ARCH_FILE_MODE)) == -1 &&
+        errno == EEXIST);
+
+  if(fd == -1)
+  {
+    err(errout, "%s: error creating archive file %s: %s\n", PROGNAME, path, strerror(errno));
+    return -1;
+  }
+
+  if(ftruncate(fd, hdr.size) == -1 ||
+     (p = mmap(NULL, hdr.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+  {
+    err(errout, "%s: error sizing/mapping archive file %s: %s\n", PROGNAME, path, strerror(errno));
+    close(fd);
+    unlink(path);
+    return -1;
+  }
+
+  arch->fd = fd;
+  arch->hdr = (pdsarch_hdr *) p;
+  arch->nrecs = 0;
+  arch->nvalue_bytes = 0;
+  arch->last_ns = now_ns;
+
+  /* The tag index is written before the header, so a reader that sees the
+     magic no. sees a complete index */
+  tags = (pdsarch_tag *) ((char *) p + hdr.tags);
+
+  for(i = 0; i < arch->ntags; i++)
+  {
+    strncpy(tags[i].name, arch->tags[i].name, PDS_TAGNAME_LEN - 1);
+    tags[i].value = arch->values[i];
+    tags[i].status = arch->statuses[i];
+  }
+
+  memcpy(p, &hdr, sizeof(pdsarch_hdr));
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to close the current archive file                                  *
+*                                                                             *
+* Pre-condition:  The archive is passed to the function                       *
+* Post-condition: The current archive file is flushed, unmapped & closed.  On *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+int close_archive_file(hist_arch *arch)
+{
+  size_t size = 0;
+  int retval = 0;
+
+  if(!arch->hdr)
+    return 0;
+
+  commit_archive_file(arch);
+  size = arch->hdr->size;
+
+  if(msync(arch->hdr, size, MS_SYNC) == -1)
+  {
+    err(errout, "%s: error flushing archive file: %s\n", PROGNAME, strerror(errno));
+    retval = -1;
+  }
+
+  munmap(arch->hdr, size);
+  close(arch->fd);
+
+  arch->hdr = NULL;
+  arch->fd = -1;
+
+  return retval;
+}
+
+
+
+/******************************************************************************
+* Function to append a tag's change to the archive                            *
+*                                                                             *
+* Pre-condition:  The archive, the tag's ID, its new value & status & the     *
+*                 time of the change are passed to the function               *
+* Post-condition: The change is appended to the current archive file's        *
+*                 columns, rolling over to a new file if the current file is  *
+*                 full or its span has elapsed.  The record is committed by   *
+*                 commit_archive_file().  On error a -1 is returned           *
+******************************************************************************/
+int append_change(hist_arch *arch, unsigned int id, unsigned short int value,
+                  unsigned short int status, unsigned long long mtime_ns)
+{
+  pdsarch_hdr *hdr = arch->hdr;
+  unsigned char *p = NULL;
+  unsigned short int z = 0;
+
+  if(id >= (unsigned int) arch->ntags)
+  {
+    err(errout, "%s: change to unknown tag ID %u\n", PROGNAME, id);
+    return -1;
+  }
+
+  /* The time column must never go backwards */
+  if(mtime_ns < arch->last_ns)
+    mtime_ns = arch->last_ns;
+
+  if(!hdr || arch->nrecs >= hdr->capacity ||
+     mtime_ns - hdr->first_ns >= arch->span_ns)
+  {
+    if(open_archive_file(arch, mtime_ns) == -1)
+      return -1;
+
+    hdr = arch->hdr;
+  }
+
+  PDS_ARCH_TIMES(hdr)[arch->nrecs] = mtime_ns;
+  PDS_ARCH_IDS(hdr)[arch->nrecs] = id;
+  PDS_ARCH_STATUSES(hdr)[arch->nrecs] = status;
+
+  /* Store the value as a zigzag-encoded varint delta */
+  z = PDS_ARCH_ZIGZAG((short int) (value - arch->values[id]));
+  p = PDS_ARCH_VALUES(hdr) + arch->nvalue_bytes;
+
+  while(z > PDS_ARCH_VARINT_MASK)
+  {
+    *p++ = (unsigned char) ((z & PDS_ARCH_VARINT_MASK) | PDS_ARCH_VARINT_MORE);
+    z >>= PDS_ARCH_VARINT_BITS;
+  }
+  *p++ = (unsigned char) z;
+
+  arch->nvalue_bytes = p - PDS_ARCH_VALUES(hdr);
+  arch->nrecs++;
+  arch->last_ns = mtime_ns;
+  arch->values[id] = value;
+  arch->statuses[id] = status;
+  PDS_ARCH_TAGS(hdr)[id].nrecs++;
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to commit the records appended to the current archive file         *
+*                                                                             *
+* Pre-condition:  The archive is passed to the function                       *
+* Post-condition: The file's header is updated, so that readers see the       *
+*                 records appended since the last commit.  The no. of records *
+*                 in the file is returned                                     *
+******************************************************************************/
+unsigned int commit_archive_file(hist_arch *arch)
+{
+  pdsarch_hdr *hdr = arch->hdr;
+
+  if(!hdr)
+    return 0;
+
+  if(hdr->nrecs != arch->nrecs)
+  {
+    /* The record count is published last, so a reader never decodes beyond
+       what has been written */
+    hdr->nvalue_bytes = arch->nvalue_bytes;
+    hdr->last_ns = arch->last_ns;
+    __sync_synchronize();
+    hdr->nrecs = arch->nrecs;
+  }
+
+  return hdr->nrecs;
+}
+
+
+
+/******************************************************************************
+* Function to get the time now in nanoseconds                                 *
+*                                                                             *
+* Pre-condition:  The function is called                                      *
+* Post-condition: The time now (nsecs since the epoch) is returned            *
+******************************************************************************/
+unsigned long long get_time_ns(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  return (now.tv_sec * 1000000000ULL) + now.tv_nsec;
+}
+
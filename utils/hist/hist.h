@@ -0,0 +1,185 @@
+/******************************************************************************
+* PROJECT:  PDS Utilities                                                     *
+* MODULE:   hist.h                                                            *
+* PURPOSE:  Header file for hist.c                                            *
+* AUTHOR:   Paul M. Breen                                                     *
+* DATE:     2026-10-17                                                        *
+******************************************************************************/
+
+#ifndef __HIST_H
+#define __HIST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <pds.h>
+#include <pds_arch.h>
+#include <error.h>
+#include <daemon.h>
+
+/******************************************************************************
+* Defines                                                                     *
+******************************************************************************/
+
+#define PROGNAME	"hist"
+#define VERSION		"Version 1.0"
+#define CREATED		"Created on " __DATE__ " at " __TIME__
+
+#define HIST_DEF_DIR		"."
+#define HIST_DEF_CAPACITY	1048576   /* Records per archive file */
+#define HIST_DEF_SPAN		3600      /* Max. span of an archive file (secs) */
+#define HIST_MIN_CAPACITY	1024
+#define HIST_MAX_CAPACITY	67108864
+#define HIST_LOGFILE		"hist.log"
+#define HIST_BATCH		4096      /* Changes read from the journal at once */
+#define HIST_WAIT_TMO		1000000   /* Max. wait for a change (usecs) */
+
+/******************************************************************************
+* hist's command line arguments struct definition                             *
+******************************************************************************/
+typedef struct hist_args_rec
+{
+  char dir[PATH_MAX];             /* The archive directory */
+  unsigned int capacity;          /* Max. no. of records per archive file */
+  int span;                       /* Max. span of an archive file (secs) */
+  int daemon;                     /* Run as a daemon (bool) */
+} hist_args;
+
+/******************************************************************************
+* hist's archive (current archive file & the tags' last values) struct        *
+******************************************************************************/
+typedef struct hist_arch_rec
+{
+  char dir[PATH_MAX];             /* The archive directory */
+  unsigned int capacity;          /* Max. no. of records per archive file */
+  unsigned long long span_ns;     /* Max. span of an archive file (nsecs) */
+  unsigned int nfiles;            /* No. of archive files started */
+
+  int fd;                         /* The current archive file's fd */
+  pdsarch_hdr *hdr;               /* The current archive file (mapped) */
+  unsigned int nrecs;             /* No. of records written to the file */
+  unsigned int nvalue_bytes;      /* No. of value column bytes written */
+  unsigned long long last_ns;     /* Time of the last record appended */
+
+  int ntags;                      /* No. of tags in the segment */
+  pdstag *tags;                   /* The segment's tags */
+  unsigned short int *values;     /* The tags' last archived values */
+  unsigned short int *statuses;   /* The tags' last archived statuses */
+} hist_arch;
+
+/******************************************************************************
+* Function prototypes                                                         *
+******************************************************************************/
+
+/******************************************************************************
+* Function to parse the command line arguments                                *
+*                                                                             *
+* Pre-condition:  The command line arguments and a struct for storage are     *
+*                 passed to the function                                      *
+* Post-condition: Arguments are parsed and if found are stored in the         *
+*                 appropriate member of the structure                         *
+******************************************************************************/
+int parse_hist_cmdln(int argc, char *argv[], hist_args *args);
+
+/******************************************************************************
+* Function to install a signal handler                                        *
+*                                                                             *
+* Pre-condition:  Program is running, signal is received                      *
+* Post-condition: Signal handler is called                                    *
+******************************************************************************/
+void install_signal_handler();
+
+/******************************************************************************
+* Function to handle quit signals                                             *
+*                                                                             *
+* Pre-condition:  Signal has been received                                    *
+* Post-condition: Quit flag is set, signal handler is re-installed            *
+******************************************************************************/
+void set_quit();
+
+/******************************************************************************
+* Function to archive the changes to the tags                                 *
+*                                                                             *
+* Pre-condition:  A valid server connection & the archive are passed to the   *
+*                 function                                                    *
+* Post-condition: The tags' changes are read from the server's change journal *
+*                 & appended to the archive, until the quit flag is set.  If  *
+*                 the journal overruns, the tags are read afresh & any        *
+*                 changes archived.  On error a -1 is returned                *
+******************************************************************************/
+int archive_changes(pdsconn *conn, hist_arch *arch);
+
+/******************************************************************************
+* Function to read the tags afresh                                            *
+*                                                                             *
+* Pre-condition:  A valid server connection, the archive & the time now are   *
+*                 passed to the function                                      *
+* Post-condition: Each tag's value & status are read from the server & any    *
+*                 that differ from the last archived are appended to the      *
+*                 archive.  The no. of changes appended is returned.  On      *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+int resync_tags(pdsconn *conn, hist_arch *arch, unsigned long long now_ns);
+
+/******************************************************************************
+* Function to start a new archive file                                        *
+*                                                                             *
+* Pre-condition:  The archive & the time now are passed to the function       *
+* Post-condition: Any current archive file is closed & a new file is created, *
+*                 sized for the archive's capacity & mapped.  The file's tag  *
+*                 index holds the tags' last archived values.  On error a -1  *
+*                 is returned                                                 *
+******************************************************************************/
+int open_archive_file(hist_arch *arch, unsigned long long now_ns);
+
+/******************************************************************************
+* Function to close the current archive file                                  *
+*                                                                             *
+* Pre-condition:  The archive is passed to the function                       *
+* Post-condition: The current archive file is flushed, unmapped & closed.  On *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+int close_archive_file(hist_arch *arch);
+
+/******************************************************************************
+* Function to append a tag's change to the archive                            *
+*                                                                             *
+* Pre-condition:  The archive, the tag's ID, its new value & status & the     *
+*                 time of the change are passed to the function               *
+* Post-condition: The change is appended to the current archive file's        *
+*                 columns, rolling over to a new file if the current file is  *
+*                 full or its span has elapsed.  The record is committed by   *
+*                 commit_archive_file().  On error a -1 is returned           *
+******************************************************************************/
+int append_change(hist_arch *arch, unsigned int id, unsigned short int value,
+                  unsigned short int status, unsigned long long mtime_ns);
+
+/******************************************************************************
+* Function to commit the records appended to the current archive file         *
+*                                                                             *
+* Pre-condition:  The archive is passed to the function                       *
+* Post-condition: The file's header is updated, so that readers see the       *
+*                 records appended since the last commit.  The no. of records *
+*                 in the file is returned                                     *
+******************************************************************************/
+unsigned int commit_archive_file(hist_arch *arch);
+
+/******************************************************************************
+* Function to get the time now in nanoseconds                                 *
+*                                                                             *
+* Pre-condition:  The function is called                                      *
+* Post-condition: The time now (nsecs since the epoch) is returned            *
+******************************************************************************/
+unsigned long long get_time_ns(void);
+
+#endif
+
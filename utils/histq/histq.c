@@ -0,0 +1,329 @@
+/******************************************************************************
+* PROJECT:  PDS Utilities                                                     *
+* MODULE:   histq.c                                                           *
+* PURPOSE:  Utility program to query the historian's archive files for tags'  *
+*           changes over a time range                                         *
+* AUTHOR:   Paul M. Breen                                                     *
+* DATE:     2026-10-17                                                        *
+******************************************************************************/
+
+#define _GNU_SOURCE               /* For strptime() & scandir() */
+
+#include "histq.h"
+
+/******************************************************************************
+* The main function.                                                          *
+******************************************************************************/
+int main(int argc, char *argv[])
+{
+  histq_args args;
+  struct dirent **entries = NULL;
+  char path[PATH_MAX] = "\0";
+  int nentries = 0, nrecs = 0, n = 0;
+  register int i = 0;
+
+  memset(&args, 0, sizeof(histq_args));
+  strcpy(args.dir, HISTQ_DEF_DIR);
+  args.end_ns = ~0ULL;
+
+  if(parse_histq_cmdln(argc, argv, &args) == -1 || args.ntagnames < 1 ||
+     args.start_ns > args.end_ns)
+  {
+    fprintf(stderr, "Usage: %s [-d dir] [-s start] [-e end] tagname ...\n", PROGNAME);
+    fprintf(stderr, "%s: start & end are local times (%s)\n", PROGNAME, "YYYY-mm-ddTHH:MM:SS");
+    exit(1);
+  }
+
+  /* The archive files' names sort in time order */
+  if((nentries = scandir(args.dir, &entries, select_archive_file, alphasort)) == -1)
+  {
+    fprintf(stderr, "%s: error reading directory %s: %s\n", PROGNAME, args.dir, strerror(errno));
+    exit(1);
+  }
+
+  /* Print the header */
+  printf("%-23s|%-40s|%9s|%9s\n", "TIME", "TAG", "VALUE", "STATUS");
+  UNDERLINE(84);
+
+  for(i = 0; i < nentries; i++)
+  {
+    sprintf(path, "%s/%s", args.dir, entries[i]->d_name);
+
+    if((n = query_archive_file(path, &args)) > 0)
+      nrecs += n;
+
+    free(entries[i]);
+  }
+
+  if(entries) free(entries);
+
+  fprintf(stderr, "%s: %d records in %d archive files\n", PROGNAME, nrecs, nentries);
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to parse the command line arguments                                *
+*                                                                             *
+* Pre-condition:  The command line arguments and a struct for storage are     *
+*                 passed to the function                                      *
+* Post-condition: Arguments are parsed and if found are stored in the         *
+*                 appropriate member of the structure.  On error a -1 is      *
+*                 returned                                                    *
+******************************************************************************/
+int parse_histq_cmdln(int argc, char *argv[], histq_args *args)
+{
+  int opt = 0, retval = 0;
+  extern char *optarg;
+  extern int opterr, optind;
+
+  opterr = 0;                     /* Turn off getopt()'s error messages */
+
+  while((opt = getopt(argc, argv, "d:s:e:")) != -1)
+  {
+    switch(opt)
+    {
+      case 'd' :                  /* The archive directory */
+        strncpy(args->dir, optarg, PATH_MAX - 1);
+      break;
+
+      case 's' :                  /* The start of the time range */
+        if(parse_tmstamp(optarg, &args->start_ns) == -1)
+        {
+          fprintf(stderr, "Invalid start time %s\n", optarg);
+          retval = -1;
+        }
+      break;
+
+      case 'e' :                  /* The end of the time range */
+        if(parse_tmstamp(optarg, &args->end_ns) == -1)
+        {
+          fprintf(stderr, "Invalid end time %s\n", optarg);
+          retval = -1;
+        }
+      break;
+
+      /* Option should be followed by a command line argument */
+      case ':' :
+        fputs("Option should take an argument\n", stderr);
+      break;
+
+      /* Unknown option */
+      case '?' :
+        fputs("Unknown option\n", stderr);
+      break;
+    }
+  }
+
+  /* The remaining arguments are the tags to query */
+  args->tagnames = &argv[optind];
+  args->ntagnames = argc - optind;
+
+  return retval;
+}
+
+
+
+/******************************************************************************
+* Function to parse a (local) date/time stamp                                 *
+*                                                                             *
+* Pre-condition:  The date/time stamp & storage for the time are passed to    *
+*                 the function                                                *
+* Post-condition: The time (nsecs since the epoch) is stored in t_ns.  On     *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+int parse_tmstamp(const char *s, unsigned long long *t_ns)
+{
+  struct tm tm;
+  char *p = NULL;
+  time_t t = 0;
+
+  memset(&tm, 0, sizeof(struct tm));
+
+  if(!(p = strptime(s, TMSTAMP_FMT, &tm)) || *p != '\0')
+    return -1;
+
+  /* Let mktime() work out whether DST is in effect */
+  tm.tm_isdst = -1;
+
+  if((t = mktime(&tm)) == (time_t) -1)
+    return -1;
+
+  *t_ns = t * 1000000000ULL;
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to select the archive files in a directory                         *
+*                                                                             *
+* Pre-condition:  A directory entry is passed to the function                 *
+* Post-condition: If the entry is an archive file, a 1 is returned, otherwise *
+*                 a 0 is returned                                             *
+******************************************************************************/
+int select_archive_file(const struct dirent *entry)
+{
+  size_t len = strlen(entry->d_name);
+  size_t prefix_len = strlen(PDS_ARCH_FILE_PREFIX);
+  size_t suffix_len = strlen(PDS_ARCH_FILE_SUFFIX);
+
+  return (len > prefix_len + suffix_len &&
+          strncmp(entry->d_name, PDS_ARCH_FILE_PREFIX, prefix_len) == 0 &&
+          strcmp(entry->d_name + len - suffix_len, PDS_ARCH_FILE_SUFFIX) == 0);
+}
+
+
+
+/******************************************************************************
+* Function to query an archive file                                           *
+*                                                                             *
+* Pre-condition:  The archive file's path & the query are passed to the       *
+*                 function                                                    *
+* Post-condition: The file is mapped & its records for the queried tags, that *
+*                 are within the query's time range, are printed out.  The    *
+*                 no. of records printed is returned.  On error a -1 is       *
+*                 returned                                                    *
+******************************************************************************/
+int query_archive_file(const char *path, histq_args *args)
+{
+  struct stat st;
+  pdsarch_hdr *hdr = NULL;
+  pdsarch_tag *tags = NULL;
+  unsigned long long *times = NULL;
+  unsigned int *ids = NULL;
+  unsigned short int *statuses = NULL, *values = NULL;
+  unsigned char *p = NULL, *end = NULL, *selected = NULL;
+  unsigned int nrecs = 0, nvalue_bytes = 0, id = 0, z = 0, shift = 0;
+  register unsigned int i = 0;
+  register int j = 0;
+  int fd = -1, nselected = 0, nprinted = 0;
+
+  if((fd = open(path, O_RDONLY)) == -1)
+  {
+    fprintf(stderr, "%s: error opening archive file %s: %s\n", PROGNAME, path, strerror(errno));
+    return -1;
+  }
+
+  if(fstat(fd, &st) == -1 || st.st_size < PDS_ARCH_HDR_LEN ||
+     (hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+  {
+    fprintf(stderr, "%s: error mapping archive file %s\n", PROGNAME, path);
+    close(fd);
+    return -1;
+  }
+
+  /* The file is still open in the historian, so we take a consistent view
+     of its committed records.  N.B.: The record count is published last */
+  nrecs = hdr->nrecs;
+  __sync_synchronize();
+  nvalue_bytes = hdr->nvalue_bytes;
+
+  if(hdr->magic != PDS_ARCH_MAGIC || hdr->version != PDS_ARCH_VERSION ||
+     (off_t) hdr->size > st.st_size || nrecs > hdr->capacity)
+  {
+    fprintf(stderr, "%s: %s is not a valid archive file\n", PROGNAME, path);
+    nprinted = -1;
+  }
+  else if(nrecs > 0 && hdr->last_ns >= args->start_ns && hdr->first_ns <= args->end_ns)
+  {
+    tags = PDS_ARCH_TAGS(hdr);
+    times = PDS_ARCH_TIMES(hdr);
+    ids = PDS_ARCH_IDS(hdr);
+    statuses = PDS_ARCH_STATUSES(hdr);
+    p = PDS_ARCH_VALUES(hdr);
+    end = p + nvalue_bytes;
+
+    /* The deltas are decoded from each tag's value before the 1st record */
+    if((selected = calloc(hdr->ntags, sizeof(unsigned char))) &&
+       (values = calloc(hdr->ntags, sizeof(unsigned short int))))
+    {
+      for(i = 0; i < hdr->ntags; i++)
+      {
+        values[i] = tags[i].value;
+
+        for(j = 0; j < args->ntagnames; j++)
+        {
+          if(strncmp(tags[i].name, args->tagnames[j], PDS_TAGNAME_LEN) == 0)
+          {
+            selected[i] = 1;
+            nselected++;
+            break;
+          }
+        }
+      }
+
+      madvise(hdr, hdr->size, MADV_SEQUENTIAL);
+
+      for(i = 0; nselected > 0 && i < nrecs; i++)
+      {
+        if(times[i] > args->end_ns)
+          break;
+
+        if((id = ids[i]) >= hdr->ntags)
+        {
+          fprintf(stderr, "%s: %s: invalid tag ID in record %u\n", PROGNAME, path, i);
+          break;
+        }
+
+        /* Decode the value's zigzag-encoded varint delta */
+        for(z = 0, shift = 0; p < end; shift += PDS_ARCH_VARINT_BITS)
+        {
+          z |= (*p & PDS_ARCH_VARINT_MASK) << shift;
+
+          if(!(*p++ & PDS_ARCH_VARINT_MORE))
+            break;
+        }
+        values[id] += PDS_ARCH_UNZIGZAG(z);
+
+        if(selected[id] && times[i] >= args->start_ns)
+        {
+          print_record(times[i], tags[id].name, values[id], statuses[i]);
+          nprinted++;
+        }
+      }
+    }
+    else
+    {
+      fprintf(stderr, "%s: memory allocation error\n", PROGNAME);
+      nprinted = -1;
+    }
+
+    if(selected) free(selected);
+    if(values) free(values);
+  }
+
+  munmap(hdr, st.st_size);
+  close(fd);
+
+  return nprinted;
+}
+
+
+
+/******************************************************************************
+* Function to print an archived record                                        *
+*                                                                             *
+* Pre-condition:  The record's time, tagname, value & status are passed to    *
+*                 the function                                                *
+* Post-condition: The record is printed out                                   *
+******************************************************************************/
+int print_record(unsigned long long t_ns, const char *name,
+                 unsigned short int value, unsigned short int status)
+{
+  char tmstamp[TMSTAMP_LEN] = "\0";
+  time_t t = (time_t) (t_ns / 1000000000ULL);
+
+  /* Construct the date/time stamp, to the millisecond */
+  strftime(tmstamp, TMSTAMP_LEN, TMSTAMP_FMT, localtime(&t));
+
+  printf("%s.%03u|%-40.*s|%9u|%9u\n", tmstamp,
+         (unsigned int) ((t_ns / 1000000ULL) % 1000ULL),
+         PDS_TAGNAME_LEN, name, value, status);
+
+  return 0;
+}
+
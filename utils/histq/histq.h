@@ -0,0 +1,114 @@
+/******************************************************************************
+* PROJECT:  PDS Utilities                                                     *
+* MODULE:   histq.h                                                           *
+* PURPOSE:  Header file for histq.c                                           *
+* AUTHOR:   Paul M. Breen                                                     *
+* DATE:     2026-10-17                                                        *
+******************************************************************************/
+
+#ifndef __HISTQ_H
+#define __HISTQ_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <pds_arch.h>
+
+/******************************************************************************
+* Defines                                                                     *
+******************************************************************************/
+
+#define PROGNAME	"histq"
+#define VERSION		"Version 1.0"
+#define CREATED		"Created on " __DATE__ " at " __TIME__
+
+#define HISTQ_DEF_DIR	"."
+#define TMSTAMP_FMT	"%Y-%m-%dT%H:%M:%S"
+#define TMSTAMP_LEN	25
+
+#define UNDERLINE(c)\
+{\
+  int i = 0;\
+  for(i = 0; i < c; i++) putchar('-');\
+  putchar('\n');\
+}
+
+/******************************************************************************
+* histq's command line arguments struct definition                            *
+******************************************************************************/
+typedef struct histq_args_rec
+{
+  char dir[PATH_MAX];             /* The archive directory */
+  unsigned long long start_ns;    /* Start of the query's time range */
+  unsigned long long end_ns;      /* End of the query's time range */
+  char **tagnames;                /* The tags to query */
+  int ntagnames;                  /* No. of tags to query */
+} histq_args;
+
+/******************************************************************************
+* Function prototypes                                                         *
+******************************************************************************/
+
+/******************************************************************************
+* Function to parse the command line arguments                                *
+*                                                                             *
+* Pre-condition:  The command line arguments and a struct for storage are     *
+*                 passed to the function                                      *
+* Post-condition: Arguments are parsed and if found are stored in the         *
+*                 appropriate member of the structure.  On error a -1 is      *
+*                 returned                                                    *
+******************************************************************************/
+int parse_histq_cmdln(int argc, char *argv[], histq_args *args);
+
+/******************************************************************************
+* Function to parse a (local) date/time stamp                                 *
+*                                                                             *
+* Pre-condition:  The date/time stamp & storage for the time are passed to    *
+*                 the function                                                *
+* Post-condition: The time (nsecs since the epoch) is stored in t_ns.  On     *
+*                 error a -1 is returned                                      *
+******************************************************************************/
+int parse_tmstamp(const char *s, unsigned long long *t_ns);
+
+/******************************************************************************
+* Function to select the archive files in a directory                         *
+*                                                                             *
+* Pre-condition:  A directory entry is passed to the function                 *
+* Post-condition: If the entry is an archive file, a 1 is returned, otherwise *
+*                 a 0 is returned                                             *
+******************************************************************************/
+int select_archive_file(const struct dirent *entry);
+
+/******************************************************************************
+* Function to query an archive file                                           *
+*                                                                             *
+* Pre-condition:  The archive file's path & the query are passed to the       *
+*                 function                                                    *
+* Post-condition: The file is mapped & its records for the queried tags, that *
+*                 are within the query's time range, are printed out.  The    *
+*                 no. of records printed is returned.  On error a -1 is       *
+*                 returned                                                    *
+******************************************************************************/
+int query_archive_file(const char *path, histq_args *args);
+
+/******************************************************************************
+* Function to print an archived record                                        *
+*                                                                             *
+* Pre-condition:  The record's time, tagname, value & status are passed to    *
+*                 the function                                                *
+* Post-condition: The record is printed out                                   *
+******************************************************************************/
+int print_record(unsigned long long t_ns, const char *name,
+                 unsigned short int value, unsigned short int status);
+
+#endif
+
@@ -472,13 +472,15 @@ int setup_taglist(int argc, char **argv, plctaglist *taglist)
 * Function to encapsulate the program's main loop                             *
 *                                                                             *
 * Pre-condition:  The filled taglist struct is passed to the function         *
-* Post-condition: The program enters its main loop.  If a signal is caught,   *
-*                 it exits the loop                                           *
+* Post-condition: The program enters its main loop, redisplaying the tags    *
+*                 whenever any of them change.  If a signal is caught, it     *
+*                 exits the loop                                              *
 ******************************************************************************/
 int mcrd_main(plctaglist *taglist)
 {
   int retval = 0;
   pdsconn *conn = NULL;
+  pdshandle *handles = NULL;
   char tagvalue[PDS_TAGVALUE_LEN] = "\0", date_heading[DTHDR_LEN] = "\0";
   time_t clock;
   int i = 0, ival = 0;
@@ -497,6 +499,18 @@ int mcrd_main(plctaglist *taglist)
     /* Setup the program's data window */
     setup_datawin(taglist->ntags);
 
+    /* Resolve the tags once, so that we can wait for changes to them */
+    if(!(handles = (pdshandle *) malloc(taglist->ntags * sizeof(pdshandle))))
+    {
+      mvwprintw(errwin, DEFP_Y, DEFP_X, "%s: memory allocation error", PROGNAME);
+      wrefresh(errwin);
+      sleep(ERRMSG_LGPAUSE);
+      terminate();
+    }
+
+    for(i = 0; i < taglist->ntags; i++)
+      handles[i] = PDSresolve_tag(conn, taglist->tags[i].name);
+
     while(!quit_flag)
     {
       /* Get the user specified tag's value and display in the data window */
@@ -540,8 +554,14 @@ int mcrd_main(plctaglist *taglist)
 
       mvwprintw(hdrwin, DEFP_Y, (HW_COLS - (DTHDR_LEN + DEFP_X)), "%s", date_heading);
       wrefresh(hdrwin);
+
+      /* Sleep until the server refreshes any of the tags with a change.
+         N.B.: The timeout keeps the date/time heading current */
+      if(PDSwait_for_change(conn, handles, taglist->ntags, CHANGE_TMO) == -1)
+        sleep(ERRMSG_PAUSE);
     }
 
+    free(handles);
     delwin(datawin);
 
     PDSdisconnect(conn);
@@ -37,6 +37,7 @@
 #define DTHDR_LEN	26
 #define ERRMSG_PAUSE	1
 #define ERRMSG_LGPAUSE	2
+#define CHANGE_TMO	1000000 /* Max. wait for a change (usecs) */
 
 /* Common default window constants */
 #define DEFP_Y		1
@@ -193,8 +194,9 @@ int setup_taglist(int argc, char **argv, plctaglist *taglist);
 * Function to encapsulate the program's main loop                             *
 *                                                                             *
 * Pre-condition:  The filled taglist struct is passed to the function         *
-* Post-condition: The program enters its main loop.  If a signal is caught,   *
-*                 it exits the loop                                           *
+* Post-condition: The program enters its main loop, redisplaying the tags    *
+*                 whenever any of them change.  If a signal is caught, it     *
+*                 exits the loop                                              *
 ******************************************************************************/
 int mcrd_main(plctaglist *taglist);
  
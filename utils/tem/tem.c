@@ -20,6 +20,7 @@ int main(int argc, char *argv[])
 {
   pdsconn *conn = NULL;
   pdstag *p = NULL;
+  pdshandle h = PDS_HANDLE_INVALID;
   char tagname[PDS_TAGNAME_LEN] = "\0";
   unsigned short int prev_val = 0;
 
@@ -48,20 +49,28 @@ int main(int argc, char *argv[])
     /* Get a pointer to the tag.  N.B.:  We search through ALL tags
        (data & status), this means we can monitor changes to status tags as
        well as data tags */
-    if((p = PDSget_tag_object(conn, tagname)))
+    if((p = PDSget_tag_object(conn, tagname)) &&
+       (h = PDSresolve_tag(conn, tagname)) != PDS_HANDLE_INVALID)
     {
       print_tag(p, prev_val);
-      prev_val = p->value;
+      prev_val = PDStag_get_value(p);
 
       while(!quit_flag)
       {
+        /* Sleep until the server refreshes the tag's block with a change.
+           N.B.: The timeout lets us periodically check the quit flag */
+        if(PDSwait_for_change(conn, &h, 1, CHECK_TMO) == -1)
+        {
+          fprintf(stderr, "%s: error waiting for a change to tag %s\n", PROGNAME, tagname);
+          break;
+        }
+
         /* If the tagvalue has changed, print the data */
-        if(p->value != prev_val)
+        if(PDStag_get_value(p) != prev_val)
         {
           print_tag(p, prev_val);
-          prev_val = p->value;
+          prev_val = PDStag_get_value(p);
         }
-        usleep(CHECK_PAUSE);
       }
     }
     else
@@ -123,11 +132,12 @@ void set_quit()
 int print_tag(pdstag *tag, unsigned short int prev_val)
 {
   char tmstamp[TMSTAMP_LEN] = "\0";
+  time_t mtime = PDStag_get_mtime(tag);
 
   /* Construct the date/time stamp */
-  strftime(tmstamp, TMSTAMP_LEN, TMSTAMP_FMT, localtime(&tag->mtime));
+  strftime(tmstamp, TMSTAMP_LEN, TMSTAMP_FMT, localtime(&mtime));
 
-  printf("%-19s|%-40s|%9u|%9u\n", tmstamp, tag->name, tag->value, prev_val);
+  printf("%-19s|%-40s|%9u|%9u\n", tmstamp, tag->name, PDStag_get_value(tag), prev_val);
 
   return 0;
 }
@@ -25,7 +25,7 @@
 
 #define TMSTAMP_FMT	"%Y-%m-%dT%H:%M:%S"
 #define TMSTAMP_LEN	25
-#define CHECK_PAUSE     1000      /* (usecs) */
+#define CHECK_TMO       1000000   /* Max. wait for a change (usecs) */
 
 #define UNDERLINE(c)\
 {\
@@ -0,0 +1,227 @@
+/******************************************************************************
+* PROJECT:  PDS Utilities                                                     *
+* MODULE:   tlb.c                                                             *
+* PURPOSE:  Utility program to benchmark tag lookups by name                  *
+* AUTHOR:   Paul M. Breen                                                     *
+* DATE:     2026-10-17                                                        *
+******************************************************************************/
+
+#include "tlb.h"
+
+/******************************************************************************
+* The main function.                                                          *
+******************************************************************************/
+int main(int argc, char *argv[])
+{
+  char **names = NULL;
+  int ntags = 0, i = 0, misses = 0;
+  double scan_usecs = 0, index_usecs = 0;
+  struct timeval start, end;
+  pdsconn conn;
+  tlb_args args;
+
+  memset(&args, 0, sizeof(args));
+  args.max_tags = TLB_DEF_MAX_TAGS;
+  args.nlookups = TLB_DEF_NLOOKUPS;
+
+  parse_tlb_cmdln(argc, argv, &args);
+
+  if(args.max_tags < TLB_MIN_TAGS || args.nlookups < 1)
+  {
+    fprintf(stderr, "Usage: %s [-m max_tags] [-n nlookups]\n", PROGNAME);
+    exit(1);
+  }
+
+  /* The tagnames to lookup are chosen at random, but are the same for both
+     lookup methods */
+  if(!(names = (char **) calloc(args.nlookups, sizeof(char *))))
+  {
+    fprintf(stderr, "%s: memory allocation error\n", PROGNAME);
+    exit(1);
+  }
+
+  printf("%10s %16s %17s %10s\n", "ntags", "scan (us/lookup)",
+         "index (us/lookup)", "speedup");
+
+  for(ntags = TLB_MIN_TAGS; ntags <= args.max_tags; ntags *= 10)
+  {
+    if(setup_tags(&conn, ntags) == -1)
+    {
+      fprintf(stderr, "%s: error setting up %d tags\n", PROGNAME, ntags);
+      exit(1);
+    }
+
+    srand(ntags);
+
+    for(i = 0; i < args.nlookups; i++)
+      names[i] = conn.data[rand() % ntags].name;
+
+    /* Linear scan of the tags */
+    gettimeofday(&start, NULL);
+
+    for(i = 0, misses = 0; i < args.nlookups; i++)
+      if(scan_tags(&conn, names[i]) == NULL) misses++;
+
+    gettimeofday(&end, NULL);
+    scan_usecs = elapsed_usecs(&start, &end) / args.nlookups;
+
+    /* The library's lookup, via the tag name index */
+    gettimeofday(&start, NULL);
+
+    for(i = 0; i < args.nlookups; i++)
+      if(PDSget_tag_object(&conn, names[i]) == NULL) misses++;
+
+    gettimeofday(&end, NULL);
+    index_usecs = elapsed_usecs(&start, &end) / args.nlookups;
+
+    if(misses > 0)
+      fprintf(stderr, "%s: %d lookups failed for %d tags\n", PROGNAME, misses, ntags);
+
+    printf("%10d %16.3f %17.3f %9.1fx\n", ntags, scan_usecs, index_usecs,
+           (index_usecs > 0 ? scan_usecs / index_usecs : 0));
+
+    free(conn.data);
+    free(conn.hash);
+  }
+
+  free(names);
+
+  return 0;
+}
+
+
+ 
+/******************************************************************************
+* Function to parse the command line arguments                                *
+*                                                                             *
+* Pre-condition:  The command line arguments and a struct for storage are     *
+*                 passed to the function                                      *
+* Post-condition: Arguments are parsed and if found are stored in the         *
+*                 appropriate member of the structure                         *
+******************************************************************************/
+int parse_tlb_cmdln(int argc, char *argv[], tlb_args *args)
+{
+  int opt = 0;
+  extern char *optarg;
+  extern int opterr, optind;
+
+  opterr = 0;                     /* Turn off getopt()'s error messages */
+
+  while((opt = getopt(argc, argv, "m:n:")) != -1)
+  {
+    switch(opt)
+    {
+      case 'm' :                  /* The largest no. of tags */ 
+        args->max_tags = atoi(optarg);
+      break; 
+
+      case 'n' :                  /* The no. of lookups per tag count */ 
+        args->nlookups = atoi(optarg);
+      break; 
+
+      /* Option should be followed by a command line argument */ 
+      case ':' :
+        fputs("Option should take an argument\n", stderr);
+      break;
+
+      /* Unknown option */
+      case '?' :  
+        fputs("Unknown option\n", stderr);
+      break;
+    }
+  }   
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to setup a synthetic segment of tags & its tag name index          *
+*                                                                             *
+* Pre-condition:  A connection struct & the no. of tags are passed to the     *
+*                 function                                                    *
+* Post-condition: The tags & the index are allocated & built in the same way  *
+*                 as the server builds its shared memory segment.  If an      *
+*                 error occurs a -1 is returned                               *
+******************************************************************************/
+int setup_tags(pdsconn *conn, int ntags)
+{
+  register int i = 0, s = 0;
+  unsigned int h = 0;
+  pdstag *tag = NULL;
+
+  memset(conn, 0, sizeof(pdsconn));
+
+  conn->ndata_tags = conn->ttags = ntags;
+
+  for(conn->nhash = 1; conn->nhash < (ntags * PDS_HASH_SLOTS_TAG); conn->nhash <<= 1);
+
+  if(!(conn->data = (pdstag *) calloc(ntags, sizeof(pdstag))))
+    return -1;
+
+  if(!(conn->hash = (unsigned int *) calloc(conn->nhash, sizeof(unsigned int))))
+  {
+    free(conn->data);
+    return -1;
+  }
+
+  conn->status = conn->data + ntags;
+
+  for(i = 0, tag = conn->data; i < ntags; i++, tag++)
+  {
+    tag->id = i;
+    sprintf(tag->name, "PLC%d_TAG%d", (i % 8), i);
+
+    PDS_HASH_TAGNAME(h, tag->name);
+
+    for(s = PDS_HASH_SLOT(h, conn->nhash); conn->hash[s] != PDS_HASH_EMPTY; s = PDS_HASH_NEXT_SLOT(s, conn->nhash));
+
+    conn->hash[s] = i + 1;
+  }
+
+  return 0;
+}
+
+
+
+/******************************************************************************
+* Function to find a tag by a linear scan of the tags                         *
+*                                                                             *
+* Pre-condition:  A connection struct & the tagname are passed to the         *
+*                 function                                                    *
+* Post-condition: The tags are searched in order, as the library did before   *
+*                 the tag name index.  A pointer to the tag is returned or a  *
+*                 NULL if it's not found                                      *
+******************************************************************************/
+pdstag* scan_tags(pdsconn *conn, const char *tagname)
+{
+  pdstag *tag = NULL;
+  int len = strlen(tagname), i = 0;
+
+  /* Search for tagname ensuring string is not just a substring of tag */
+  for(tag = conn->data, i = 0; tag && i < conn->ttags; tag++, i++)
+  {
+    if(memcmp(tag->name, tagname, len) == 0)
+    {
+      if(len == strlen(tag->name)) 
+        return tag;
+    }
+  }
+
+  return NULL;
+}
+
+
+
+/******************************************************************************
+* Function to get the elapsed time in microseconds                            *
+*                                                                             *
+* Pre-condition:  The start & end times are passed to the function            *
+* Post-condition: The elapsed time in microseconds is returned                *
+******************************************************************************/
+double elapsed_usecs(struct timeval *start, struct timeval *end)
+{
+  return ((end->tv_sec - start->tv_sec) * 1e6) + (end->tv_usec - start->tv_usec);
+}
+
@@ -0,0 +1,83 @@
+/******************************************************************************
+* PROJECT:  PDS Utilities                                                     *
+* MODULE:   tlb.h                                                             *
+* PURPOSE:  Header file for tlb.c                                             *
+* AUTHOR:   Paul M. Breen                                                     *
+* DATE:     2026-10-17                                                        *
+******************************************************************************/
+
+#ifndef __TLB_H
+#define __TLB_H
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <pds.h>
+
+/******************************************************************************
+* Defines                                                                     *
+******************************************************************************/
+
+#define PROGNAME	"tlb"
+#define VERSION		"Version 1.0"
+#define CREATED		"Created on " __DATE__ " at " __TIME__
+
+#define TLB_DEF_MAX_TAGS	100000
+#define TLB_DEF_NLOOKUPS	100000
+#define TLB_MIN_TAGS		10
+
+/******************************************************************************
+* tlb's command line arguments struct definition                              *
+******************************************************************************/
+typedef struct tlb_args_rec
+{
+  int max_tags;                   /* Largest no. of tags to benchmark */
+  int nlookups;                   /* No. of lookups for each tag count */
+} tlb_args;
+
+/******************************************************************************
+* Function prototypes                                                         *
+******************************************************************************/
+
+/******************************************************************************
+* Function to parse the command line arguments                                *
+*                                                                             *
+* Pre-condition:  The command line arguments and a struct for storage are     *
+*                 passed to the function                                      *
+* Post-condition: Arguments are parsed and if found are stored in the         *
+*                 appropriate member of the structure                         *
+******************************************************************************/
+int parse_tlb_cmdln(int argc, char *argv[], tlb_args *args);
+
+/******************************************************************************
+* Function to setup a synthetic segment of tags & its tag name index          *
+*                                                                             *
+* Pre-condition:  A connection struct & the no. of tags are passed to the     *
+*                 function                                                    *
+* Post-condition: The tags & the index are allocated & built in the same way  *
+*                 as the server builds its shared memory segment.  If an      *
+*                 error occurs a -1 is returned                               *
+******************************************************************************/
+int setup_tags(pdsconn *conn, int ntags);
+
+/******************************************************************************
+* Function to find a tag by a linear scan of the tags                         *
+*                                                                             *
+* Pre-condition:  A connection struct & the tagname are passed to the         *
+*                 function                                                    *
+* Post-condition: The tags are searched in order, as the library did before   *
+*                 the tag name index.  A pointer to the tag is returned or a  *
+*                 NULL if it's not found                                      *
+******************************************************************************/
+pdstag* scan_tags(pdsconn *conn, const char *tagname);
+
+/******************************************************************************
+* Function to get the elapsed time in microseconds                            *
+*                                                                             *
+* Pre-condition:  The start & end times are passed to the function            *
+* Post-condition: The elapsed time in microseconds is returned                *
+******************************************************************************/
+double elapsed_usecs(struct timeval *start, struct timeval *end);
+
+#endif
+